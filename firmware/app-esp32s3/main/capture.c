@@ -0,0 +1,330 @@
+/*
+ * capture.c
+ *
+ *  Logic analyzer. A task on the second core samples up to CAPTURE_MAX_CHANS
+ *  pins at a fixed rate, paced by the CPU cycle counter, into a ring in
+ *  PSRAM, one bit per channel and one or two bytes per sample. The ring is
+ *  the length of the capture, so the samples kept from before the trigger
+ *  are simply the ones it still holds when the capture ends.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_private/esp_clk.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "soc/soc.h"
+#include "soc/gpio_reg.h"
+
+#include "capture.h"
+
+#define CAPTURE_BUF_SZ		(CONFIG_GPIO_CAPTURE_BUF_KB * 1024)
+#define CAPTURE_CHECK_HZ	(1000)	// Abort and timeout are checked about every ms
+#define CAPTURE_TASK_CORE	(1)
+#define CAPTURE_TASK_PRIO	(20)	// Above every application task on the core
+
+// A capture starves every other task of CAPTURE_TASK_CORE, its idle task
+// included, so no task may be pinned there and the run must end well
+// inside the task watchdog period.
+#if CONFIG_ESP_TASK_WDT_CHECK_IDLE_TASK_CPU1 && CAPTURE_RUN_MAX_MS + 1000 > CONFIG_ESP_TASK_WDT_TIMEOUT_S * 1000
+#error "CAPTURE_RUN_MAX_MS leaves the task watchdog no margin"
+#endif
+
+typedef struct {
+	TaskHandle_t			task;
+	captureDoneCb_t			doneCb;
+	void*					cbArg;
+	uint8_t*				ring;		// CAPTURE_BUF_SZ bytes, allocated by the first capture
+	captureConf_t			conf;
+	uint32_t				periodCycles;
+	uint32_t				checkEvery;	// Samples between abort and timeout checks
+	bool					useIn1;		// A pin is in GPIO_IN1
+	volatile captureState_t	state;
+	volatile bool			abort;
+	captureStatus_t			status;		// Complete once state has ended
+	uint32_t				first;		// Ring position of the first kept sample
+	portMUX_TYPE			mux;
+} capCtrl_t;
+
+static void captureTask(void* param);
+
+static capCtrl_t*	cap;
+
+/**
+ * @brief Start the capture task, doneCb is called from it as each capture ends
+ */
+esp_err_t captureInit(captureDoneCb_t doneCb, void* arg)
+{
+	capCtrl_t*	c = cap;
+	if (c) {
+		return ESP_OK;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		return ESP_ERR_NO_MEM;
+	}
+	c->doneCb = doneCb;
+	c->cbArg = arg;
+	c->status.trigIdx = -1;
+	portMUX_INITIALIZE(&c->mux);
+
+	BaseType_t	ret = xTaskCreatePinnedToCore(
+		captureTask,
+		"gpio_capture",
+		3072,
+		(void*)c,
+		CAPTURE_TASK_PRIO,
+		&c->task,
+		CAPTURE_TASK_CORE
+	);
+	if (pdPASS != ret) {
+		free(c);
+		return ESP_FAIL;
+	}
+
+	cap = c;
+	return ESP_OK;
+}
+
+/**
+ * @brief Sample the channels, GPIO_IN and GPIO_IN1 are read back to back
+ */
+static inline uint32_t _capture_sample(const capCtrl_t* c)
+{
+	uint32_t	in = REG_READ(GPIO_IN_REG);
+	uint32_t	in1 = c->useIn1 ? REG_READ(GPIO_IN1_REG) : 0;
+	uint32_t	sample = 0;
+
+	for (int ch = 0; ch < c->conf.chanCount; ch++) {
+		int	pin = c->conf.pins[ch];
+		sample |= (((pin < 32 ? in : in1) >> (pin & 31)) & 1) << ch;
+	}
+	return sample;
+}
+
+/**
+ * @brief Run one capture to its end
+ *
+ * Spins for the whole capture, which captureStart() bounds to
+ * CAPTURE_RUN_MAX_MS so the idle task of the core runs within the task
+ * watchdog period. A sample taken a period or more after its time is
+ * counted late; the samples after it catch up, keeping the time base.
+ */
+static void _capture_run(capCtrl_t* c)
+{
+	const captureConf_t*	conf = &c->conf;
+	uint8_t*		ring = c->ring;
+	uint32_t		ringLen = conf->samples;
+	bool			wide = conf->chanCount > 8;
+	uint32_t		period = c->periodCycles;
+	uint32_t		remain = conf->samples - conf->preSamples;	// From the trigger sample on
+	uint32_t		pos = 0;
+	uint32_t		total = 0;
+	int64_t			trigAt = -1;
+	uint32_t		late = 0;
+	captureState_t	end = captureState_done;
+	int64_t			startUs = esp_timer_get_time();
+	int64_t			deadlineUs = startUs + conf->timeoutMs * 1000LL;
+	uint32_t		check = c->checkEvery;
+	uint32_t		prev = _capture_sample(c);
+	uint32_t		due = esp_cpu_get_cycle_count();
+
+	while (true) {
+		uint32_t	now;
+		while ((int32_t)((now = esp_cpu_get_cycle_count()) - due) < 0) {
+			// Spin
+		}
+		if (now - due >= period) {
+			late++;
+		}
+		due += period;
+
+		uint32_t	sample = _capture_sample(c);
+		if (wide) {
+			((uint16_t*)ring)[pos] = sample;
+		} else {
+			ring[pos] = sample;
+		}
+		if (++pos == ringLen) {
+			pos = 0;
+		}
+		total++;
+
+		if (trigAt < 0) {
+			if ((sample & conf->trigMask) == conf->trigValue && ((sample ^ prev) & conf->edgeMask) == conf->edgeMask) {
+				trigAt = total - 1;
+				c->state = captureState_triggered;
+			}
+			prev = sample;
+		}
+		if (trigAt >= 0 && --remain == 0) {
+			break;
+		}
+		if (--check == 0) {
+			check = c->checkEvery;
+			if (c->abort) {
+				end = captureState_aborted;
+				break;
+			}
+			if (trigAt < 0 && esp_timer_get_time() >= deadlineUs) {
+				end = captureState_timeout;
+				break;
+			}
+		}
+	}
+
+	// Keep the last ringLen samples, whatever ended the capture
+	uint32_t	count = (total < ringLen) ? total : ringLen;
+	uint32_t	skipped = total - count;
+	uint32_t	rateHz = c->status.rateHz;
+
+	portENTER_CRITICAL(&c->mux);
+	c->first = (total < ringLen) ? 0 : pos;
+	c->status.count = count;
+	c->status.trigIdx = (trigAt < 0) ? -1 : (int32_t)(trigAt - skipped);
+	c->status.late = late;
+	c->status.startUs = startUs + (int64_t)skipped * 1000000 / rateHz;
+	c->status.state = c->state = end;
+	portEXIT_CRITICAL(&c->mux);
+}
+
+static void captureTask(void* param)
+{
+	capCtrl_t*	c = param;
+
+	while (true) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		_capture_run(c);
+		if (c->doneCb) {
+			c->doneCb(c->cbArg);
+		}
+	}
+}
+
+/**
+ * @brief Arm a capture, returning the rate it runs at in rateHz
+ *
+ * The rate is rounded to a whole number of CPU cycles per sample. Returns
+ * ESP_ERR_INVALID_STATE while a capture runs and ESP_ERR_INVALID_SIZE if the
+ * samples do not fit the ring.
+ */
+esp_err_t captureStart(const captureConf_t* conf, uint32_t* rateHz)
+{
+	capCtrl_t*	c = cap;
+	if (!c) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (conf->chanCount < 1 || conf->chanCount > CAPTURE_MAX_CHANS ||
+		conf->rateHz < 1 || conf->rateHz > CAPTURE_RATE_MAX || conf->preSamples >= conf->samples) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	int	width = (conf->chanCount > 8) ? 2 : 1;
+	if ((uint64_t)conf->samples * width > CAPTURE_BUF_SZ) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	if (captureState_armed == c->state || captureState_triggered == c->state) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (!c->ring) {
+		if ((c->ring = heap_caps_malloc(CAPTURE_BUF_SZ, MALLOC_CAP_SPIRAM)) == NULL) {
+			return ESP_ERR_NO_MEM;
+		}
+	}
+
+	uint32_t	cpuHz = esp_clk_cpu_freq();
+
+	c->conf = *conf;
+	c->periodCycles = (cpuHz + conf->rateHz / 2) / conf->rateHz;
+	c->checkEvery = (conf->rateHz > CAPTURE_CHECK_HZ) ? conf->rateHz / CAPTURE_CHECK_HZ : 1;
+	c->useIn1 = false;
+	for (int ch = 0; ch < conf->chanCount; ch++) {
+		c->useIn1 |= (conf->pins[ch] >= 32);
+	}
+	c->abort = false;
+
+	portENTER_CRITICAL(&c->mux);
+	memset(&c->status, 0, sizeof(c->status));
+	c->status.rateHz = cpuHz / c->periodCycles;
+	c->status.width = width;
+	c->status.trigIdx = -1;
+	c->status.state = c->state = captureState_armed;
+	portEXIT_CRITICAL(&c->mux);
+
+	*rateHz = c->status.rateHz;
+	xTaskNotifyGive(c->task);
+	return ESP_OK;
+}
+
+/**
+ * @brief Stop a running capture, keeping the samples taken
+ *
+ * Takes effect within about a millisecond or a sample, whichever is longer.
+ */
+void captureAbort(void)
+{
+	if (cap) {
+		cap->abort = true;
+	}
+}
+
+/**
+ * @brief Copy the capture status; the sample count and times are set once it ends
+ */
+void captureGetStatus(captureStatus_t* status)
+{
+	capCtrl_t*	c = cap;
+
+	memset(status, 0, sizeof(*status));
+	status->trigIdx = -1;
+	if (!c) {
+		return;
+	}
+
+	portENTER_CRITICAL(&c->mux);
+	*status = c->status;
+	status->state = c->state;
+	portEXIT_CRITICAL(&c->mux);
+}
+
+/**
+ * @brief Point data at up to count kept samples from offset, return how many
+ *
+ * The samples returned stop at the end of the ring, read again from the
+ * next offset for the rest. Returns 0 past the end and while capturing.
+ */
+int captureRead(uint32_t offset, uint32_t count, const uint8_t** data)
+{
+	capCtrl_t*	c = cap;
+	if (!c || !c->ring) {
+		return 0;
+	}
+
+	portENTER_CRITICAL(&c->mux);
+	captureState_t	state = c->state;
+	uint32_t		kept = c->status.count;
+	uint32_t		first = c->first;
+	int				width = c->status.width;
+	portEXIT_CRITICAL(&c->mux);
+
+	if (captureState_armed == state || captureState_triggered == state || offset >= kept) {
+		return 0;
+	}
+
+	uint32_t	ringLen = c->conf.samples;
+	uint32_t	pos = (first + offset) % ringLen;
+	if (count > kept - offset) {
+		count = kept - offset;
+	}
+	if (count > ringLen - pos) {
+		count = ringLen - pos;
+	}
+	*data = &c->ring[pos * width];
+	return count;
+}
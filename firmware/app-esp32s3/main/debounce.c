@@ -0,0 +1,99 @@
+/*
+ * debounce.c
+ *
+ *  Vertical-counter debounce of up to 64 inputs sampled together. Pure
+ *  functions of the samples given, no hardware access.
+ */
+#include <string.h>
+
+#include "debounce.h"
+
+void debounceInit(debounce_t* db)
+{
+	memset(db, 0, sizeof(*db));
+}
+
+/**
+ * @brief Start debouncing an input from low, changing after ticks differing samples
+ *
+ * ticks is clamped to 1..DEBOUNCE_MAX_TICKS; 1 follows the input on the next sample.
+ */
+void debounceSetPin(debounce_t* db, int pin, uint32_t ticks)
+{
+	uint64_t	bit = 1ULL << pin;
+
+	if (ticks < 1) {
+		ticks = 1;
+	} else if (ticks > DEBOUNCE_MAX_TICKS) {
+		ticks = DEBOUNCE_MAX_TICKS;
+	}
+
+	db->mask |= bit;
+	db->stable &= ~bit;
+	for (int b = 0; b < DEBOUNCE_CNT_BITS; b++) {
+		db->cnt[b] &= ~bit;
+		if (ticks & (1U << b)) {
+			db->thr[b] |= bit;
+		} else {
+			db->thr[b] &= ~bit;
+		}
+	}
+}
+
+/**
+ * @brief Stop debouncing an input
+ */
+void debounceClearPin(debounce_t* db, int pin)
+{
+	uint64_t	bit = 1ULL << pin;
+
+	db->mask &= ~bit;
+	db->stable &= ~bit;
+	for (int b = 0; b < DEBOUNCE_CNT_BITS; b++) {
+		db->cnt[b] &= ~bit;
+		db->thr[b] &= ~bit;
+	}
+}
+
+/**
+ * @brief Threshold in samples for a glitch time, rounded up, at least one
+ */
+uint32_t debounceTicks(uint32_t glitchUs, uint32_t periodUs)
+{
+	uint32_t	ticks = (uint32_t)(((uint64_t)glitchUs + periodUs - 1) / periodUs);
+
+	if (ticks < 1) {
+		return 1;
+	}
+	return (ticks > DEBOUNCE_MAX_TICKS) ? DEBOUNCE_MAX_TICKS : ticks;
+}
+
+/**
+ * @brief Debounce one sample of all inputs, return the mask of inputs that changed
+ *
+ * The new levels are in db->stable.
+ */
+uint64_t debounceTick(debounce_t* db, uint64_t sample)
+{
+	uint64_t	delta = (sample ^ db->stable) & db->mask;
+	uint64_t	carry = delta;
+	uint64_t	equal = delta;
+
+	// Counters of inputs back at their level restart, the others count up
+	for (int b = 0; b < DEBOUNCE_CNT_BITS; b++) {
+		uint64_t	c = db->cnt[b] & delta;
+
+		db->cnt[b] = c ^ carry;
+		carry &= c;
+		equal &= ~(db->cnt[b] ^ db->thr[b]);
+	}
+
+	// Inputs whose counter reached the threshold take the new level
+	if (equal) {
+		db->stable ^= equal;
+		for (int b = 0; b < DEBOUNCE_CNT_BITS; b++) {
+			db->cnt[b] &= ~equal;
+		}
+	}
+	return equal;
+}
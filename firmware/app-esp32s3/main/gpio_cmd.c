@@ -4,18 +4,66 @@
  */
 #include <string.h>
 
+#include "sdkconfig.h"
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "driver/gpio.h"
 #include "esp_timer.h"
+#include "soc/soc.h"
+#include "soc/gpio_reg.h"
 #include "cJSON.h"
+#include "mbedtls/base64.h"
 
 #include "cmd_proc.h"
+#include "test_comm.h"
 #include "gpio_cmd.h"
+#include "debounce.h"
+#include "pin_map.h"
+#include "pulse_count.h"
+#include "capture.h"
+#include "interlock.h"
 
 #define NUM_GPIO_PINS	(49)
-#define GLITCH_MS		(50)
+#define GPIO_ALL_MASK	((1ULL << NUM_GPIO_PINS) - 1)
+#define GLITCH_MS		(50)		// Default input debounce time
+#define GLITCH_US		(GLITCH_MS * 1000LL)
+#define GLITCH_MAX_US	(10000000)
 
-#define TIME_MS()		((uint32_t)(esp_timer_get_time() / 1000LL))
+#define EDGE_QUEUE_SZ	(32)
+#define EDGE_DEADLINE	(-1)		// edgeEvt_t.gpio_num: a debounce deadline passed
+
+#define EDGE_WAKE		(-2)		// edgeEvt_t.gpio_num: sequence ended, a wait timed out or an interlock event is due
+
+#define EVENT_RING_SZ	(CONFIG_GPIO_EVENT_RING_SZ)
+#define EVENT_COPY_CNT	(16)		// Events copied out of the ring per lock
+
+#define SEQ_MAX_STEPS		(CONFIG_GPIO_SEQ_MAX_STEPS)
+#define SEQ_SPIN_US			(100)	// Timer wakes this early, then spins to the step time
+#define SEQ_MIN_PERIOD_US	(500)
+
+#define WAIT_MAX			(8)		// gpio-wait requests pending at once
+#define WAIT_TIMEOUT_MS		(10000)
+#define WAIT_TIMEOUT_MAX_MS	(3600000)
+#define WAIT_REPLY_PRIO		(4)		// Below the debounce task, which queues the replies
+
+#define COUNT_SAMPLE_MS		(100)	// Pulse count history period
+#define COUNT_HIST			(32)	// History samples, bounds the gpio-freq window
+#define COUNT_WINDOW_MS		(1000)
+
+#define CAPTURE_SAMPLES_MAX		(CONFIG_GPIO_CAPTURE_BUF_KB * 1024)
+#define CAPTURE_TIMEOUT_MS		(1000)
+#define CAPTURE_CHUNK_MAX		(4096)	// Bytes of samples per gpio-capture-read
+#define CAPTURE_ABORT_WAIT_MS	(100)
+
+#if CONFIG_GPIO_DEBOUNCE_SCAN
+#define SCAN_PERIOD_US		(CONFIG_GPIO_SCAN_PERIOD_US)
+#define SCAN_GLITCH_MAX_US	((double)DEBOUNCE_MAX_TICKS * SCAN_PERIOD_US)	// Longest the vertical counters can count
+#define INPUT_INTR_TYPE		GPIO_INTR_DISABLE
+#else
+#define INPUT_INTR_TYPE		GPIO_INTR_ANYEDGE
+#endif
 
 typedef enum {
 	pinState_low = 0,
@@ -30,27 +78,189 @@ typedef enum {
 	pinDir_output
 } pinDir_t;
 
-typedef uint32_t glitchMs_t;
-
 typedef struct {
 	bool			enabled;
 	pinDir_t		dir;
 	inputState_t	state;
-	uint32_t		cosTimeMs;  // Change of state timestamp
-	glitchMs_t		glitchMs;
+	int64_t			cosTimeUs;  // Change of state deadline while rising or falling
+	int64_t			edgeUs;     // Time of the edge that started the last change
+	uint32_t		glitchUs;   // Debounce time, 0 to follow every edge
 } pinCtrl_t;
 
+// Input transition timestamped by the edge interrupt, or debounced by the scan
+typedef struct {
+	int8_t		gpio_num;		// Or EDGE_DEADLINE, EDGE_WAKE
+	uint8_t		level;
+	bool		arm;			// Pin newly configured, restart from low
+	int64_t		timeUs;
+} edgeEvt_t;
+
+// Debounced input change kept for gpio-events
+typedef struct {
+	int64_t		timeUs;
+	uint8_t		gpio_num;
+	uint8_t		level;
+} gpioEvt_t;
+
+// Output sequence step, applied offsetUs after the start of each repeat
+typedef struct {
+	uint32_t	offsetUs;
+	uint64_t	setMask;
+	uint64_t	clrMask;
+} seqStep_t;
+
+typedef enum {
+	seqState_idle = 0,
+	seqState_running,
+	seqState_done,
+	seqState_aborted
+} seqState_t;
+
+static const char* seqStateName[] = {"idle", "running", "done", "aborted"};
+static const char* captureStateName[] = {"idle", "armed", "triggered", "done", "timeout", "aborted"};
+
+typedef enum {
+	waitCond_active = 0,	// Levels
+	waitCond_inactive,
+	waitCond_rising,		// Edges
+	waitCond_falling,
+	waitCond_edge
+} waitCond_t;
+
+// Pending gpio-wait request, checked by the debounce task, answered by _wait_reply_task()
+typedef struct {
+	bool				used;
+	bool				replying;		// Met or timed out, reply queued; the slot is freed once sent
+	waitCond_t			cond;
+	bool				all;			// Level of every pin in mask, else of any
+	uint64_t			mask;
+	int64_t				deadlineUs;
+	testComm_replyTo_t	replyTo;
+} gpioWait_t;
+
+// gpio-wait reply, sent by the wait reply task so the debounce task never
+// waits for a TX frame
+typedef struct {
+	int			slot;			// In wait[]
+	bool		met;			// Else timed out
+	int			gpio_num;
+	bool		active;
+	int64_t		timeUs;
+	uint32_t	seq;
+} waitReply_t;
+
+typedef struct {
+	int64_t		timeUs;
+	uint64_t	total;
+} countSample_t;
+
+// Pin attached to a pulse counter
+typedef struct {
+	int				gpio_num;
+	pulseCount_t*	pc;					// NULL when free
+	uint64_t		base;				// Total at the last clear
+	countSample_t	hist[COUNT_HIST];	// Sample n is at n % COUNT_HIST
+	uint32_t		histCnt;			// Samples taken since configured
+} gpioCount_t;
+
+// Interlock rule counters, cleared when the rules are set
 typedef struct {
-	bool		isInitialized;
-	bool		isRunning;
-	pinCtrl_t	pinCtrl[NUM_GPIO_PINS];
+	uint32_t	trips;
+	uint32_t	late;			// Trips slower than the rule's max_us
+	uint32_t	blocked;		// Output writes refused
+	uint32_t	worstUs;		// Slowest trip, edge to output write
+} interlockStat_t;
+
+typedef struct {
+	bool				isInitialized;
+	bool				isRunning;
+	pinCtrl_t			pinCtrl[NUM_GPIO_PINS];
+	QueueHandle_t		edgeQueue;
+	volatile bool		edgeOverflow;	// Edges lost, resample all inputs
+	uint64_t			pendMask;		// Inputs rising or falling
+	esp_timer_handle_t	deadlineTimer;
+	gpioEvt_t*			evtRing;		// Event with sequence number n is at n % EVENT_RING_SZ
+	uint32_t			evtSeq;			// Sequence number of the latest event, 0 before the first
+	portMUX_TYPE		evtMux;
+	struct {
+		seqStep_t*			steps;		// SEQ_MAX_STEPS entries
+		int					count;
+		uint32_t			periodUs;
+		uint32_t			repeat;		// 0 repeats until aborted
+		uint32_t			id;
+		volatile seqState_t	state;
+		int					step;		// Next step
+		uint32_t			rep;		// Repeats completed
+		int64_t				startUs;	// Start of the current repeat
+		uint32_t			lateMaxUs;	// Worst step write after its time
+		volatile bool		notify;		// Ended, event not yet sent
+		esp_timer_handle_t	timer;
+		portMUX_TYPE		mux;
+	} seq;
+	gpioWait_t			wait[WAIT_MAX];
+	SemaphoreHandle_t	waitMutex;
+	QueueHandle_t		waitReplyQueue;	// WAIT_MAX deep, one reply per slot at most
+	esp_timer_handle_t	waitTimer;
+	volatile bool		waitDue;		// A wait deadline passed
+	pinMap_t*			pinMap;			// Named pins and groups, NULL if none stored
+	gpioCount_t			count[PULSE_COUNT_MAX];
+	SemaphoreHandle_t	countMutex;
+	esp_timer_handle_t	countTimer;
+	struct {
+		uint8_t				pins[CAPTURE_MAX_CHANS];	// Of the latest gpio-capture
+		int					chanCount;
+	} capture;
+	struct {
+		interlockTab_t*		tab;		// NULL if no rules set
+		uint64_t			rawMask;	// Inputs of raw trip rules, read without outMux to skip others
+		interlockStat_t		stat[INTERLOCK_MAX_RULES];
+		uint32_t			latched;	// Latching trip rules that fired, bit n is rule n
+		uint32_t			pendTrip;	// Rules that fired, late or blocked since the last event
+		uint32_t			pendLate;
+		uint32_t			pendBlock;
+		volatile bool		notify;		// Event not yet sent
+#if CONFIG_GPIO_DEBOUNCE_SCAN
+		uint64_t			rawPrev;	// Previous scan sample
+		int64_t				rawPrevUs;
+#endif
+	} ilk;					// Guarded by outMux
+#if CONFIG_GPIO_DEBOUNCE_SCAN
+	debounce_t			deb;
+	portMUX_TYPE		debMux;
+#endif
 } ctrl_t;
 
-static void input_scan(void* params);
+static void input_debounce(void* params);
+#if CONFIG_GPIO_DEBOUNCE_SCAN
+static void _scan_cb(void* arg);
+#else
+static void _deadline_cb(void* arg);
+#endif
+static void _input_arm(ctrl_t* pCtrl, int gpio_num);
+static void _input_disarm(ctrl_t* pCtrl, int gpio_num);
+static void _seq_cb(void* arg);
+static void _seq_notify(ctrl_t* pCtrl);
+static void _wait_cb(void* arg);
+static void _wait_edge(ctrl_t* pCtrl, uint32_t seq, int gpio_num, bool active, int64_t edgeUs);
+static void _wait_expire(ctrl_t* pCtrl);
+static void _wait_reply_task(void* param);
+static void log_edge(ctrl_t* pCtrl, int gpio_num, bool active, int64_t edgeUs);
+static void _pin_map_boot(ctrl_t* pCtrl);
+static void _count_cb(void* arg);
+static void _count_detach(ctrl_t* pCtrl, int gpio_num);
+static void _count_conf(ctrl_t* pCtrl, int gpio_num, cJSON* jParam, cmdReturn_t* ret);
+static void _capture_done(void* arg);
+static bool _interlock_trip(ctrl_t* pCtrl, int gpio_num, bool level, bool raw, int64_t edgeUs);
+static void _interlock_notify(ctrl_t* pCtrl);
+static void _interlock_boot(ctrl_t* pCtrl);
 static esp_err_t register_cmds(ctrl_t* pCtrl);
 
 static ctrl_t* ctrl;
 
+// Keeps the output register writes of one gpio-set-mask together, and
+// the interlock check or trip with them
+static portMUX_TYPE	outMux = portMUX_INITIALIZER_UNLOCKED;
+
 esp_err_t gpioCmdInit(void)
 {
 	ctrl_t* pCtrl = ctrl;
@@ -63,7 +273,36 @@ esp_err_t gpioCmdInit(void)
 		return ESP_ERR_NO_MEM;
 	}
 
-	// ToDo - Other initializations ?
+	pCtrl->edgeQueue = xQueueCreate(EDGE_QUEUE_SZ, sizeof(edgeEvt_t));
+	if (!pCtrl->edgeQueue) {
+		return ESP_ERR_NO_MEM;
+	}
+
+	pCtrl->evtRing = calloc(EVENT_RING_SZ, sizeof(gpioEvt_t));
+	if (!pCtrl->evtRing) {
+		return ESP_ERR_NO_MEM;
+	}
+	portMUX_INITIALIZE(&pCtrl->evtMux);
+
+	pCtrl->seq.steps = calloc(SEQ_MAX_STEPS, sizeof(seqStep_t));
+	if (!pCtrl->seq.steps) {
+		return ESP_ERR_NO_MEM;
+	}
+	portMUX_INITIALIZE(&pCtrl->seq.mux);
+
+	pCtrl->waitMutex = xSemaphoreCreateMutex();
+	if (!pCtrl->waitMutex) {
+		return ESP_ERR_NO_MEM;
+	}
+	pCtrl->waitReplyQueue = xQueueCreate(WAIT_MAX, sizeof(waitReply_t));
+	if (!pCtrl->waitReplyQueue) {
+		return ESP_ERR_NO_MEM;
+	}
+
+	pCtrl->countMutex = xSemaphoreCreateMutex();
+	if (!pCtrl->countMutex) {
+		return ESP_ERR_NO_MEM;
+	}
 
 	// Register methods with the command processor
 	esp_err_t	status;
@@ -86,12 +325,86 @@ esp_err_t gpioCmdStart(void)
 		return ESP_OK;
 	}
 
-	// Start the input monitor task
+	esp_err_t	status;
+#if CONFIG_GPIO_DEBOUNCE_SCAN
+	// Inputs are sampled together every SCAN_PERIOD_US
+	debounceInit(&pCtrl->deb);
+	portMUX_INITIALIZE(&pCtrl->debMux);
+
+	esp_timer_create_args_t	timerArgs = {
+		.callback = _scan_cb,
+		.arg = pCtrl,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "gpio_scan"
+	};
+	if ((status = esp_timer_create(&timerArgs, &pCtrl->deadlineTimer)) != ESP_OK) {
+		return status;
+	}
+	if ((status = esp_timer_start_periodic(pCtrl->deadlineTimer, SCAN_PERIOD_US)) != ESP_OK) {
+		return status;
+	}
+#else
+	// Inputs are debounced from their edge interrupts
+	status = gpio_install_isr_service(0);
+	if (ESP_OK != status && ESP_ERR_INVALID_STATE != status) {
+		// Invalid state: already installed by someone else
+		return status;
+	}
+
+	esp_timer_create_args_t	timerArgs = {
+		.callback = _deadline_cb,
+		.arg = pCtrl,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "gpio_debounce"
+	};
+	if ((status = esp_timer_create(&timerArgs, &pCtrl->deadlineTimer)) != ESP_OK) {
+		return status;
+	}
+#endif
+
+	esp_timer_create_args_t	seqArgs = {
+		.callback = _seq_cb,
+		.arg = pCtrl,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "gpio_seq"
+	};
+	if ((status = esp_timer_create(&seqArgs, &pCtrl->seq.timer)) != ESP_OK) {
+		return status;
+	}
+
+	esp_timer_create_args_t	waitArgs = {
+		.callback = _wait_cb,
+		.arg = pCtrl,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "gpio_wait"
+	};
+	if ((status = esp_timer_create(&waitArgs, &pCtrl->waitTimer)) != ESP_OK) {
+		return status;
+	}
+
+	esp_timer_create_args_t	countArgs = {
+		.callback = _count_cb,
+		.arg = pCtrl,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "gpio_count"
+	};
+	if ((status = esp_timer_create(&countArgs, &pCtrl->countTimer)) != ESP_OK) {
+		return status;
+	}
+	if ((status = esp_timer_start_periodic(pCtrl->countTimer, COUNT_SAMPLE_MS * 1000)) != ESP_OK) {
+		return status;
+	}
+
+	if ((status = captureInit(_capture_done, pCtrl)) != ESP_OK) {
+		return status;
+	}
+
+	// Start the input debounce task
 	BaseType_t	ret;
 	ret = xTaskCreate(
-		input_scan,
-		"input_scan",
-		2000,
+		input_debounce,
+		"input_debounce",
+		3000,
 		(void*)pCtrl,
 		5,
 		NULL
@@ -100,99 +413,462 @@ esp_err_t gpioCmdStart(void)
 		return ESP_FAIL;
 	}
 
-	// ToDo ?
+	ret = xTaskCreate(
+		_wait_reply_task,
+		"gpio_wait_reply",
+		3000,
+		(void*)pCtrl,
+		WAIT_REPLY_PRIO,
+		NULL
+	);
+	if (pdPASS != ret) {
+		return ESP_FAIL;
+	}
+
+	// Apply the stored interlock rules before any output is driven
+	_interlock_boot(pCtrl);
+
+	// Configure the pins of the stored pin map, if any
+	_pin_map_boot(pCtrl);
 
 	pCtrl->isRunning = true;
 	return ESP_OK;
 }
 
-static void input_scan(void* params)
+#if CONFIG_GPIO_DEBOUNCE_SCAN
+
+/**
+ * @brief Sample both input banks and debounce every input at once
+ *
+ * Runs every SCAN_PERIOD_US from the esp_timer task. Only inputs that
+ * change are passed on to the debounce task.
+ */
+static void _scan_cb(void* arg)
 {
-	ctrl_t* pCtrl = (ctrl_t *)params;
-	uint32_t now_ms;
-	pinCtrl_t* pin;
-	gpio_num_t gpio_num;
+	ctrl_t*		pCtrl = arg;
+	uint64_t	sample = REG_READ(GPIO_IN_REG) | ((uint64_t)REG_READ(GPIO_IN1_REG) << 32);
+	int64_t		nowUs = esp_timer_get_time();
+
+	portENTER_CRITICAL(&pCtrl->debMux);
+	uint64_t	changed = debounceTick(&pCtrl->deb, sample);
+	uint64_t	levels = pCtrl->deb.stable;
+	portEXIT_CRITICAL(&pCtrl->debMux);
+
+	// Raw trip rules act on the sample itself; the edge is taken to be
+	// just after the previous sample, so the reaction time is the worst case
+	uint64_t	rawChanged = (sample ^ pCtrl->ilk.rawPrev) & pCtrl->ilk.rawMask;
+	int64_t		prevUs = pCtrl->ilk.rawPrevUs;
+	bool		tripped = false;
+	pCtrl->ilk.rawPrev = sample;
+	pCtrl->ilk.rawPrevUs = nowUs;
+	while (rawChanged && prevUs) {
+		int	gpio_num = __builtin_ctzll(rawChanged);
+		rawChanged &= rawChanged - 1;
+		tripped |= _interlock_trip(pCtrl, gpio_num, (sample >> gpio_num) & 1, true, prevUs);
+	}
+	if (tripped) {
+		edgeEvt_t	evt = {.gpio_num = EDGE_WAKE};
+		xQueueSend(pCtrl->edgeQueue, &evt, 0);
+	}
+
+	while (changed) {
+		int			gpio_num = __builtin_ctzll(changed);
+		edgeEvt_t	evt = {
+			.gpio_num = gpio_num,
+			.level = (levels >> gpio_num) & 1,
+			.timeUs = nowUs
+		};
+		changed &= changed - 1;
+
+		if (xQueueSend(pCtrl->edgeQueue, &evt, 0) != pdTRUE) {
+			pCtrl->edgeOverflow = true;
+		}
+	}
+}
+
+/**
+ * @brief Samples an input level must hold for before it changes
+ */
+static uint32_t _scan_ticks(const pinCtrl_t* pin)
+{
+	return debounceTicks(pin->glitchUs, SCAN_PERIOD_US);
+}
+
+/**
+ * @brief Start debouncing an input, from low
+ */
+static void _input_arm(ctrl_t* pCtrl, int gpio_num)
+{
+	edgeEvt_t	evt = {.gpio_num = gpio_num, .arm = true};
+
+	portENTER_CRITICAL(&pCtrl->debMux);
+	debounceSetPin(&pCtrl->deb, gpio_num, _scan_ticks(&pCtrl->pinCtrl[gpio_num]));
+	portEXIT_CRITICAL(&pCtrl->debMux);
+
+	if (xQueueSend(pCtrl->edgeQueue, &evt, 0) != pdTRUE) {
+		pCtrl->edgeOverflow = true;
+	}
+}
+
+/**
+ * @brief Stop debouncing a pin that is now an output
+ */
+static void _input_disarm(ctrl_t* pCtrl, int gpio_num)
+{
+	portENTER_CRITICAL(&pCtrl->debMux);
+	debounceClearPin(&pCtrl->deb, gpio_num);
+	portEXIT_CRITICAL(&pCtrl->debMux);
+}
+
+/**
+ * @brief Record and publish the input changes found by the scan
+ *
+ * The published time is that of the first sample at the new level.
+ */
+static void input_debounce(void* params)
+{
+	ctrl_t*		pCtrl = (ctrl_t *)params;
+	edgeEvt_t	evt;
 
 	while (true)
 	{
-		vTaskDelay(pdMS_TO_TICKS(10));
+		xQueueReceive(pCtrl->edgeQueue, &evt, portMAX_DELAY);
 
-		now_ms = TIME_MS();
+		if (pCtrl->seq.notify) {
+			_seq_notify(pCtrl);
+		}
+		if (pCtrl->waitDue) {
+			_wait_expire(pCtrl);
+		}
+		if (pCtrl->ilk.notify) {
+			_interlock_notify(pCtrl);
+		}
+		pinCtrl_t*	pin = (evt.gpio_num >= 0) ? &pCtrl->pinCtrl[evt.gpio_num] : NULL;
+		if (!pin) {
+			// Only a wakeup
+		} else if (evt.arm) {
+			pin->state = pinState_low;
+		} else if (pin->enabled && pin->dir != pinDir_output) {
+			pin->state = evt.level ? pinState_high : pinState_low;
+			pin->edgeUs = evt.timeUs - (int64_t)(_scan_ticks(pin) - 1) * SCAN_PERIOD_US;
+			log_edge(pCtrl, evt.gpio_num, evt.level, pin->edgeUs);
+		}
 
-		for (gpio_num = 0, pin = pCtrl->pinCtrl; gpio_num < NUM_GPIO_PINS; gpio_num++, pin++) {
-			if (!pin->enabled || pin->dir == pinDir_output) {
-				continue;
+		if (pCtrl->edgeOverflow) {
+			// Changes were lost, catch up with the debounced levels
+			pCtrl->edgeOverflow = false;
+			portENTER_CRITICAL(&pCtrl->debMux);
+			uint64_t	levels = pCtrl->deb.stable;
+			portEXIT_CRITICAL(&pCtrl->debMux);
+
+			for (int gpio_num = 0; gpio_num < NUM_GPIO_PINS; gpio_num++) {
+				pin = &pCtrl->pinCtrl[gpio_num];
+				bool	level = (levels >> gpio_num) & 1;
+				if (pin->enabled && pin->dir != pinDir_output && level != (pin->state == pinState_high)) {
+					pin->state = level ? pinState_high : pinState_low;
+					log_edge(pCtrl, gpio_num, level, esp_timer_get_time());
+				}
 			}
+		}
+	}
+}
 
-			if (gpio_get_level(gpio_num) == 0) {
-				// Input is low - check for change of state
-				switch (pin->state)
-				{
-					case pinState_low:
-						// Remain in this state
-						break;
-
-					case pinState_high:
-						// Transitioning from high to low - start glitch timer
-						pin->state = pinState_falling;
-						pin->cosTimeMs = now_ms + GLITCH_MS;
-						break;
-
-					case pinState_falling:
-						// Still low, see if glitch filter timeout reached
-						if (pin->cosTimeMs <= now_ms) {
-							// Officially low
-							pin->state = pinState_low;
-						}
-						break;
-
-					case pinState_rising:
-						// Cancel rising state
-						pin->state = pinState_low;
-						break;
-
-					default:
-						// Got lost -- reset to low
-						pin->state = pinState_low;
-						break;
-				}
-			} else {
-				// Input is high - check for change of state
-				switch (pin->state)
-				{
-					case pinState_high:
-						// Remain in this state
-						break;
-
-					case pinState_low:
-						// Transitioning from low to high - start glitch timer
-						pin->state = pinState_rising;
-						pin->cosTimeMs = now_ms + GLITCH_MS;
-						break;
-
-					case pinState_rising:
-						// Still high, see if glitch filter timeout reached
-						if (pin->cosTimeMs <= now_ms) {
-							// Officially high
-							pin->state = pinState_high;
-						}
-						break;
-
-					case pinState_falling:
-						// Cancel falling state
-						pin->state = pinState_high;
-						break;
-
-					default:
-						// Got lost -- reset to low
-						pin->state = pinState_low;
-						break;
-				}
+#else
+
+/**
+ * @brief Edge interrupt of an enabled input: timestamp it for the debounce task
+ */
+static void _edge_isr(void* arg)
+{
+	ctrl_t*		pCtrl = ctrl;
+	int			gpio_num = (int)(intptr_t)arg;
+	edgeEvt_t	evt = {
+		.gpio_num = gpio_num,
+		.level = gpio_get_level(gpio_num),
+		.timeUs = esp_timer_get_time()
+	};
+	BaseType_t	woken = pdFALSE;
+
+	// Raw trip rules act here; the debounce task sends their event
+	if (pCtrl->ilk.rawMask & (1ULL << gpio_num)) {
+		_interlock_trip(pCtrl, gpio_num, evt.level, true, evt.timeUs);
+	}
+
+	if (xQueueSendFromISR(pCtrl->edgeQueue, &evt, &woken) != pdTRUE) {
+		pCtrl->edgeOverflow = true;
+	}
+	if (woken) {
+		portYIELD_FROM_ISR();
+	}
+}
+
+/**
+ * @brief Debounce deadline timer, wakes the debounce task
+ */
+static void _deadline_cb(void* arg)
+{
+	ctrl_t*		pCtrl = arg;
+	edgeEvt_t	evt = {.gpio_num = EDGE_DEADLINE};
+
+	if (xQueueSend(pCtrl->edgeQueue, &evt, 0) != pdTRUE) {
+		pCtrl->edgeOverflow = true;
+	}
+}
+
+/**
+ * @brief Feed an input level seen at timeUs to the pin's debounce state
+ */
+static void _edge_apply(ctrl_t* pCtrl, int gpio_num, bool level, int64_t timeUs)
+{
+	pinCtrl_t*	pin = &pCtrl->pinCtrl[gpio_num];
+	uint64_t	bit = 1ULL << gpio_num;
+
+	if (!pin->enabled || pin->dir == pinDir_output) {
+		return;
+	}
+
+	if (0 == pin->glitchUs) {
+		// No filter, every edge is a change
+		bool	high = (pin->state == pinState_high || pin->state == pinState_falling);
+		pin->state = level ? pinState_high : pinState_low;
+		pCtrl->pendMask &= ~bit;
+		if (level != high) {
+			pin->edgeUs = timeUs;
+			log_edge(pCtrl, gpio_num, level, timeUs);
+		}
+		return;
+	}
+
+	if (!level) {
+		// Input is low - check for change of state
+		switch (pin->state)
+		{
+			case pinState_low:
+			case pinState_falling:
+				// Remain in this state
+				break;
+
+			case pinState_high:
+				// Transitioning from high to low - start glitch timer
+				pin->state = pinState_falling;
+				pin->cosTimeUs = timeUs + pin->glitchUs;
+				pin->edgeUs = timeUs;
+				pCtrl->pendMask |= bit;
+				break;
+
+			case pinState_rising:
+				// Cancel rising state
+				pin->state = pinState_low;
+				pCtrl->pendMask &= ~bit;
+				break;
+
+			default:
+				// Got lost -- reset to low
+				pin->state = pinState_low;
+				pCtrl->pendMask &= ~bit;
+				break;
+		}
+	} else {
+		// Input is high - check for change of state
+		switch (pin->state)
+		{
+			case pinState_high:
+			case pinState_rising:
+				// Remain in this state
+				break;
+
+			case pinState_low:
+				// Transitioning from low to high - start glitch timer
+				pin->state = pinState_rising;
+				pin->cosTimeUs = timeUs + pin->glitchUs;
+				pin->edgeUs = timeUs;
+				pCtrl->pendMask |= bit;
+				break;
+
+			case pinState_falling:
+				// Cancel falling state
+				pin->state = pinState_high;
+				pCtrl->pendMask &= ~bit;
+				break;
+
+			default:
+				// Got lost -- reset to low
+				pin->state = pinState_low;
+				pCtrl->pendMask &= ~bit;
+				break;
+		}
+	}
+}
+
+/**
+ * @brief Settle the inputs whose glitch time has passed, return the next deadline or 0
+ */
+static int64_t _deadline_check(ctrl_t* pCtrl, int64_t nowUs)
+{
+	int64_t		nextUs = 0;
+	uint64_t	mask = pCtrl->pendMask;
+
+	while (mask) {
+		int			gpio_num = __builtin_ctzll(mask);
+		pinCtrl_t*	pin = &pCtrl->pinCtrl[gpio_num];
+		mask &= mask - 1;
+
+		if (!pin->enabled || pin->dir == pinDir_output) {
+			// Reconfigured as an output meanwhile
+			pCtrl->pendMask &= ~(1ULL << gpio_num);
+			continue;
+		}
+		if (pin->cosTimeUs > nowUs) {
+			if (0 == nextUs || pin->cosTimeUs < nextUs) {
+				nextUs = pin->cosTimeUs;
+			}
+			continue;
+		}
+
+		// Glitch time passed without a cancelling edge. Confirm the level in
+		// case the interrupt of a short pulse was missed.
+		bool level = gpio_get_level(gpio_num);
+		pCtrl->pendMask &= ~(1ULL << gpio_num);
+		if (pinState_rising == pin->state) {
+			// Officially high
+			pin->state = level ? pinState_high : pinState_low;
+			if (level) {
+				log_edge(pCtrl, gpio_num, true, pin->edgeUs);
+			}
+		} else if (pinState_falling == pin->state) {
+			// Officially low
+			pin->state = level ? pinState_high : pinState_low;
+			if (!level) {
+				log_edge(pCtrl, gpio_num, false, pin->edgeUs);
+			}
+		}
+	}
+	return nextUs;
+}
+
+/**
+ * @brief Start debouncing an input from its current level
+ *
+ * Called once an input is configured, as no edge may follow.
+ */
+static void _input_arm(ctrl_t* pCtrl, int gpio_num)
+{
+	edgeEvt_t	evt = {
+		.gpio_num = gpio_num,
+		.level = gpio_get_level(gpio_num),
+		.arm = true,
+		.timeUs = esp_timer_get_time()
+	};
+
+	gpio_isr_handler_add(gpio_num, _edge_isr, (void*)(intptr_t)gpio_num);
+	if (xQueueSend(pCtrl->edgeQueue, &evt, 0) != pdTRUE) {
+		pCtrl->edgeOverflow = true;
+	}
+}
+
+/**
+ * @brief Stop debouncing a pin that is now an output
+ */
+static void _input_disarm(ctrl_t* pCtrl, int gpio_num)
+{
+	// Fails harmlessly if the pin was not an input
+	gpio_isr_handler_remove(gpio_num);
+}
+
+/**
+ * @brief Debounce task, sleeps until an edge arrives or a glitch time ends
+ *
+ * Edges are timestamped in the interrupt. A pin changes state once its level
+ * has held for its glitch time; the published time is that of the edge itself.
+ */
+static void input_debounce(void* params)
+{
+	ctrl_t*		pCtrl = (ctrl_t *)params;
+	edgeEvt_t	evt;
+
+	while (true)
+	{
+		xQueueReceive(pCtrl->edgeQueue, &evt, portMAX_DELAY);
+
+		if (pCtrl->seq.notify) {
+			_seq_notify(pCtrl);
+		}
+		if (pCtrl->waitDue) {
+			_wait_expire(pCtrl);
+		}
+		if (pCtrl->ilk.notify) {
+			_interlock_notify(pCtrl);
+		}
+
+		do {
+			if (evt.gpio_num < 0) {
+				continue;
+			}
+			if (evt.arm) {
+				pCtrl->pinCtrl[evt.gpio_num].state = pinState_low;
+				pCtrl->pendMask &= ~(1ULL << evt.gpio_num);
 			}
+			_edge_apply(pCtrl, evt.gpio_num, evt.level, evt.timeUs);
+		} while (xQueueReceive(pCtrl->edgeQueue, &evt, 0) == pdTRUE);
+
+		int64_t	nowUs = esp_timer_get_time();
+		if (pCtrl->edgeOverflow) {
+			// Edges were lost, take every input from its current level
+			pCtrl->edgeOverflow = false;
+			for (int gpio_num = 0; gpio_num < NUM_GPIO_PINS; gpio_num++) {
+				_edge_apply(pCtrl, gpio_num, gpio_get_level(gpio_num), nowUs);
+			}
+		}
+
+		int64_t	nextUs = _deadline_check(pCtrl, nowUs);
+		esp_timer_stop(pCtrl->deadlineTimer);
+		if (nextUs) {
+			esp_timer_start_once(pCtrl->deadlineTimer, nextUs - nowUs);
 		}
 	}
 }
 
+#endif /* CONFIG_GPIO_DEBOUNCE_SCAN */
+
+/**
+ * @brief Publish a debounced input change on the "gpio" event topic
+ */
+static void pub_edge(uint32_t seq, int gpio_num, bool active, int64_t edgeUs)
+{
+	if (!testCommEventEnabled("gpio")) {
+		return;
+	}
+
+	cJSON* jData = cJSON_CreateObject();
+	cJSON_AddNumberToObject(jData, "gpio_num", gpio_num);
+	cJSON_AddBoolToObject(jData, "active", active);
+	cJSON_AddNumberToObject(jData, "time_us", edgeUs);
+	cJSON_AddNumberToObject(jData, "seq", seq);
+	testCommSendEvent("gpio", jData);
+}
+
+/**
+ * @brief Record a debounced input change in the event ring and publish it
+ */
+static void log_edge(ctrl_t* pCtrl, int gpio_num, bool active, int64_t edgeUs)
+{
+	bool	tripped = _interlock_trip(pCtrl, gpio_num, active, false, edgeUs);
+
+	portENTER_CRITICAL(&pCtrl->evtMux);
+	uint32_t	seq = ++pCtrl->evtSeq;
+	gpioEvt_t*	evt = &pCtrl->evtRing[seq % EVENT_RING_SZ];
+	evt->timeUs = edgeUs;
+	evt->gpio_num = gpio_num;
+	evt->level = active;
+	portEXIT_CRITICAL(&pCtrl->evtMux);
+
+	pub_edge(seq, gpio_num, active, edgeUs);
+	_wait_edge(pCtrl, seq, gpio_num, active, edgeUs);
+	if (tripped) {
+		_interlock_notify(pCtrl);
+	}
+}
+
 /**
  * @brief Helper function does common operations for called API methods
  */
@@ -241,28 +917,147 @@ static pinCtrl_t* _get_pin_ctrl(ctrl_t* pCtrl, cJSON* jParam, cmdReturn_t* ret,
 }
 
 /**
- * /brief Process JSON command to configure a GPIO pin
- * 
- * JSON parameter contents:
- *   "gpio_num": <GPIO number>,
- *   "mode": <"in"|out">
- *   "pull_up_en": <true|false>,
- *   "pull_down_en": <true|false>
- * 
+ * /brief Drive masks of pins high and low together, for callers holding outMux
+ *
+ * Pins 0-31 and 32-48 are in separate output registers; each gets one
+ * write-1-to-set and one write-1-to-clear, back to back with interrupts off.
  */
-static void _confPin(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+static inline void _out_regs(uint64_t setMask, uint64_t clrMask)
 {
-	ctrl_t* pCtrl = (ctrl_t*)cbData;
-	int gpio_num;
+	REG_WRITE(GPIO_OUT_W1TS_REG, (uint32_t)setMask);
+	REG_WRITE(GPIO_OUT_W1TC_REG, (uint32_t)clrMask);
+	REG_WRITE(GPIO_OUT1_W1TS_REG, (uint32_t)(setMask >> 32));
+	REG_WRITE(GPIO_OUT1_W1TC_REG, (uint32_t)(clrMask >> 32));
+}
 
-	if (!_enter_api(pCtrl, jParam, ret, &gpio_num)) {
-		return;
+/**
+ * /brief Drive outputs with _out_regs() unless an interlock rule refuses
+ *
+ * The levels driven are checked and written in one critical section, so no
+ * trip can come between. A refused write changes no pin and is counted; the
+ * caller wakes the debounce task to publish it. Returns the refusing rule or -1.
+ */
+static int _out_write_checked(ctrl_t* pCtrl, uint64_t setMask, uint64_t clrMask)
+{
+	int	rule = -1;
+
+	portENTER_CRITICAL(&outMux);
+	if (pCtrl->ilk.tab) {
+		uint64_t	levels = REG_READ(GPIO_OUT_REG) | ((uint64_t)REG_READ(GPIO_OUT1_REG) << 32);
+		rule = interlockCheck(pCtrl->ilk.tab, pCtrl->ilk.latched, levels, setMask, clrMask);
+	}
+	if (rule < 0) {
+		_out_regs(setMask, clrMask);
+	} else {
+		pCtrl->ilk.stat[rule].blocked++;
+		pCtrl->ilk.pendBlock |= 1UL << rule;
+		pCtrl->ilk.notify = true;
 	}
+	portEXIT_CRITICAL(&outMux);
+	return rule;
+}
 
-	char* str;
+/**
+ * @brief Fail a method whose output write an interlock rule refused
+ */
+static void _out_refused(ctrl_t* pCtrl, cmdReturn_t* ret)
+{
+	ret->code = RPC_ERR_INTERLOCK;
+	ret->mesg = "Refused by interlock rule";
 
-	gpio_mode_t mode;
-	str = cJSON_GetStringValue(cJSON_GetObjectItem(jParam, "mode"));
+	// The debounce task sends the event
+	edgeEvt_t	evt = {.gpio_num = EDGE_WAKE};
+	xQueueSend(pCtrl->edgeQueue, &evt, 0);
+}
+
+/**
+ * @brief Drive outputs for a method, failing it with RPC_ERR_INTERLOCK if refused
+ */
+static void _out_write_method(ctrl_t* pCtrl, uint64_t setMask, uint64_t clrMask, cmdReturn_t* ret)
+{
+	if (_out_write_checked(pCtrl, setMask, clrMask) >= 0) {
+		_out_refused(pCtrl, ret);
+	}
+}
+
+/**
+ * /brief Read a flag given as a JSON bool or as the string "true"
+ */
+static bool _get_flag(cJSON* jParam, const char* key)
+{
+	cJSON* jObj = cJSON_GetObjectItem(jParam, key);
+	char* str = cJSON_GetStringValue(jObj);
+	return cJSON_IsTrue(jObj) || (str && strcmp(str, "true") == 0);
+}
+
+/**
+ * @brief Get an input debounce time from "glitch_us" or "glitch_ms", GLITCH_US if neither
+ *
+ * The scan debouncer also refuses times over SCAN_GLITCH_MAX_US.
+ */
+static bool _get_glitch(cJSON* jParam, uint32_t* glitchUs, cmdReturn_t* ret)
+{
+	cJSON*	jUs = cJSON_GetObjectItem(jParam, "glitch_us");
+	cJSON*	jMs = cJSON_GetObjectItem(jParam, "glitch_ms");
+	double	us = GLITCH_US;
+
+	if (jUs && jMs) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "Give glitch_us or glitch_ms, not both";
+		return false;
+	}
+	if (jUs) {
+		us = cJSON_IsNumber(jUs) ? cJSON_GetNumberValue(jUs) : -1;
+	} else if (jMs) {
+		us = cJSON_IsNumber(jMs) ? cJSON_GetNumberValue(jMs) * 1000 : -1;
+	}
+	if (!(us >= 0 && us <= GLITCH_MAX_US)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "glitch time must be 0 to 10 s";
+		return false;
+	}
+#if CONFIG_GPIO_DEBOUNCE_SCAN
+	if (us > SCAN_GLITCH_MAX_US) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "glitch time exceeds 4095 scan periods";
+		return false;
+	}
+#endif
+	*glitchUs = (uint32_t)(us + 0.5);
+	return true;
+}
+
+/**
+ * /brief Process JSON command to configure a GPIO pin
+ * 
+ * JSON parameter contents:
+ *   "gpio_num": <GPIO number>,
+ *   "mode": <"in"|"out"|"count">
+ *   "pull_up_en": <true|false>,
+ *   "pull_down_en": <true|false>
+ *   "glitch_us": <input debounce time, default 50000, 0 for none> or "glitch_ms"
+ * 
+ * With the scan debouncer the glitch time is rounded up to whole scan
+ * periods, and 0 follows the input from one sample to the next. It may be
+ * at most DEBOUNCE_MAX_TICKS (4095) scan periods, 4.095 s at the default
+ * 1 ms GPIO_SCAN_PERIOD_US.
+ *
+ * "count" attaches the pin to a pulse counter instead, see _count_conf(),
+ * read with gpio-count and gpio-freq.
+ */
+static void _confPin(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	int gpio_num;
+
+	if (!_enter_api(pCtrl, jParam, ret, &gpio_num)) {
+		return;
+	}
+
+	char* str;
+
+	gpio_mode_t mode;
+	str = cJSON_GetStringValue(cJSON_GetObjectItem(jParam, "mode"));
 	if (!str) {
 		ret->code = RPC_ERR_PARAMS;
 		ret->mesg = "mode required";
@@ -272,36 +1067,41 @@ static void _confPin(cJSON *jParam, cmdReturn_t *ret, void *cbData)
 		mode = GPIO_MODE_INPUT;
 	} else if (strcmp(str, "out") == 0) {
 		mode = GPIO_MODE_OUTPUT;
+	} else if (strcmp(str, "count") == 0) {
+		_count_conf(pCtrl, gpio_num, jParam, ret);
+		return;
 	} else {
 		ret->code = RPC_ERR_PARAMS;
 		ret->mesg = "Invalid mode";
 		return;
 	}
 
-	gpio_pullup_t pu_en = GPIO_PULLUP_DISABLE;
-	str = cJSON_GetStringValue(cJSON_GetObjectItem(jParam, "pull_up_en"));
-	if (str && strcmp(str, "true") == 0) {
-		pu_en = GPIO_PULLUP_ENABLE;
-	}
-
-	gpio_pulldown_t pd_en = GPIO_PULLDOWN_DISABLE;
-	str = cJSON_GetStringValue(cJSON_GetObjectItem(jParam, "pull_down_en"));
-	if (str && strcmp(str, "true") == 0) {
-		pd_en = GPIO_PULLDOWN_ENABLE;
+	uint32_t glitchUs;
+	if (!_get_glitch(jParam, &glitchUs, ret)) {
+		return;
 	}
 
 	if (GPIO_MODE_OUTPUT == mode) {
-		// Set initial output level
-		cJSON* jObj = cJSON_GetObjectItem(jParam, "istate");
-		gpio_set_level((gpio_num_t)gpio_num, cJSON_IsTrue(jObj) ? 1 : 0);
+		// Set initial output level, unless an interlock rule refuses it
+		uint64_t bit = 1ULL << gpio_num;
+		bool istate = cJSON_IsTrue(cJSON_GetObjectItem(jParam, "istate"));
+		if (_out_write_checked(pCtrl, istate ? bit : 0, istate ? 0 : bit) >= 0) {
+			_out_refused(pCtrl, ret);
+			return;
+		}
 	}
 
+	_count_detach(pCtrl, gpio_num);
+
+	gpio_pullup_t pu_en = _get_flag(jParam, "pull_up_en") ? GPIO_PULLUP_ENABLE : GPIO_PULLUP_DISABLE;
+	gpio_pulldown_t pd_en = _get_flag(jParam, "pull_down_en") ? GPIO_PULLDOWN_ENABLE : GPIO_PULLDOWN_DISABLE;
+
 	gpio_config_t	gpioCfg = {
 		.pin_bit_mask = (uint64_t)1 << gpio_num,
 		.mode         = mode,
 		.pull_down_en = pd_en,
 		.pull_up_en   = pu_en,
-		.intr_type    = GPIO_INTR_DISABLE
+		.intr_type    = (GPIO_MODE_OUTPUT == mode) ? GPIO_INTR_DISABLE : INPUT_INTR_TYPE
 	};
 
 	gpio_config(&gpioCfg);
@@ -310,7 +1110,175 @@ static void _confPin(cJSON *jParam, cmdReturn_t *ret, void *cbData)
 
 	// Flag this as a configured pin
 	pin->dir = (GPIO_MODE_OUTPUT == mode) ? pinDir_output : pinDir_input;
+	pin->glitchUs = glitchUs;
 	pin->enabled = true;
+
+	if (GPIO_MODE_OUTPUT == mode) {
+		_input_disarm(pCtrl, gpio_num);
+	} else {
+		_input_arm(pCtrl, gpio_num);
+	}
+}
+
+// Pins sharing a mode and pull settings are configured by one gpio_config()
+#define CONF_GROUPS		(8)
+#define CONF_GROUP(out, pu, pd)	(((out) ? 4 : 0) | ((pu) ? 2 : 0) | ((pd) ? 1 : 0))
+
+/**
+ * @brief Configure groups of pins and start debouncing the inputs among them
+ *
+ * groupMask[] is indexed by CONF_GROUP(); outputs are the pins of highMask
+ * and lowMask, which give their initial levels. glitchUs[] is indexed by
+ * GPIO number. Returns ESP_ERR_NOT_ALLOWED, changing nothing, if an
+ * interlock rule refuses the initial levels.
+ */
+static esp_err_t _conf_apply(ctrl_t* pCtrl, const uint64_t* groupMask, uint64_t highMask, uint64_t lowMask, const uint32_t* glitchUs)
+{
+	uint64_t allMask = 0;
+
+	// Initial levels first so outputs start driving the right state
+	if (_out_write_checked(pCtrl, highMask, lowMask) >= 0) {
+		return ESP_ERR_NOT_ALLOWED;
+	}
+
+	for (int grp = 0; grp < CONF_GROUPS; grp++) {
+		if (!groupMask[grp]) {
+			continue;
+		}
+		gpio_config_t	gpioCfg = {
+			.pin_bit_mask = groupMask[grp],
+			.mode         = (grp & 4) ? GPIO_MODE_OUTPUT : GPIO_MODE_INPUT,
+			.pull_up_en   = (grp & 2) ? GPIO_PULLUP_ENABLE : GPIO_PULLUP_DISABLE,
+			.pull_down_en = (grp & 1) ? GPIO_PULLDOWN_ENABLE : GPIO_PULLDOWN_DISABLE,
+			.intr_type    = (grp & 4) ? GPIO_INTR_DISABLE : INPUT_INTR_TYPE
+		};
+		esp_err_t	status;
+		if ((status = gpio_config(&gpioCfg)) != ESP_OK) {
+			return status;
+		}
+		allMask |= groupMask[grp];
+	}
+
+	// Flag the configured pins
+	uint64_t outMask = highMask | lowMask;
+	for (int gpio_num = 0; gpio_num < NUM_GPIO_PINS; gpio_num++) {
+		if (allMask & (1ULL << gpio_num)) {
+			pinCtrl_t* pin = &pCtrl->pinCtrl[gpio_num];
+			_count_detach(pCtrl, gpio_num);
+			pin->dir = (outMask & (1ULL << gpio_num)) ? pinDir_output : pinDir_input;
+			pin->glitchUs = glitchUs[gpio_num];
+			pin->enabled = true;
+			if (pinDir_output == pin->dir) {
+				_input_disarm(pCtrl, gpio_num);
+			} else {
+				_input_arm(pCtrl, gpio_num);
+			}
+		}
+	}
+	return ESP_OK;
+}
+
+/**
+ * /brief Configure many GPIO pins in one command
+ *
+ * JSON parameter contents:
+ *   "pins": [<descriptor>, ...]
+ *
+ * A descriptor takes the gpio-conf parameters, with either "gpio_num" for
+ * one pin or "gpio_nums": [<GPIO number>, ...] for a group of pins sharing
+ * them. Nothing is changed unless every descriptor is valid. Initial output
+ * levels are written before any output is enabled.
+ */
+static void _confPinMulti(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	cJSON* jPins = cJSON_GetObjectItem(jParam, "pins");
+	if (!cJSON_IsArray(jPins)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "pins array required";
+		return;
+	}
+
+	uint64_t groupMask[CONF_GROUPS] = {0};
+	uint32_t glitchUs[NUM_GPIO_PINS];
+	uint64_t allMask = 0;
+	uint64_t highMask = 0;
+	uint64_t lowMask = 0;
+
+	cJSON* jDesc;
+	cJSON_ArrayForEach(jDesc, jPins) {
+		char* str = cJSON_GetStringValue(cJSON_GetObjectItem(jDesc, "mode"));
+		bool isOut;
+		if (str && strcmp(str, "in") == 0) {
+			isOut = false;
+		} else if (str && strcmp(str, "out") == 0) {
+			isOut = true;
+		} else {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "mode missing or invalid";
+			return;
+		}
+
+		// One pin, or a group of pins
+		uint64_t mask = 0;
+		cJSON* jNum = cJSON_GetObjectItem(jDesc, "gpio_num");
+		cJSON* jNums = cJSON_GetObjectItem(jDesc, "gpio_nums");
+		if (cJSON_IsNumber(jNum) && jNum->valueint >= 0 && jNum->valueint < NUM_GPIO_PINS) {
+			mask = 1ULL << jNum->valueint;
+		} else if (!jNum && cJSON_IsArray(jNums)) {
+			cJSON_ArrayForEach(jNum, jNums) {
+				if (!cJSON_IsNumber(jNum) || jNum->valueint < 0 || jNum->valueint >= NUM_GPIO_PINS) {
+					mask = 0;
+					break;
+				}
+				mask |= 1ULL << jNum->valueint;
+			}
+		}
+		if (!mask) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "gpio_num or gpio_nums missing or invalid";
+			return;
+		}
+		if (mask & allMask) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "pin listed more than once";
+			return;
+		}
+		allMask |= mask;
+
+		uint32_t descGlitchUs;
+		if (!_get_glitch(jDesc, &descGlitchUs, ret)) {
+			return;
+		}
+		for (int gpio_num = 0; gpio_num < NUM_GPIO_PINS; gpio_num++) {
+			if (mask & (1ULL << gpio_num)) {
+				glitchUs[gpio_num] = descGlitchUs;
+			}
+		}
+
+		groupMask[CONF_GROUP(isOut, _get_flag(jDesc, "pull_up_en"), _get_flag(jDesc, "pull_down_en"))] |= mask;
+		if (isOut) {
+			if (cJSON_IsTrue(cJSON_GetObjectItem(jDesc, "istate"))) {
+				highMask |= mask;
+			} else {
+				lowMask |= mask;
+			}
+		}
+	}
+
+	esp_err_t status = _conf_apply(pCtrl, groupMask, highMask, lowMask, glitchUs);
+	if (ESP_ERR_NOT_ALLOWED == status) {
+		_out_refused(pCtrl, ret);
+	} else if (ESP_OK != status) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "gpio_config failed";
+	}
 }
 
 /**
@@ -336,66 +1304,2256 @@ static void _gpioSet(cJSON *jParam, cmdReturn_t *ret, void *cbData)
 		return;
 	}
 
-	gpio_set_level((gpio_num_t)gpio_num, cJSON_IsTrue(jObj) ? 1 : 0);
+	uint64_t	bit = 1ULL << gpio_num;
+	_out_write_method(pCtrl, cJSON_IsTrue(jObj) ? bit : 0, cJSON_IsTrue(jObj) ? 0 : bit, ret);
 }
 
 /**
- * /brief Read input pin state
- * 
- * returns JSON structure:
- *   {"gpio_num": <number>, "active": <true|false>}
+ * /brief Read an optional pin mask parameter, 0 if absent
  */
-static void _gpioGet(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+static bool _mask_value(cJSON* jObj, uint64_t* mask)
+{
+	double val = cJSON_GetNumberValue(jObj);
+	if (!cJSON_IsNumber(jObj) || val < 0 || val > (double)GPIO_ALL_MASK || val != (double)(uint64_t)val) {
+		return false;
+	}
+	*mask = (uint64_t)val;
+	return true;
+}
+
+static bool _get_mask(cJSON* jParam, const char* key, uint64_t* mask, cmdReturn_t* ret)
+{
+	cJSON* jObj = cJSON_GetObjectItem(jParam, key);
+
+	*mask = 0;
+	if (!jObj) {
+		return true;
+	}
+	if (!_mask_value(jObj, mask)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "set and clear must be pin masks";
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Check that every pin of a mask is a configured output
+ */
+static bool _check_outputs(ctrl_t* pCtrl, uint64_t mask, cmdReturn_t* ret)
+{
+	for (int gpio_num = 0; gpio_num < NUM_GPIO_PINS; gpio_num++) {
+		pinCtrl_t* pin = &pCtrl->pinCtrl[gpio_num];
+		if ((mask & (1ULL << gpio_num)) && (!pin->enabled || pin->dir != pinDir_output)) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "pin not configured as output";
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * /brief Set several output pins at once
+ *
+ * JSON parameter contents, either or both of:
+ *   "set": <mask of pins to drive high>, "clear": <mask of pins to drive low>
+ *   "pins": [{"gpio_num": <number>, "active": <true|false>}, ...]
+ *
+ * Bit n of a mask is GPIO n. The pins change together, see _out_regs().
+ */
+static void _gpioSetMask(cJSON *jParam, cmdReturn_t *ret, void *cbData)
 {
 	ctrl_t* pCtrl = (ctrl_t*)cbData;
-	int gpio_num;
-	pinCtrl_t* pin = _get_pin_ctrl(pCtrl, jParam, ret, &gpio_num);
-	if (!pin) {
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
 		return;
 	}
 
-	bool level = (pin->state == pinState_high || pin->state == pinState_falling);
+	uint64_t setMask, clrMask;
+	if (!_get_mask(jParam, "set", &setMask, ret) || !_get_mask(jParam, "clear", &clrMask, ret)) {
+		return;
+	}
+
+	cJSON* jPins = cJSON_GetObjectItem(jParam, "pins");
+	if (jPins && !cJSON_IsArray(jPins)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "pins must be an array";
+		return;
+	}
+	cJSON* jPin;
+	cJSON_ArrayForEach(jPin, jPins) {
+		cJSON* jNum = cJSON_GetObjectItem(jPin, "gpio_num");
+		cJSON* jActive = cJSON_GetObjectItem(jPin, "active");
+		if (!cJSON_IsNumber(jNum) || jNum->valueint < 0 || jNum->valueint >= NUM_GPIO_PINS || !cJSON_IsBool(jActive)) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "pins items need gpio_num and active";
+			return;
+		}
+		if (cJSON_IsTrue(jActive)) {
+			setMask |= 1ULL << jNum->valueint;
+		} else {
+			clrMask |= 1ULL << jNum->valueint;
+		}
+	}
+
+	if (setMask & clrMask) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "Pin both set and cleared";
+		return;
+	}
+
+	if (!_check_outputs(pCtrl, setMask | clrMask, ret)) {
+		return;
+	}
 
-	ret->jResult = cJSON_CreateObject();
-	cJSON_AddNumberToObject(ret->jResult, "gpio_num", gpio_num);
-	cJSON_AddBoolToObject(ret->jResult, "active", level);
+	_out_write_method(pCtrl, setMask, clrMask, ret);
 }
 
 /**
- * /brief Return a JSON array of the state of all input pins
- * 
- * returns JSON array:
- *   [{"gpio_num": <int>, "active": <true|false>}, ...]
+ * @brief Output sequence timer, writes every step that is due
+ *
+ * The timer is armed SEQ_SPIN_US ahead of the next step to absorb the
+ * esp_timer task dispatch latency; the last stretch is spun out here.
+ * esp_timer_stop() does not wait for a running callback, so the step is
+ * written only if its sequence is still the one running after the spin.
  */
-static void _gpioGetAll(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+static void _seq_cb(void* arg)
+{
+	ctrl_t*	pCtrl = arg;
+
+	while (true) {
+		portENTER_CRITICAL(&pCtrl->seq.mux);
+		if (seqState_running != pCtrl->seq.state) {
+			portEXIT_CRITICAL(&pCtrl->seq.mux);
+			return;
+		}
+		seqStep_t	step = pCtrl->seq.steps[pCtrl->seq.step];
+		int64_t		dueUs = pCtrl->seq.startUs + step.offsetUs;
+		uint32_t	id = pCtrl->seq.id;
+		portEXIT_CRITICAL(&pCtrl->seq.mux);
+
+		int64_t	nowUs = esp_timer_get_time();
+		if (dueUs - nowUs > SEQ_SPIN_US) {
+			esp_timer_start_once(pCtrl->seq.timer, dueUs - nowUs - SEQ_SPIN_US);
+			return;
+		}
+		while ((nowUs = esp_timer_get_time()) < dueUs) {
+			// Spin
+		}
+
+		bool	ended = false;
+		portENTER_CRITICAL(&pCtrl->seq.mux);
+		if (seqState_running != pCtrl->seq.state || id != pCtrl->seq.id) {
+			// Aborted meanwhile, and maybe another sequence started
+			portEXIT_CRITICAL(&pCtrl->seq.mux);
+			return;
+		}
+		if (_out_write_checked(pCtrl, step.setMask, step.clrMask) >= 0) {
+			// A step an interlock rule refuses ends the sequence
+			pCtrl->seq.state = seqState_aborted;
+			pCtrl->seq.notify = ended = true;
+		} else {
+			if (nowUs - dueUs > pCtrl->seq.lateMaxUs) {
+				pCtrl->seq.lateMaxUs = nowUs - dueUs;
+			}
+			if (++pCtrl->seq.step == pCtrl->seq.count) {
+				pCtrl->seq.step = 0;
+				pCtrl->seq.startUs += pCtrl->seq.periodUs;
+				if (++pCtrl->seq.rep == pCtrl->seq.repeat) {
+					pCtrl->seq.state = seqState_done;
+					pCtrl->seq.notify = ended = true;
+				}
+			}
+		}
+		portEXIT_CRITICAL(&pCtrl->seq.mux);
+
+		if (ended) {
+			// The debounce task sends the event
+			edgeEvt_t	evt = {.gpio_num = EDGE_WAKE};
+			xQueueSend(pCtrl->edgeQueue, &evt, 0);
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Write the output sequence status
+ */
+static void _seq_status(ctrl_t* pCtrl, testComm_jw_t* jw)
+{
+	portENTER_CRITICAL(&pCtrl->seq.mux);
+	uint32_t	id = pCtrl->seq.id;
+	seqState_t	state = pCtrl->seq.state;
+	uint32_t	rep = pCtrl->seq.rep;
+	int			step = pCtrl->seq.step;
+	uint32_t	lateMaxUs = pCtrl->seq.lateMaxUs;
+	portEXIT_CRITICAL(&pCtrl->seq.mux);
+
+	testCommJwObjectStart(jw, NULL);
+	testCommJwInt(jw, "id", id);
+	testCommJwString(jw, "state", seqStateName[state]);
+	testCommJwInt(jw, "repeats", rep);
+	testCommJwInt(jw, "step", step);
+	testCommJwInt(jw, "late_max_us", lateMaxUs);
+	testCommJwObjectEnd(jw);
+}
+
+/**
+ * @brief Publish the end of an output sequence on the "gpio-seq" event topic
+ */
+static void _seq_notify(ctrl_t* pCtrl)
+{
+	pCtrl->seq.notify = false;
+	if (!testCommEventEnabled("gpio-seq")) {
+		return;
+	}
+
+	portENTER_CRITICAL(&pCtrl->seq.mux);
+	uint32_t	id = pCtrl->seq.id;
+	seqState_t	state = pCtrl->seq.state;
+	uint32_t	rep = pCtrl->seq.rep;
+	uint32_t	lateMaxUs = pCtrl->seq.lateMaxUs;
+	portEXIT_CRITICAL(&pCtrl->seq.mux);
+
+	cJSON* jData = cJSON_CreateObject();
+	cJSON_AddNumberToObject(jData, "id", id);
+	cJSON_AddStringToObject(jData, "state", seqStateName[state]);
+	cJSON_AddNumberToObject(jData, "repeats", rep);
+	cJSON_AddNumberToObject(jData, "late_max_us", lateMaxUs);
+	testCommSendEvent("gpio-seq", jData);
+}
+
+/**
+ * /brief Run a timed sequence of output changes on the board
+ *
+ * JSON parameter contents:
+ *   "steps": [[<offset_us>, <pin mask>, <active>], ...]
+ *   "repeat": <times to run the steps, 0 until aborted, default 1>
+ *   "period_us": <time between repeats, default the last offset>
+ *
+ * Offsets are from the start of each repeat and may not decrease. Bit n of
+ * a mask is GPIO n, driven high if active is true or 1, else low. Returns at
+ * once with {"id": <sequence id>}; the end is published on the "gpio-seq"
+ * event topic and can be polled with gpio-seq-status. Only one sequence runs
+ * at a time. A step an interlock rule refuses aborts the sequence.
+ */
+static void _gpioSeq(cJSON *jParam, cmdReturn_t *ret, void *cbData)
 {
 	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	cJSON* jSteps = cJSON_GetObjectItem(jParam, "steps");
+	int count = cJSON_GetArraySize(jSteps);
+	if (!cJSON_IsArray(jSteps) || count < 1 || count > SEQ_MAX_STEPS) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "steps must be an array, at most GPIO_SEQ_MAX_STEPS long";
+		return;
+	}
 
-	ret->jResult = cJSON_CreateArray();
+	uint32_t repeat = 1;
+	cJSON* jObj = cJSON_GetObjectItem(jParam, "repeat");
+	if (jObj) {
+		if (!cJSON_IsNumber(jObj) || jObj->valuedouble < 0 || jObj->valuedouble > UINT32_MAX) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "Invalid repeat";
+			return;
+		}
+		repeat = (uint32_t)jObj->valuedouble;
+	}
 
-	int gpio_num;
-	pinCtrl_t* pin;
+	portENTER_CRITICAL(&pCtrl->seq.mux);
+	bool busy = (seqState_running == pCtrl->seq.state);
+	portEXIT_CRITICAL(&pCtrl->seq.mux);
+	if (busy) {
+		ret->code = RPC_ERR_BUSY;
+		ret->mesg = "Sequence running";
+		return;
+	}
 
-	// Return the current states of all input pins
-	for (gpio_num = 0, pin = pCtrl->pinCtrl; gpio_num < NUM_GPIO_PINS; gpio_num++, pin++) {
-		if (!pin->enabled || pin->dir == pinDir_output) {
-			continue;
+	// Steps are only read while a sequence runs, fill them in place
+	seqStep_t*	steps = pCtrl->seq.steps;
+	uint64_t	mask = 0;
+	uint32_t	lastUs = 0;
+	cJSON*		jStep;
+	int			idx = 0;
+	cJSON_ArrayForEach(jStep, jSteps) {
+		cJSON*		jOffset = cJSON_GetArrayItem(jStep, 0);
+		cJSON*		jActive = cJSON_GetArrayItem(jStep, 2);
+		uint64_t	stepMask;
+		if (!cJSON_IsArray(jStep) || cJSON_GetArraySize(jStep) != 3
+			|| !cJSON_IsNumber(jOffset) || jOffset->valuedouble < lastUs || jOffset->valuedouble > UINT32_MAX
+			|| !_mask_value(cJSON_GetArrayItem(jStep, 1), &stepMask)
+			|| !(cJSON_IsBool(jActive) || cJSON_IsNumber(jActive))) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "steps items are [offset_us, mask, active] in time order";
+			return;
+		}
+		bool active = cJSON_IsBool(jActive) ? cJSON_IsTrue(jActive) : (jActive->valueint != 0);
+		lastUs = (uint32_t)jOffset->valuedouble;
+		steps[idx].offsetUs = lastUs;
+		steps[idx].setMask = active ? stepMask : 0;
+		steps[idx].clrMask = active ? 0 : stepMask;
+		mask |= stepMask;
+		idx++;
+	}
+	if (!_check_outputs(pCtrl, mask, ret)) {
+		return;
+	}
+
+	uint32_t periodUs = lastUs;
+	if ((jObj = cJSON_GetObjectItem(jParam, "period_us")) != NULL) {
+		if (!cJSON_IsNumber(jObj) || jObj->valuedouble < lastUs || jObj->valuedouble > UINT32_MAX) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "period_us must not be before the last step";
+			return;
 		}
+		periodUs = (uint32_t)jObj->valuedouble;
+	}
+	if (repeat != 1 && periodUs < SEQ_MIN_PERIOD_US) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "period_us too short to repeat";
+		return;
+	}
 
-		bool active = (pin->state == pinState_high || pin->state == pinState_falling);
+	// A stale wakeup of the previous sequence may still be armed
+	esp_timer_stop(pCtrl->seq.timer);
+
+	portENTER_CRITICAL(&pCtrl->seq.mux);
+	pCtrl->seq.count = count;
+	pCtrl->seq.periodUs = periodUs;
+	pCtrl->seq.repeat = repeat;
+	pCtrl->seq.id++;
+	pCtrl->seq.step = 0;
+	pCtrl->seq.rep = 0;
+	pCtrl->seq.lateMaxUs = 0;
+	pCtrl->seq.startUs = esp_timer_get_time() + SEQ_SPIN_US;
+	pCtrl->seq.state = seqState_running;
+	uint32_t id = pCtrl->seq.id;
+	portEXIT_CRITICAL(&pCtrl->seq.mux);
+
+	esp_timer_start_once(pCtrl->seq.timer, 0);
+
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	testCommJwObjectStart(jw, NULL);
+	testCommJwInt(jw, "id", id);
+	testCommJwObjectEnd(jw);
+}
 
-		cJSON* jItem = cJSON_CreateObject();
-		cJSON_AddNumberToObject(jItem, "gpio_num", gpio_num);
-		cJSON_AddBoolToObject(jItem, "active", active);
-		cJSON_AddItemToArray(ret->jResult, jItem);
+/**
+ * /brief Stop the output sequence, outputs keep their current levels
+ *
+ * returns the gpio-seq-status of the stopped sequence
+ */
+static void _gpioSeqAbort(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	portENTER_CRITICAL(&pCtrl->seq.mux);
+	bool running = (seqState_running == pCtrl->seq.state);
+	if (running) {
+		pCtrl->seq.state = seqState_aborted;
+	}
+	portEXIT_CRITICAL(&pCtrl->seq.mux);
+	esp_timer_stop(pCtrl->seq.timer);
+	if (running) {
+		_seq_notify(pCtrl);
+	}
+
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	_seq_status(pCtrl, jw);
+}
+
+/**
+ * /brief Report the progress of the latest output sequence
+ *
+ * returns JSON structure:
+ *   {"id": <int>, "state": <"idle"|"running"|"done"|"aborted">, "repeats": <completed>,
+ *    "step": <next step>, "late_max_us": <worst step time error>}
+ */
+static void _gpioSeqStatus(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	_seq_status(pCtrl, jw);
+}
+
+/**
+ * /brief Read input pin state
+ * 
+ * returns JSON structure:
+ *   {"gpio_num": <number>, "active": <true|false>}
+ */
+static void _gpioGet(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	int gpio_num;
+	pinCtrl_t* pin = _get_pin_ctrl(pCtrl, jParam, ret, &gpio_num);
+	if (!pin) {
+		return;
+	}
+
+	bool level = (pin->state == pinState_high || pin->state == pinState_falling);
+
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	testCommJwObjectStart(jw, NULL);
+	testCommJwInt(jw, "gpio_num", gpio_num);
+	testCommJwBool(jw, "active", level);
+	testCommJwObjectEnd(jw);
+}
+
+/**
+ * /brief Return a JSON array of the state of all input pins
+ * 
+ * returns JSON array:
+ *   [{"gpio_num": <int>, "active": <true|false>}, ...]
+ */
+static void _gpioGetAll(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+
+	// Written straight into the response, no cJSON tree
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	testCommJwArrayStart(jw, NULL);
+
+	int gpio_num;
+	pinCtrl_t* pin;
+
+	// Return the current states of all input pins
+	for (gpio_num = 0, pin = pCtrl->pinCtrl; gpio_num < NUM_GPIO_PINS; gpio_num++, pin++) {
+		if (!pin->enabled || pin->dir == pinDir_output) {
+			continue;
+		}
+
+		bool active = (pin->state == pinState_high || pin->state == pinState_falling);
+
+		testCommJwObjectStart(jw, NULL);
+		testCommJwInt(jw, "gpio_num", gpio_num);
+		testCommJwBool(jw, "active", active);
+		testCommJwObjectEnd(jw);
+	}
+	testCommJwArrayEnd(jw);
+}
+
+/**
+ * /brief Return the input changes recorded after a sequence number
+ *
+ * params (all optional):
+ *   {"since": <seq, default 0>, "max": <events, default all>}
+ *
+ * Events are numbered from 1. Pass the returned "seq" as "since" of the next
+ * call to receive only newer events. "lost" counts events after "since" that
+ * were overwritten in the ring before they could be returned.
+ *
+ * returns JSON structure:
+ *   {"events": [[<gpio_num>, <0|1>, <us after the previous event>], ...],
+ *    "time_us": <time of the first event, absent if none>, "lost": <int>,
+ *    "seq": <seq of the last event returned>, "more": <true if events remain>}
+ */
+static void _gpioEvents(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	uint32_t	since = 0;
+	uint32_t	max = EVENT_RING_SZ;
+	cJSON*		jObj;
+
+	if ((jObj = cJSON_GetObjectItem(jParam, "since")) != NULL) {
+		if (!cJSON_IsNumber(jObj) || jObj->valuedouble < 0 || jObj->valuedouble > UINT32_MAX) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "Invalid since";
+			return;
+		}
+		since = (uint32_t)jObj->valuedouble;
+	}
+	if ((jObj = cJSON_GetObjectItem(jParam, "max")) != NULL) {
+		if (!cJSON_IsNumber(jObj) || jObj->valueint < 1) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "Invalid max";
+			return;
+		}
+		if ((uint32_t)jObj->valueint < max) {
+			max = jObj->valueint;
+		}
+	}
+
+	portENTER_CRITICAL(&pCtrl->evtMux);
+	uint32_t	last = pCtrl->evtSeq;
+	portEXIT_CRITICAL(&pCtrl->evtMux);
+
+	if (since > last) {
+		// The host is ahead: the firmware restarted since its last call
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "since is after the latest event";
+		return;
+	}
+
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+
+	uint32_t	oldest = (last > EVENT_RING_SZ) ? last - EVENT_RING_SZ + 1 : 1;
+	uint32_t	seq = (since < oldest) ? oldest - 1 : since;
+	uint32_t	lost = seq - since;
+	uint32_t	count = 0;
+	int64_t		firstUs = 0;
+	int64_t		prevUs = 0;
+
+	testCommJwObjectStart(jw, NULL);
+	testCommJwArrayStart(jw, "events");
+
+	// Copy a few events at a time, new ones can overwrite the oldest meanwhile
+	while (seq < last && count < max) {
+		gpioEvt_t	copy[EVENT_COPY_CNT];
+		uint32_t	n = last - seq;
+		if (n > max - count) {
+			n = max - count;
+		}
+		if (n > EVENT_COPY_CNT) {
+			n = EVENT_COPY_CNT;
+		}
+
+		portENTER_CRITICAL(&pCtrl->evtMux);
+		bool overwritten = (pCtrl->evtSeq - seq) > EVENT_RING_SZ;
+		if (!overwritten) {
+			for (uint32_t i = 0; i < n; i++) {
+				copy[i] = pCtrl->evtRing[(seq + 1 + i) % EVENT_RING_SZ];
+			}
+		}
+		portEXIT_CRITICAL(&pCtrl->evtMux);
+		if (overwritten) {
+			// Report the rest as lost on the next call
+			break;
+		}
+
+		for (uint32_t i = 0; i < n; i++) {
+			if (0 == count + i) {
+				firstUs = prevUs = copy[i].timeUs;
+			}
+			testCommJwArrayStart(jw, NULL);
+			testCommJwInt(jw, NULL, copy[i].gpio_num);
+			testCommJwInt(jw, NULL, copy[i].level);
+			testCommJwInt(jw, NULL, copy[i].timeUs - prevUs);
+			testCommJwArrayEnd(jw);
+			prevUs = copy[i].timeUs;
+		}
+		seq += n;
+		count += n;
+	}
+	testCommJwArrayEnd(jw);
+
+	if (count) {
+		testCommJwInt(jw, "time_us", firstUs);
+	}
+	testCommJwInt(jw, "lost", lost);
+	testCommJwInt(jw, "seq", seq);
+	testCommJwBool(jw, "more", seq < last);
+	testCommJwObjectEnd(jw);
+}
+
+/**
+ * @brief Debounced levels of the enabled inputs, bit n is GPIO n
+ */
+static uint64_t _input_levels(ctrl_t* pCtrl)
+{
+	uint64_t	levels = 0;
+
+	for (int gpio_num = 0; gpio_num < NUM_GPIO_PINS; gpio_num++) {
+		pinCtrl_t*	pin = &pCtrl->pinCtrl[gpio_num];
+		if (pin->enabled && pin->dir != pinDir_output
+			&& (pin->state == pinState_high || pin->state == pinState_falling)) {
+			levels |= 1ULL << gpio_num;
+		}
+	}
+	return levels;
+}
+
+/**
+ * @brief Whether the levels of a wait's pins meet its level condition
+ */
+static bool _wait_level_met(const gpioWait_t* w, uint64_t levels)
+{
+	uint64_t	hits = ((waitCond_active == w->cond) ? levels : ~levels) & w->mask;
+
+	return w->all ? (hits == w->mask) : (hits != 0);
+}
+
+/**
+ * @brief Arm the wait timer for the earliest deadline. Call with waitMutex held.
+ */
+static void _wait_arm(ctrl_t* pCtrl)
+{
+	int64_t	nextUs = 0;
+
+	for (int i = 0; i < WAIT_MAX; i++) {
+		gpioWait_t*	w = &pCtrl->wait[i];
+		if (w->used && !w->replying && (!nextUs || w->deadlineUs < nextUs)) {
+			nextUs = w->deadlineUs;
+		}
+	}
+
+	esp_timer_stop(pCtrl->waitTimer);
+	if (nextUs) {
+		int64_t	nowUs = esp_timer_get_time();
+		esp_timer_start_once(pCtrl->waitTimer, (nextUs > nowUs) ? nextUs - nowUs : 0);
+	}
+}
+
+static void _wait_cb(void* arg)
+{
+	ctrl_t*		pCtrl = arg;
+	edgeEvt_t	evt = {.gpio_num = EDGE_WAKE};
+
+	// The debounce task sends the timeouts
+	pCtrl->waitDue = true;
+	xQueueSend(pCtrl->edgeQueue, &evt, 0);
+}
+
+/**
+ * @brief Send the gpio-wait replies queued by the debounce task
+ *
+ * Waits for TX frames as long as it takes; the debounce task only queues
+ * the replies, so it keeps debouncing meanwhile. The wait slot is freed
+ * once its reply is sent.
+ */
+static void _wait_reply_task(void* param)
+{
+	ctrl_t*		pCtrl = param;
+	waitReply_t	reply;
+
+	while (true) {
+		xQueueReceive(pCtrl->waitReplyQueue, &reply, portMAX_DELAY);
+		gpioWait_t*	w = &pCtrl->wait[reply.slot];
+
+		if (reply.met) {
+			cJSON* jResult = cJSON_CreateObject();
+			cJSON_AddNumberToObject(jResult, "gpio_num", reply.gpio_num);
+			cJSON_AddBoolToObject(jResult, "active", reply.active);
+			cJSON_AddNumberToObject(jResult, "time_us", reply.timeUs);
+			cJSON_AddNumberToObject(jResult, "seq", reply.seq);
+			cmdDeferredReply(&w->replyTo, jResult);
+		} else {
+			testCommSendErrResponse(&w->replyTo, RPC_ERR_TIMEOUT, "Condition not met in time");
+		}
+
+		xSemaphoreTake(pCtrl->waitMutex, portMAX_DELAY);
+		w->used = w->replying = false;
+		xSemaphoreGive(pCtrl->waitMutex);
+	}
+}
+
+/**
+ * @brief Queue the reply of a wait. Call with waitMutex held.
+ *
+ * Never blocks: each slot has at most one reply queued, and the queue
+ * holds one per slot.
+ */
+static void _wait_queue_reply(ctrl_t* pCtrl, waitReply_t* reply)
+{
+	pCtrl->wait[reply->slot].replying = true;
+	xQueueSend(pCtrl->waitReplyQueue, reply, 0);
+}
+
+/**
+ * @brief Answer the waits met by a debounced input change
+ */
+static void _wait_edge(ctrl_t* pCtrl, uint32_t seq, int gpio_num, bool active, int64_t edgeUs)
+{
+	bool		answered = false;
+	uint64_t	bit = 1ULL << gpio_num;
+
+	xSemaphoreTake(pCtrl->waitMutex, portMAX_DELAY);
+	uint64_t	levels = (_input_levels(pCtrl) & ~bit) | (active ? bit : 0);
+	for (int i = 0; i < WAIT_MAX; i++) {
+		gpioWait_t*	w = &pCtrl->wait[i];
+		if (!w->used || w->replying || !(w->mask & bit)) {
+			continue;
+		}
+
+		bool	met;
+		switch (w->cond) {
+			case waitCond_rising:
+				met = active;
+				break;
+			case waitCond_falling:
+				met = !active;
+				break;
+			case waitCond_edge:
+				met = true;
+				break;
+			default:
+				met = _wait_level_met(w, levels);
+				break;
+		}
+		if (met) {
+			waitReply_t	reply = {.slot = i, .met = true, .gpio_num = gpio_num, .active = active, .timeUs = edgeUs, .seq = seq};
+			_wait_queue_reply(pCtrl, &reply);
+			answered = true;
+		}
+	}
+	if (answered) {
+		_wait_arm(pCtrl);
+	}
+	xSemaphoreGive(pCtrl->waitMutex);
+}
+
+/**
+ * @brief Fail the waits whose timeout has passed
+ */
+static void _wait_expire(ctrl_t* pCtrl)
+{
+	pCtrl->waitDue = false;
+
+	xSemaphoreTake(pCtrl->waitMutex, portMAX_DELAY);
+	int64_t	nowUs = esp_timer_get_time();
+	for (int i = 0; i < WAIT_MAX; i++) {
+		gpioWait_t*	w = &pCtrl->wait[i];
+		if (w->used && !w->replying && w->deadlineUs <= nowUs) {
+			waitReply_t	reply = {.slot = i, .met = false};
+			_wait_queue_reply(pCtrl, &reply);
+		}
+	}
+	_wait_arm(pCtrl);
+	xSemaphoreGive(pCtrl->waitMutex);
+}
+
+/**
+ * /brief Wait on the board for an input condition
+ *
+ * JSON parameter contents:
+ *   "gpio_num": <number> or "mask": <pins, bit n is GPIO n>
+ *   "active": <true|false>, the level to wait for, or
+ *   "edge": <"rising"|"falling"|"any">, the next change to wait for
+ *   "all": <true: every pin of the mask at the level, default any one>
+ *   "timeout_ms": <default 10000>
+ *
+ * A level already met is answered at once. Otherwise the request is answered
+ * by the debounce task as soon as an input change meets it, and the command
+ * worker goes on with other requests meanwhile; use request IDs to match the
+ * late reply. Not available inside a batch or as an async job unless the
+ * level is already met.
+ *
+ * returns JSON structure:
+ *   {"gpio_num": <pin that met it>, "active": <its level>,
+ *    "time_us": <time of its debounced edge>, "seq": <gpio-events number, 0 if met at once>}
+ * or the error RPC_ERR_TIMEOUT
+ */
+static void _gpioWait(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	gpioWait_t	wait = {.used = true};
+	cJSON*		jObj;
+
+	if ((jObj = cJSON_GetObjectItem(jParam, "gpio_num")) != NULL) {
+		if (!cJSON_IsNumber(jObj) || jObj->valueint < 0 || jObj->valueint >= NUM_GPIO_PINS) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "Invalid gpio_num";
+			return;
+		}
+		wait.mask = 1ULL << jObj->valueint;
+	} else if (!_mask_value(cJSON_GetObjectItem(jParam, "mask"), &wait.mask) || !wait.mask) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "Need gpio_num or a non-empty mask";
+		return;
+	}
+	for (int gpio_num = 0; gpio_num < NUM_GPIO_PINS; gpio_num++) {
+		pinCtrl_t* pin = &pCtrl->pinCtrl[gpio_num];
+		if ((wait.mask & (1ULL << gpio_num)) && (!pin->enabled || pin->dir == pinDir_output)) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "pin not configured as input";
+			return;
+		}
+	}
+
+	cJSON*		jActive = cJSON_GetObjectItem(jParam, "active");
+	const char*	edge = cJSON_GetStringValue(cJSON_GetObjectItem(jParam, "edge"));
+	if (cJSON_IsBool(jActive) && !edge) {
+		wait.cond = cJSON_IsTrue(jActive) ? waitCond_active : waitCond_inactive;
+	} else if (!jActive && edge && strcmp(edge, "rising") == 0) {
+		wait.cond = waitCond_rising;
+	} else if (!jActive && edge && strcmp(edge, "falling") == 0) {
+		wait.cond = waitCond_falling;
+	} else if (!jActive && edge && strcmp(edge, "any") == 0) {
+		wait.cond = waitCond_edge;
+	} else {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "Need active, or edge rising, falling or any";
+		return;
+	}
+	wait.all = _get_flag(jParam, "all");
+
+	double	timeoutMs = WAIT_TIMEOUT_MS;
+	if ((jObj = cJSON_GetObjectItem(jParam, "timeout_ms")) != NULL) {
+		timeoutMs = cJSON_GetNumberValue(jObj);
+		if (!cJSON_IsNumber(jObj) || timeoutMs < 0 || timeoutMs > WAIT_TIMEOUT_MAX_MS) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "Invalid timeout_ms";
+			return;
+		}
+	}
+	wait.deadlineUs = esp_timer_get_time() + (int64_t)(timeoutMs * 1000);
+
+	xSemaphoreTake(pCtrl->waitMutex, portMAX_DELAY);
+	if (wait.cond <= waitCond_inactive) {
+		uint64_t	levels = _input_levels(pCtrl);
+		if (_wait_level_met(&wait, levels)) {
+			xSemaphoreGive(pCtrl->waitMutex);
+
+			// Report the pin at the level that changed last
+			bool		active = (waitCond_active == wait.cond);
+			uint64_t	hits = (active ? levels : ~levels) & wait.mask;
+			int			gpio_num = -1;
+			for (int n = 0; n < NUM_GPIO_PINS; n++) {
+				if ((hits & (1ULL << n)) && (gpio_num < 0 || pCtrl->pinCtrl[n].edgeUs > pCtrl->pinCtrl[gpio_num].edgeUs)) {
+					gpio_num = n;
+				}
+			}
+
+			testComm_jw_t* jw = cmdResultStream(ret);
+			if (!jw) {
+				return;
+			}
+			testCommJwObjectStart(jw, NULL);
+			testCommJwInt(jw, "gpio_num", gpio_num);
+			testCommJwBool(jw, "active", active);
+			testCommJwInt(jw, "time_us", pCtrl->pinCtrl[gpio_num].edgeUs);
+			testCommJwInt(jw, "seq", 0);
+			testCommJwObjectEnd(jw);
+			return;
+		}
+	}
+
+	gpioWait_t*	slot = NULL;
+	for (int i = 0; i < WAIT_MAX && !slot; i++) {
+		if (!pCtrl->wait[i].used) {
+			slot = &pCtrl->wait[i];
+		}
+	}
+	if (!slot) {
+		ret->code = RPC_ERR_BUSY;
+		ret->mesg = "Too many gpio-wait pending";
+	} else if (!cmdDefer(ret, &wait.replyTo)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "gpio-wait must be its own request";
+	} else {
+		*slot = wait;
+		_wait_arm(pCtrl);
+	}
+	xSemaphoreGive(pCtrl->waitMutex);
+}
+
+/**
+ * @brief Configure the pins of a pin map, outputs inactive
+ */
+static esp_err_t _pin_map_apply(ctrl_t* pCtrl, const pinMap_t* map)
+{
+	uint64_t	groupMask[CONF_GROUPS] = {0};
+	uint32_t	glitchUs[NUM_GPIO_PINS];
+
+	for (int idx = 0; idx < map->pinCount; idx++) {
+		const pinMapPin_t*	pin = &map->pins[idx];
+		groupMask[CONF_GROUP(pin->isOut, pin->pullUp, pin->pullDown)] |= 1ULL << pin->gpio_num;
+		glitchUs[pin->gpio_num] = pin->glitchUs;
+	}
+	return _conf_apply(pCtrl, groupMask, map->outMask & map->invMask, map->outMask & ~map->invMask, glitchUs);
+}
+
+/**
+ * @brief Load the stored pin map at start up and configure its pins
+ */
+static void _pin_map_boot(ctrl_t* pCtrl)
+{
+	pinMap_t*	map = malloc(sizeof(*map));
+	if (!map) {
+		return;
+	}
+	if (pinMapLoad(map) != ESP_OK || _pin_map_apply(pCtrl, map) != ESP_OK) {
+		free(map);
+		return;
+	}
+	pCtrl->pinMap = map;
+}
+
+/**
+ * @brief Build a pin map from pin-map-set parameters
+ */
+static bool _pin_map_parse(cJSON* jParam, pinMap_t* map, cmdReturn_t* ret)
+{
+	pinMapInit(map);
+
+	cJSON* jPins = cJSON_GetObjectItem(jParam, "pins");
+	if (!cJSON_IsArray(jPins)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "pins array required";
+		return false;
+	}
+
+	cJSON* jDesc;
+	cJSON_ArrayForEach(jDesc, jPins) {
+		char*	name = cJSON_GetStringValue(cJSON_GetObjectItem(jDesc, "name"));
+		char*	dir = cJSON_GetStringValue(cJSON_GetObjectItem(jDesc, "dir"));
+		cJSON*	jNum = cJSON_GetObjectItem(jDesc, "gpio_num");
+
+		if (!name || !cJSON_IsNumber(jNum) || jNum->valueint < 0 || jNum->valueint >= NUM_GPIO_PINS
+			|| !dir || (strcmp(dir, "in") != 0 && strcmp(dir, "out") != 0)) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "pins items need name, gpio_num and dir";
+			return false;
+		}
+
+		pinMapPin_t	pin = {
+			.gpio_num = jNum->valueint,
+			.isOut    = (strcmp(dir, "out") == 0),
+			.activeHi = _get_flag(jDesc, "active_hi"),
+			.pullUp   = _get_flag(jDesc, "pull_up_en"),
+			.pullDown = _get_flag(jDesc, "pull_down_en")
+		};
+		if (!_get_glitch(jDesc, &pin.glitchUs, ret)) {
+			return false;
+		}
+		const char*	mesg = pinMapAddPin(map, name, &pin);
+		if (mesg) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = mesg;
+			return false;
+		}
+	}
+
+	// Groups list pin names, or names of groups already given
+	cJSON* jGroups = cJSON_GetObjectItem(jParam, "groups");
+	if (jGroups && !cJSON_IsObject(jGroups)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "groups must be an object";
+		return false;
+	}
+	cJSON* jGroup;
+	cJSON_ArrayForEach(jGroup, jGroups) {
+		if (!cJSON_IsArray(jGroup)) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "group must be an array of names";
+			return false;
+		}
+
+		pinMapSort(map);
+		uint64_t	mask = 0;
+		cJSON*		jName;
+		cJSON_ArrayForEach(jName, jGroup) {
+			char*				str = cJSON_GetStringValue(jName);
+			const pinMapName_t*	entry = str ? pinMapFind(map, str) : NULL;
+			if (!entry) {
+				ret->code = RPC_ERR_PARAMS;
+				ret->mesg = "group member not mapped";
+				return false;
+			}
+			mask |= entry->mask;
+		}
+
+		const char*	mesg = pinMapAddGroup(map, jGroup->string, mask);
+		if (mesg) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = mesg;
+			return false;
+		}
+	}
+
+	pinMapSort(map);
+	return true;
+}
+
+/**
+ * /brief Store a pin map in NVS and configure its pins
+ *
+ * JSON parameter contents:
+ *   "pins": [{"name": <name>, "gpio_num": <GPIO number>, "dir": <"in"|"out">,
+ *             "active_hi": <true|false>, "pull_up_en", "pull_down_en", "glitch_us"}, ...]
+ *   "groups": {<group name>: [<pin or group name>, ...], ...}
+ *   "save": <true|false>, default true
+ *
+ * Names are up to 15 characters, shared by pins and groups. Outputs start
+ * inactive. The stored map is applied again at every start, so the host
+ * need only send it when it changes. An empty pins array erases the map.
+ */
+static void _pinMapSet(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	pinMap_t*	map = malloc(sizeof(*map));
+	if (!map) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "No memory";
+		return;
+	}
+	if (!_pin_map_parse(jParam, map, ret)) {
+		free(map);
+		return;
+	}
+
+	cJSON*		jSave = cJSON_GetObjectItem(jParam, "save");
+	bool		save = !jSave || cJSON_IsTrue(jSave);
+	esp_err_t	status = ESP_OK;
+	if (0 == map->pinCount) {
+		free(map);
+		map = NULL;
+		if (save) {
+			status = pinMapErase();
+		}
+	} else if ((status = _pin_map_apply(pCtrl, map)) != ESP_OK) {
+		free(map);
+		if (ESP_ERR_NOT_ALLOWED == status) {
+			_out_refused(pCtrl, ret);
+		} else {
+			ret->code = RPC_ERR_INTERNAL;
+			ret->mesg = "gpio_config failed";
+		}
+		return;
+	} else if (save) {
+		status = pinMapSave(map);
+	}
+
+	// Methods using the map all run on the IO class worker, as this one
+	free(pCtrl->pinMap);
+	pCtrl->pinMap = map;
+
+	if (ESP_OK != status) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "Map applied but not stored";
+	}
+}
+
+/**
+ * /brief Return the pin map in the form pin-map-set takes, without "save"
+ *
+ * Groups list their pins. "pins" is empty when no map is set.
+ */
+static void _pinMapGet(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	const pinMap_t* map = pCtrl->pinMap;
+
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	testCommJwObjectStart(jw, NULL);
+	testCommJwArrayStart(jw, "pins");
+	for (int idx = 0; map && idx < map->pinCount; idx++) {
+		const pinMapPin_t*	pin = &map->pins[idx];
+		testCommJwObjectStart(jw, NULL);
+		testCommJwString(jw, "name", map->names[idx].name);
+		testCommJwInt(jw, "gpio_num", pin->gpio_num);
+		testCommJwString(jw, "dir", pin->isOut ? "out" : "in");
+		testCommJwBool(jw, "active_hi", pin->activeHi);
+		testCommJwBool(jw, "pull_up_en", pin->pullUp);
+		testCommJwBool(jw, "pull_down_en", pin->pullDown);
+		testCommJwInt(jw, "glitch_us", pin->glitchUs);
+		testCommJwObjectEnd(jw);
+	}
+	testCommJwArrayEnd(jw);
+
+	testCommJwObjectStart(jw, "groups");
+	for (int idx = map ? map->pinCount : 0; map && idx < map->nameCount; idx++) {
+		testCommJwArrayStart(jw, map->names[idx].name);
+		for (int pin = 0; pin < map->pinCount; pin++) {
+			if (map->names[idx].mask & map->names[pin].mask) {
+				testCommJwString(jw, NULL, map->names[pin].name);
+			}
+		}
+		testCommJwArrayEnd(jw);
+	}
+	testCommJwObjectEnd(jw);
+	testCommJwObjectEnd(jw);
+}
+
+/**
+ * @brief Look up a pin or group of the pin map
+ */
+static const pinMapName_t* _pin_find(ctrl_t* pCtrl, const char* name, cmdReturn_t* ret)
+{
+	const pinMapName_t*	entry = (pCtrl->pinMap && name) ? pinMapFind(pCtrl->pinMap, name) : NULL;
+	if (!entry) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = pCtrl->pinMap ? "name not mapped" : "No pin map set";
+	}
+	return entry;
+}
+
+/**
+ * /brief Set named outputs, or all outputs of named groups, active or inactive
+ *
+ * JSON parameter contents, one of:
+ *   "name": <pin or group name>, "active": <true|false>
+ *   "names": {<pin or group name>: <true|false>, ...}
+ *
+ * Active is high for an active_hi pin and low otherwise. Every pin named
+ * changes in one _out_write_checked(), as gpio-set-mask.
+ */
+static void _pinSet(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	uint64_t	activeMask = 0;
+	uint64_t	inactiveMask = 0;
+	cJSON*		jName = cJSON_GetObjectItem(jParam, "name");
+	cJSON*		jNames = cJSON_GetObjectItem(jParam, "names");
+
+	if (jName) {
+		cJSON*	jActive = cJSON_GetObjectItem(jParam, "active");
+		if (!cJSON_IsBool(jActive)) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "active missing or invalid type";
+			return;
+		}
+		const pinMapName_t*	entry = _pin_find(pCtrl, cJSON_GetStringValue(jName), ret);
+		if (!entry) {
+			return;
+		}
+		if (cJSON_IsTrue(jActive)) {
+			activeMask = entry->mask;
+		} else {
+			inactiveMask = entry->mask;
+		}
+	} else if (cJSON_IsObject(jNames)) {
+		cJSON_ArrayForEach(jName, jNames) {
+			if (!cJSON_IsBool(jName)) {
+				ret->code = RPC_ERR_PARAMS;
+				ret->mesg = "names values must be true or false";
+				return;
+			}
+			const pinMapName_t*	entry = _pin_find(pCtrl, jName->string, ret);
+			if (!entry) {
+				return;
+			}
+			if (cJSON_IsTrue(jName)) {
+				activeMask |= entry->mask;
+			} else {
+				inactiveMask |= entry->mask;
+			}
+		}
+	} else {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "name or names required";
+		return;
+	}
+
+	if (activeMask & inactiveMask) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "Pin both active and inactive";
+		return;
+	}
+	if (!_check_outputs(pCtrl, activeMask | inactiveMask, ret)) {
+		return;
+	}
+
+	uint64_t	invMask = pCtrl->pinMap->invMask;
+	_out_write_method(pCtrl, (activeMask & ~invMask) | (inactiveMask & invMask), (activeMask & invMask) | (inactiveMask & ~invMask), ret);
+}
+
+/**
+ * /brief Read a named pin, or the pins of a named group
+ *
+ * JSON parameter contents:
+ *   "name": <pin or group name>
+ *
+ * returns JSON structure:
+ *   {<pin name>: <true|false>, ...}
+ *
+ * Active per the pin's active_hi; inputs give their debounced level,
+ * outputs the level driven.
+ */
+static void _pinGet(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	const pinMapName_t*	entry = _pin_find(pCtrl, cJSON_GetStringValue(cJSON_GetObjectItem(jParam, "name")), ret);
+	if (!entry) {
+		return;
+	}
+
+	const pinMap_t*	map = pCtrl->pinMap;
+	uint64_t		outLevels = REG_READ(GPIO_OUT_REG) | ((uint64_t)REG_READ(GPIO_OUT1_REG) << 32);
+	uint64_t		levels = (_input_levels(pCtrl) & ~map->outMask) | (outLevels & map->outMask);
+	uint64_t		active = levels ^ map->invMask;
+
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	testCommJwObjectStart(jw, NULL);
+	for (int idx = 0; idx < map->pinCount; idx++) {
+		if (entry->mask & map->names[idx].mask) {
+			testCommJwBool(jw, map->names[idx].name, (active & map->names[idx].mask) != 0);
+		}
+	}
+	testCommJwObjectEnd(jw);
+}
+
+/**
+ * @brief Pulse counter history timer, samples the total of every counter
+ */
+static void _count_cb(void* arg)
+{
+	ctrl_t*	pCtrl = (ctrl_t*)arg;
+
+	xSemaphoreTake(pCtrl->countMutex, portMAX_DELAY);
+	int64_t	nowUs = esp_timer_get_time();
+	for (int idx = 0; idx < PULSE_COUNT_MAX; idx++) {
+		gpioCount_t*	cnt = &pCtrl->count[idx];
+		if (cnt->pc) {
+			countSample_t*	smp = &cnt->hist[cnt->histCnt++ % COUNT_HIST];
+			smp->timeUs = nowUs;
+			smp->total = pulseCountRead(cnt->pc);
+		}
+	}
+	xSemaphoreGive(pCtrl->countMutex);
+}
+
+/**
+ * @brief Stop counting on a pin, if it was
+ */
+static void _count_detach(ctrl_t* pCtrl, int gpio_num)
+{
+	xSemaphoreTake(pCtrl->countMutex, portMAX_DELAY);
+	for (int idx = 0; idx < PULSE_COUNT_MAX; idx++) {
+		gpioCount_t*	cnt = &pCtrl->count[idx];
+		if (cnt->pc && cnt->gpio_num == gpio_num) {
+			pulseCountClose(cnt->pc);
+			cnt->pc = NULL;
+		}
+	}
+	xSemaphoreGive(pCtrl->countMutex);
+}
+
+/**
+ * @brief gpio-conf "count" mode: count the rising edges of a pin from 0
+ *
+ * The pin leaves the debounced inputs. "filter_ns" drops shorter pulses;
+ * simulated counters take their rate from "sim_hz".
+ */
+static void _count_conf(ctrl_t* pCtrl, int gpio_num, cJSON* jParam, cmdReturn_t* ret)
+{
+	cJSON*	jFilter = cJSON_GetObjectItem(jParam, "filter_ns");
+	double	filterNs = jFilter ? cJSON_GetNumberValue(jFilter) : 0;
+	if (!(filterNs >= 0 && filterNs <= PULSE_FILTER_MAX_NS)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "filter_ns must be 0 to 12000";
+		return;
+	}
+
+	_count_detach(pCtrl, gpio_num);
+
+	xSemaphoreTake(pCtrl->countMutex, portMAX_DELAY);
+	gpioCount_t*	cnt = NULL;
+	for (int idx = 0; idx < PULSE_COUNT_MAX && !cnt; idx++) {
+		if (!pCtrl->count[idx].pc) {
+			cnt = &pCtrl->count[idx];
+		}
+	}
+	if (!cnt) {
+		xSemaphoreGive(pCtrl->countMutex);
+		ret->code = RPC_ERR_BUSY;
+		ret->mesg = "No pulse counter free";
+		return;
+	}
+
+	pinCtrl_t* pin = &pCtrl->pinCtrl[gpio_num];
+	pin->enabled = false;
+	_input_disarm(pCtrl, gpio_num);
+	gpio_intr_disable((gpio_num_t)gpio_num);
+
+	if (pulseCountOpen(gpio_num, (uint32_t)filterNs, &cnt->pc) != ESP_OK) {
+		cnt->pc = NULL;
+		xSemaphoreGive(pCtrl->countMutex);
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "Failed to start pulse counter";
+		return;
+	}
+#if CONFIG_GPIO_COUNT_SIM
+	pulseCountSimRate(cnt->pc, cJSON_GetNumberValue(cJSON_GetObjectItem(jParam, "sim_hz")));
+#endif
+	cnt->gpio_num = gpio_num;
+	cnt->base = 0;
+	cnt->hist[0].timeUs = esp_timer_get_time();
+	cnt->hist[0].total = 0;
+	cnt->histCnt = 1;
+	xSemaphoreGive(pCtrl->countMutex);
+}
+
+/**
+ * @brief Find the counter of the pin given by "gpio_num", call with countMutex held
+ */
+static gpioCount_t* _count_find(ctrl_t* pCtrl, cJSON* jParam, cmdReturn_t* ret)
+{
+	int	gpio_num;
+	if (!_enter_api(pCtrl, jParam, ret, &gpio_num)) {
+		return NULL;
+	}
+
+	for (int idx = 0; idx < PULSE_COUNT_MAX; idx++) {
+		if (pCtrl->count[idx].pc && pCtrl->count[idx].gpio_num == gpio_num) {
+			return &pCtrl->count[idx];
+		}
+	}
+	ret->code = RPC_ERR_PARAMS;
+	ret->mesg = "pin not configured as counter";
+	return NULL;
+}
+
+/**
+ * /brief Read the rising edges counted on a pin
+ *
+ * JSON parameter contents:
+ *   "gpio_num": <GPIO number>
+ *   "clear": <true|false>, restart the count after reading it
+ *
+ * returns JSON structure:
+ *   {"gpio_num": <number>, "count": <edges since configured or cleared>, "time_us": <time read>}
+ */
+static void _gpioCount(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+
+	xSemaphoreTake(pCtrl->countMutex, portMAX_DELAY);
+	gpioCount_t*	cnt = _count_find(pCtrl, jParam, ret);
+	if (!cnt) {
+		xSemaphoreGive(pCtrl->countMutex);
+		return;
+	}
+	int64_t		nowUs = esp_timer_get_time();
+	uint64_t	total = pulseCountRead(cnt->pc);
+	uint64_t	count = total - cnt->base;
+	int			gpio_num = cnt->gpio_num;
+	if (_get_flag(jParam, "clear")) {
+		cnt->base = total;
+	}
+	xSemaphoreGive(pCtrl->countMutex);
+
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	testCommJwObjectStart(jw, NULL);
+	testCommJwInt(jw, "gpio_num", gpio_num);
+	testCommJwInt(jw, "count", count);
+	testCommJwInt(jw, "time_us", nowUs);
+	testCommJwObjectEnd(jw);
+}
+
+/**
+ * /brief Measure the rate of rising edges on a pin over a recent window
+ *
+ * JSON parameter contents:
+ *   "gpio_num": <GPIO number>
+ *   "window_ms": <window length, default 1000>
+ *
+ * returns JSON structure:
+ *   {"gpio_num": <number>, "freq_hz": <rate>, "count": <edges in window>, "window_us": <window used>}
+ *
+ * Answered at once from the count history, sampled every COUNT_SAMPLE_MS:
+ * the window runs from the latest sample at least window_ms old to now,
+ * up to COUNT_SAMPLE_MS longer than asked. A counter
+ * configured more recently gives the rate since it was configured.
+ */
+static void _gpioFreq(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+
+	cJSON*	jWindow = cJSON_GetObjectItem(jParam, "window_ms");
+	double	windowMs = jWindow ? cJSON_GetNumberValue(jWindow) : COUNT_WINDOW_MS;
+	if (!(windowMs >= COUNT_SAMPLE_MS && windowMs <= COUNT_SAMPLE_MS * (COUNT_HIST - 1))) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "window_ms out of range";
+		return;
+	}
+
+	xSemaphoreTake(pCtrl->countMutex, portMAX_DELAY);
+	gpioCount_t*	cnt = _count_find(pCtrl, jParam, ret);
+	if (!cnt) {
+		xSemaphoreGive(pCtrl->countMutex);
+		return;
+	}
+	int64_t		nowUs = esp_timer_get_time();
+	uint64_t	total = pulseCountRead(cnt->pc);
+	int			gpio_num = cnt->gpio_num;
+
+	// Newest sample at least the window old, else the oldest kept
+	int64_t			startUs = nowUs - (int64_t)(windowMs * 1000);
+	uint32_t		kept = (cnt->histCnt < COUNT_HIST) ? cnt->histCnt : COUNT_HIST;
+	countSample_t	from = cnt->hist[(cnt->histCnt - kept) % COUNT_HIST];
+	for (uint32_t n = 1; n <= kept; n++) {
+		countSample_t*	smp = &cnt->hist[(cnt->histCnt - n) % COUNT_HIST];
+		if (smp->timeUs <= startUs) {
+			from = *smp;
+			break;
+		}
+	}
+	xSemaphoreGive(pCtrl->countMutex);
+
+	int64_t		spanUs = nowUs - from.timeUs;
+	uint64_t	count = total - from.total;
+
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	testCommJwObjectStart(jw, NULL);
+	testCommJwInt(jw, "gpio_num", gpio_num);
+	testCommJwNumber(jw, "freq_hz", (spanUs > 0) ? count * 1e6 / spanUs : 0);
+	testCommJwInt(jw, "count", count);
+	testCommJwInt(jw, "window_us", spanUs);
+	testCommJwObjectEnd(jw);
+}
+
+/**
+ * @brief Publish the end of a capture on the "gpio-capture" event topic
+ *
+ * Called from the capture task.
+ */
+static void _capture_done(void* arg)
+{
+	if (!testCommEventEnabled("gpio-capture")) {
+		return;
+	}
+
+	captureStatus_t	status;
+	captureGetStatus(&status);
+
+	cJSON* jData = cJSON_CreateObject();
+	cJSON_AddStringToObject(jData, "state", captureStateName[status.state]);
+	cJSON_AddNumberToObject(jData, "samples", status.count);
+	cJSON_AddNumberToObject(jData, "trigger", status.trigIdx);
+	cJSON_AddNumberToObject(jData, "late", status.late);
+	testCommSendEvent("gpio-capture", jData);
+}
+
+/**
+ * @brief Convert a mask of captured pins to channel bits
+ */
+static bool _capture_chans(const captureConf_t* conf, uint64_t mask, uint16_t* chans)
+{
+	*chans = 0;
+	for (int ch = 0; ch < conf->chanCount; ch++) {
+		uint64_t	bit = 1ULL << conf->pins[ch];
+		if (mask & bit) {
+			*chans |= 1U << ch;
+			mask &= ~bit;
+		}
+	}
+	return mask == 0;
+}
+
+/**
+ * @brief Read the trigger of a gpio-capture request into conf
+ */
+static bool _capture_trigger(cJSON* jTrig, captureConf_t* conf, cmdReturn_t* ret)
+{
+	conf->trigMask = conf->trigValue = conf->edgeMask = 0;
+	if (!jTrig) {
+		return true;
+	}
+
+	static const char*	types[] = {"none", "rising", "falling", "edge", "pattern"};
+	const char*	type = cJSON_GetStringValue(cJSON_GetObjectItem(jTrig, "type"));
+	int			t;
+	for (t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+		if (type && strcmp(type, types[t]) == 0) {
+			break;
+		}
+	}
+	if (t == sizeof(types) / sizeof(types[0])) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "trigger type must be none, rising, falling, edge or pattern";
+		return false;
+	}
+	if (0 == t) {
+		return true;
+	}
+
+	// Pattern, or the qualifier of an edge
+	uint64_t	mask = 0;
+	uint64_t	value = 0;
+	cJSON*		jMask = cJSON_GetObjectItem(jTrig, "mask");
+	cJSON*		jValue = cJSON_GetObjectItem(jTrig, "value");
+	if ((jMask && !_mask_value(jMask, &mask)) || (jValue && !_mask_value(jValue, &value)) || (value & ~mask)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "trigger mask and value must be pin masks, value within mask";
+		return false;
+	}
+	if (4 == t && !mask) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "pattern trigger needs a mask";
+		return false;
+	}
+
+	uint64_t	edge = 0;
+	if (t >= 1 && t <= 3) {
+		cJSON* jObj = cJSON_GetObjectItem(jTrig, "gpio_num");
+		if (!cJSON_IsNumber(jObj) || jObj->valueint < 0 || jObj->valueint >= NUM_GPIO_PINS) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "edge trigger needs gpio_num";
+			return false;
+		}
+		edge = 1ULL << jObj->valueint;
+		if (1 == t || 2 == t) {
+			// The level after the edge
+			mask |= edge;
+			value = (1 == t) ? (value | edge) : (value & ~edge);
+		}
+	}
+
+	if (!_capture_chans(conf, mask, &conf->trigMask) || !_capture_chans(conf, value, &conf->trigValue) ||
+		!_capture_chans(conf, edge, &conf->edgeMask)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "trigger pins must be captured";
+		return false;
+	}
+	return true;
+}
+
+/**
+ * /brief Sample input pins at a fixed rate, like a logic analyzer
+ *
+ * JSON parameter contents:
+ *   "gpio_nums": [<GPIO number or pin map name>, ...], 1 to 16 configured pins
+ *   "rate_hz": <samples per second, up to 500000>
+ *   "samples": <samples kept, including pre_samples>
+ *   "pre_samples": <samples kept from before the trigger, default 0>
+ *   "trigger": {"type": <"none"|"rising"|"falling"|"edge"|"pattern">,
+ *               "gpio_num": <edge pin>, "mask": <pin mask>, "value": <pin mask>}
+ *   "timeout_ms": <wait for the trigger at most this long, default 1000>
+ *
+ * Channel n of a sample is gpio_nums[n]. A pattern trigger fires on the
+ * first sample with the pins in mask at the levels in value, an edge
+ * trigger on a change of gpio_num, which may be qualified with a pattern.
+ * No trigger keeps the first samples, pre_samples is ignored. Sampling starts at once: pre-trigger
+ * samples are those kept from before the trigger, fewer if it fires early.
+ * The timeout plus the capture time may not exceed 4 s.
+ *
+ * Returns at once with {"rate_hz": <actual rate>, "width": <bytes per sample>};
+ * the end is published on the "gpio-capture" event topic and can be polled
+ * with gpio-capture-status. Only one capture runs at a time.
+ */
+static void _gpioCapture(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	captureStatus_t	status;
+	captureGetStatus(&status);
+	if (captureState_armed == status.state || captureState_triggered == status.state) {
+		ret->code = RPC_ERR_BUSY;
+		ret->mesg = "Capture running";
+		return;
+	}
+
+	captureConf_t	conf = {0};
+	cJSON*			jPins = cJSON_GetObjectItem(jParam, "gpio_nums");
+	int				chanCount = cJSON_GetArraySize(jPins);
+	if (!cJSON_IsArray(jPins) || chanCount < 1 || chanCount > CAPTURE_MAX_CHANS) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "gpio_nums must list 1 to 16 pins";
+		return;
+	}
+
+	uint64_t	pinMask = 0;
+	cJSON*		jPin;
+	cJSON_ArrayForEach(jPin, jPins) {
+		int	gpio_num = -1;
+		if (cJSON_IsString(jPin)) {
+			const pinMapName_t*	entry = _pin_find(pCtrl, jPin->valuestring, ret);
+			if (!entry) {
+				return;
+			}
+			if (entry->mask & (entry->mask - 1)) {
+				ret->code = RPC_ERR_PARAMS;
+				ret->mesg = "groups cannot be captured, name their pins";
+				return;
+			}
+			gpio_num = __builtin_ctzll(entry->mask);
+		} else if (cJSON_IsNumber(jPin)) {
+			gpio_num = jPin->valueint;
+		}
+		if (gpio_num < 0 || gpio_num >= NUM_GPIO_PINS || !pCtrl->pinCtrl[gpio_num].enabled) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "capture pins must be configured";
+			return;
+		}
+		if (pinMask & (1ULL << gpio_num)) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "pin captured more than once";
+			return;
+		}
+		pinMask |= 1ULL << gpio_num;
+		conf.pins[conf.chanCount++] = gpio_num;
+	}
+
+	double	rateHz = cJSON_GetNumberValue(cJSON_GetObjectItem(jParam, "rate_hz"));
+	double	samples = cJSON_GetNumberValue(cJSON_GetObjectItem(jParam, "samples"));
+	cJSON*	jPre = cJSON_GetObjectItem(jParam, "pre_samples");
+	double	preSamples = jPre ? cJSON_GetNumberValue(jPre) : 0;
+	cJSON*	jTimeout = cJSON_GetObjectItem(jParam, "timeout_ms");
+	double	timeoutMs = jTimeout ? cJSON_GetNumberValue(jTimeout) : CAPTURE_TIMEOUT_MS;
+	if (!(rateHz >= 1 && rateHz <= CAPTURE_RATE_MAX)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "rate_hz out of range";
+		return;
+	}
+	if (!(samples >= 1 && samples <= CAPTURE_SAMPLES_MAX) || !(preSamples >= 0 && preSamples < samples)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "samples or pre_samples out of range";
+		return;
+	}
+	if (!(timeoutMs >= 0) || timeoutMs + samples * 1000 / rateHz > CAPTURE_RUN_MAX_MS) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "timeout_ms plus capture time over 4 s";
+		return;
+	}
+	conf.rateHz = rateHz;
+	conf.samples = samples;
+	conf.preSamples = preSamples;
+	conf.timeoutMs = timeoutMs;
+
+	if (!_capture_trigger(cJSON_GetObjectItem(jParam, "trigger"), &conf, ret)) {
+		return;
+	}
+	if (!conf.trigMask && !conf.edgeMask) {
+		// Fires on the first sample
+		conf.preSamples = 0;
+	}
+
+	// Outputs are read back through their input path
+	for (int ch = 0; ch < conf.chanCount; ch++) {
+		if (pinDir_output == pCtrl->pinCtrl[conf.pins[ch]].dir) {
+			gpio_input_enable(conf.pins[ch]);
+		}
+	}
+
+	uint32_t	actualHz;
+	esp_err_t	err = captureStart(&conf, &actualHz);
+	if (ESP_ERR_INVALID_SIZE == err) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "samples do not fit the capture buffer";
+		return;
+	}
+	if (ESP_OK != err) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = (ESP_ERR_NO_MEM == err) ? "No memory for capture buffer" : "Capture not started";
+		return;
+	}
+	memcpy(pCtrl->capture.pins, conf.pins, sizeof(conf.pins));
+	pCtrl->capture.chanCount = conf.chanCount;
+
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	testCommJwObjectStart(jw, NULL);
+	testCommJwInt(jw, "rate_hz", actualHz);
+	testCommJwInt(jw, "width", (conf.chanCount > 8) ? 2 : 1);
+	testCommJwObjectEnd(jw);
+}
+
+/**
+ * /brief Report the progress of the latest capture
+ *
+ * returns JSON structure:
+ *   {"state": <"idle"|"armed"|"triggered"|"done"|"timeout"|"aborted">,
+ *    "gpio_nums": [<pin of channel n>, ...], "rate_hz": <int>, "width": <bytes per sample>,
+ *    "samples": <kept>, "trigger": <trigger sample, -1 if none>, "late": <late samples>,
+ *    "time_us": <time of the first sample>}
+ *
+ * The samples, trigger and time are set once the capture has ended. Samples
+ * kept after a timeout or abort are the latest taken, without a trigger.
+ */
+static void _gpioCaptureStatus(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	captureStatus_t	status;
+	captureGetStatus(&status);
+
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	testCommJwObjectStart(jw, NULL);
+	testCommJwString(jw, "state", captureStateName[status.state]);
+	testCommJwArrayStart(jw, "gpio_nums");
+	for (int ch = 0; ch < pCtrl->capture.chanCount; ch++) {
+		testCommJwInt(jw, NULL, pCtrl->capture.pins[ch]);
+	}
+	testCommJwArrayEnd(jw);
+	testCommJwInt(jw, "rate_hz", status.rateHz);
+	testCommJwInt(jw, "width", status.width);
+	testCommJwInt(jw, "samples", status.count);
+	testCommJwInt(jw, "trigger", status.trigIdx);
+	testCommJwInt(jw, "late", status.late);
+	testCommJwInt(jw, "time_us", status.startUs);
+	testCommJwObjectEnd(jw);
+}
+
+/**
+ * /brief Stop the capture, keeping the samples taken
+ *
+ * Returns once it has stopped, with {"state": <state it ended in>}.
+ */
+static void _gpioCaptureAbort(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	captureStatus_t	status;
+	int64_t			untilUs = esp_timer_get_time() + CAPTURE_ABORT_WAIT_MS * 1000;
+	captureAbort();
+	while (true) {
+		captureGetStatus(&status);
+		if ((captureState_armed != status.state && captureState_triggered != status.state) ||
+			esp_timer_get_time() >= untilUs) {
+			break;
+		}
+		vTaskDelay(1);
+	}
+
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	testCommJwObjectStart(jw, NULL);
+	testCommJwString(jw, "state", captureStateName[status.state]);
+	testCommJwObjectEnd(jw);
+}
+
+/**
+ * /brief Read kept samples of the latest capture
+ *
+ * JSON parameter contents:
+ *   "offset": <first sample, default 0>
+ *   "count": <samples, default and most 4096 bytes worth>
+ *
+ * returns JSON structure:
+ *   {"offset": <first sample>, "count": <samples returned>, "width": <bytes per sample>}
+ *
+ * The samples, little-endian with channel n in bit n, are the binary
+ * attachment of the response, or "data": <Base64> with ASCII framing and in
+ * batches. Fewer samples than asked may be returned; read on from
+ * offset + count until count is 0.
+ */
+static void _gpioCaptureRead(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	captureStatus_t	status;
+	captureGetStatus(&status);
+	if (captureState_armed == status.state || captureState_triggered == status.state) {
+		ret->code = RPC_ERR_BUSY;
+		ret->mesg = "Capture running";
+		return;
+	}
+
+	int		width = status.width ? status.width : 1;
+	cJSON*	jOffset = cJSON_GetObjectItem(jParam, "offset");
+	cJSON*	jCount = cJSON_GetObjectItem(jParam, "count");
+	double	offset = jOffset ? cJSON_GetNumberValue(jOffset) : 0;
+	double	count = jCount ? cJSON_GetNumberValue(jCount) : CAPTURE_CHUNK_MAX / width;
+	if (!(offset >= 0 && offset <= UINT32_MAX) || !(count >= 0)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "offset or count out of range";
+		return;
+	}
+	if (count > CAPTURE_CHUNK_MAX / width) {
+		count = CAPTURE_CHUNK_MAX / width;
+	}
+
+	const uint8_t*	data = NULL;
+	int				got = captureRead(offset, count, &data);
+
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	testCommJwObjectStart(jw, NULL);
+	testCommJwInt(jw, "offset", (uint32_t)offset);
+	testCommJwInt(jw, "count", got);
+	testCommJwInt(jw, "width", width);
+	if (got > 0 && !testCommJwAttach(jw, data, got * width)) {
+		// No attachment, the samples go in the JSON
+		size_t	b64Len;
+		mbedtls_base64_encode(NULL, 0, &b64Len, data, got * width);
+		unsigned char*	b64 = malloc(b64Len);
+		if (!b64) {
+			ret->code = RPC_ERR_INTERNAL;
+			ret->mesg = "Not enough memory";
+			return;
+		}
+		mbedtls_base64_encode(b64, b64Len, &b64Len, data, got * width);
+		testCommJwString(jw, "data", (const char*)b64);
+		free(b64);
+	}
+	testCommJwObjectEnd(jw);
+}
+
+/**
+ * @brief Drive the outputs of the trip rules an input change fires
+ *
+ * Called with the input level and the time of its edge: for raw rules from
+ * the edge interrupt or the scan, for debounced rules from the debounce task
+ * once the change is debounced, so their reaction time includes the pin's
+ * debounce time. Returns true if a rule fired; the debounce task publishes it.
+ */
+static bool _interlock_trip(ctrl_t* pCtrl, int gpio_num, bool level, bool raw, int64_t edgeUs)
+{
+	uint64_t	setMask, clrMask;
+	uint32_t	fired = 0;
+
+	portENTER_CRITICAL_SAFE(&outMux);
+	interlockTab_t*	tab = pCtrl->ilk.tab;
+	if (tab && ((raw ? tab->rawMask : tab->debMask) & (1ULL << gpio_num))) {
+		fired = interlockTrip(tab, gpio_num, level, raw, &setMask, &clrMask);
+	}
+	if (fired) {
+		_out_regs(setMask, clrMask);
+
+		uint32_t	reactUs = esp_timer_get_time() - edgeUs;
+		for (uint32_t bits = fired; bits; bits &= bits - 1) {
+			int						idx = __builtin_ctz(bits);
+			const interlockRule_t*	rule = &tab->rules[idx];
+			interlockStat_t*		stat = &pCtrl->ilk.stat[idx];
+
+			stat->trips++;
+			if (reactUs > stat->worstUs) {
+				stat->worstUs = reactUs;
+			}
+			if (rule->maxUs && reactUs > rule->maxUs) {
+				stat->late++;
+				pCtrl->ilk.pendLate |= 1UL << idx;
+			}
+			if (rule->latch) {
+				pCtrl->ilk.latched |= 1UL << idx;
+			}
+		}
+		pCtrl->ilk.pendTrip |= fired;
+		pCtrl->ilk.notify = true;
+	}
+	portEXIT_CRITICAL_SAFE(&outMux);
+
+	return fired != 0;
+}
+
+/**
+ * @brief Add an array of the rule indexes of a mask to an event
+ */
+static void _interlock_add_rules(cJSON* jData, const char* key, uint32_t rules)
+{
+	cJSON* jArr = cJSON_AddArrayToObject(jData, key);
+	for (; rules; rules &= rules - 1) {
+		cJSON_AddItemToArray(jArr, cJSON_CreateNumber(__builtin_ctz(rules)));
+	}
+}
+
+/**
+ * @brief Publish the rules that fired, were late or refused a write on the "interlock" event topic
+ */
+static void _interlock_notify(ctrl_t* pCtrl)
+{
+	portENTER_CRITICAL(&outMux);
+	uint32_t	tripped = pCtrl->ilk.pendTrip;
+	uint32_t	late = pCtrl->ilk.pendLate;
+	uint32_t	blocked = pCtrl->ilk.pendBlock;
+	uint32_t	latched = pCtrl->ilk.latched;
+	pCtrl->ilk.pendTrip = pCtrl->ilk.pendLate = pCtrl->ilk.pendBlock = 0;
+	pCtrl->ilk.notify = false;
+	portEXIT_CRITICAL(&outMux);
+
+	if (!(tripped | blocked) || !testCommEventEnabled("interlock")) {
+		return;
+	}
+
+	cJSON* jData = cJSON_CreateObject();
+	_interlock_add_rules(jData, "tripped", tripped);
+	_interlock_add_rules(jData, "late", late);
+	_interlock_add_rules(jData, "blocked", blocked);
+	_interlock_add_rules(jData, "latched", latched);
+	cJSON_AddNumberToObject(jData, "time_us", esp_timer_get_time());
+	testCommSendEvent("interlock", jData);
+}
+
+/**
+ * @brief Replace the rules, NULL for none, clearing the counters and latches
+ */
+static void _interlock_apply(ctrl_t* pCtrl, interlockTab_t* tab)
+{
+	portENTER_CRITICAL(&outMux);
+	interlockTab_t*	old = pCtrl->ilk.tab;
+	pCtrl->ilk.tab = tab;
+	pCtrl->ilk.rawMask = tab ? tab->rawMask : 0;
+	memset(pCtrl->ilk.stat, 0, sizeof(pCtrl->ilk.stat));
+	pCtrl->ilk.latched = 0;
+	pCtrl->ilk.pendTrip = pCtrl->ilk.pendLate = pCtrl->ilk.pendBlock = 0;
+	portEXIT_CRITICAL(&outMux);
+
+	free(old);
+}
+
+/**
+ * @brief Load the stored interlock rules at start up
+ */
+static void _interlock_boot(ctrl_t* pCtrl)
+{
+	interlockTab_t*	tab = malloc(sizeof(*tab));
+	if (!tab) {
+		return;
+	}
+	if (interlockLoad(tab) != ESP_OK || 0 == tab->count) {
+		free(tab);
+		return;
+	}
+	_interlock_apply(pCtrl, tab);
+}
+
+/**
+ * @brief Read a pin mask member of an interlock rule
+ */
+static bool _interlock_mask(cJSON* jRule, const char* key, uint64_t* mask, cmdReturn_t* ret)
+{
+	cJSON* jObj = cJSON_GetObjectItem(jRule, key);
+
+	*mask = 0;
+	if (jObj && !_mask_value(jObj, mask)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "rule masks must be pin masks";
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Build an interlock table from interlock-set parameters
+ */
+static bool _interlock_parse(cJSON* jParam, interlockTab_t* tab, cmdReturn_t* ret)
+{
+	interlockInit(tab);
+
+	cJSON* jRules = cJSON_GetObjectItem(jParam, "rules");
+	if (!cJSON_IsArray(jRules)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "rules array required";
+		return false;
+	}
+
+	cJSON* jRule;
+	cJSON_ArrayForEach(jRule, jRules) {
+		char*			type = cJSON_GetStringValue(cJSON_GetObjectItem(jRule, "type"));
+		interlockRule_t	rule = {0};
+
+		if (type && strcmp(type, "trip") == 0) {
+			cJSON*	jNum = cJSON_GetObjectItem(jRule, "gpio_num");
+			cJSON*	jActive = cJSON_GetObjectItem(jRule, "active");
+			cJSON*	jMax = cJSON_GetObjectItem(jRule, "max_us");
+
+			if (!cJSON_IsNumber(jNum) || jNum->valueint < 0 || jNum->valueint >= NUM_GPIO_PINS
+				|| (jActive && !cJSON_IsBool(jActive))) {
+				ret->code = RPC_ERR_PARAMS;
+				ret->mesg = "trip rules need gpio_num";
+				return false;
+			}
+			if (jMax && (!cJSON_IsNumber(jMax) || jMax->valuedouble < 0 || jMax->valuedouble > UINT32_MAX)) {
+				ret->code = RPC_ERR_PARAMS;
+				ret->mesg = "max_us must be a number of microseconds";
+				return false;
+			}
+			rule.type = interlockType_trip;
+			rule.gpio_num = jNum->valueint;
+			rule.level = !jActive || cJSON_IsTrue(jActive);
+			rule.raw = _get_flag(jRule, "raw");
+			rule.latch = _get_flag(jRule, "latch");
+			rule.maxUs = jMax ? (uint32_t)jMax->valuedouble : 0;
+			if (!_interlock_mask(jRule, "set", &rule.setMask, ret) || !_interlock_mask(jRule, "clear", &rule.clrMask, ret)) {
+				return false;
+			}
+		} else if (type && strcmp(type, "exclusive") == 0) {
+			rule.type = interlockType_exclusive;
+			if (!_interlock_mask(jRule, "mask", &rule.mask, ret) || !_interlock_mask(jRule, "high", &rule.onHigh, ret)) {
+				return false;
+			}
+			if (!cJSON_GetObjectItem(jRule, "high")) {
+				rule.onHigh = rule.mask;
+			}
+		} else {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "rule type must be trip or exclusive";
+			return false;
+		}
+
+		const char*	mesg = interlockAdd(tab, &rule);
+		if (mesg) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = mesg;
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * /brief Set the interlock rules, evaluated on the board without the host
+ *
+ * JSON parameter contents:
+ *   "rules": [{"type": "trip", "gpio_num": <input>, "active": <level that fires, default true>,
+ *              "set": <mask driven high>, "clear": <mask driven low>,
+ *              "raw": <true|false>, "latch": <true|false>, "max_us": <reaction limit>}
+ *           | {"type": "exclusive", "mask": <outputs>, "high": <those on when high, default mask>}, ...]
+ *   "save": <true|false>, default true
+ *
+ * A trip rule drives its outputs when its input changes to the given level:
+ * on the debounced change, or with "raw" on the edge itself, ahead of the
+ * debounce. Trips later than max_us after the edge are counted late. A
+ * latching rule then refuses writes moving its outputs back until
+ * interlock-reset. An exclusive rule refuses writes turning on a second
+ * output of its mask. Every output write is checked: gpio-set, gpio-set-mask,
+ * pin-set and gpio-seq writes and the initial levels of gpio-conf,
+ * gpio-conf-multi and pin-map-set, which fail with RPC_ERR_INTERLOCK.
+ * Trip inputs must be configured as inputs. Rules are numbered in the order
+ * given. Counters and latches are cleared; the stored rules are applied at
+ * every start. An empty rules array removes them.
+ */
+static void _interlockSet(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	interlockTab_t*	tab = malloc(sizeof(*tab));
+	if (!tab) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "No memory";
+		return;
+	}
+	if (!_interlock_parse(jParam, tab, ret)) {
+		free(tab);
+		return;
+	}
+
+	cJSON*		jSave = cJSON_GetObjectItem(jParam, "save");
+	bool		save = !jSave || cJSON_IsTrue(jSave);
+	esp_err_t	status = ESP_OK;
+	if (save) {
+		status = tab->count ? interlockSave(tab) : interlockErase();
+	}
+	if (0 == tab->count) {
+		free(tab);
+		tab = NULL;
+	}
+	_interlock_apply(pCtrl, tab);
+
+	if (ESP_OK != status) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "Rules applied but not stored";
+	}
+}
+
+/**
+ * /brief Return the interlock rules in the form interlock-set takes, with their counters
+ *
+ * returns JSON structure:
+ *   {"rules": [{<rule>, "trips": <count>, "late": <count>, "blocked": <writes refused>,
+ *               "worst_us": <slowest trip>, "latched": <true|false>}, ...]}
+ */
+static void _interlockGet(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	// Rules change only on this worker, the counters under outMux
+	const interlockTab_t*	tab = pCtrl->ilk.tab;
+	interlockStat_t			stat[INTERLOCK_MAX_RULES];
+	portENTER_CRITICAL(&outMux);
+	memcpy(stat, pCtrl->ilk.stat, sizeof(stat));
+	uint32_t	latched = pCtrl->ilk.latched;
+	portEXIT_CRITICAL(&outMux);
+
+	testComm_jw_t* jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	testCommJwObjectStart(jw, NULL);
+	testCommJwArrayStart(jw, "rules");
+	for (int idx = 0; tab && idx < tab->count; idx++) {
+		const interlockRule_t*	rule = &tab->rules[idx];
+
+		testCommJwObjectStart(jw, NULL);
+		if (interlockType_trip == rule->type) {
+			testCommJwString(jw, "type", "trip");
+			testCommJwInt(jw, "gpio_num", rule->gpio_num);
+			testCommJwBool(jw, "active", rule->level);
+			testCommJwInt(jw, "set", rule->setMask);
+			testCommJwInt(jw, "clear", rule->clrMask);
+			testCommJwBool(jw, "raw", rule->raw);
+			testCommJwBool(jw, "latch", rule->latch);
+			testCommJwInt(jw, "max_us", rule->maxUs);
+		} else {
+			testCommJwString(jw, "type", "exclusive");
+			testCommJwInt(jw, "mask", rule->mask);
+			testCommJwInt(jw, "high", rule->onHigh);
+		}
+		testCommJwInt(jw, "trips", stat[idx].trips);
+		testCommJwInt(jw, "late", stat[idx].late);
+		testCommJwInt(jw, "blocked", stat[idx].blocked);
+		testCommJwInt(jw, "worst_us", stat[idx].worstUs);
+		testCommJwBool(jw, "latched", (latched >> idx) & 1);
+		testCommJwObjectEnd(jw);
+	}
+	testCommJwArrayEnd(jw);
+	testCommJwObjectEnd(jw);
+}
+
+/**
+ * /brief Release latched trip rules
+ *
+ * JSON parameter contents:
+ *   "rule": <rule number>, default all rules
+ *   "clear": <true|false>, also zero the counters, default false
+ *
+ * The outputs keep their levels; the host drives them back.
+ */
+static void _interlockReset(cJSON *jParam, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t* pCtrl = (ctrl_t*)cbData;
+	if (!pCtrl || !pCtrl->isRunning) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "GPIO service not running";
+		return;
+	}
+
+	int			count = pCtrl->ilk.tab ? pCtrl->ilk.tab->count : 0;
+	uint32_t	rules = (1UL << count) - 1;
+	cJSON*		jRule = cJSON_GetObjectItem(jParam, "rule");
+	if (jRule) {
+		if (!cJSON_IsNumber(jRule) || jRule->valueint < 0 || jRule->valueint >= count) {
+			ret->code = RPC_ERR_PARAMS;
+			ret->mesg = "No such rule";
+			return;
+		}
+		rules = 1UL << jRule->valueint;
+	}
+	bool	clear = _get_flag(jParam, "clear");
+
+	portENTER_CRITICAL(&outMux);
+	pCtrl->ilk.latched &= ~rules;
+	for (int idx = 0; clear && idx < count; idx++) {
+		if (rules & (1UL << idx)) {
+			memset(&pCtrl->ilk.stat[idx], 0, sizeof(pCtrl->ilk.stat[idx]));
+		}
 	}
+	portEXIT_CRITICAL(&outMux);
 }
 
 static cmdTab_t	cmdTab[] = {
-	{"gpio-conf",    _confPin},
-	{"gpio-set",     _gpioSet},
-	{"gpio-get",     _gpioGet},
-	{"gpio-get-all", _gpioGetAll}
+	{"gpio-conf",       _confPin,        CMD_FLAG_CLASS_IO},
+	{"gpio-conf-multi", _confPinMulti,   CMD_FLAG_CLASS_IO},
+	{"gpio-set",        _gpioSet,        CMD_FLAG_CLASS_IO},
+	{"gpio-set-mask",   _gpioSetMask,    CMD_FLAG_CLASS_IO},
+	{"gpio-get",        _gpioGet,        CMD_FLAG_CLASS_IO},
+	{"gpio-get-all",    _gpioGetAll,     CMD_FLAG_CLASS_IO},
+	{"gpio-events",     _gpioEvents,     CMD_FLAG_CLASS_IO},
+	{"gpio-seq",        _gpioSeq,        CMD_FLAG_CLASS_IO},
+	{"gpio-seq-abort",  _gpioSeqAbort,   CMD_FLAG_CLASS_IO},
+	{"gpio-seq-status", _gpioSeqStatus,  CMD_FLAG_CLASS_IO},
+	{"gpio-wait",       _gpioWait,       CMD_FLAG_CLASS_IO},
+	{"pin-map-set",     _pinMapSet,      CMD_FLAG_CLASS_IO},
+	{"pin-map-get",     _pinMapGet,      CMD_FLAG_CLASS_IO},
+	{"pin-set",         _pinSet,         CMD_FLAG_CLASS_IO},
+	{"pin-get",         _pinGet,         CMD_FLAG_CLASS_IO},
+	{"gpio-count",      _gpioCount,      CMD_FLAG_CLASS_IO},
+	{"gpio-freq",       _gpioFreq,       CMD_FLAG_CLASS_IO},
+	{"gpio-capture",    _gpioCapture,    CMD_FLAG_CLASS_IO},
+	{"gpio-capture-status", _gpioCaptureStatus, CMD_FLAG_CLASS_IO},
+	{"gpio-capture-abort",  _gpioCaptureAbort,  CMD_FLAG_CLASS_IO},
+	{"gpio-capture-read",   _gpioCaptureRead,   CMD_FLAG_CLASS_IO},
+	{"interlock-set",   _interlockSet,   CMD_FLAG_CLASS_IO},
+	{"interlock-get",   _interlockGet,   CMD_FLAG_CLASS_IO},
+	{"interlock-reset", _interlockReset, CMD_FLAG_CLASS_IO}
 };
 static const int cmdTabSz = sizeof(cmdTab) / sizeof(cmdTab_t);
 
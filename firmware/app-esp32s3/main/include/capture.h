@@ -0,0 +1,71 @@
+/*
+ * capture.h
+ *
+ *  Logic analyzer: samples GPIO pins at a fixed rate into a PSRAM ring
+ */
+
+#ifndef COMPONENTS_MAIN_INCLUDE_CAPTURE_H_
+#define COMPONENTS_MAIN_INCLUDE_CAPTURE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAPTURE_MAX_CHANS	(16)		// Channels per sample, 1 byte up to 8
+#define CAPTURE_RATE_MAX	(500000)
+#define CAPTURE_RUN_MAX_MS	(4000)		// Arm timeout plus capture time, see captureStart()
+
+typedef enum {
+	captureState_idle = 0,
+	captureState_armed,			// Sampling, waiting for the trigger
+	captureState_triggered,		// Sampling the post-trigger samples
+	captureState_done,
+	captureState_timeout,		// No trigger before the timeout
+	captureState_aborted
+} captureState_t;
+
+/*
+ * Channel n of a sample is bit n, the level of pins[n]. The trigger fires on
+ * the first sample whose channels in trigMask equal trigValue and whose
+ * channels in edgeMask all differ from the previous sample. All masks 0
+ * triggers on the first sample.
+ */
+typedef struct {
+	uint8_t		pins[CAPTURE_MAX_CHANS];
+	int			chanCount;
+	uint32_t	rateHz;
+	uint32_t	samples;		// Kept in all, including preSamples
+	uint32_t	preSamples;		// Kept from before the trigger
+	uint16_t	trigMask;
+	uint16_t	trigValue;
+	uint16_t	edgeMask;
+	uint32_t	timeoutMs;		// Wait for the trigger at most this long
+} captureConf_t;
+
+typedef struct {
+	captureState_t	state;
+	uint32_t		rateHz;			// Actual rate, a whole number of CPU cycles apart
+	int				width;			// Bytes per sample
+	uint32_t		count;			// Samples kept
+	int32_t			trigIdx;		// Sample that fired the trigger, -1 if none
+	uint32_t		late;			// Samples taken over a period after their time
+	int64_t			startUs;		// esp_timer time of the first kept sample
+} captureStatus_t;
+
+typedef void (*captureDoneCb_t)(void* arg);
+
+esp_err_t captureInit(captureDoneCb_t doneCb, void* arg);
+esp_err_t captureStart(const captureConf_t* conf, uint32_t* rateHz);
+void captureAbort(void);
+void captureGetStatus(captureStatus_t* status);
+int captureRead(uint32_t offset, uint32_t count, const uint8_t** data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMPONENTS_MAIN_INCLUDE_CAPTURE_H_ */
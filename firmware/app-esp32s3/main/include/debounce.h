@@ -0,0 +1,44 @@
+/*
+ * debounce.h
+ *
+ *  Vertical-counter debounce of up to 64 inputs sampled together
+ */
+
+#ifndef COMPONENTS_MAIN_INCLUDE_DEBOUNCE_H_
+#define COMPONENTS_MAIN_INCLUDE_DEBOUNCE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEBOUNCE_CNT_BITS	(12)	// Up to 4095 samples, 4 s at a 1 ms scan
+#define DEBOUNCE_MAX_TICKS	((1U << DEBOUNCE_CNT_BITS) - 1)
+
+/*
+ * Bit n of every word is input n. Each input has a counter of consecutive
+ * samples differing from its debounced level, held bit-sliced: cnt[b] holds
+ * bit b of every counter, so one tick updates all inputs with a handful of
+ * word-wide operations. An input changes once its counter reaches its
+ * threshold, held bit-sliced the same way.
+ */
+typedef struct {
+	uint64_t	mask;						// Inputs being debounced
+	uint64_t	stable;						// Debounced levels
+	uint64_t	cnt[DEBOUNCE_CNT_BITS];
+	uint64_t	thr[DEBOUNCE_CNT_BITS];
+} debounce_t;
+
+void debounceInit(debounce_t* db);
+void debounceSetPin(debounce_t* db, int pin, uint32_t ticks);
+void debounceClearPin(debounce_t* db, int pin);
+uint32_t debounceTicks(uint32_t glitchUs, uint32_t periodUs);
+uint64_t debounceTick(debounce_t* db, uint64_t sample);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMPONENTS_MAIN_INCLUDE_DEBOUNCE_H_ */
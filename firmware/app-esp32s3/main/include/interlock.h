@@ -0,0 +1,63 @@
+/*
+ * interlock.h
+ *
+ *  Input to output interlock rules, kept in NVS
+ */
+
+#ifndef COMPONENTS_MAIN_INCLUDE_INTERLOCK_H_
+#define COMPONENTS_MAIN_INCLUDE_INTERLOCK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define INTERLOCK_MAX_RULES	(16)
+
+typedef enum {
+	interlockType_trip = 0,		// An input change drives outputs
+	interlockType_exclusive		// At most one output of a set on
+} interlockType_t;
+
+// Pins are given as masks, bit n is GPIO n
+typedef struct {
+	uint8_t		type;
+	uint8_t		gpio_num;		// Trip: input
+	bool		level;			// Trip: input level that fires the rule
+	bool		raw;			// Trip: fire on the raw edge, else on the debounced change
+	bool		latch;			// Trip: hold the outputs at their trip levels until reset
+	uint32_t	maxUs;			// Trip: reaction time limit, 0 for none
+	uint64_t	setMask;		// Trip: outputs driven high
+	uint64_t	clrMask;		// Trip: outputs driven low
+	uint64_t	mask;			// Exclusive: outputs of which at most one may be on
+	uint64_t	onHigh;			// Exclusive: outputs of mask that are on when high
+} interlockRule_t;
+
+/*
+ * Stored in NVS as is. rawMask and debMask, the inputs of raw and debounced
+ * trip rules, let an edge skip the rules when no rule watches its pin.
+ */
+typedef struct {
+	uint32_t		version;
+	uint16_t		count;
+	uint64_t		rawMask;
+	uint64_t		debMask;
+	interlockRule_t	rules[INTERLOCK_MAX_RULES];
+} interlockTab_t;
+
+void interlockInit(interlockTab_t* tab);
+const char* interlockAdd(interlockTab_t* tab, const interlockRule_t* rule);
+uint32_t interlockTrip(const interlockTab_t* tab, int gpio_num, bool level, bool raw, uint64_t* setMask, uint64_t* clrMask);
+int interlockCheck(const interlockTab_t* tab, uint32_t latched, uint64_t outLevels, uint64_t setMask, uint64_t clrMask);
+esp_err_t interlockLoad(interlockTab_t* tab);
+esp_err_t interlockSave(const interlockTab_t* tab);
+esp_err_t interlockErase(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMPONENTS_MAIN_INCLUDE_INTERLOCK_H_ */
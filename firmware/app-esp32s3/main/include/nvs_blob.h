@@ -0,0 +1,25 @@
+/*
+ * nvs_blob.h
+ *
+ *  Fixed-size structures kept in NVS as one blob each
+ */
+
+#ifndef COMPONENTS_MAIN_INCLUDE_NVS_BLOB_H_
+#define COMPONENTS_MAIN_INCLUDE_NVS_BLOB_H_
+
+#include <stddef.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t nvsBlobLoad(const char* ns, const char* key, void* blob, size_t size);
+esp_err_t nvsBlobSave(const char* ns, const char* key, const void* blob, size_t size);
+esp_err_t nvsBlobErase(const char* ns, const char* key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMPONENTS_MAIN_INCLUDE_NVS_BLOB_H_ */
@@ -0,0 +1,67 @@
+/*
+ * pin_map.h
+ *
+ *  Named pins and pin groups, kept in NVS
+ */
+
+#ifndef COMPONENTS_MAIN_INCLUDE_PIN_MAP_H_
+#define COMPONENTS_MAIN_INCLUDE_PIN_MAP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIN_MAP_NAME_LEN	(16)	// Including the terminator
+#define PIN_MAP_MAX_PINS	(48)
+#define PIN_MAP_MAX_GROUPS	(16)
+#define PIN_MAP_MAX_NAMES	(PIN_MAP_MAX_PINS + PIN_MAP_MAX_GROUPS)
+
+typedef struct {
+	uint8_t		gpio_num;
+	bool		isOut;
+	bool		activeHi;
+	bool		pullUp;
+	bool		pullDown;
+	uint32_t	glitchUs;
+} pinMapPin_t;
+
+// A pin or group name and its pins, one bit per GPIO
+typedef struct {
+	char		name[PIN_MAP_NAME_LEN];
+	uint64_t	mask;
+} pinMapName_t;
+
+/*
+ * names[] holds the pins, matching pins[], then the groups, in the order
+ * given; sorted[] indexes them by name for pinMapFind(). Stored in NVS as
+ * is, so a map loaded at boot is ready to use.
+ */
+typedef struct {
+	uint32_t		version;
+	uint16_t		pinCount;
+	uint16_t		nameCount;
+	uint64_t		outMask;				// Output pins
+	uint64_t		invMask;				// Active-low pins
+	pinMapPin_t		pins[PIN_MAP_MAX_PINS];
+	pinMapName_t	names[PIN_MAP_MAX_NAMES];
+	uint8_t			sorted[PIN_MAP_MAX_NAMES];
+} pinMap_t;
+
+void pinMapInit(pinMap_t* map);
+const char* pinMapAddPin(pinMap_t* map, const char* name, const pinMapPin_t* pin);
+const char* pinMapAddGroup(pinMap_t* map, const char* name, uint64_t mask);
+void pinMapSort(pinMap_t* map);
+const pinMapName_t* pinMapFind(const pinMap_t* map, const char* name);
+esp_err_t pinMapLoad(pinMap_t* map);
+esp_err_t pinMapSave(const pinMap_t* map);
+esp_err_t pinMapErase(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMPONENTS_MAIN_INCLUDE_PIN_MAP_H_ */
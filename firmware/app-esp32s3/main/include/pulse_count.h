@@ -0,0 +1,36 @@
+/*
+ * pulse_count.h
+ *
+ *  Rising-edge counters on GPIO pins, extended to 64 bits
+ */
+
+#ifndef COMPONENTS_MAIN_INCLUDE_PULSE_COUNT_H_
+#define COMPONENTS_MAIN_INCLUDE_PULSE_COUNT_H_
+
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PULSE_COUNT_MAX		(4)			// PCNT units on the ESP32-S3
+#define PULSE_COUNT_LIMIT	(32767)		// Hardware count at which a unit restarts
+#define PULSE_FILTER_MAX_NS	(12000)		// Longest glitch the PCNT filter removes
+
+typedef struct pulseCount_s pulseCount_t;
+
+esp_err_t pulseCountOpen(int gpio_num, uint32_t filterNs, pulseCount_t** pc);
+void pulseCountClose(pulseCount_t* pc);
+uint64_t pulseCountRead(pulseCount_t* pc);
+#if CONFIG_GPIO_COUNT_SIM
+void pulseCountSimRate(pulseCount_t* pc, double hz);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMPONENTS_MAIN_INCLUDE_PULSE_COUNT_H_ */
@@ -0,0 +1,153 @@
+/*
+ * interlock.c
+ *
+ *  Input to output interlock rules, kept in NVS as one blob. Trip rules
+ *  say which outputs an input change drives, exclusive rules which output
+ *  writes to refuse. Pure functions of the table and the levels given, no
+ *  hardware access, so they can run in the edge interrupt.
+ */
+#include <string.h>
+
+#include "esp_err.h"
+
+#include "interlock.h"
+#include "nvs_blob.h"
+
+#define INTERLOCK_VERSION	(1)		// Change with the layout of interlockTab_t
+#define INTERLOCK_NUM_PINS	(49)
+
+static const char* ilk_ns = "interlock";
+static const char* ilk_key = "rules";
+
+void interlockInit(interlockTab_t* tab)
+{
+	memset(tab, 0, sizeof(*tab));
+	tab->version = INTERLOCK_VERSION;
+}
+
+/**
+ * @brief Check and add a rule, return an error message or NULL
+ */
+const char* interlockAdd(interlockTab_t* tab, const interlockRule_t* rule)
+{
+	uint64_t	allMask = (1ULL << INTERLOCK_NUM_PINS) - 1;
+
+	if (tab->count >= INTERLOCK_MAX_RULES) {
+		return "too many rules";
+	}
+
+	if (interlockType_trip == rule->type) {
+		uint64_t	outMask = rule->setMask | rule->clrMask;
+
+		if (rule->gpio_num >= INTERLOCK_NUM_PINS) {
+			return "invalid trip input";
+		}
+		if (!outMask || (outMask & ~allMask) || (rule->setMask & rule->clrMask)) {
+			return "trip needs set and clear masks of distinct pins";
+		}
+		if (outMask & (1ULL << rule->gpio_num)) {
+			return "trip input is also an output";
+		}
+		if (rule->raw) {
+			tab->rawMask |= 1ULL << rule->gpio_num;
+		} else {
+			tab->debMask |= 1ULL << rule->gpio_num;
+		}
+	} else if (interlockType_exclusive == rule->type) {
+		if (__builtin_popcountll(rule->mask) < 2 || (rule->mask & ~allMask) || (rule->onHigh & ~rule->mask)) {
+			return "exclusive needs a mask of 2 or more pins";
+		}
+	} else {
+		return "invalid rule type";
+	}
+
+	tab->rules[tab->count++] = *rule;
+	return NULL;
+}
+
+/**
+ * @brief Find the trip rules an input change fires, return them as a mask of rule indexes
+ *
+ * The outputs to drive high and low are returned in setMask and clrMask;
+ * a pin both rules drive high and others drive low is driven low.
+ */
+uint32_t interlockTrip(const interlockTab_t* tab, int gpio_num, bool level, bool raw, uint64_t* setMask, uint64_t* clrMask)
+{
+	uint32_t	fired = 0;
+
+	*setMask = *clrMask = 0;
+	for (int idx = 0; idx < tab->count; idx++) {
+		const interlockRule_t*	rule = &tab->rules[idx];
+
+		if (interlockType_trip == rule->type && rule->gpio_num == gpio_num && rule->level == level && rule->raw == raw) {
+			*setMask |= rule->setMask;
+			*clrMask |= rule->clrMask;
+			fired |= 1UL << idx;
+		}
+	}
+	*setMask &= ~*clrMask;
+	return fired;
+}
+
+/**
+ * @brief Outputs of an exclusive rule that are on at the given levels
+ */
+static uint64_t _exclusive_on(const interlockRule_t* rule, uint64_t levels)
+{
+	return ((levels & rule->onHigh) | (~levels & ~rule->onHigh)) & rule->mask;
+}
+
+/**
+ * @brief Check an output write, return the index of the rule it breaks or -1
+ *
+ * outLevels are the levels driven before the write. A latched trip rule
+ * refuses writes moving its outputs off their trip levels. An exclusive rule
+ * refuses writes turning on one of its outputs while another is on; writes
+ * turning outputs off are always allowed.
+ */
+int interlockCheck(const interlockTab_t* tab, uint32_t latched, uint64_t outLevels, uint64_t setMask, uint64_t clrMask)
+{
+	uint64_t	newLevels = (outLevels | setMask) & ~clrMask;
+
+	for (int idx = 0; idx < tab->count; idx++) {
+		const interlockRule_t*	rule = &tab->rules[idx];
+
+		if (interlockType_trip == rule->type) {
+			if ((latched & (1UL << idx)) && ((setMask & rule->clrMask) || (clrMask & rule->setMask))) {
+				return idx;
+			}
+		} else {
+			uint64_t	on = _exclusive_on(rule, newLevels);
+			if (__builtin_popcountll(on) > 1 && (on & ~_exclusive_on(rule, outLevels))) {
+				return idx;
+			}
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Load the stored rules, ESP_ERR_NOT_FOUND if there are none
+ */
+esp_err_t interlockLoad(interlockTab_t* tab)
+{
+	esp_err_t	status = nvsBlobLoad(ilk_ns, ilk_key, tab, sizeof(*tab));
+
+	if (ESP_OK == status && (tab->version != INTERLOCK_VERSION || tab->count > INTERLOCK_MAX_RULES)) {
+		status = ESP_ERR_NOT_FOUND;
+	}
+	if (ESP_OK != status) {
+		interlockInit(tab);
+	}
+	return status;
+}
+
+esp_err_t interlockSave(const interlockTab_t* tab)
+{
+	return nvsBlobSave(ilk_ns, ilk_key, tab, sizeof(*tab));
+}
+
+esp_err_t interlockErase(void)
+{
+	return nvsBlobErase(ilk_ns, ilk_key);
+}
@@ -7,6 +7,7 @@
 
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "driver/gpio.h"
@@ -38,7 +39,11 @@ static testComm_conf_t tcConf = {
 #endif
 	},
 	.rxBufSz = 2048,
-	.taskPriority = 8,
+	.rxQueueDepth = 6,
+	.msgBufSz = 30000,
+	.msgBufCaps = MALLOC_CAP_SPIRAM,
+	.taskPriority = 9,
+	.cmdTaskPriority = 8,
 	.cmdProc = cmdProcMesg
 };
 
@@ -57,8 +62,20 @@ void app_main(void)
 	ESP_ERROR_CHECK(esp_netif_init());
 
     // Initialize command processor before test components
-	cmdConf_t cpConf;
-	cpConf.fwVersion = fwVersion;
+	cmdConf_t cpConf = {
+		.fwVersion = fwVersion,
+		.arenaSz = 16384,
+		.arenaCaps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+		.jobTaskPriority = 3,
+		// GPIO/relay ahead of NVS/config ahead of Wi-Fi/HTTP. No worker is
+		// pinned: a gpio-capture holds core 1 for up to CAPTURE_RUN_MAX_MS,
+		// and a worker pinned there would get no CPU until it ends.
+		.classConf = {
+			[cmdClass_io]		= {.priority = 7, .core = CMD_CORE_ANY, .queueDepth = 4},
+			[cmdClass_config]	= {.priority = 6, .core = CMD_CORE_ANY, .queueDepth = 2},
+			[cmdClass_net]		= {.priority = 4, .core = CMD_CORE_ANY, .queueDepth = 2}
+		}
+	};
     ESP_ERROR_CHECK(cmdProcInit(&cpConf));
 	ESP_ERROR_CHECK(testCommInit(&tcConf));
 
@@ -0,0 +1,79 @@
+/*
+ * nvs_blob.c
+ *
+ *  Load, save and erase a fixed-size structure kept in NVS as one blob.
+ *  The callers check the version and contents of what is loaded.
+ */
+#include "esp_err.h"
+#include "nvs.h"
+
+#include "nvs_blob.h"
+
+/**
+ * @brief Load a blob of exactly size bytes, ESP_ERR_NOT_FOUND if there is none
+ *
+ * A blob of another size, stored by firmware with another layout, counts
+ * as none.
+ */
+esp_err_t nvsBlobLoad(const char* ns, const char* key, void* blob, size_t size)
+{
+	nvs_handle_t	handle;
+	esp_err_t		status;
+	size_t			len = size;
+
+	status = nvs_open(ns, NVS_READONLY, &handle);
+	if (ESP_ERR_NVS_NOT_FOUND == status) {
+		return ESP_ERR_NOT_FOUND;
+	}
+	if (ESP_OK != status) {
+		return status;
+	}
+
+	status = nvs_get_blob(handle, key, blob, &len);
+	nvs_close(handle);
+	if (ESP_ERR_NVS_NOT_FOUND == status || ESP_ERR_NVS_INVALID_LENGTH == status) {
+		return ESP_ERR_NOT_FOUND;
+	}
+	if (ESP_OK != status) {
+		return status;
+	}
+	return (len == size) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t nvsBlobSave(const char* ns, const char* key, const void* blob, size_t size)
+{
+	nvs_handle_t	handle;
+	esp_err_t		status;
+
+	if ((status = nvs_open(ns, NVS_READWRITE, &handle)) != ESP_OK) {
+		return status;
+	}
+	status = nvs_set_blob(handle, key, blob, size);
+	if (ESP_OK == status) {
+		status = nvs_commit(handle);
+	}
+	nvs_close(handle);
+	return status;
+}
+
+/**
+ * @brief Erase a blob, ESP_OK if there is none
+ */
+esp_err_t nvsBlobErase(const char* ns, const char* key)
+{
+	nvs_handle_t	handle;
+	esp_err_t		status;
+
+	if ((status = nvs_open(ns, NVS_READWRITE, &handle)) != ESP_OK) {
+		return status;
+	}
+	status = nvs_erase_key(handle, key);
+	if (ESP_ERR_NVS_NOT_FOUND == status) {
+		status = ESP_OK;
+	}
+	if (ESP_OK == status) {
+		status = nvs_commit(handle);
+	}
+	nvs_close(handle);
+	return status;
+}
@@ -0,0 +1,163 @@
+/*
+ * pin_map.c
+ *
+ *  Named pins and pin groups, kept in NVS as one blob. Lookups are a
+ *  binary search of the sorted names, no hardware access.
+ */
+#include <string.h>
+
+#include "esp_err.h"
+
+#include "pin_map.h"
+#include "nvs_blob.h"
+
+#define PIN_MAP_VERSION		(1)		// Change with the layout of pinMap_t
+
+static const char* map_ns = "pinmap";
+static const char* map_key = "map";
+
+void pinMapInit(pinMap_t* map)
+{
+	memset(map, 0, sizeof(*map));
+	map->version = PIN_MAP_VERSION;
+}
+
+/**
+ * @brief Check a new name, return an error message or NULL
+ */
+static const char* _check_name(const pinMap_t* map, const char* name)
+{
+	size_t	len = strlen(name);
+
+	if (len == 0 || len >= PIN_MAP_NAME_LEN) {
+		return "name must be 1 to 15 characters";
+	}
+	for (int idx = 0; idx < map->nameCount; idx++) {
+		if (strcmp(map->names[idx].name, name) == 0) {
+			return "name used more than once";
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Add a named pin, return an error message or NULL
+ *
+ * All pins are added before the first group.
+ */
+const char* pinMapAddPin(pinMap_t* map, const char* name, const pinMapPin_t* pin)
+{
+	const char*	mesg;
+	uint64_t	bit = 1ULL << pin->gpio_num;
+
+	if (map->nameCount != map->pinCount || map->pinCount >= PIN_MAP_MAX_PINS) {
+		return "too many pins";
+	}
+	if ((mesg = _check_name(map, name)) != NULL) {
+		return mesg;
+	}
+	for (int idx = 0; idx < map->pinCount; idx++) {
+		if (map->names[idx].mask & bit) {
+			return "pin mapped more than once";
+		}
+	}
+
+	map->pins[map->pinCount++] = *pin;
+	strcpy(map->names[map->nameCount].name, name);
+	map->names[map->nameCount++].mask = bit;
+	if (pin->isOut) {
+		map->outMask |= bit;
+	}
+	if (!pin->activeHi) {
+		map->invMask |= bit;
+	}
+	return NULL;
+}
+
+/**
+ * @brief Add a named group of mapped pins, return an error message or NULL
+ */
+const char* pinMapAddGroup(pinMap_t* map, const char* name, uint64_t mask)
+{
+	const char*	mesg;
+
+	if (map->nameCount >= PIN_MAP_MAX_NAMES || map->nameCount - map->pinCount >= PIN_MAP_MAX_GROUPS) {
+		return "too many groups";
+	}
+	if ((mesg = _check_name(map, name)) != NULL) {
+		return mesg;
+	}
+
+	strcpy(map->names[map->nameCount].name, name);
+	map->names[map->nameCount++].mask = mask;
+	return NULL;
+}
+
+/**
+ * @brief Index the names for pinMapFind(), once all are added
+ */
+void pinMapSort(pinMap_t* map)
+{
+	// Insertion sort, a few dozen names at most
+	for (int idx = 0; idx < map->nameCount; idx++) {
+		int	pos = idx;
+
+		while (pos > 0 && strcmp(map->names[map->sorted[pos - 1]].name, map->names[idx].name) > 0) {
+			map->sorted[pos] = map->sorted[pos - 1];
+			pos--;
+		}
+		map->sorted[pos] = idx;
+	}
+}
+
+/**
+ * @brief Look up a pin or group by name, NULL if not mapped
+ */
+const pinMapName_t* pinMapFind(const pinMap_t* map, const char* name)
+{
+	int	lo = 0;
+	int	hi = map->nameCount - 1;
+
+	while (lo <= hi) {
+		int					mid = (lo + hi) / 2;
+		const pinMapName_t*	entry = &map->names[map->sorted[mid]];
+		int					cmp = strcmp(name, entry->name);
+
+		if (cmp == 0) {
+			return entry;
+		}
+		if (cmp < 0) {
+			hi = mid - 1;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Load the stored map, ESP_ERR_NOT_FOUND if there is none
+ */
+esp_err_t pinMapLoad(pinMap_t* map)
+{
+	esp_err_t	status = nvsBlobLoad(map_ns, map_key, map, sizeof(*map));
+
+	if (ESP_OK == status && (map->version != PIN_MAP_VERSION ||
+		map->pinCount > PIN_MAP_MAX_PINS || map->nameCount > PIN_MAP_MAX_NAMES || map->nameCount < map->pinCount)) {
+		status = ESP_ERR_NOT_FOUND;
+	}
+	if (ESP_OK != status) {
+		pinMapInit(map);
+	}
+	return status;
+}
+
+esp_err_t pinMapSave(const pinMap_t* map)
+{
+	return nvsBlobSave(map_ns, map_key, map, sizeof(*map));
+}
+
+esp_err_t pinMapErase(void)
+{
+	return nvsBlobErase(map_ns, map_key);
+}
@@ -0,0 +1,183 @@
+/*
+ * pulse_count.c
+ *
+ *  Rising-edge counters on GPIO pins. Each uses a PCNT unit, whose 16-bit
+ *  count is extended to 64 bits by counting the times it reaches its limit.
+ *  With GPIO_COUNT_SIM set the counts are instead made up from esp_timer
+ *  time at a rate set per counter, to exercise the count methods without
+ *  a signal source.
+ */
+#include <stdlib.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#if !CONFIG_GPIO_COUNT_SIM
+#include "driver/pulse_cnt.h"
+#endif
+
+#include "pulse_count.h"
+
+#if CONFIG_GPIO_COUNT_SIM
+
+struct pulseCount_s {
+	double		hz;
+	int64_t		startUs;	// Time hz was set
+	uint64_t	base;		// Count when hz was set
+};
+
+esp_err_t pulseCountOpen(int gpio_num, uint32_t filterNs, pulseCount_t** pc)
+{
+	pulseCount_t*	p = calloc(1, sizeof(*p));
+	if (!p) {
+		return ESP_ERR_NO_MEM;
+	}
+	p->startUs = esp_timer_get_time();
+	*pc = p;
+	return ESP_OK;
+}
+
+void pulseCountClose(pulseCount_t* pc)
+{
+	free(pc);
+}
+
+uint64_t pulseCountRead(pulseCount_t* pc)
+{
+	return pc->base + (uint64_t)((esp_timer_get_time() - pc->startUs) * pc->hz / 1000000);
+}
+
+/**
+ * @brief Set the rate of a simulated counter, counts so far are kept
+ */
+void pulseCountSimRate(pulseCount_t* pc, double hz)
+{
+	pc->base = pulseCountRead(pc);
+	pc->startUs = esp_timer_get_time();
+	pc->hz = (hz > 0) ? hz : 0;
+}
+
+#else
+
+struct pulseCount_s {
+	pcnt_unit_handle_t		unit;
+	pcnt_channel_handle_t	chan;
+	volatile uint32_t		wraps;	// Times the unit reached PULSE_COUNT_LIMIT
+	uint64_t				last;	// Last total read
+};
+
+/**
+ * @brief Unit reached its limit and restarted from 0
+ */
+static bool _on_reach(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t* edata, void* userCtx)
+{
+	pulseCount_t*	pc = (pulseCount_t*)userCtx;
+
+	if (PULSE_COUNT_LIMIT == edata->watch_point_value) {
+		pc->wraps++;
+	}
+	return false;
+}
+
+/**
+ * @brief Count the rising edges of a pin on a free PCNT unit
+ *
+ * filterNs drops pulses shorter than it, 0 for no filter.
+ */
+esp_err_t pulseCountOpen(int gpio_num, uint32_t filterNs, pulseCount_t** pc)
+{
+	esp_err_t		status;
+	pulseCount_t*	p = calloc(1, sizeof(*p));
+	if (!p) {
+		return ESP_ERR_NO_MEM;
+	}
+
+	pcnt_unit_config_t	unitCfg = {
+		.low_limit = -1,
+		.high_limit = PULSE_COUNT_LIMIT
+	};
+	if ((status = pcnt_new_unit(&unitCfg, &p->unit)) != ESP_OK) {
+		free(p);
+		return status;
+	}
+
+	if (filterNs) {
+		pcnt_glitch_filter_config_t	filterCfg = {
+			.max_glitch_ns = filterNs
+		};
+		if ((status = pcnt_unit_set_glitch_filter(p->unit, &filterCfg)) != ESP_OK) {
+			goto openFail;
+		}
+	}
+
+	pcnt_chan_config_t	chanCfg = {
+		.edge_gpio_num = gpio_num,
+		.level_gpio_num = -1
+	};
+	if ((status = pcnt_new_channel(p->unit, &chanCfg, &p->chan)) != ESP_OK) {
+		goto openFail;
+	}
+	pcnt_channel_set_edge_action(p->chan, PCNT_CHANNEL_EDGE_ACTION_INCREASE, PCNT_CHANNEL_EDGE_ACTION_HOLD);
+
+	pcnt_event_callbacks_t	cbs = {
+		.on_reach = _on_reach
+	};
+	if ((status = pcnt_unit_add_watch_point(p->unit, PULSE_COUNT_LIMIT)) != ESP_OK ||
+		(status = pcnt_unit_register_event_callbacks(p->unit, &cbs, p)) != ESP_OK ||
+		(status = pcnt_unit_enable(p->unit)) != ESP_OK) {
+		goto openFail;
+	}
+	pcnt_unit_clear_count(p->unit);
+	if ((status = pcnt_unit_start(p->unit)) != ESP_OK) {
+		pcnt_unit_disable(p->unit);
+		goto openFail;
+	}
+
+	*pc = p;
+	return ESP_OK;
+
+openFail:
+	if (p->chan) {
+		pcnt_del_channel(p->chan);
+	}
+	pcnt_del_unit(p->unit);
+	free(p);
+	return status;
+}
+
+void pulseCountClose(pulseCount_t* pc)
+{
+	pcnt_unit_stop(pc->unit);
+	pcnt_unit_disable(pc->unit);
+	pcnt_del_channel(pc->chan);
+	pcnt_unit_remove_watch_point(pc->unit, PULSE_COUNT_LIMIT);
+	pcnt_del_unit(pc->unit);
+	free(pc);
+}
+
+/**
+ * @brief Total rising edges since the counter was opened
+ *
+ * Callers of one counter must not overlap.
+ */
+uint64_t pulseCountRead(pulseCount_t* pc)
+{
+	uint32_t	wraps;
+	int			raw;
+
+	do {
+		wraps = pc->wraps;
+		pcnt_unit_get_count(pc->unit, &raw);
+	} while (wraps != pc->wraps);
+
+	// The unit restarts from 0 before its limit interrupt has run: a count
+	// below the last one read is missing that wrap
+	uint64_t	total = (uint64_t)wraps * PULSE_COUNT_LIMIT + raw;
+	if (total < pc->last) {
+		total += PULSE_COUNT_LIMIT;
+	}
+	pc->last = total;
+	return total;
+}
+
+#endif
@@ -5,12 +5,39 @@
  *      Author: wesd
  */
 
-const char* fwVersion = "1.2.0";
+const char* fwVersion = "1.3.0";
 
 /*
 ********************************************************************************
 Release notes
 
+v1.3.0
+- Add negotiable binary message framing (set-framing) with raw attachments
+- Add optional request IDs in message headers and queue received commands to a command task
+- Add batch command to run an array of commands in one request
+- Event-driven UART receive with EOT pattern detection, Kconfig buffer sizes, comm-stats
+- Build responses in pooled TX frames sent by a dedicated TX task
+- Receive messages straight into pooled PSRAM buffers with a running CRC
+- Add EVT frames for gpio, wifi and http events with topic subscription (evt-subscribe)
+- Dispatch all methods, built-ins included, through a lock-free hash table (CMD_PROC_MAX_METHODS)
+- Allocate request JSON from a per-request arena, add mem-stats
+- Stream gpio-get, gpio-get-all and wifi-scan results straight into the response frame
+- Run wifi-scan and HTTP requests as async jobs (job-status, job-result, job-cancel)
+- Schedule commands by class (io, config, net) on per-class workers, per-class latency in comm-stats
+- Add perf-stats and perf-reset: per-method handler timing and frame byte/error counters
+- Add gpio-set-mask to switch several outputs together through the W1TS/W1TC registers
+- Add gpio-conf-multi to configure many pins in one request, accept bool pull_up_en/pull_down_en
+- Debounce inputs from edge interrupts and an esp_timer deadline instead of a 10 ms scan, gpio events carry time_us
+- Add optional vertical-counter scan debouncer (GPIO_DEBOUNCE_SCAN) sampling GPIO_IN/IN1 every tick
+- Record debounced input changes in a numbered ring, add gpio-events to read them since a sequence number
+- Add gpio-seq output sequencer (gpio-seq-abort, gpio-seq-status, "gpio-seq" end event) timed by esp_timer
+- Add gpio-wait, answered by the debounce task when an input level or edge is met (deferred replies in cmd_proc)
+- Per-pin input debounce time in gpio-conf and gpio-conf-multi ("glitch_us"/"glitch_ms"), 0 to bypass the filter
+- Store named pins and groups in NVS, configure them at start (pin-map-set, pin-map-get), set and read them by name (pin-set, pin-get)
+- Add gpio-conf "count" mode on PCNT units with 64-bit totals, read with gpio-count and gpio-freq (GPIO_COUNT_SIM for simulated counters)
+- Add gpio-capture logic analyzer sampling up to 16 pins at up to 500 kHz into a PSRAM ring, with edge/pattern triggers and pre-trigger samples, read as binary response attachments (gpio-capture-read)
+- Add interlock rules run by the GPIO engine: trip rules drive outputs on raw or debounced input edges within a checked reaction time, exclusive rules refuse writes turning on two outputs of a set, optionally stored in NVS (interlock-set/get/reset)
+
 v1.2.0
 - Remove IOX (IO Expander) support. Not used in this application
 
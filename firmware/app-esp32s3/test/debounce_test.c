@@ -0,0 +1,143 @@
+/*
+ * debounce_test.c
+ *
+ *  Host test and benchmark of the vertical-counter debouncer. Checks
+ *  debounceTick() against a per-pin reference model over random sample
+ *  streams, then measures ticks per second. Build and run with make.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "debounce.h"
+
+#define NUM_PINS		(49)
+#define ALL_PINS		((1ULL << NUM_PINS) - 1)
+#define UNUSED_PIN		(13)		// Never set up, must stay low
+#define CHECK_TICKS		(2000000L)
+#define BENCH_TICKS		(50000000L)
+
+// Reference model of one input: counts samples differing from its level
+typedef struct {
+	uint32_t	ticks;
+	uint32_t	cnt;
+	int			level;
+} refPin_t;
+
+static int testTicks(void)
+{
+	int	fail = 0;
+
+	struct {
+		uint32_t	glitchUs;
+		uint32_t	periodUs;
+		uint32_t	ticks;
+	} cases[] = {
+		{0, 1000, 1},
+		{1, 1000, 1},
+		{5000, 1000, 5},
+		{5001, 1000, 6},
+		{10000000, 1000, DEBOUNCE_MAX_TICKS},
+	};
+	for (int i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++) {
+		uint32_t	ticks = debounceTicks(cases[i].glitchUs, cases[i].periodUs);
+		if (ticks != cases[i].ticks) {
+			printf("FAIL debounceTicks(%u, %u) = %u, expected %u\n",
+				cases[i].glitchUs, cases[i].periodUs, ticks, cases[i].ticks);
+			fail++;
+		}
+	}
+	return fail;
+}
+
+static int testModel(void)
+{
+	debounce_t	db;
+	refPin_t	ref[NUM_PINS] = {0};
+	uint64_t	in = 0;
+	long		mismatch = 0;
+	long		changes = 0;
+
+	srand(1);
+	debounceInit(&db);
+	for (int pin = 0; pin < NUM_PINS; pin++) {
+		uint32_t	ticks = (pin % 7 == 0) ? 0 : rand() % 5000;	// Out of range ones are clamped
+		ref[pin].ticks = (ticks < 1) ? 1 : (ticks > DEBOUNCE_MAX_TICKS) ? DEBOUNCE_MAX_TICKS : ticks;
+		if (pin != UNUSED_PIN) {
+			debounceSetPin(&db, pin, ticks);
+		}
+	}
+
+	for (long t = 0; t < CHECK_TICKS; t++) {
+		// Mostly single pin toggles, now and then every pin at once
+		if (rand() % 4 == 0) {
+			in ^= 1ULL << (rand() % NUM_PINS);
+		}
+		if (t % 50000 == 0) {
+			in = (((uint64_t)rand() << 32) | rand()) & ALL_PINS;
+		}
+
+		uint64_t	changed = debounceTick(&db, in);
+		for (int pin = 0; pin < NUM_PINS; pin++) {
+			if (pin == UNUSED_PIN) {
+				continue;
+			}
+			refPin_t*	r = &ref[pin];
+			int			level = (in >> pin) & 1;
+			int			change = 0;
+
+			if (level == r->level) {
+				r->cnt = 0;
+			} else if (++r->cnt >= r->ticks) {
+				r->level = level;
+				r->cnt = 0;
+				change = 1;
+			}
+			if (change != (int)((changed >> pin) & 1) || r->level != (int)((db.stable >> pin) & 1)) {
+				mismatch++;
+			}
+			changes += change;
+		}
+		if ((db.stable >> UNUSED_PIN) & 1) {
+			mismatch++;
+		}
+	}
+
+	printf("model: %ld ticks, %ld changes, %ld mismatches\n", CHECK_TICKS, changes, mismatch);
+	return mismatch ? 1 : 0;
+}
+
+static void bench(void)
+{
+	debounce_t			db;
+	struct timespec		start, end;
+	volatile uint64_t	sink = 0;
+	uint64_t			x = 0x123456789ULL;
+
+	debounceInit(&db);
+	for (int pin = 0; pin < NUM_PINS; pin++) {
+		debounceSetPin(&db, pin, 1 + pin * 40);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long t = 0; t < BENCH_TICKS; t++) {
+		// Noisy inputs half the time, settled the other half
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		sink ^= debounceTick(&db, (t & 1023) < 512 ? x & ALL_PINS : db.stable);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double	sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("bench: %.1f M ticks/s, %.1f ns per tick of %d inputs\n", BENCH_TICKS / sec / 1e6, sec / BENCH_TICKS * 1e9, NUM_PINS);
+}
+
+int main(void)
+{
+	int	fail = testTicks() + testModel();
+
+	bench();
+	printf("%s\n", fail ? "FAILED" : "PASSED");
+	return fail ? 1 : 0;
+}
@@ -0,0 +1,210 @@
+/*
+ * interlock_test.c
+ *
+ *  Host test of the interlock rule checks: exclusive rules of mixed
+ *  polarity, latched trip rules, and the outputs several trip rules drive
+ *  together. NVS is replaced by one blob in memory. Build and run with make.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "interlock.h"
+#include "nvs_blob.h"
+
+#define BIT(n)		(1ULL << (n))
+
+static int	fail = 0;
+
+#define CHECK(cond)	do { if (!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); fail++; } } while (0)
+
+// The stored blob, as nvs_blob.c would keep it
+static uint8_t	store[sizeof(interlockTab_t)];
+static size_t	storeLen = 0;
+
+esp_err_t nvsBlobLoad(const char* ns, const char* key, void* blob, size_t size)
+{
+	(void)ns;
+	(void)key;
+	if (storeLen != size) {
+		return ESP_ERR_NOT_FOUND;
+	}
+	memcpy(blob, store, size);
+	return ESP_OK;
+}
+
+esp_err_t nvsBlobSave(const char* ns, const char* key, const void* blob, size_t size)
+{
+	(void)ns;
+	(void)key;
+	memcpy(store, blob, size);
+	storeLen = size;
+	return ESP_OK;
+}
+
+esp_err_t nvsBlobErase(const char* ns, const char* key)
+{
+	(void)ns;
+	(void)key;
+	storeLen = 0;
+	return ESP_OK;
+}
+
+static void testAdd(void)
+{
+	interlockTab_t	tab;
+	interlockRule_t	rule;
+
+	interlockInit(&tab);
+
+	rule = (interlockRule_t){.type = interlockType_trip, .gpio_num = 5, .level = true, .setMask = BIT(5) | BIT(20)};
+	CHECK(interlockAdd(&tab, &rule) != NULL);		// Input is also an output
+	rule = (interlockRule_t){.type = interlockType_trip, .gpio_num = 5, .level = true, .setMask = BIT(20), .clrMask = BIT(20)};
+	CHECK(interlockAdd(&tab, &rule) != NULL);		// Pin both set and cleared
+	rule = (interlockRule_t){.type = interlockType_trip, .gpio_num = 49, .level = true, .setMask = BIT(20)};
+	CHECK(interlockAdd(&tab, &rule) != NULL);		// No such input
+	rule = (interlockRule_t){.type = interlockType_exclusive, .mask = BIT(2)};
+	CHECK(interlockAdd(&tab, &rule) != NULL);		// One output
+	rule = (interlockRule_t){.type = interlockType_exclusive, .mask = BIT(2) | BIT(3), .onHigh = BIT(4)};
+	CHECK(interlockAdd(&tab, &rule) != NULL);		// onHigh outside the mask
+	CHECK(0 == tab.count);
+
+	rule = (interlockRule_t){.type = interlockType_trip, .gpio_num = 5, .level = true, .raw = true, .setMask = BIT(20)};
+	CHECK(interlockAdd(&tab, &rule) == NULL);
+	rule.gpio_num = 6;
+	rule.raw = false;
+	CHECK(interlockAdd(&tab, &rule) == NULL);
+	CHECK(BIT(5) == tab.rawMask && BIT(6) == tab.debMask);
+
+	while (tab.count < INTERLOCK_MAX_RULES) {
+		CHECK(interlockAdd(&tab, &rule) == NULL);
+	}
+	CHECK(interlockAdd(&tab, &rule) != NULL);		// Table full
+}
+
+static void testExclusive(void)
+{
+	interlockTab_t	tab;
+	interlockInit(&tab);
+
+	// Pins 2 and 3 are on when high, pin 4 when low
+	interlockRule_t	rule = {.type = interlockType_exclusive, .mask = BIT(2) | BIT(3) | BIT(4), .onHigh = BIT(2) | BIT(3)};
+	CHECK(interlockAdd(&tab, &rule) == NULL);
+
+	uint64_t	allOff = BIT(4);
+	uint64_t	twoOn = BIT(2);				// Pin 2 on
+
+	CHECK(-1 == interlockCheck(&tab, 0, allOff, BIT(2), 0));
+	CHECK(-1 == interlockCheck(&tab, 0, allOff, 0, BIT(4)));
+	CHECK(0 == interlockCheck(&tab, 0, allOff, BIT(2) | BIT(3), 0));
+	CHECK(0 == interlockCheck(&tab, 0, allOff, BIT(2), BIT(4)));
+	CHECK(0 == interlockCheck(&tab, 0, twoOn | BIT(4), BIT(3), 0));
+	CHECK(0 == interlockCheck(&tab, 0, twoOn | BIT(4), 0, BIT(4)));
+
+	// Switching over in one write leaves one on
+	CHECK(-1 == interlockCheck(&tab, 0, twoOn | BIT(4), BIT(3), BIT(2)));
+	CHECK(-1 == interlockCheck(&tab, 0, twoOn | BIT(4), 0, BIT(2) | BIT(4)));
+
+	// Pins outside the rule are free
+	CHECK(-1 == interlockCheck(&tab, 0, twoOn | BIT(4), BIT(5), 0));
+
+	// With two already on, writes turning outputs off or leaving them are allowed
+	uint64_t	bothOn = BIT(2);			// Pins 2 and 4 on
+	CHECK(-1 == interlockCheck(&tab, 0, bothOn, 0, BIT(2)));
+	CHECK(-1 == interlockCheck(&tab, 0, bothOn, BIT(4), 0));
+	CHECK(-1 == interlockCheck(&tab, 0, bothOn, BIT(2), 0));
+	CHECK(0 == interlockCheck(&tab, 0, bothOn, BIT(3), BIT(2)));
+}
+
+static void testLatch(void)
+{
+	interlockTab_t	tab;
+	interlockInit(&tab);
+
+	interlockRule_t	excl = {.type = interlockType_exclusive, .mask = BIT(30) | BIT(31), .onHigh = BIT(30) | BIT(31)};
+	interlockRule_t	trip = {.type = interlockType_trip, .gpio_num = 10, .level = true, .latch = true,
+		.setMask = BIT(20), .clrMask = BIT(21)};
+	CHECK(interlockAdd(&tab, &excl) == NULL);
+	CHECK(interlockAdd(&tab, &trip) == NULL);
+
+	uint32_t	latched = 1UL << 1;
+	uint64_t	tripped = BIT(20);			// Pin 20 high, pin 21 low
+
+	CHECK(1 == interlockCheck(&tab, latched, tripped, 0, BIT(20)));
+	CHECK(1 == interlockCheck(&tab, latched, tripped, BIT(21), 0));
+	CHECK(1 == interlockCheck(&tab, latched, tripped, BIT(21) | BIT(22), 0));
+	CHECK(-1 == interlockCheck(&tab, latched, tripped, BIT(20), BIT(21)));
+	CHECK(-1 == interlockCheck(&tab, latched, tripped, BIT(22), BIT(23)));
+
+	// Until reset, and only while latched
+	CHECK(-1 == interlockCheck(&tab, 0, tripped, BIT(21), BIT(20)));
+}
+
+static void testTrip(void)
+{
+	interlockTab_t	tab;
+	interlockInit(&tab);
+
+	interlockRule_t	rules[] = {
+		{.type = interlockType_trip, .gpio_num = 5, .level = true, .setMask = BIT(20) | BIT(21)},
+		{.type = interlockType_trip, .gpio_num = 5, .level = true, .setMask = BIT(22), .clrMask = BIT(21)},
+		{.type = interlockType_trip, .gpio_num = 5, .level = false, .setMask = BIT(23)},
+		{.type = interlockType_trip, .gpio_num = 5, .level = true, .raw = true, .clrMask = BIT(24)},
+		{.type = interlockType_trip, .gpio_num = 6, .level = true, .setMask = BIT(25)},
+	};
+	for (int i = 0; i < (int)(sizeof(rules) / sizeof(rules[0])); i++) {
+		CHECK(interlockAdd(&tab, &rules[i]) == NULL);
+	}
+
+	uint64_t	setMask, clrMask;
+	uint32_t	fired;
+
+	// A pin one rule drives high and another low goes low
+	fired = interlockTrip(&tab, 5, true, false, &setMask, &clrMask);
+	CHECK(0x03 == fired);
+	CHECK((BIT(20) | BIT(22)) == setMask && BIT(21) == clrMask);
+
+	fired = interlockTrip(&tab, 5, false, false, &setMask, &clrMask);
+	CHECK(0x04 == fired && BIT(23) == setMask && 0 == clrMask);
+
+	fired = interlockTrip(&tab, 5, true, true, &setMask, &clrMask);
+	CHECK(0x08 == fired && 0 == setMask && BIT(24) == clrMask);
+
+	fired = interlockTrip(&tab, 7, true, false, &setMask, &clrMask);
+	CHECK(0 == fired && 0 == setMask && 0 == clrMask);
+}
+
+static void testStore(void)
+{
+	interlockTab_t	tab, loaded;
+	interlockRule_t	rule = {.type = interlockType_exclusive, .mask = BIT(2) | BIT(3), .onHigh = BIT(2) | BIT(3)};
+
+	CHECK(ESP_ERR_NOT_FOUND == interlockLoad(&loaded));
+
+	interlockInit(&tab);
+	CHECK(interlockAdd(&tab, &rule) == NULL);
+	CHECK(ESP_OK == interlockSave(&tab));
+	CHECK(ESP_OK == interlockLoad(&loaded) && 1 == loaded.count);
+	CHECK(0 == memcmp(&tab, &loaded, sizeof(tab)));
+
+	// Another layout, or a corrupt count, is ignored
+	((interlockTab_t*)store)->version++;
+	CHECK(ESP_ERR_NOT_FOUND == interlockLoad(&loaded) && 0 == loaded.count);
+	((interlockTab_t*)store)->version--;
+	((interlockTab_t*)store)->count = INTERLOCK_MAX_RULES + 1;
+	CHECK(ESP_ERR_NOT_FOUND == interlockLoad(&loaded) && 0 == loaded.count);
+
+	CHECK(ESP_OK == interlockErase());
+	CHECK(ESP_ERR_NOT_FOUND == interlockLoad(&loaded));
+}
+
+int main(void)
+{
+	testAdd();
+	testExclusive();
+	testLatch();
+	testTrip();
+	testStore();
+
+	printf("interlock: %s\n", fail ? "FAILED" : "PASSED");
+	return fail ? 1 : 0;
+}
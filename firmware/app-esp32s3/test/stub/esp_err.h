@@ -0,0 +1,16 @@
+/*
+ * esp_err.h
+ *
+ *  Host stand-in for the ESP-IDF error codes used by the tested modules
+ */
+
+#ifndef TEST_STUB_ESP_ERR_H_
+#define TEST_STUB_ESP_ERR_H_
+
+typedef int esp_err_t;
+
+#define ESP_OK				(0)
+#define ESP_FAIL			(-1)
+#define ESP_ERR_NOT_FOUND	(0x105)
+
+#endif /* TEST_STUB_ESP_ERR_H_ */
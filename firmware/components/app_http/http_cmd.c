@@ -12,15 +12,18 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
 #include <cJSON.h>
 #include <mbedtls/base64.h>
 
 #include "cmd_proc.h"
+#include "test_comm.h"
 #include "tf_http.h"
 #include "http_cmd.h"
 
 typedef struct {
 	tfHttpCmdConf_t	conf;
+	SemaphoreHandle_t	mutex;	// Methods may run on the command task and on job workers
 	char			*rxBuf;
 } ctrl_t;
 
@@ -37,18 +40,40 @@ static bool _enterApi(void *cbData, cmdReturn_t *ret, ctrl_t **ppCtrl)
 	return true;
 }
 
-static void _postBin(cJSON *jParams, cmdReturn_t *ret, void *cbData)
+/**
+ * @brief Publish the outcome of an HTTP transaction on the "http" event topic
+ */
+static void _pubDone(const char *method, esp_err_t status, int hStatus)
 {
-	ctrl_t *pCtrl;
-	if (!_enterApi(cbData, ret, &pCtrl)) {
+	if (!testCommEventEnabled("http")) {
 		return;
 	}
 
-	char *url = cJSON_GetStringValue(cJSON_GetObjectItem(jParams, "url"));
-	if (!url) {
-		ret->code = RPC_ERR_PARAMS;
-		ret->mesg = "'url' missing";
-		return;
+	cJSON *jData = cJSON_CreateObject();
+	cJSON_AddStringToObject(jData, "method", method);
+	if (ESP_OK == status) {
+		cJSON_AddNumberToObject(jData, "status_code", hStatus);
+	} else {
+		cJSON_AddStringToObject(jData, "error", esp_err_to_name(status));
+	}
+	testCommSendEvent("http", jData);
+}
+
+/**
+ * @brief Get the binary payload of a request
+ *
+ * A raw attachment (binary framing) is used as-is. Otherwise the payload is
+ * expected as Base64 in the "data" parameter and is decoded into a buffer
+ * returned in decBuf, which the caller must free.
+ */
+static bool _getBinData(cJSON *jParams, cmdReturn_t *ret, const char **data, size_t *len, char **decBuf)
+{
+	*decBuf = NULL;
+
+	if (ret->reqBin.data) {
+		*data = (const char *)ret->reqBin.data;
+		*len = ret->reqBin.len;
+		return true;
 	}
 
 	// Expecting Base64-encoded binary data
@@ -56,7 +81,7 @@ static void _postBin(cJSON *jParams, cmdReturn_t *ret, void *cbData)
 	if (!src) {
 		ret->code = RPC_ERR_PARAMS;
 		ret->mesg = "'data' missing";
-		return;
+		return false;
 	}
 
 	size_t	srcLen = strlen(src);
@@ -68,7 +93,7 @@ static void _postBin(cJSON *jParams, cmdReturn_t *ret, void *cbData)
 	if (MBEDTLS_ERR_BASE64_INVALID_CHARACTER == sts) {
 		ret->code = RPC_ERR_PARAMS;
 		ret->mesg = "'data' not proper Base64";
-		return;
+		return false;
 	}
 
 	// Allocate buffer to hold decoded data
@@ -76,13 +101,40 @@ static void _postBin(cJSON *jParams, cmdReturn_t *ret, void *cbData)
 	if (!outBuf) {
 		ret->code = RPC_ERR_INTERNAL;
 		ret->mesg = "Not enough memory";
-		return;
+		return false;
 	}
 
 	// Decode
 	size_t	outLen;
 	mbedtls_base64_decode((unsigned char *)outBuf, outSz, &outLen, (unsigned char*)src, srcLen);
 
+	*data = outBuf;
+	*len = outLen;
+	*decBuf = outBuf;
+	return true;
+}
+
+static void _postBin(cJSON *jParams, cmdReturn_t *ret, void *cbData)
+{
+	ctrl_t *pCtrl;
+	if (!_enterApi(cbData, ret, &pCtrl)) {
+		return;
+	}
+
+	char *url = cJSON_GetStringValue(cJSON_GetObjectItem(jParams, "url"));
+	if (!url) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "'url' missing";
+		return;
+	}
+
+	const char	*outBuf;
+	size_t		outLen;
+	char		*decBuf;
+	if (!_getBinData(jParams, ret, &outBuf, &outLen, &decBuf)) {
+		return;
+	}
+
 	// Get optional millisecond timeout, default = 20,000
 	int tout;
 	cJSON*	jObj = cJSON_GetObjectItem(jParams, "timeout_ms");
@@ -124,7 +176,7 @@ static void _postBin(cJSON *jParams, cmdReturn_t *ret, void *cbData)
 		.hdrCt = hdrCt,
 		.hdr = hdrs,
 		.dataLen = outLen,
-		.data = outBuf,
+		.data = (char *)outBuf,
 		.rxBuf = pCtrl->rxBuf,
 		.rxLen = pCtrl->conf.rxBufSz - 1,
 		.timeoutMs = tout
@@ -132,6 +184,7 @@ static void _postBin(cJSON *jParams, cmdReturn_t *ret, void *cbData)
 
 	esp_err_t	status;
 	status = tfHttpPost(&args);
+	_pubDone("http-post-bin", status, args.hStatus);
 
 	// Release the headers memory
 	if (hdrs) {
@@ -139,7 +192,9 @@ static void _postBin(cJSON *jParams, cmdReturn_t *ret, void *cbData)
 	}
 
 	// Release the decoded data buffer
-	free(outBuf);
+	if (decBuf) {
+		free(decBuf);
+	}
 
 	// Check post status
 	if (ESP_OK != status) {
@@ -230,6 +285,7 @@ static void _post(cJSON *jParams, cmdReturn_t *ret, void *cbData)
 
 	esp_err_t	status;
 	status = tfHttpPost(&args);
+	_pubDone("http-post", status, args.hStatus);
 
 	// Done with the headers memory
 	if (hdrs) {
@@ -304,6 +360,7 @@ static void _get(cJSON *jParams, cmdReturn_t *ret, void *cbData)
 
 	esp_err_t	status;
 	status = tfHttpGet(&args);
+	_pubDone("http-get", status, args.hStatus);
 
 	if (hdrs) {
 		free(hdrs);
@@ -400,41 +457,18 @@ static void _wrBin(cJSON *jParams, cmdReturn_t *ret, void *cbData)
 		return;
 	}
 
-	// Expecting Base64-encoded binary data
-	char *src = cJSON_GetStringValue(cJSON_GetObjectItem(jParams, "data"));
-	if (!src) {
-		ret->code = RPC_ERR_PARAMS;
-		ret->mesg = "'data' missing";
+	const char	*outBuf;
+	size_t		outLen;
+	char		*decBuf;
+	if (!_getBinData(jParams, ret, &outBuf, &outLen, &decBuf)) {
 		return;
 	}
 
-	size_t	srcLen = strlen(src);
-	size_t	outSz;
-
-	// Determine size of buffer required to hold decoded binary
-	int sts;
-	sts = mbedtls_base64_decode(NULL, 0, &outSz, (unsigned char*)src, srcLen);
-	if (MBEDTLS_ERR_BASE64_INVALID_CHARACTER == sts) {
-		ret->code = RPC_ERR_PARAMS;
-		ret->mesg = "'data' not proper Base64";
-		return;
-	}
-
-	// Allocate buffer to hold decoded data
-	char *outBuf = malloc(outSz);
-	if (!outBuf) {
-		ret->code = RPC_ERR_INTERNAL;
-		ret->mesg = "Not enough memory";
-		return;
-	}
-
-	// Decode
-	size_t	outLen;
-	mbedtls_base64_decode((unsigned char *)outBuf, outSz, &outLen, (unsigned char*)src, srcLen);
-
 	esp_err_t status;
 	status = tfHttpWrite(outBuf, outLen);
-	free(outBuf);
+	if (decBuf) {
+		free(decBuf);
+	}
 
 	if (status != ESP_OK) {
 		ret->code = RPC_ERR_INTERNAL;
@@ -456,6 +490,7 @@ static void _wrFinish(cJSON *jParams, cmdReturn_t *ret, void *cbData)
 	int			hStatus;
 
 	status = tfHttpWriteFinish(&respLen, &hStatus);
+	_pubDone("http-write-fin", status, hStatus);
 	if (status != ESP_OK) {
 		ret->code = RPC_ERR_INTERNAL;
 		ret->mesg = "HTTP finish failed";
@@ -479,17 +514,34 @@ static void _wrFinish(cJSON *jParams, cmdReturn_t *ret, void *cbData)
 	}
 }
 
+// Requests that wait on the remote end run as async jobs
 static cmdTab_t	cmdTab[] = {
-	{"http-post-bin",	_postBin},
-	{"http-post",		_post},
-	{"http-get",		_get},
-	{"http-open",		_open},
-	{"http-close",		_close},
-	{"http-write-bin",	_wrBin},
-	{"http-write-fin",	_wrFinish},
+	{"http-post-bin",	_postBin,	CMD_FLAG_CLASS_NET | CMD_FLAG_ASYNC},
+	{"http-post",		_post,		CMD_FLAG_CLASS_NET | CMD_FLAG_ASYNC},
+	{"http-get",		_get,		CMD_FLAG_CLASS_NET | CMD_FLAG_ASYNC},
+	{"http-open",		_open,		CMD_FLAG_CLASS_NET},
+	{"http-close",		_close,		CMD_FLAG_CLASS_NET},
+	{"http-write-bin",	_wrBin,		CMD_FLAG_CLASS_NET},
+	{"http-write-fin",	_wrFinish,	CMD_FLAG_CLASS_NET | CMD_FLAG_ASYNC},
 };
 static const int cmdTabSz = sizeof(cmdTab) / sizeof(cmdTab_t);
 
+/**
+ * @brief Run a method with the HTTP client to itself
+ *
+ * There is one client and one receive buffer, shared by the methods running
+ * on the command task and those running as jobs.
+ */
+static void _serialize(cJSON *jParams, cmdReturn_t *ret, void *cbData)
+{
+	cmdTab_t	*item = cbData;
+	ctrl_t		*pCtrl = ctrl;
+
+	xSemaphoreTake(pCtrl->mutex, portMAX_DELAY);
+	item->func(jParams, ret, pCtrl);
+	xSemaphoreGive(pCtrl->mutex);
+}
+
 esp_err_t httpCmdRegisterMethods(tfHttpCmdConf_t *conf)
 {
 	ctrl_t *pCtrl = ctrl;
@@ -509,15 +561,20 @@ esp_err_t httpCmdRegisterMethods(tfHttpCmdConf_t *conf)
 	pCtrl->conf = *conf;
 
 	pCtrl->rxBuf = malloc(pCtrl->conf.rxBufSz);
-	if (!pCtrl->rxBuf) {
+	pCtrl->mutex = xSemaphoreCreateMutex();
+	if (!pCtrl->rxBuf || !pCtrl->mutex) {
 		return ESP_ERR_NO_MEM;
 	}
+	ctrl = pCtrl;
 
 	esp_err_t	status;
-	if ((status = cmdFuncTabRegister(cmdTab, cmdTabSz, pCtrl)) != ESP_OK) {
-		return status;
+	int			i;
+	for (i = 0; i < cmdTabSz; i++) {
+		status = cmdFuncRegisterFlags(cmdTab[i].method, _serialize, cmdTab[i].flags, (void *)&cmdTab[i]);
+		if (ESP_OK != status) {
+			return status;
+		}
 	}
 
-	ctrl = pCtrl;
 	return ESP_OK;
 }
@@ -53,17 +53,22 @@ static void _scan(cJSON *jParams, cmdReturn_t *ret, void *cbData)
 
 	wifiApSort(apList, &apCount);
 
-	ret->jResult = cJSON_CreateArray();
+	// Written straight into the response, no cJSON tree
+	testComm_jw_t	*jw = cmdResultStream(ret);
+	if (!jw) {
+		wifiApRelease(apList);
+		return;
+	}
+	testCommJwArrayStart(jw, NULL);
 	int i;
 	for (i = 0; i < apCount; i++) {
-		cJSON	*jObj = cJSON_CreateObject();
-
-		cJSON_AddStringToObject(jObj, "ssid", (char *)apList[i].ssid);
-		cJSON_AddNumberToObject(jObj, "chan", apList[i].primary);
-		cJSON_AddNumberToObject(jObj, "rssi", apList[i].rssi);
-
-		cJSON_AddItemToArray(ret->jResult, jObj);
+		testCommJwObjectStart(jw, NULL);
+		testCommJwString(jw, "ssid", (char *)apList[i].ssid);
+		testCommJwInt(jw, "chan", apList[i].primary);
+		testCommJwInt(jw, "rssi", apList[i].rssi);
+		testCommJwObjectEnd(jw);
 	}
+	testCommJwArrayEnd(jw);
 	wifiApRelease(apList);
 }
 
@@ -130,10 +135,10 @@ static void _status(cJSON *jParams, cmdReturn_t *ret, void *cbData)
 }
 
 static cmdTab_t	cmdTab[] = {
-	{"wifi-scan",		_scan},
-	{"wifi-connect",	_connect},
-	{"wifi-disconnect",	_disconnect},
-	{"wifi-status",		_status},
+	{"wifi-scan",		_scan,			CMD_FLAG_CLASS_NET | CMD_FLAG_ASYNC},
+	{"wifi-connect",	_connect,		CMD_FLAG_CLASS_NET},
+	{"wifi-disconnect",	_disconnect,	CMD_FLAG_CLASS_NET},
+	{"wifi-status",		_status,		CMD_FLAG_CLASS_NET},
 };
 static const int cmdTabSz = sizeof(cmdTab) / sizeof(cmdTab_t);
 
@@ -14,7 +14,9 @@
 #include "esp_log.h"
 #include "esp_netif.h"
 #include "esp_wifi.h"
+#include "cJSON.h"
 
+#include "test_comm.h"
 #include "wifi_ctrl.h"
 
 //static const char *TAG = "wifi_ctrl";
@@ -28,6 +30,23 @@ typedef struct {
 
 static wifiCtrl_t *wifiCtrl;
 
+/**
+ * @brief Publish a station state change on the "wifi" event topic
+ */
+static void wifiPublish(wifiCtrl_t *pCtrl, const char *event)
+{
+	if (!testCommEventEnabled("wifi")) {
+		return;
+	}
+
+	cJSON *jData = cJSON_CreateObject();
+	cJSON_AddStringToObject(jData, "event", event);
+	if (pCtrl->status.sta.ipAssigned) {
+		cJSON_AddStringToObject(jData, "ip_addr", pCtrl->status.sta.ipAddr);
+	}
+	testCommSendEvent("wifi", jData);
+}
+
 static void wifiEvtHandler(
 	void *				evtArg,
 	esp_event_base_t	evtBase,
@@ -48,12 +67,14 @@ static void wifiEvtHandler(
 	case WIFI_EVENT_STA_CONNECTED:
 		pCtrl->status.sta.connected = true;
 		//printf("wifi connected\n");
+		wifiPublish(pCtrl, "connected");
 		break;
 
 	case WIFI_EVENT_STA_DISCONNECTED:
 		//printf("wifi disconnected\n");
 		pCtrl->status.sta.connected = false;
 		pCtrl->status.sta.ipAssigned = false;
+		wifiPublish(pCtrl, "disconnected");
 		break;
 
 	default:
@@ -84,10 +105,12 @@ static void ipEvtHandler(
 		sprintf(pCtrl->status.sta.gwAddr, IPSTR, IP2STR(&evtGotIp->ip_info.gw));
 		sprintf(pCtrl->status.sta.ipMask, IPSTR, IP2STR(&evtGotIp->ip_info.netmask));
 		pCtrl->status.sta.ipAssigned = true;
+		wifiPublish(pCtrl, "got_ip");
 		break;
 
 	case IP_EVENT_STA_LOST_IP:
 		pCtrl->status.sta.ipAssigned = false;
+		wifiPublish(pCtrl, "lost_ip");
 		break;
 
 	default:
@@ -6,16 +6,20 @@
  */
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "sdkconfig.h"
 #include "freertos/freeRTOS.h"
 #include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_timer.h"
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_chip_info.h"
+#include "esp_heap_caps.h"
 #include "cJSON.h"
 
 #include "cmd_proc.h"
@@ -26,30 +30,209 @@ static const char* TAG = "cmd_proc";
 #define MUTEX_GET(ctrl)	xSemaphoreTake(ctrl->mutex, 0xFFFFFFFF)
 #define MUTEX_PUT(ctrl)	xSemaphoreGive(ctrl->mutex)
 
-typedef struct cmdTabItem_s {
-	struct cmdTabItem_s	*next;
-	const char			*method;
-	cmdFunc_t			func;
-	void				*cbData;
-} cmdListItem_t;
+#define PERF_HIST_BUCKETS	(20)
 
+/*
+ * Always-on handler timing of one method. Histogram bucket n counts handler
+ * times of 2^n to 2^(n+1)-1 us; bucket 0 also counts 0 us and the last bucket
+ * everything longer.
+ */
+typedef struct {
+	uint32_t	calls;
+	uint32_t	errors;			// Handler returned an error code
+	uint32_t	minUs;
+	uint32_t	maxUs;
+	uint64_t	sumUs;
+	uint32_t	hist[PERF_HIST_BUCKETS];
+} cmdPerf_t;
+
+/*
+ * Methods are kept in an open-addressing hash table keyed by the FNV-1a hash
+ * of the method name. Entries are only ever added, and an entry is published
+ * by storing its method pointer last, so lookups run without the mutex. The
+ * mutex serializes registrations.
+ */
 typedef struct {
-	cmdListItem_t	*head;
-	cmdListItem_t	*tail;
-} cmdList_t;
+	const char	*method;
+	uint32_t	hash;
+	cmdFunc_t	func;
+	uint32_t	flags;
+	void		*cbData;
+	cmdPerf_t	*perf;
+} cmdEntry_t;
 
 //#define HTTP_RX_SIZE	(8000)
 
+#define ARENA_SZ_DEFAULT	(16384)
+#define ARENA_ALIGN			(8)
+
+/*
+ * Bump allocator for the cJSON objects of one request: the parsed request,
+ * the result and the response built from it. cJSON allocations made by the
+ * task processing a request come from its arena, and the whole arena is
+ * released at once after the response is sent. Anything that does not fit
+ * falls back to the heap. Other tasks are unaffected.
+ */
+typedef struct {
+	uint8_t		*base;
+	size_t		size;
+	size_t		top;			// Next free offset
+	size_t		last;			// Offset of the most recent allocation
+	size_t		hwm;			// High-water mark of top
+	uint32_t	requests;
+	uint32_t	overflows;		// Allocations that fell back to the heap
+} cmdArena_t;
+
+#define JOB_TASK_PRIORITY_DEFAULT	(5)
+
+#define CLASS_QUEUE_DEPTH_DEFAULT	(2)
+#define METHOD_PEEK_SZ				(48)
+
+/*
+ * Requests are sorted by class as they arrive: each class has its own queue
+ * and worker task, so a slow Wi-Fi or HTTP request never holds up GPIO and
+ * relay operations behind it. Each worker processes its requests in its own
+ * arena.
+ */
+typedef struct {
+	cmdClass_t		id;
+	QueueHandle_t	queue;		// const testComm_mesg_t*
+	cmdArena_t		arena;
+	uint32_t		rejected;	// Requests refused with the queue full
+} cmdClassCtrl_t;
+
+static const char* const className[cmdClass_max] = {
+	[cmdClass_io]		= "io",
+	[cmdClass_config]	= "config",
+	[cmdClass_net]		= "net",
+};
+
+static const cmdClassConf_t	classConfDefault[cmdClass_max] = {
+	[cmdClass_io]		= {.priority = 7, .core = CMD_CORE_ANY, .queueDepth = 4},
+	[cmdClass_config]	= {.priority = 6, .core = CMD_CORE_ANY, .queueDepth = CLASS_QUEUE_DEPTH_DEFAULT},
+	[cmdClass_net]		= {.priority = 4, .core = CMD_CORE_ANY, .queueDepth = CLASS_QUEUE_DEPTH_DEFAULT},
+};
+
+typedef enum {
+	jobState_free = 0,
+	jobState_queued,
+	jobState_running,
+	jobState_done,
+	jobState_failed,
+	jobState_cancelled,
+} jobState_t;
+
+/*
+ * A command flagged CMD_FLAG_ASYNC runs on a worker task. The job keeps its
+ * own heap copies of the parameters and attachment, and holds the outcome
+ * until the host collects it with job-result.
+ */
+typedef struct {
+	uint16_t			id;			// 0 while the slot is free
+	jobState_t			state;
+	bool				cancel;		// Discard the outcome of a running job
+	const cmdEntry_t	*entry;
+	cJSON				*jParams;
+	uint8_t				*bin;
+	int					binLen;
+	cJSON				*jResult;
+	int					code;
+	const char			*mesg;
+	int64_t				queuedUs;
+	int64_t				startUs;
+	int64_t				endUs;
+} cmdJob_t;
+
 typedef struct {
 	cmdConf_t			conf;
 	SemaphoreHandle_t	mutex;
-	cmdList_t			cmdList;
+	cmdEntry_t			*cmdTab;
+	uint32_t			cmdTabMask;
+	int					cmdCount;
+	cmdPerf_t			*perfTab;		// One per registered method
+	SemaphoreHandle_t	perfMutex;
+	cmdClassCtrl_t		cls[cmdClass_max];
+	struct {
+		SemaphoreHandle_t	mutex;
+		SemaphoreHandle_t	ready;		// Given when a job is queued
+		cmdJob_t			tab[CONFIG_CMD_PROC_JOB_MAX];
+		uint16_t			lastId;
+	} job;
 } cmdCtrl_t;
 
-static void cmdProc(cmdRequest_t* req, cmdReturn_t* ret);
+static void cmdProc(cmdRequest_t* req, cmdReturn_t* ret, bool allowAsync);
+static void streamToResult(cmdReturn_t* ret);
+static void jobSubmit(cmdCtrl_t* pCtrl, const cmdEntry_t* entry, cmdRequest_t* req, cmdReturn_t* ret);
+static void jobTask(void* param);
+static void classTask(void* param);
+static uint32_t methodHash(const char* method);
+static void perfRecord(cmdCtrl_t* pCtrl, const cmdEntry_t* entry, int64_t startUs, bool failed);
+static cmdEntry_t* findCmdEntry(cmdCtrl_t* pCtrl, const char* method, uint32_t hash);
+
+static esp_err_t builtinRegister(cmdCtrl_t* pCtrl);
 
 static cmdCtrl_t	*cmdCtrl;
 
+// Arena of the request being processed by this task, NULL when none
+static __thread cmdArena_t	*curArena;
+
+// Class of the worker this task is, -1 on any other task
+static __thread int			curClass = -1;
+
+static void* arenaMalloc(size_t sz)
+{
+	cmdArena_t*	arena = curArena;
+
+	if (arena) {
+		size_t	off = (arena->top + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+		if (sz > 0 && off + sz <= arena->size) {
+			arena->last = off;
+			arena->top = off + sz;
+			if (arena->top > arena->hwm) {
+				arena->hwm = arena->top;
+			}
+			return arena->base + off;
+		}
+		arena->overflows++;
+	}
+	return malloc(sz);
+}
+
+static void arenaFree(void* ptr)
+{
+	uint8_t*	p = ptr;
+
+	for (int i = 0; i < cmdClass_max; i++) {
+		cmdArena_t*	arena = &cmdCtrl->cls[i].arena;
+
+		if (p >= arena->base && p < arena->base + arena->size) {
+			// Released with the arena, but give back the latest allocation so
+			// temporary print buffers can be reused
+			if (arena == curArena && p == arena->base + arena->last) {
+				arena->top = arena->last;
+			}
+			return;
+		}
+	}
+	free(ptr);
+}
+
+static void arenaBegin(cmdArena_t* arena)
+{
+	if (arena->base) {
+		arena->top = 0;
+		arena->last = 0;
+		arena->requests++;
+		curArena = arena;
+	}
+}
+
+static void arenaEnd(void)
+{
+	curArena = NULL;
+}
+
 esp_err_t cmdProcInit(cmdConf_t* conf)
 {
 	cmdCtrl_t	*pCtrl = cmdCtrl;
@@ -62,18 +245,132 @@ esp_err_t cmdProcInit(cmdConf_t* conf)
 		return ESP_ERR_NO_MEM;
 	}
 	pCtrl->conf = *conf;
+	if (pCtrl->conf.arenaSz <= 0) {
+		pCtrl->conf.arenaSz = ARENA_SZ_DEFAULT;
+	}
 
+	// Keep the table at most half full so probe sequences stay short
+	uint32_t	tabSz = 1;
+	while (tabSz < 2 * CONFIG_CMD_PROC_MAX_METHODS) {
+		tabSz <<= 1;
+	}
+	pCtrl->cmdTab = calloc(tabSz, sizeof(cmdEntry_t));
+	pCtrl->perfTab = calloc(CONFIG_CMD_PROC_MAX_METHODS, sizeof(cmdPerf_t));
 	pCtrl->mutex = xSemaphoreCreateMutex();
+	pCtrl->perfMutex = xSemaphoreCreateMutex();
+	if (!pCtrl->cmdTab || !pCtrl->perfTab || !pCtrl->mutex || !pCtrl->perfMutex) {
+		if (pCtrl->mutex) {
+			vSemaphoreDelete(pCtrl->mutex);
+		}
+		if (pCtrl->perfMutex) {
+			vSemaphoreDelete(pCtrl->perfMutex);
+		}
+		free(pCtrl->cmdTab);
+		free(pCtrl->perfTab);
+		free(pCtrl);
+		return ESP_ERR_NO_MEM;
+	}
+	pCtrl->cmdTabMask = tabSz - 1;
+
+	for (int i = 0; i < cmdClass_max; i++) {
+		cmdClassCtrl_t*	cls = &pCtrl->cls[i];
+		cmdClassConf_t*	clsConf = &pCtrl->conf.classConf[i];
+
+		cls->id = i;
+		if (0 == clsConf->priority) {
+			clsConf->priority = classConfDefault[i].priority;
+		}
+		if (clsConf->queueDepth <= 0) {
+			clsConf->queueDepth = classConfDefault[i].queueDepth;
+		}
+
+		// Prefer the configured memory, fall back to any. Without an arena all
+		// JSON allocations simply go to the heap.
+		cmdArena_t*	arena = &cls->arena;
+		if (pCtrl->conf.arenaCaps) {
+			arena->base = heap_caps_malloc(pCtrl->conf.arenaSz, pCtrl->conf.arenaCaps);
+		}
+		if (!arena->base) {
+			arena->base = malloc(pCtrl->conf.arenaSz);
+		}
+		if (arena->base) {
+			arena->size = pCtrl->conf.arenaSz;
+		} else {
+			ESP_LOGW(TAG, "No memory for %d byte %s JSON arena", pCtrl->conf.arenaSz, className[i]);
+		}
+
+		cls->queue = xQueueCreate(clsConf->queueDepth, sizeof(const testComm_mesg_t*));
+		if (!cls->queue) {
+			return ESP_ERR_NO_MEM;
+		}
+	}
+
+	// Async job workers
+	pCtrl->job.mutex = xSemaphoreCreateMutex();
+	pCtrl->job.ready = xSemaphoreCreateCounting(CONFIG_CMD_PROC_JOB_MAX, 0);
+	if (!pCtrl->job.mutex || !pCtrl->job.ready) {
+		return ESP_ERR_NO_MEM;
+	}
+	if (0 == pCtrl->conf.jobTaskPriority) {
+		pCtrl->conf.jobTaskPriority = JOB_TASK_PRIORITY_DEFAULT;
+	}
+	for (int i = 0; i < CONFIG_CMD_PROC_JOB_WORKERS; i++) {
+		BaseType_t	ret = xTaskCreate(
+			jobTask,
+			"cmd_job",
+			CONFIG_CMD_PROC_JOB_STACK_SZ,
+			(void*)pCtrl,
+			pCtrl->conf.jobTaskPriority,
+			NULL
+		);
+		if (pdPASS != ret) {
+			ESP_LOGE(TAG, "Job task create failed");
+			return ESP_FAIL;
+		}
+	}
 
 	cmdCtrl = pCtrl;
-	return ESP_OK;
+
+	// Class workers, started once cmdCtrl is set
+	for (int i = 0; i < cmdClass_max; i++) {
+		cmdClassConf_t*	clsConf = &pCtrl->conf.classConf[i];
+		char			name[16];
+
+		snprintf(name, sizeof(name), "cmd_%s", className[i]);
+		BaseType_t	ret = xTaskCreatePinnedToCore(
+			classTask,
+			name,
+			CONFIG_CMD_PROC_CLASS_STACK_SZ,
+			(void*)&pCtrl->cls[i],
+			clsConf->priority,
+			NULL,
+			CMD_CORE_ANY == clsConf->core ? tskNO_AFFINITY : clsConf->core
+		);
+		if (pdPASS != ret) {
+			ESP_LOGE(TAG, "%s task create failed", name);
+			return ESP_FAIL;
+		}
+	}
+
+	cJSON_Hooks	hooks = {
+		.malloc_fn = arenaMalloc,
+		.free_fn = arenaFree
+	};
+	cJSON_InitHooks(&hooks);
+
+	// Built-in methods go through the same table as everyone else
+	return builtinRegister(pCtrl);
 }
 
-void cmdProcMesg(const char* mesg)
+static void procMesg(const testComm_mesg_t* mesg, cmdClass_t clsId)
 {
-	cJSON* jMsg = cJSON_Parse(mesg);
+	// Responses are counted in the latency statistics of the class
+	testComm_replyTo_t	replyTo = mesg->replyTo;
+	replyTo.latClass = clsId;
+
+	cJSON* jMsg = cJSON_ParseWithLength(mesg->body, mesg->bodyLen);
 	if (!jMsg) {
-		testCommSendErrResponse(RPC_ERR_PARSE, "Message not proper JSON");
+		testCommSendErrResponse(&replyTo, RPC_ERR_PARSE, "Message not proper JSON");
 		return;
 	}
 
@@ -83,7 +380,7 @@ void cmdProcMesg(const char* mesg)
 	// method is required
 	req.method = cJSON_GetStringValue(cJSON_GetObjectItem(jMsg, "method"));
 	if (!req.method) {
-		testCommSendErrResponse(RPC_ERR_INV_REQ, "Missing 'method'");
+		testCommSendErrResponse(&replyTo, RPC_ERR_INV_REQ, "Missing 'method'");
 		cJSON_Delete(jMsg);
 		return;
 	}
@@ -96,16 +393,39 @@ void cmdProcMesg(const char* mesg)
 
 	// Set inactive return values, command process may change any of these
 	cmdReturn_t ret = {
-		.tcAction = testComm_action_init()
+		.tcAction = testComm_action_init(),
+		.reqBin = {
+			.data = mesg->bin,
+			.len = mesg->binLen
+		},
+		.stream.replyTo = &replyTo
 	};
 
-	cmdProc(&req, &ret);
+	cmdProc(&req, &ret, true);
 
 	// Done with request message
 	cJSON_Delete(jMsg);
 
+	if (ret.deferred) {
+		// The method replies when it is done, see cmdDefer()
+		return;
+	}
+
+	if (ret.stream.active) {
+		// The result was written straight into the response frame
+		cJSON_Delete(ret.jResult);
+		if (0 != ret.code) {
+			testCommRespStreamAbort(&ret.stream.jw);
+		} else if (testCommRespStreamEnd(&ret.stream.jw, &ret.tcAction) == ESP_OK) {
+			return;
+		} else {
+			ret.code = RPC_ERR_INTERNAL;
+			ret.mesg = "Result incomplete";
+		}
+	}
+
 	if (0 != ret.code) {
-		testCommSendErrResponse(ret.code, ret.mesg);
+		testCommSendErrResponse(&replyTo, ret.code, ret.mesg);
 		return;
 	}
 
@@ -120,25 +440,240 @@ void cmdProcMesg(const char* mesg)
 		cJSON_AddNumberToObject(jResp, "result", 0);
 	}
 
-	testCommSendResponse(jResp, &ret.tcAction);
+	testCommSendResponse(&replyTo, jResp, &ret.tcAction);
+}
+
+/**
+ * @brief Worker task processing the requests of one class
+ */
+static void classTask(void* param)
+{
+	cmdClassCtrl_t*			cls = param;
+	const testComm_mesg_t*	mesg;
+
+	curClass = cls->id;
+	while (true) {
+		xQueueReceive(cls->queue, &mesg, portMAX_DELAY);
+
+		// Everything built for this request is released with the arena once
+		// the response has been sent
+		arenaBegin(&cls->arena);
+		procMesg(mesg, cls->id);
+		arenaEnd();
+
+		testCommMesgRelease(mesg);
+	}
 }
 
-static cmdListItem_t *findCmdItem(cmdCtrl_t *pCtrl, const char *method)
+/**
+ * @brief Find the top-level "method" of a request without parsing it
+ *
+ * Only used to pick the class, the worker parses and checks the request.
+ * Escaped characters in the method name are not supported.
+ */
+static bool peekMethod(const char* body, int len, char* method, int methodSz)
 {
-	cmdListItem_t	*item;
+	int		depth = 0;
+	bool	isKey = false;		// Next string at the top level is a key
+	bool	isMethod = false;	// Next value at the top level is the method
+
+	for (int i = 0; i < len; i++) {
+		char	c = body[i];
+
+		if ('"' == c) {
+			int		start = ++i;
+			bool	escaped = false;
+			while (i < len && '"' != body[i]) {
+				if ('\\' == body[i]) {
+					escaped = true;
+					i++;
+				}
+				i++;
+			}
+			if (i >= len) {
+				return false;
+			}
+			if (1 != depth) {
+				continue;
+			}
+			int	sLen = i - start;
+			if (isKey) {
+				isMethod = (6 == sLen && memcmp(&body[start], "method", 6) == 0);
+				isKey = false;
+			} else if (isMethod) {
+				if (escaped || sLen >= methodSz) {
+					return false;
+				}
+				memcpy(method, &body[start], sLen);
+				method[sLen] = '\0';
+				return true;
+			}
+			continue;
+		}
 
-	for (item = pCtrl->cmdList.head; item != NULL; item = item->next) {
-		if (strcmp(method, item->method) == 0) {
-			return item;
+		switch (c) {
+		case '{':
+		case '[':
+			if (0 == depth++ && '{' == c) {
+				isKey = true;
+			}
+			break;
+		case '}':
+		case ']':
+			depth--;
+			break;
+		case ',':
+			if (1 == depth) {
+				isKey = true;
+				isMethod = false;
+			}
+			break;
+		case ':':
+		case ' ':
+		case '\t':
+		case '\r':
+		case '\n':
+			break;
+		default:
+			// Any other top level value is not a method name
+			if (1 == depth) {
+				isMethod = false;
+			}
+			break;
 		}
 	}
+	return false;
+}
 
-	// No match found
-	return NULL;
+/**
+ * @brief Pick the class of a batch from the methods of its items
+ *
+ * A batch runs on the io worker if any item is an io method, so the GPIO
+ * and relay methods only ever run on that one task, and on the config
+ * worker otherwise. Every "method" member is looked at, whatever its depth;
+ * batchFunc() checks each item again before running it.
+ */
+static cmdClass_t batchClass(cmdCtrl_t* pCtrl, const char* body, int len)
+{
+	static const char	key[] = "\"method\"";
+	const int			keyLen = sizeof(key) - 1;
+	char				method[METHOD_PEEK_SZ];
+
+	for (int i = 0; i + keyLen <= len; i++) {
+		if (memcmp(&body[i], key, keyLen) != 0) {
+			continue;
+		}
+
+		int	j = i + keyLen;
+		while (j < len && (' ' == body[j] || '\t' == body[j] || '\r' == body[j] || '\n' == body[j] || ':' == body[j])) {
+			j++;
+		}
+		if (j >= len || '"' != body[j]) {
+			continue;
+		}
+		int	start = ++j;
+		while (j < len && '"' != body[j] && '\\' != body[j]) {
+			j++;
+		}
+		if (j >= len || '"' != body[j] || j - start >= (int)sizeof(method)) {
+			continue;
+		}
+		memcpy(method, &body[start], j - start);
+		method[j - start] = '\0';
+
+		cmdEntry_t*	entry = findCmdEntry(pCtrl, method, methodHash(method));
+		if (entry && (entry->flags & CMD_FLAG_CLASS_IO)) {
+			return cmdClass_io;
+		}
+		i = j;
+	}
+	return cmdClass_config;
+}
+
+/**
+ * @brief Queue a request to the worker of its class
+ *
+ * Runs on the test_comm command task. Requests that cannot be classified
+ * go to the config class, whose worker reports what is wrong with them.
+ * A batch goes to the class of its items, see batchClass().
+ *
+ * @return true if the message was kept, released by the worker when done
+ */
+bool cmdProcMesg(const testComm_mesg_t* mesg)
+{
+	cmdCtrl_t*	pCtrl = cmdCtrl;
+	if (!pCtrl) {
+		testCommSendErrResponse(&mesg->replyTo, RPC_ERR_INTERNAL, "Command processor not initialized");
+		return false;
+	}
+
+	cmdClass_t	clsId = cmdClass_config;
+	char		method[METHOD_PEEK_SZ];
+	if (peekMethod(mesg->body, mesg->bodyLen, method, sizeof(method))) {
+		cmdEntry_t*	entry = findCmdEntry(pCtrl, method, methodHash(method));
+		if (strcmp(method, "batch") == 0) {
+			clsId = batchClass(pCtrl, mesg->body, mesg->bodyLen);
+		} else if (entry && (entry->flags & CMD_FLAG_CLASS_IO)) {
+			clsId = cmdClass_io;
+		} else if (entry && (entry->flags & CMD_FLAG_CLASS_NET)) {
+			clsId = cmdClass_net;
+		}
+	}
+
+	cmdClassCtrl_t*	cls = &pCtrl->cls[clsId];
+	if (xQueueSend(cls->queue, &mesg, 0) != pdTRUE) {
+		cls->rejected++;
+		testComm_replyTo_t	replyTo = mesg->replyTo;
+		replyTo.latClass = clsId;
+		testCommSendErrResponse(&replyTo, RPC_ERR_BUSY, "Command queue full");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief 32-bit FNV-1a hash of a method name
+ */
+static uint32_t methodHash(const char* method)
+{
+	uint32_t	hash = 2166136261UL;
+
+	while (*method) {
+		hash ^= (uint8_t)*method++;
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+/**
+ * @brief Find the table slot holding method, or the empty slot ending its probe sequence
+ *
+ * Safe to call without the mutex: a slot's method pointer is written last
+ * when it is registered and never changes afterwards.
+ */
+static cmdEntry_t* findCmdEntry(cmdCtrl_t* pCtrl, const char* method, uint32_t hash)
+{
+	uint32_t	idx = hash & pCtrl->cmdTabMask;
+
+	for (;;) {
+		cmdEntry_t*	entry = &pCtrl->cmdTab[idx];
+		const char*	name = __atomic_load_n(&entry->method, __ATOMIC_ACQUIRE);
+
+		if (!name || (entry->hash == hash && strcmp(method, name) == 0)) {
+			return entry;
+		}
+		idx = (idx + 1) & pCtrl->cmdTabMask;
+	}
 }
 
 
 esp_err_t cmdFuncRegister(const char* method, cmdFunc_t func, void* cbData)
+{
+	return cmdFuncRegisterFlags(method, func, 0, cbData);
+}
+
+
+esp_err_t cmdFuncRegisterFlags(const char* method, cmdFunc_t func, uint32_t flags, void* cbData)
 {
 	cmdCtrl_t* pCtrl = cmdCtrl;
 	if (!pCtrl) {
@@ -150,36 +685,28 @@ esp_err_t cmdFuncRegister(const char* method, cmdFunc_t func, void* cbData)
 	}
 
 	esp_err_t	status = ESP_OK;
+	uint32_t	hash = methodHash(method);
 
 	MUTEX_GET(pCtrl);
 
 	// Check if method is already registered
-	cmdListItem_t* item = findCmdItem(pCtrl, method);
-	if (NULL == item) {
-		// Add item to the linked list
-		item = malloc(sizeof(*item));
-		if (!item) {
-			MUTEX_PUT(pCtrl);
-			return ESP_ERR_NO_MEM;
-		}
-
-		item->next = NULL;
-		item->method = method;
-		item->func = func;
-		item->cbData = cbData;
-
-		if (pCtrl->cmdList.head == NULL) {
-			// First item in the list
-			pCtrl->cmdList.head = item;
-		} else {
-			// Add item to the tail
-			pCtrl->cmdList.tail->next = item;
-		}
-		pCtrl->cmdList.tail = item;
-	} else {
+	cmdEntry_t* entry = findCmdEntry(pCtrl, method, hash);
+	if (entry->method) {
 		// A method by that name is already registered
 		ESP_LOGE(TAG, "Method \"%s\" already registered", method);
 		status = ESP_FAIL;
+	} else if (pCtrl->cmdCount >= CONFIG_CMD_PROC_MAX_METHODS) {
+		ESP_LOGE(TAG, "No room for method \"%s\", raise CMD_PROC_MAX_METHODS", method);
+		status = ESP_ERR_NO_MEM;
+	} else {
+		entry->hash = hash;
+		entry->func = func;
+		entry->flags = flags;
+		entry->cbData = cbData;
+		entry->perf = &pCtrl->perfTab[pCtrl->cmdCount];
+		// Publish the entry to lock-free readers
+		__atomic_store_n(&entry->method, method, __ATOMIC_RELEASE);
+		pCtrl->cmdCount++;
 	}
 
 	MUTEX_PUT(pCtrl);
@@ -193,7 +720,7 @@ esp_err_t cmdFuncTabRegister(cmdTab_t *tab, int cmdTabSz, void *cbData)
 	int			i;
 
 	for (i = 0; i < cmdTabSz; i++, tab++) {
-		status = cmdFuncRegister(tab->method, tab->func, cbData);
+		status = cmdFuncRegisterFlags(tab->method, tab->func, tab->flags, cbData);
 		if (ESP_OK != status) {
 			return status;
 		}
@@ -201,6 +728,126 @@ esp_err_t cmdFuncTabRegister(cmdTab_t *tab, int cmdTabSz, void *cbData)
 	return ESP_OK;
 }
 
+/**
+ * @brief Return a writer for the command result, as an alternative to jResult
+ *
+ * The handler writes exactly one JSON value. For a single command the value
+ * goes straight into the response frame, so call this once the result is
+ * ready rather than before a long operation. Inside a batch the value is
+ * buffered and added to the results array. Returns NULL, with ret->code set,
+ * if no writer is available.
+ */
+testComm_jw_t* cmdResultStream(cmdReturn_t* ret)
+{
+	if (ret->stream.active) {
+		return &ret->stream.jw;
+	}
+
+	if (ret->stream.replyTo) {
+		if (testCommRespStreamBegin(&ret->stream.jw, ret->stream.replyTo) != ESP_OK) {
+			ret->code = RPC_ERR_INTERNAL;
+			ret->mesg = "Response stream not available";
+			return NULL;
+		}
+	} else {
+		testCommJwBufInit(&ret->stream.jw, 256);
+	}
+	ret->stream.active = true;
+	return &ret->stream.jw;
+}
+
+/**
+ * @brief Reply to the request later, from whichever task completes it
+ *
+ * Copies where to reply into replyTo and marks the request as answered, so
+ * the worker moves on to the next request at once. Only requests with a
+ * response of their own can be deferred: returns false inside a batch or an
+ * async job, and after the result stream was started. The wait is left out
+ * of the latency statistics.
+ */
+bool cmdDefer(cmdReturn_t* ret, testComm_replyTo_t* replyTo)
+{
+	if (!ret->stream.replyTo || ret->stream.active) {
+		return false;
+	}
+	*replyTo = *ret->stream.replyTo;
+	replyTo->rxTimeUs = 0;
+	ret->deferred = true;
+	return true;
+}
+
+/**
+ * @brief Send the result of a deferred request, takes ownership of jResult
+ *
+ * jResult may be NULL for a bare success. Errors are sent with
+ * testCommSendErrResponse().
+ */
+esp_err_t cmdDeferredReply(const testComm_replyTo_t* replyTo, cJSON* jResult)
+{
+	testComm_action_t	action = testComm_action_init();
+	cJSON*				jResp = cJSON_CreateObject();
+
+	if (jResult) {
+		cJSON_AddItemToObject(jResp, "result", jResult);
+	} else {
+		cJSON_AddNumberToObject(jResp, "result", 0);
+	}
+	return testCommSendResponse(replyTo, jResp, &action);
+}
+
+/**
+ * @brief Turn a buffered result stream (batch item, async job) into jResult
+ */
+static void streamToResult(cmdReturn_t* ret)
+{
+	if (!ret->stream.active) {
+		return;
+	}
+	ret->stream.active = false;
+
+	char*	text = testCommJwBufTake(&ret->stream.jw);
+	if (0 == ret->code) {
+		if (text) {
+			cJSON_Delete(ret->jResult);
+			ret->jResult = cJSON_CreateRaw(text);
+		}
+		if (!ret->jResult) {
+			ret->code = RPC_ERR_INTERNAL;
+			ret->mesg = "Result incomplete";
+		}
+	}
+	cJSON_free(text);
+}
+
+/**
+ * @brief Add the handler time since startUs to the method's statistics
+ */
+static void perfRecord(cmdCtrl_t* pCtrl, const cmdEntry_t* entry, int64_t startUs, bool failed)
+{
+	cmdPerf_t*	perf = entry->perf;
+	uint32_t	us = (uint32_t)(esp_timer_get_time() - startUs);
+	int			bucket = (us > 1) ? 31 - __builtin_clz(us) : 0;
+
+	if (bucket >= PERF_HIST_BUCKETS) {
+		bucket = PERF_HIST_BUCKETS - 1;
+	}
+
+	xSemaphoreTake(pCtrl->perfMutex, portMAX_DELAY);
+	if (0 == perf->calls || us < perf->minUs) {
+		perf->minUs = us;
+	}
+	if (us > perf->maxUs) {
+		perf->maxUs = us;
+	}
+	perf->calls++;
+	perf->sumUs += us;
+	perf->hist[bucket]++;
+	if (failed) {
+		perf->errors++;
+	}
+	xSemaphoreGive(pCtrl->perfMutex);
+}
+
 static const char* chipModelStr(esp_chip_model_t model)
 {
 	switch (model)
@@ -220,7 +867,7 @@ static const char* chipModelStr(esp_chip_model_t model)
 	}
 }
 
-static void cmdProc(cmdRequest_t* req, cmdReturn_t* ret)
+static void cmdProc(cmdRequest_t* req, cmdReturn_t* ret, bool allowAsync)
 {
 	ret->code = 0;
 	ret->mesg = "";
@@ -239,49 +886,795 @@ static void cmdProc(cmdRequest_t* req, cmdReturn_t* ret)
 		return;
 	}
 
-	if (strcmp("version", req->method) == 0) {
-		ret->jResult = cJSON_CreateObject();
-		cJSON_AddStringToObject(ret->jResult, "version", pCtrl->conf.fwVersion);
-	} else if (strcmp("uptime", req->method) == 0) {
-		ret->jResult = cJSON_CreateObject();
-		cJSON_AddNumberToObject(ret->jResult, "uptime", (req->curTimeMs / 1000LL));
-	} else if (strcmp("reboot", req->method) == 0) {
-		ret->tcAction.reboot.active = true;
-		ret->tcAction.reboot.timeMs = req->curTimeMs + 500;
-	} else if (strcmp("echo", req->method) == 0) {
-		char* data = cJSON_GetStringValue(cJSON_GetObjectItem(req->jParams, "data"));
+	cmdEntry_t*	entry = findCmdEntry(pCtrl, req->method, methodHash(req->method));
+	if (!entry->method) {
+		ret->code = RPC_ERR_METHOD;
+		ret->mesg = "Method not supported";
+		return;
+	}
+
+	if (allowAsync && (entry->flags & CMD_FLAG_ASYNC)) {
+		jobSubmit(pCtrl, entry, req, ret);
+		return;
+	}
+
+	int64_t	startUs = esp_timer_get_time();
+	entry->func(req->jParams, ret, entry->cbData);
+	perfRecord(pCtrl, entry, startUs, 0 != ret->code);
+}
+
+static void versionFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	cmdCtrl_t*	pCtrl = cbData;
+
+	ret->jResult = cJSON_CreateObject();
+	cJSON_AddStringToObject(ret->jResult, "version", pCtrl->conf.fwVersion);
+}
+
+static void uptimeFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	ret->jResult = cJSON_CreateObject();
+	cJSON_AddNumberToObject(ret->jResult, "uptime", esp_timer_get_time() / 1000000LL);
+}
+
+static void rebootFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	ret->tcAction.reboot.active = true;
+	ret->tcAction.reboot.timeMs = esp_timer_get_time() / 1000LL + 500;
+}
+
+static void echoFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	char* data = cJSON_GetStringValue(cJSON_GetObjectItem(jParams, "data"));
+	ret->jResult = cJSON_CreateObject();
+	if (data) {
+		cJSON_AddStringToObject(ret->jResult, "data", data);
+	} else {
+		cJSON_AddStringToObject(ret->jResult, "data", "");
+	}
+}
+
+static void chipInfoFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	esp_chip_info_t	info;
+	esp_chip_info(&info);
+	ret->jResult = cJSON_CreateObject();
+	cJSON_AddNumberToObject(ret->jResult, "model", info.model);
+	cJSON_AddStringToObject(ret->jResult, "name", chipModelStr(info.model));
+	cJSON_AddNumberToObject(ret->jResult, "revision", info.revision);
+	cJSON_AddNumberToObject(ret->jResult, "cores", info.cores);
+}
+
+static void setBaudFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	cJSON*	jBaud = cJSON_GetObjectItem(jParams, "value");
+	if (cJSON_IsNumber(jBaud)) {
+		ret->tcAction.newBaud = (uint32_t)jBaud->valueint;
+	} else {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "Baud value required";
+	}
+}
+
+static void setFramingFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	char*	mode = cJSON_GetStringValue(cJSON_GetObjectItem(jParams, "mode"));
+	if (mode && strcmp("binary", mode) == 0) {
+		ret->tcAction.framing = testComm_framing_binary;
+	} else if (mode && strcmp("ascii", mode) == 0) {
+		ret->tcAction.framing = testComm_framing_ascii;
+	} else {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "mode must be \"ascii\" or \"binary\"";
+	}
+}
+
+static void commStatsFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	testComm_stats_t	stats;
+	bool				reset = cJSON_IsTrue(cJSON_GetObjectItem(jParams, "reset"));
+	if (testCommGetStats(&stats, reset) == ESP_OK) {
 		ret->jResult = cJSON_CreateObject();
-		if (data) {
-			cJSON_AddStringToObject(ret->jResult, "data", data);
+		cJSON_AddNumberToObject(ret->jResult, "rx_fifo_ovf", stats.rxFifoOvf);
+		cJSON_AddNumberToObject(ret->jResult, "rx_buf_full", stats.rxBufFull);
+		cJSON_AddNumberToObject(ret->jResult, "rx_line_err", stats.rxLineErr);
+		cJSON_AddNumberToObject(ret->jResult, "cmd_count", stats.cmdCount);
+		cJSON_AddNumberToObject(ret->jResult, "latency_last_us", stats.latencyLastUs);
+		cJSON_AddNumberToObject(ret->jResult, "latency_max_us", stats.latencyMaxUs);
+		cJSON_AddNumberToObject(ret->jResult, "latency_avg_us",
+			stats.cmdCount ? (double)(stats.latencySumUs / stats.cmdCount) : 0);
+		cJSON_AddNumberToObject(ret->jResult, "evt_sent", stats.evtSent);
+		cJSON_AddNumberToObject(ret->jResult, "evt_dropped", stats.evtDropped);
+
+		// Per scheduling class
+		cmdCtrl_t*	pCtrl = cbData;
+		cJSON*		jClasses = cJSON_AddObjectToObject(ret->jResult, "classes");
+		for (int i = 0; i < cmdClass_max; i++) {
+			cJSON*	jCls = cJSON_AddObjectToObject(jClasses, className[i]);
+			cJSON_AddNumberToObject(jCls, "cmd_count", stats.latency[i].count);
+			cJSON_AddNumberToObject(jCls, "latency_last_us", stats.latency[i].lastUs);
+			cJSON_AddNumberToObject(jCls, "latency_max_us", stats.latency[i].maxUs);
+			cJSON_AddNumberToObject(jCls, "latency_avg_us",
+				stats.latency[i].count ? (double)(stats.latency[i].sumUs / stats.latency[i].count) : 0);
+			cJSON_AddNumberToObject(jCls, "queued", uxQueueMessagesWaiting(pCtrl->cls[i].queue));
+			cJSON_AddNumberToObject(jCls, "rejected", pCtrl->cls[i].rejected);
+			if (reset) {
+				pCtrl->cls[i].rejected = 0;
+			}
+		}
+	} else {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "Statistics not available";
+	}
+}
+
+/**
+ * @brief Merge the test_comm action requested by a batch item
+ */
+static void batchActionMerge(testComm_action_t* dst, const testComm_action_t* src)
+{
+	if (src->newBaud) {
+		dst->newBaud = src->newBaud;
+	}
+	if (testComm_framing_none != src->framing) {
+		dst->framing = src->framing;
+	}
+	if (src->reboot.active) {
+		dst->reboot = src->reboot;
+	}
+}
+
+/**
+ * @brief Check that a batch item may run on this worker, else fail it
+ *
+ * io methods run only on the io worker, which a batch holding one is routed
+ * to. Async methods are queued as jobs. Other net methods are refused: they
+ * may block for seconds and would hold up the worker running the batch.
+ */
+static bool batchItemCheck(cmdCtrl_t* pCtrl, const char* method, cmdReturn_t* ret)
+{
+	cmdEntry_t*	entry = findCmdEntry(pCtrl, method, methodHash(method));
+
+	if (!entry->method || (entry->flags & CMD_FLAG_ASYNC)) {
+		// cmdProc() reports an unknown method or queues the job
+		return true;
+	}
+	if ((entry->flags & CMD_FLAG_CLASS_IO) && cmdClass_io != curClass) {
+		ret->code = RPC_ERR_INV_REQ;
+		ret->mesg = "io method in a batch not run by the io worker";
+		return false;
+	}
+	if (entry->flags & CMD_FLAG_CLASS_NET) {
+		ret->code = RPC_ERR_INV_REQ;
+		ret->mesg = "Method not allowed in a batch";
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Run a list of commands, returning an array of per-command results
+ *
+ * params is either the command array, or an object of the form
+ *   {"cmds": [...], "stop_on_error": true|false}
+ *
+ * Each command is {"method": "...", "params": ...}. The result array holds
+ * {"result": ...} or {"error": {"code": n, "message": "..."}} for each
+ * command run. With stop_on_error the array ends at the first failure.
+ * A batch holding an io method runs on the io worker. Async methods are
+ * queued as jobs, their result is {"job_id": n}; other net methods fail.
+ */
+static void batchFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	cJSON*	jCmds = jParams;
+	bool	stopOnError = false;
+
+	if (cJSON_IsObject(jCmds)) {
+		stopOnError = cJSON_IsTrue(cJSON_GetObjectItem(jCmds, "stop_on_error"));
+		jCmds = cJSON_GetObjectItem(jCmds, "cmds");
+	}
+	if (!cJSON_IsArray(jCmds)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "Command array required";
+		return;
+	}
+
+	cJSON*	jResults = cJSON_CreateArray();
+	if (!jResults) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "No memory for results";
+		return;
+	}
+
+	cJSON*	jCmd;
+	cJSON_ArrayForEach(jCmd, jCmds) {
+		cmdRequest_t	subReq = {
+			.curTimeMs = esp_timer_get_time() / 1000LL,
+			.method = cJSON_GetStringValue(cJSON_GetObjectItem(jCmd, "method")),
+			.jParams = cJSON_GetObjectItem(jCmd, "params")
+		};
+		cmdReturn_t		subRet = {
+			.tcAction = testComm_action_init(),
+			.reqBin = ret->reqBin
+		};
+
+		if (!subReq.method) {
+			subRet.code = RPC_ERR_INV_REQ;
+			subRet.mesg = "Missing 'method'";
+		} else if (strcmp("batch", subReq.method) == 0) {
+			subRet.code = RPC_ERR_INV_REQ;
+			subRet.mesg = "Nested batch not supported";
+		} else if (!batchItemCheck(cmdCtrl, subReq.method, &subRet)) {
+			// Refused, see batchItemCheck()
 		} else {
-			cJSON_AddStringToObject(ret->jResult, "data", "");
+			cmdProc(&subReq, &subRet, true);
 		}
-	} else if (strcmp("chip-info", req->method) == 0) {
-		esp_chip_info_t	info;
-		esp_chip_info(&info);
-		ret->jResult = cJSON_CreateObject();
-		cJSON_AddNumberToObject(ret->jResult, "model", info.model);
-		cJSON_AddStringToObject(ret->jResult, "name", chipModelStr(info.model));
-		cJSON_AddNumberToObject(ret->jResult, "revision", info.revision);
-		cJSON_AddNumberToObject(ret->jResult, "cores", info.cores);
-	} else if (strcmp("set-baud", req->method) == 0) {
-		cJSON*	jBaud = cJSON_GetObjectItem(req->jParams, "value");
-		if (cJSON_IsNumber(jBaud)) {
-			ret->tcAction.newBaud = (uint32_t)jBaud->valueint;
+
+		streamToResult(&subRet);
+
+		cJSON*	jItem = cJSON_CreateObject();
+		if (0 == subRet.code) {
+			if (subRet.jResult) {
+				cJSON_AddItemToObject(jItem, "result", subRet.jResult);
+			} else {
+				cJSON_AddNumberToObject(jItem, "result", 0);
+			}
+			batchActionMerge(&ret->tcAction, &subRet.tcAction);
 		} else {
-			ret->code = RPC_ERR_PARAMS;
-			ret->mesg = "Baud value required";
+			cJSON_Delete(subRet.jResult);
+
+			cJSON*	jErr = cJSON_AddObjectToObject(jItem, "error");
+			cJSON_AddNumberToObject(jErr, "code", subRet.code);
+			cJSON_AddStringToObject(jErr, "message", subRet.mesg);
 		}
+		cJSON_AddItemToArray(jResults, jItem);
+
+		if (0 != subRet.code && stopOnError) {
+			break;
+		}
+	}
+
+	ret->jResult = jResults;
+}
+
+/**
+ * @brief Enable or disable EVT topics
+ *
+ * params: {"topics": ["gpio", "wifi", ...]}, "*" matches every topic.
+ * Unsubscribing without topics disables all events.
+ *
+ * Returns the list of subscribed topics
+ */
+static void evtSubscribe(cJSON* jParams, cmdReturn_t* ret, bool enable)
+{
+	cJSON*	jTopics = cJSON_GetObjectItem(jParams, "topics");
+
+	if (!jTopics && !enable) {
+		testCommEventUnsubscribe(NULL);
+	} else if (!cJSON_IsArray(jTopics)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "topics array required";
+		return;
 	} else {
-		// Check for registered commands
-		MUTEX_GET(pCtrl);
-		cmdListItem_t* item = findCmdItem(pCtrl, req->method);
-		if (item == NULL) {
-			ret->code = RPC_ERR_METHOD;
-			ret->mesg = "Method not supported";
+		cJSON*	jTopic;
+		cJSON_ArrayForEach(jTopic, jTopics) {
+			char*		topic = cJSON_GetStringValue(jTopic);
+			esp_err_t	status = ESP_ERR_INVALID_ARG;
+
+			if (topic) {
+				status = enable ? testCommEventSubscribe(topic) : testCommEventUnsubscribe(topic);
+			}
+			if (ESP_ERR_NO_MEM == status) {
+				ret->code = RPC_ERR_PARAMS;
+				ret->mesg = "Too many topics";
+				return;
+			} else if (ESP_OK != status) {
+				ret->code = RPC_ERR_PARAMS;
+				ret->mesg = "Invalid topic";
+				return;
+			}
+		}
+	}
+
+	ret->jResult = cJSON_CreateArray();
+	testCommEventList(ret->jResult);
+}
+
+static void memStatsFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	cmdCtrl_t*	pCtrl = cbData;
+	bool		reset = cJSON_IsTrue(cJSON_GetObjectItem(jParams, "reset"));
+
+	ret->jResult = cJSON_CreateObject();
+	cJSON_AddNumberToObject(ret->jResult, "arena_size", pCtrl->conf.arenaSz);
+	cJSON*	jArenas = cJSON_AddObjectToObject(ret->jResult, "arenas");
+	for (int i = 0; i < cmdClass_max; i++) {
+		cmdArena_t*	arena = &pCtrl->cls[i].arena;
+		cJSON*		jArena = cJSON_AddObjectToObject(jArenas, className[i]);
+
+		cJSON_AddNumberToObject(jArena, "hwm", arena->hwm);
+		cJSON_AddNumberToObject(jArena, "requests", arena->requests);
+		cJSON_AddNumberToObject(jArena, "overflows", arena->overflows);
+	}
+	cJSON_AddNumberToObject(ret->jResult, "heap_free", esp_get_free_heap_size());
+	cJSON_AddNumberToObject(ret->jResult, "heap_min_free", esp_get_minimum_free_heap_size());
+	cJSON_AddNumberToObject(ret->jResult, "heap_largest_free", heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
+
+	if (reset) {
+		for (int i = 0; i < cmdClass_max; i++) {
+			cmdArena_t*	arena = &pCtrl->cls[i].arena;
+
+			// The mark of this request's arena restarts from what it has already used
+			arena->hwm = (arena == curArena) ? arena->top : 0;
+			arena->requests = 0;
+			arena->overflows = 0;
+		}
+	}
+}
+
+static void evtSubscribeFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	evtSubscribe(jParams, ret, true);
+}
+
+static void evtUnsubscribeFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	evtSubscribe(jParams, ret, false);
+}
+
+static const char* jobStateStr(jobState_t state)
+{
+	switch (state)
+	{
+		case jobState_queued:
+			return "queued";
+		case jobState_running:
+			return "running";
+		case jobState_done:
+			return "done";
+		case jobState_failed:
+			return "failed";
+		case jobState_cancelled:
+			return "cancelled";
+		default:
+			return "?";
+	}
+}
+
+static bool jobFinished(const cmdJob_t* job)
+{
+	return job->state >= jobState_done;
+}
+
+/**
+ * @brief Return a job slot to the free pool. Call with job.mutex held.
+ */
+static void jobRelease(cmdJob_t* job)
+{
+	cJSON_Delete(job->jParams);
+	cJSON_Delete(job->jResult);
+	free(job->bin);
+	memset(job, 0, sizeof(*job));
+}
+
+/**
+ * @brief Find a job by the "job_id" parameter. Call with job.mutex held.
+ */
+static cmdJob_t* jobFind(cmdCtrl_t* pCtrl, cJSON* jParams, cmdReturn_t* ret)
+{
+	cJSON*	jId = cJSON_GetObjectItem(jParams, "job_id");
+	if (!cJSON_IsNumber(jId)) {
+		ret->code = RPC_ERR_PARAMS;
+		ret->mesg = "job_id required";
+		return NULL;
+	}
+
+	for (int i = 0; i < CONFIG_CMD_PROC_JOB_MAX; i++) {
+		cmdJob_t*	job = &pCtrl->job.tab[i];
+		if (job->id != 0 && job->id == jId->valueint) {
+			return job;
+		}
+	}
+	ret->code = RPC_ERR_PARAMS;
+	ret->mesg = "Unknown job_id";
+	return NULL;
+}
+
+/**
+ * @brief Publish a finished job on the "job" event topic
+ */
+static void jobPublish(uint16_t id, const char* method, jobState_t state)
+{
+	if (!testCommEventEnabled("job")) {
+		return;
+	}
+
+	cJSON*	jData = cJSON_CreateObject();
+	cJSON_AddNumberToObject(jData, "job_id", id);
+	cJSON_AddStringToObject(jData, "method", method);
+	cJSON_AddStringToObject(jData, "state", jobStateStr(state));
+	testCommSendEvent("job", jData);
+}
+
+/**
+ * @brief Queue an async command, replying with its job ID
+ *
+ * Runs on the class worker of the request, or of the batch holding it. The
+ * copies of the parameters are taken outside the worker's arena: they must
+ * outlive the request.
+ */
+static void jobSubmit(cmdCtrl_t* pCtrl, const cmdEntry_t* entry, cmdRequest_t* req, cmdReturn_t* ret)
+{
+	cmdJob_t*	job = NULL;
+	cmdJob_t*	oldest = NULL;
+
+	xSemaphoreTake(pCtrl->job.mutex, portMAX_DELAY);
+
+	// Take a free slot, or else the slot of the oldest finished job
+	for (int i = 0; i < CONFIG_CMD_PROC_JOB_MAX && !job; i++) {
+		cmdJob_t*	slot = &pCtrl->job.tab[i];
+		if (jobState_free == slot->state) {
+			job = slot;
+		} else if (jobFinished(slot) && (!oldest || slot->endUs < oldest->endUs)) {
+			oldest = slot;
+		}
+	}
+	if (!job && oldest) {
+		jobRelease(oldest);
+		job = oldest;
+	}
+	if (!job) {
+		xSemaphoreGive(pCtrl->job.mutex);
+		ret->code = RPC_ERR_BUSY;
+		ret->mesg = "Too many jobs";
+		return;
+	}
+
+	cmdArena_t*	arena = curArena;
+	curArena = NULL;
+	job->jParams = req->jParams ? cJSON_Duplicate(req->jParams, true) : NULL;
+	curArena = arena;
+	if (ret->reqBin.data && ret->reqBin.len > 0) {
+		job->bin = malloc(ret->reqBin.len);
+		if (job->bin) {
+			memcpy(job->bin, ret->reqBin.data, ret->reqBin.len);
+			job->binLen = ret->reqBin.len;
+		}
+	}
+	if ((req->jParams && !job->jParams) || (ret->reqBin.data && !job->bin)) {
+		jobRelease(job);
+		xSemaphoreGive(pCtrl->job.mutex);
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "No memory for job";
+		return;
+	}
+
+	if (++pCtrl->job.lastId == 0) {
+		pCtrl->job.lastId = 1;
+	}
+	job->id = pCtrl->job.lastId;
+	job->entry = entry;
+	job->state = jobState_queued;
+	job->queuedUs = esp_timer_get_time();
+
+	uint16_t	id = job->id;
+
+	xSemaphoreGive(pCtrl->job.mutex);
+	xSemaphoreGive(pCtrl->job.ready);
+
+	ret->jResult = cJSON_CreateObject();
+	cJSON_AddNumberToObject(ret->jResult, "job_id", id);
+}
+
+/**
+ * @brief Take the oldest queued job and mark it running, NULL if none
+ */
+static cmdJob_t* jobNext(cmdCtrl_t* pCtrl)
+{
+	cmdJob_t*	next = NULL;
+
+	xSemaphoreTake(pCtrl->job.mutex, portMAX_DELAY);
+	for (int i = 0; i < CONFIG_CMD_PROC_JOB_MAX; i++) {
+		cmdJob_t*	job = &pCtrl->job.tab[i];
+		if (jobState_queued == job->state && (!next || job->queuedUs < next->queuedUs)) {
+			next = job;
+		}
+	}
+	if (next) {
+		next->state = jobState_running;
+		next->startUs = esp_timer_get_time();
+	}
+	xSemaphoreGive(pCtrl->job.mutex);
+
+	return next;
+}
+
+/**
+ * @brief Run a job taken by jobNext and record its outcome
+ *
+ * A running job cannot be interrupted; if it is cancelled meanwhile its
+ * outcome is discarded when it finishes.
+ */
+static void jobRun(cmdCtrl_t* pCtrl, cmdJob_t* job)
+{
+	cmdReturn_t	ret = {
+		.tcAction = testComm_action_init(),
+		.reqBin = {
+			.data = job->bin,
+			.len = job->binLen
+		}
+	};
+	int64_t	startUs = esp_timer_get_time();
+	job->entry->func(job->jParams, &ret, job->entry->cbData);
+	perfRecord(pCtrl, job->entry, startUs, 0 != ret.code);
+	streamToResult(&ret);
+
+	xSemaphoreTake(pCtrl->job.mutex, portMAX_DELAY);
+	cJSON_Delete(job->jParams);
+	job->jParams = NULL;
+	free(job->bin);
+	job->bin = NULL;
+	job->endUs = esp_timer_get_time();
+	if (job->cancel) {
+		job->state = jobState_cancelled;
+		cJSON_Delete(ret.jResult);
+	} else if (0 != ret.code) {
+		job->state = jobState_failed;
+		job->code = ret.code;
+		job->mesg = ret.mesg;
+		cJSON_Delete(ret.jResult);
+	} else {
+		job->state = jobState_done;
+		job->jResult = ret.jResult;
+	}
+	uint16_t	id = job->id;
+	jobState_t	state = job->state;
+	const char*	method = job->entry->method;
+	xSemaphoreGive(pCtrl->job.mutex);
+
+	jobPublish(id, method, state);
+}
+
+/**
+ * @brief Worker task running async jobs
+ */
+static void jobTask(void* param)
+{
+	cmdCtrl_t*	pCtrl = param;
+	cmdJob_t*	job;
+
+	while (true) {
+		xSemaphoreTake(pCtrl->job.ready, portMAX_DELAY);
+
+		// Run everything queued, cancelled jobs are simply not found
+		while ((job = jobNext(pCtrl)) != NULL) {
+			jobRun(pCtrl, job);
+		}
+	}
+}
+
+static void jobStatusItem(cJSON* jItem, const cmdJob_t* job)
+{
+	int64_t	now = esp_timer_get_time();
+
+	cJSON_AddNumberToObject(jItem, "job_id", job->id);
+	cJSON_AddStringToObject(jItem, "method", job->entry->method);
+	cJSON_AddStringToObject(jItem, "state", jobStateStr(job->state));
+	if (job->state >= jobState_running && job->startUs) {
+		int64_t	endUs = jobFinished(job) ? job->endUs : now;
+		cJSON_AddNumberToObject(jItem, "run_ms", (endUs - job->startUs) / 1000);
+	}
+}
+
+/**
+ * @brief Report one job, or every job if no job_id is given
+ */
+static void jobStatusFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	cmdCtrl_t*	pCtrl = cbData;
+
+	xSemaphoreTake(pCtrl->job.mutex, portMAX_DELAY);
+	if (!cJSON_GetObjectItem(jParams, "job_id")) {
+		ret->jResult = cJSON_CreateArray();
+		for (int i = 0; i < CONFIG_CMD_PROC_JOB_MAX; i++) {
+			cmdJob_t*	job = &pCtrl->job.tab[i];
+			if (jobState_free != job->state) {
+				cJSON*	jItem = cJSON_CreateObject();
+				jobStatusItem(jItem, job);
+				cJSON_AddItemToArray(ret->jResult, jItem);
+			}
+		}
+	} else {
+		cmdJob_t*	job = jobFind(pCtrl, jParams, ret);
+		if (job) {
+			ret->jResult = cJSON_CreateObject();
+			jobStatusItem(ret->jResult, job);
+		}
+	}
+	xSemaphoreGive(pCtrl->job.mutex);
+}
+
+/**
+ * @brief Return the outcome of a finished job and free it
+ *
+ * A failed job replies with the error it failed with. RPC_ERR_BUSY means the
+ * job has not finished yet.
+ */
+static void jobResultFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	cmdCtrl_t*	pCtrl = cbData;
+
+	xSemaphoreTake(pCtrl->job.mutex, portMAX_DELAY);
+	cmdJob_t*	job = jobFind(pCtrl, jParams, ret);
+	if (!job) {
+		// Error set by jobFind
+	} else if (!jobFinished(job)) {
+		ret->code = RPC_ERR_BUSY;
+		ret->mesg = "Job not finished";
+	} else {
+		if (jobState_done == job->state) {
+			ret->jResult = job->jResult;
+			job->jResult = NULL;
+		} else if (jobState_failed == job->state) {
+			ret->code = job->code;
+			ret->mesg = job->mesg;
 		} else {
-			item->func(req->jParams, ret, item->cbData);
+			ret->code = RPC_ERR_INTERNAL;
+			ret->mesg = "Job cancelled";
+		}
+		jobRelease(job);
+	}
+	xSemaphoreGive(pCtrl->job.mutex);
+}
+
+/**
+ * @brief Cancel a job. A queued job never runs, a running job's outcome is discarded.
+ */
+static void jobCancelFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	cmdCtrl_t*	pCtrl = cbData;
+
+	xSemaphoreTake(pCtrl->job.mutex, portMAX_DELAY);
+	cmdJob_t*	job = jobFind(pCtrl, jParams, ret);
+	bool		dequeued = false;
+	uint16_t	id = 0;
+	const char*	method = NULL;
+
+	if (job) {
+		if (jobState_queued == job->state) {
+			job->state = jobState_cancelled;
+			job->endUs = esp_timer_get_time();
+			cJSON_Delete(job->jParams);
+			job->jParams = NULL;
+			free(job->bin);
+			job->bin = NULL;
+			dequeued = true;
+			id = job->id;
+			method = job->entry->method;
+		} else if (jobState_running == job->state) {
+			job->cancel = true;
 		}
-		MUTEX_PUT(pCtrl);
+		ret->jResult = cJSON_CreateObject();
+		jobStatusItem(ret->jResult, job);
 	}
+	xSemaphoreGive(pCtrl->job.mutex);
+
+	if (dequeued) {
+		jobPublish(id, method, jobState_cancelled);
+	}
+}
+
+/**
+ * @brief Report handler timing per method and frame counters
+ *
+ * Methods not called since the last reset are left out unless "all" is set.
+ * Trailing empty histogram buckets are left out.
+ */
+static void perfStatsFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	cmdCtrl_t*			pCtrl = cbData;
+	bool				all = cJSON_IsTrue(cJSON_GetObjectItem(jParams, "all"));
+	testComm_stats_t	stats;
+
+	if (testCommGetStats(&stats, false) != ESP_OK) {
+		ret->code = RPC_ERR_INTERNAL;
+		ret->mesg = "Statistics not available";
+		return;
+	}
+
+	testComm_jw_t*	jw = cmdResultStream(ret);
+	if (!jw) {
+		return;
+	}
+	testCommJwObjectStart(jw, NULL);
+	testCommJwString(jw, "version", pCtrl->conf.fwVersion);
+	testCommJwInt(jw, "uptime_ms", esp_timer_get_time() / 1000);
+
+	testCommJwObjectStart(jw, "frame");
+	testCommJwInt(jw, "rx_bytes", stats.rxBytes);
+	testCommJwInt(jw, "rx_frames", stats.rxFrames);
+	testCommJwInt(jw, "tx_bytes", stats.txBytes);
+	testCommJwInt(jw, "tx_frames", stats.txFrames);
+	testCommJwInt(jw, "crc_err", stats.rxCrcErr);
+	testCommJwInt(jw, "hdr_err", stats.rxHdrErr);
+	testCommJwInt(jw, "ovr_err", stats.rxOvrErr);
+	testCommJwInt(jw, "rx_fifo_ovf", stats.rxFifoOvf);
+	testCommJwInt(jw, "rx_buf_full", stats.rxBufFull);
+	testCommJwObjectEnd(jw);
+
+	testCommJwObjectStart(jw, "methods");
+	for (uint32_t i = 0; i <= pCtrl->cmdTabMask; i++) {
+		cmdEntry_t*	entry = &pCtrl->cmdTab[i];
+		const char*	method = __atomic_load_n(&entry->method, __ATOMIC_ACQUIRE);
+		cmdPerf_t	perf;
+
+		if (!method) {
+			continue;
+		}
+		xSemaphoreTake(pCtrl->perfMutex, portMAX_DELAY);
+		perf = *entry->perf;
+		xSemaphoreGive(pCtrl->perfMutex);
+		if (0 == perf.calls && !all) {
+			continue;
+		}
+
+		testCommJwObjectStart(jw, method);
+		testCommJwInt(jw, "calls", perf.calls);
+		testCommJwInt(jw, "errors", perf.errors);
+		testCommJwInt(jw, "min_us", perf.minUs);
+		testCommJwInt(jw, "avg_us", perf.calls ? perf.sumUs / perf.calls : 0);
+		testCommJwInt(jw, "max_us", perf.maxUs);
+		int	used = PERF_HIST_BUCKETS;
+		while (used > 0 && 0 == perf.hist[used - 1]) {
+			used--;
+		}
+		testCommJwArrayStart(jw, "hist");
+		for (int b = 0; b < used; b++) {
+			testCommJwInt(jw, NULL, perf.hist[b]);
+		}
+		testCommJwArrayEnd(jw);
+		testCommJwObjectEnd(jw);
+	}
+	testCommJwObjectEnd(jw);
+	testCommJwObjectEnd(jw);
+}
+
+/**
+ * @brief Clear the method timing and test_comm counters, comm-stats included
+ */
+static void perfResetFunc(cJSON* jParams, cmdReturn_t* ret, void* cbData)
+{
+	cmdCtrl_t*			pCtrl = cbData;
+	testComm_stats_t	stats;
+
+	xSemaphoreTake(pCtrl->perfMutex, portMAX_DELAY);
+	memset(pCtrl->perfTab, 0, CONFIG_CMD_PROC_MAX_METHODS * sizeof(cmdPerf_t));
+	xSemaphoreGive(pCtrl->perfMutex);
+	testCommGetStats(&stats, true);
+}
+
+static cmdTab_t	builtinTab[] = {
+	{"version",			versionFunc},
+	{"uptime",			uptimeFunc},
+	{"reboot",			rebootFunc},
+	{"echo",			echoFunc},
+	{"chip-info",		chipInfoFunc},
+	{"set-baud",		setBaudFunc},
+	{"set-framing",		setFramingFunc},
+	{"comm-stats",		commStatsFunc},
+	{"mem-stats",		memStatsFunc},
+	{"evt-subscribe",	evtSubscribeFunc},
+	{"evt-unsubscribe",	evtUnsubscribeFunc},
+	{"batch",			batchFunc},
+	{"job-status",		jobStatusFunc},
+	{"job-result",		jobResultFunc},
+	{"job-cancel",		jobCancelFunc},
+	{"perf-stats",		perfStatsFunc},
+	{"perf-reset",		perfResetFunc},
+};
+static const int builtinTabSz = sizeof(builtinTab) / sizeof(cmdTab_t);
+
+static esp_err_t builtinRegister(cmdCtrl_t* pCtrl)
+{
+	return cmdFuncTabRegister(builtinTab, builtinTabSz, pCtrl);
 }
@@ -23,10 +23,38 @@ extern "C" {
 #define RPC_ERR_METHOD		(-32601)
 #define RPC_ERR_PARAMS		(-32602)
 #define RPC_ERR_INTERNAL	(-32603)
+#define RPC_ERR_BUSY		(-32001)	// Job not finished, no job slot free, or class queue full
+#define RPC_ERR_TIMEOUT		(-32002)	// Awaited condition not met in time
+#define RPC_ERR_INTERLOCK	(-32003)	// Output change refused by an interlock rule
+
+// Method flags
+#define CMD_FLAG_ASYNC		(1 << 0)	// Run as a job on a worker task, reply with its ID
+#define CMD_FLAG_CLASS_IO	(1 << 1)	// GPIO and relay operations, highest priority
+#define CMD_FLAG_CLASS_NET	(1 << 2)	// Wi-Fi and HTTP, lowest priority
+										// Neither: NVS, configuration and built-ins
+
+// Scheduling classes, each with its own queue and worker task
+typedef enum {
+	cmdClass_io = 0,
+	cmdClass_config,
+	cmdClass_net,
+	cmdClass_max
+} cmdClass_t;
+
+#define CMD_CORE_ANY		(-1)
 
+typedef struct {
+	UBaseType_t	priority;		// Worker task priority, 0 for the default
+	int			core;			// Worker core, or CMD_CORE_ANY
+	int			queueDepth;		// Requests waiting for the worker, 0 for the default
+} cmdClassConf_t;
 
 typedef struct {
 	const char*	fwVersion;
+	int			arenaSz;		// Per-request JSON arena size, 0 for the default
+	uint32_t	arenaCaps;		// heap_caps_malloc() caps for the arena, 0 for any
+	UBaseType_t	jobTaskPriority;	// Async job workers, 0 for the default
+	cmdClassConf_t	classConf[cmdClass_max];	// Indexed by cmdClass_t
 } cmdConf_t;
 
 typedef struct {
@@ -40,6 +68,19 @@ typedef struct {
 	int			code;
 	const char*	mesg;
 	testComm_action_t tcAction;
+	// Raw attachment received with the request (binary framing only)
+	struct {
+		const uint8_t*	data;
+		int				len;
+	} reqBin;
+	// Result streamed with cmdResultStream() instead of built in jResult
+	struct {
+		const testComm_replyTo_t*	replyTo;	// NULL: buffered, e.g. inside a batch
+		testComm_jw_t				jw;
+		bool						active;
+	} stream;
+	// Set by cmdDefer(), the method replies later with cmdDeferredReply()
+	bool		deferred;
 } cmdReturn_t;
 
 typedef void (*cmdFunc_t)(cJSON *jParam, cmdReturn_t *ret, void *cbData);
@@ -47,16 +88,25 @@ typedef void (*cmdFunc_t)(cJSON *jParam, cmdReturn_t *ret, void *cbData);
 typedef struct {
 	const char* method;
 	cmdFunc_t	func;
+	uint32_t	flags;		// CMD_FLAG_xxx
 } const cmdTab_t;
 
 esp_err_t cmdProcInit(cmdConf_t* conf);
 
-void cmdProcMesg(const char* mesg);
+bool cmdProcMesg(const testComm_mesg_t* mesg);
 
 esp_err_t cmdFuncRegister(const char* method, cmdFunc_t func, void* cbData);
 
+esp_err_t cmdFuncRegisterFlags(const char* method, cmdFunc_t func, uint32_t flags, void* cbData);
+
 esp_err_t cmdFuncTabRegister(cmdTab_t* tab, int cmdTabSz, void* cbData);
 
+testComm_jw_t* cmdResultStream(cmdReturn_t* ret);
+
+bool cmdDefer(cmdReturn_t* ret, testComm_replyTo_t* replyTo);
+
+esp_err_t cmdDeferredReply(const testComm_replyTo_t* replyTo, cJSON* jResult);
+
 #ifdef __cplusplus
 }
 #endif
@@ -17,7 +17,35 @@
 extern "C" {
 #endif
 
-typedef void (*cmdProcFunc_t)(const char* mesg);
+// Framing used on the serial link
+typedef enum {
+    testComm_framing_none = 0,  // No change (used by testComm_action_t)
+    testComm_framing_ascii,     // SOH <hdr> STX <body> ETX <crc> EOT (default)
+    testComm_framing_binary     // SYN <hdr len> <hdr> <json len> <bin len> <json> <bin> <crc32>
+} testComm_framing_t;
+
+// Where to send the response to a received message
+typedef struct {
+    bool        binary;     // Request arrived in a binary frame
+    bool        hasId;      // Request header carried an ID, echo it in the response
+    uint16_t    id;
+    int64_t     rxTimeUs;   // esp_timer time the request frame completed
+    uint8_t     latClass;   // Latency statistics class, set by the command processor
+} testComm_replyTo_t;
+
+#define TESTCOMM_LAT_CLASSES    (4)
+
+// A received, validated message
+typedef struct {
+    testComm_replyTo_t  replyTo;
+    const char*         body;       // NUL-terminated JSON text
+    int                 bodyLen;
+    const uint8_t*      bin;        // Raw attachment (binary framing only), NULL if none
+    int                 binLen;
+} testComm_mesg_t;
+
+// Returns true to keep the message, which is then released with testCommMesgRelease()
+typedef bool (*cmdProcFunc_t)(const testComm_mesg_t* mesg);
 
 typedef struct {
     struct {
@@ -27,7 +55,11 @@ typedef struct {
         uint32_t    baud;
     } uart;
     UBaseType_t     taskPriority;
+    UBaseType_t     cmdTaskPriority;    // Task that passes queued commands to cmdProc
     int             rxBufSz;
+    int             rxQueueDepth;       // Received commands waiting to be processed
+    int             msgBufSz;           // Largest message body + attachment, 0 for the default
+    uint32_t        msgBufCaps;         // heap_caps_malloc() caps for message buffers, 0 for any
     cmdProcFunc_t   cmdProc;
     struct {
         uint32_t    wifi: 1;
@@ -38,18 +70,100 @@ typedef struct {
 // Data passed back to testComm by command processing
 typedef struct {
     uint32_t    newBaud;
+    testComm_framing_t framing;
     struct {
         bool    active;
         uint32_t timeMs;   
     } reboot;
 } testComm_action_t;
 
-#define testComm_action_init()  {.newBaud = 0, .reboot.active = false, .reboot.timeMs = 0}
+#define testComm_action_init()  {.newBaud = 0, .framing = testComm_framing_none, .reboot.active = false, .reboot.timeMs = 0}
+
+// Serial link statistics
+typedef struct {
+    uint32_t    rxFifoOvf;      // UART hardware FIFO overflows
+    uint32_t    rxBufFull;      // UART driver ring buffer overflows
+    uint32_t    rxLineErr;      // Frame and parity errors
+    uint32_t    rxBytes;
+    uint32_t    rxFrames;       // Frames received intact
+    uint32_t    rxCrcErr;       // CRC mismatch or malformed CRC
+    uint32_t    rxHdrErr;       // Bad header, request ID or body character
+    uint32_t    rxOvrErr;       // Body too large or no receive slot free
+    uint32_t    txBytes;
+    uint32_t    txFrames;
+    uint32_t    cmdCount;       // Responses sent to timed requests
+    uint32_t    latencyLastUs;  // Request frame complete to response written
+    uint32_t    latencyMaxUs;
+    uint64_t    latencySumUs;
+    uint32_t    evtSent;        // EVT frames sent
+    uint32_t    evtDropped;     // EVT frames dropped, no transmit frame free
+    struct {
+        uint32_t    count;
+        uint32_t    lastUs;
+        uint32_t    maxUs;
+        uint64_t    sumUs;
+    } latency[TESTCOMM_LAT_CLASSES];    // By testComm_replyTo_t.latClass
+} testComm_stats_t;
+
+// Streaming JSON writer, emits tokens straight into a transmit frame (see
+// testCommRespStreamBegin) or a growing memory buffer (testCommJwBufInit)
+typedef struct {
+    uint8_t*    buf;
+    int         pos;        // Next write position
+    int         cap;        // Usable size of buf
+    int         reserve;    // Bytes kept free after cap (frame trailer, NUL)
+    int         bodyOff;    // Start of the JSON text in buf
+    uint32_t    crc;        // Running CRC of buf[bodyOff, crcPos)
+    int         crcPos;
+    uint32_t    hasItems;   // Bit n set once the container at depth n has a member
+    uint8_t     depth;
+    bool        error;      // Out of memory or nesting too deep, output is invalid
+    bool        cjsonMem;   // buf is from cJSON_malloc
+    bool        spilled;    // Outgrew the frame, buf is from malloc
+    bool        binary;
+    void*       frame;      // Transmit frame, NULL for a memory buffer
+    const uint8_t*  att;    // Attachment sent after the JSON, see testCommJwAttach
+    int         attLen;
+} testComm_jw_t;
+
+#define TESTCOMM_JW_DEPTH_MAX   (31)
+
+void testCommJwObjectStart(testComm_jw_t* jw, const char* key);    // key is NULL in arrays and at the top
+void testCommJwObjectEnd(testComm_jw_t* jw);
+void testCommJwArrayStart(testComm_jw_t* jw, const char* key);
+void testCommJwArrayEnd(testComm_jw_t* jw);
+void testCommJwString(testComm_jw_t* jw, const char* key, const char* val);
+void testCommJwNumber(testComm_jw_t* jw, const char* key, double val);
+void testCommJwInt(testComm_jw_t* jw, const char* key, int64_t val);
+void testCommJwBool(testComm_jw_t* jw, const char* key, bool val);
+void testCommJwNull(testComm_jw_t* jw, const char* key);
+
+// Memory buffer, from cJSON_malloc. Take returns the NUL-terminated text (free
+// with cJSON_free) or NULL if writing failed; the buffer is released either way.
+void testCommJwBufInit(testComm_jw_t* jw, int initSz);
+char* testCommJwBufTake(testComm_jw_t* jw);
 
 esp_err_t testCommInit(testComm_conf_t* conf);
 esp_err_t testCommStart(void);
-esp_err_t testCommSendResponse(cJSON* jResp, testComm_action_t* action);
-esp_err_t testCommSendErrResponse(int errCode, const char* errMesg);
+esp_err_t testCommSendResponse(const testComm_replyTo_t* replyTo, cJSON* jResp, testComm_action_t* action);
+esp_err_t testCommSendErrResponse(const testComm_replyTo_t* replyTo, int errCode, const char* errMesg);
+esp_err_t testCommGetStats(testComm_stats_t* stats, bool reset);
+void testCommMesgRelease(const testComm_mesg_t* mesg);
+
+// Streamed response: Begin writes the frame up to {"result":, the caller writes
+// exactly one value, End completes and queues the frame. Abort discards it.
+esp_err_t testCommRespStreamBegin(testComm_jw_t* jw, const testComm_replyTo_t* replyTo);
+esp_err_t testCommRespStreamEnd(testComm_jw_t* jw, testComm_action_t* action);
+void testCommRespStreamAbort(testComm_jw_t* jw);
+bool testCommJwAttach(testComm_jw_t* jw, const void* data, int len);   // Binary frames only
+
+// Unsolicited events, sent with an "EVT" header as {"topic": ..., "time_ms": ..., "data": ...}
+// Only topics the host has subscribed to ("*" for all) are sent.
+esp_err_t testCommEventSubscribe(const char* topic);
+esp_err_t testCommEventUnsubscribe(const char* topic);  // NULL for all
+esp_err_t testCommEventList(cJSON* jTopics);
+bool testCommEventEnabled(const char* topic);
+esp_err_t testCommSendEvent(const char* topic, cJSON* jData);  // Takes ownership of jData
 
 #ifdef __cplusplus
 }
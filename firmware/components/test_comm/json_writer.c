@@ -0,0 +1,267 @@
+/*
+ * json_writer.c
+ *
+ *  Streaming JSON writer. Tokens are written straight into a transmit frame
+ *  or a memory buffer, so a response does not need a cJSON tree that is then
+ *  printed into another buffer.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "esp32/rom/crc.h"
+#include "cJSON.h"
+
+#include "test_comm.h"
+
+/**
+ * @brief Make room for need more bytes, growing the buffer if necessary
+ *
+ * A frame-backed writer moves to a malloc'd buffer the first time it overflows
+ * the frame, a memory writer grows with cJSON_malloc.
+ */
+static bool jwReserve(testComm_jw_t* jw, int need)
+{
+	if (jw->error) {
+		return false;
+	}
+	if (jw->pos + need <= jw->cap) {
+		return true;
+	}
+
+	int	newCap = jw->cap * 2;
+	while (newCap < jw->pos + need) {
+		newCap *= 2;
+	}
+
+	uint8_t*	newBuf = jw->cjsonMem ? cJSON_malloc(newCap + jw->reserve) : malloc(newCap + jw->reserve);
+	if (!newBuf) {
+		jw->error = true;
+		return false;
+	}
+	memcpy(newBuf, jw->buf, jw->pos);
+
+	if (jw->cjsonMem) {
+		cJSON_free(jw->buf);
+	} else if (jw->spilled) {
+		free(jw->buf);
+	}
+	jw->spilled = !jw->cjsonMem;
+	jw->buf = newBuf;
+	jw->cap = newCap;
+	return true;
+}
+
+static void jwPut(testComm_jw_t* jw, const char* str, int len)
+{
+	if (jwReserve(jw, len)) {
+		memcpy(&jw->buf[jw->pos], str, len);
+		jw->pos += len;
+	}
+}
+
+static void jwPutStr(testComm_jw_t* jw, const char* str)
+{
+	static const char	hex[] = "0123456789abcdef";
+
+	if (!str) {
+		jwPut(jw, "null", 4);
+		return;
+	}
+
+	jwPut(jw, "\"", 1);
+	for (;;) {
+		// Copy the run of characters that need no escaping
+		const char*	run = str;
+		while ((uint8_t)*str >= 0x20 && *str != '"' && *str != '\\') {
+			str++;
+		}
+		jwPut(jw, run, str - run);
+
+		if (*str == '\0') {
+			break;
+		}
+
+		char	esc[6] = {'\\', 0};
+		int		escLen = 2;
+		switch (*str) {
+			case '"':	esc[1] = '"'; break;
+			case '\\':	esc[1] = '\\'; break;
+			case '\b':	esc[1] = 'b'; break;
+			case '\f':	esc[1] = 'f'; break;
+			case '\n':	esc[1] = 'n'; break;
+			case '\r':	esc[1] = 'r'; break;
+			case '\t':	esc[1] = 't'; break;
+			default:
+				esc[1] = 'u';
+				esc[2] = '0';
+				esc[3] = '0';
+				esc[4] = hex[(*str >> 4) & 0xf];
+				esc[5] = hex[*str & 0xf];
+				escLen = 6;
+				break;
+		}
+		jwPut(jw, esc, escLen);
+		str++;
+	}
+	jwPut(jw, "\"", 1);
+}
+
+/**
+ * @brief Start a value: separator from the previous member, then the key if any
+ */
+static void jwValue(testComm_jw_t* jw, const char* key)
+{
+	uint32_t	bit = 1UL << jw->depth;
+
+	if (jw->hasItems & bit) {
+		jwPut(jw, ",", 1);
+	}
+	jw->hasItems |= bit;
+
+	if (key) {
+		jwPutStr(jw, key);
+		jwPut(jw, ":", 1);
+	}
+}
+
+/**
+ * @brief Fold what has been written so far into the running CRC
+ *
+ * Only ASCII frames can do this: their CRC covers just the body. Binary frame
+ * CRCs start with the lengths, which are known only once the body is complete.
+ */
+static void jwCrcUpdate(testComm_jw_t* jw)
+{
+	if (jw->frame && !jw->binary && !jw->error) {
+		jw->crc = crc32_le(jw->crc, &jw->buf[jw->crcPos], jw->pos - jw->crcPos);
+		jw->crcPos = jw->pos;
+	}
+}
+
+static void jwOpen(testComm_jw_t* jw, const char* key, char c)
+{
+	jwValue(jw, key);
+	if (jw->depth >= TESTCOMM_JW_DEPTH_MAX) {
+		jw->error = true;
+		return;
+	}
+	jwPut(jw, &c, 1);
+	jw->depth++;
+	jw->hasItems &= ~(1UL << jw->depth);
+}
+
+static void jwClose(testComm_jw_t* jw, char c)
+{
+	if (jw->depth == 0) {
+		jw->error = true;
+		return;
+	}
+	jwPut(jw, &c, 1);
+	jw->depth--;
+
+	// Checksum each completed element of the result while it is still hot
+	if (jw->depth <= 2) {
+		jwCrcUpdate(jw);
+	}
+}
+
+void testCommJwObjectStart(testComm_jw_t* jw, const char* key)
+{
+	jwOpen(jw, key, '{');
+}
+
+void testCommJwObjectEnd(testComm_jw_t* jw)
+{
+	jwClose(jw, '}');
+}
+
+void testCommJwArrayStart(testComm_jw_t* jw, const char* key)
+{
+	jwOpen(jw, key, '[');
+}
+
+void testCommJwArrayEnd(testComm_jw_t* jw)
+{
+	jwClose(jw, ']');
+}
+
+void testCommJwString(testComm_jw_t* jw, const char* key, const char* val)
+{
+	jwValue(jw, key);
+	jwPutStr(jw, val);
+}
+
+void testCommJwNumber(testComm_jw_t* jw, const char* key, double val)
+{
+	char	num[32];
+	int		len;
+
+	jwValue(jw, key);
+	if (!isfinite(val)) {
+		// Same as cJSON: JSON has no NaN or infinity
+		jwPut(jw, "null", 4);
+		return;
+	}
+
+	// Shortest form that reads back as the same value
+	len = snprintf(num, sizeof(num), "%1.15g", val);
+	if (strtod(num, NULL) != val) {
+		len = snprintf(num, sizeof(num), "%1.17g", val);
+	}
+	jwPut(jw, num, len);
+}
+
+void testCommJwInt(testComm_jw_t* jw, const char* key, int64_t val)
+{
+	char	num[24];
+	int		len = snprintf(num, sizeof(num), "%lld", (long long)val);
+
+	jwValue(jw, key);
+	jwPut(jw, num, len);
+}
+
+void testCommJwBool(testComm_jw_t* jw, const char* key, bool val)
+{
+	jwValue(jw, key);
+	if (val) {
+		jwPut(jw, "true", 4);
+	} else {
+		jwPut(jw, "false", 5);
+	}
+}
+
+void testCommJwNull(testComm_jw_t* jw, const char* key)
+{
+	jwValue(jw, key);
+	jwPut(jw, "null", 4);
+}
+
+void testCommJwBufInit(testComm_jw_t* jw, int initSz)
+{
+	memset(jw, 0, sizeof(*jw));
+	jw->cjsonMem = true;
+	jw->reserve = 1;
+	jw->cap = initSz > 0 ? initSz : 64;
+	jw->buf = cJSON_malloc(jw->cap + jw->reserve);
+	if (!jw->buf) {
+		jw->error = true;
+	}
+}
+
+char* testCommJwBufTake(testComm_jw_t* jw)
+{
+	char*	text = (char*)jw->buf;
+
+	if (jw->error || jw->depth != 0 || !(jw->hasItems & 1)) {
+		cJSON_free(jw->buf);
+		text = NULL;
+	} else {
+		text[jw->pos] = '\0';
+	}
+	jw->buf = NULL;
+	return text;
+}
@@ -8,7 +8,11 @@
 
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
 #include "esp32/rom/crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "driver/uart.h"
 #include "esp_timer.h"
 #include "cJSON.h"
@@ -23,6 +27,7 @@ static const char* TAG = "test_comm";
 #define MSG_STX		((char)0x02)	// Start of text
 #define MSG_ETX		((char)0x03)	// End of text
 #define MSG_EOT		((char)0x04)	// End of transmission
+#define MSG_SYN		((char)0x16)	// Start of binary frame
 
 // Message receive states
 typedef enum {
@@ -30,38 +35,107 @@ typedef enum {
 	msgState_hdr,		// Receiving header until STX
 	msgState_body,		// Receiving message body until ETX
 	msgState_crc,		// Receiving CRC until EOT
-	msgState_err		// Recovering from error
+	msgState_err,		// Recovering from error
+	msgState_binHdrLen,	// Binary: receiving header length
+	msgState_binHdr,	// Binary: receiving header
+	msgState_binLen,	// Binary: receiving JSON and attachment lengths
+	msgState_binBody,	// Binary: receiving JSON and attachment
+	msgState_binCrc,	// Binary: receiving CRC32
+	msgState_binSkip	// Binary: discarding an oversized frame
 } msgState_t;
 
 #define MSG_HDR_SZ	(10)
-#define MSG_BODY_SZ	(30000)
+#define MSG_ID_SEP	'#'		// Separates header type from request ID, e.g. "CMD#1a"
+#define MSG_ID_SZ	(4)		// Max hex digits in a request ID
+#define MSG_BUF_SZ_DEFAULT	(30000)	// Message buffer size if not configured
 #define MSG_CRC_SZ	(10)
+#define MSG_BIN_LEN_SZ	(8)		// Binary frame JSON length + attachment length
+#define MSG_BIN_CRC_SZ	(4)		// Binary frame CRC32
+#define MSG_SKIP_MAX	(0x100000)	// Larger lengths are treated as noise, not skipped
 #define HTTP_RX_SZ	(8000)
 
+#define EVT_TOPIC_MAX	(8)		// Number of topics the host may subscribe to
+#define EVT_TOPIC_SZ	(15)	// Longest topic name
+#define EVT_TX_WAIT_MS	(50)	// Events are dropped if no frame frees up in this time
+
+// Largest frame overhead (binary: SYN, header length, header, lengths, CRC32)
+#define MSG_TX_OVHD	(2 + MSG_HDR_SZ + MSG_BIN_LEN_SZ + MSG_BIN_CRC_SZ)
+// Space after the body (ASCII: ETX, hex CRC + NUL, EOT)
+#define MSG_TX_TRAILER_SZ	(1 + MSG_CRC_SZ + 1)
+
+// Receive message slot, frames are assembled directly into buf
+typedef struct {
+	testComm_mesg_t	mesg;	// View of buf handed to cmdProc
+	char*			buf;	// msgBufSz + 1 bytes, room for the JSON terminator
+} rxSlot_t;
+
+// A complete outgoing frame, written to the UART by txTask
+typedef struct {
+	uint8_t*	buf;		// Preallocated frame storage
+	uint8_t*	heapBuf;	// Frame too large for buf, freed after sending
+	int			len;
+	int64_t		rxTimeUs;	// Request completion time, for latency stats
+	uint8_t		latClass;
+	uint32_t	newBaud;	// Change baud rate once this frame has gone out
+} txFrame_t;
+
 typedef struct {
 	testComm_conf_t	conf;
 	bool			isRunning;
 	int64_t			curTimeMs;
 	char*			rxBuf;
+	QueueHandle_t	uartQueue;	// UART driver events
+	QueueHandle_t	rxQueue;	// Received messages waiting for cmdTask
+	QueueHandle_t	rxFreeQueue;	// Unused message slots
+	QueueHandle_t	txQueue;	// Frames waiting for txTask
+	QueueHandle_t	txFreeQueue;	// Unused frames from txFrames
+	txFrame_t*		txFrames;
+	SemaphoreHandle_t	statsMutex;
+	testComm_framing_t	framing;
+	testComm_stats_t	stats;
+	struct {
+		SemaphoreHandle_t	mutex;
+		int			count;
+		char		topic[EVT_TOPIC_MAX][EVT_TOPIC_SZ + 1];	// Subscribed topics, "*" for all
+	} evt;
 	struct {
 		msgState_t	state;
+		testComm_replyTo_t	replyTo;
+		rxSlot_t*	slot;		// Slot receiving the body, NULL until the header is complete
 		char		hdr[MSG_HDR_SZ + 1];
-		char		body[MSG_BODY_SZ + 1];
 		char		crc[MSG_CRC_SZ];
 		int			len;
-		uint32_t	crc32;
+		int			bodyLen;
+		uint32_t	crc32;		// Running CRC of the frame
+		// Binary frame fields
+		uint8_t		hdrLen;
+		uint8_t		binLenBuf[MSG_BIN_LEN_SZ];
+		uint32_t	jsonLen;
+		uint32_t	binLen;
+		uint32_t	skipLen;
+		bool		discard;	// Frame rejected, skip its payload
 	} msg;
 	struct {
-		bool		active;
-		uint32_t	timeMs;
+		bool			active;
+		uint32_t		timeMs;
+		portMUX_TYPE	mux;		// Set by any task sending a response, read by commTask
 	} reboot;
 } appCtrl_t;
 
 
-static esp_err_t initUart(testComm_conf_t* conf);
+static esp_err_t initUart(appCtrl_t* pCtrl);
 static void commTask(void* param);
-static void sendResponse(appCtrl_t* pCtrl, cJSON* jResp);
-static void sendErrResponse(appCtrl_t* pCtrl, int errCode, const char* errMesg);
+static void cmdTask(void* param);
+static void txTask(void* param);
+static bool sendJson(appCtrl_t* pCtrl, const testComm_replyTo_t* replyTo, const char* hdr, cJSON* jBody, uint32_t newBaud, TickType_t wait);
+static txFrame_t* txFrameGet(appCtrl_t* pCtrl, const testComm_replyTo_t* replyTo, TickType_t wait);
+static void txFrameRelease(appCtrl_t* pCtrl, txFrame_t* frame);
+static const char* txHdr(const testComm_replyTo_t* replyTo, const char* hdr, char* hdrBuf, int hdrBufSz);
+static int txFramePrefix(uint8_t* buf, bool binary, const char* hdr);
+static int txFrameTrailer(uint8_t* buf, bool binary, int bodyOff, int bodyLen, int binLen);
+static int txFrameAsciiTrailer(uint8_t* buf, int pos, uint32_t crc32);
+static void sendResponse(appCtrl_t* pCtrl, const testComm_replyTo_t* replyTo, cJSON* jResp, uint32_t newBaud);
+static void sendErrResponse(appCtrl_t* pCtrl, const testComm_replyTo_t* replyTo, int errCode, const char* errMesg);
 
 static appCtrl_t*	appCtrl;
 
@@ -84,11 +158,62 @@ esp_err_t testCommInit(testComm_conf_t* conf)
 	// Store the configuration
 	pCtrl->conf = *conf;
 
+	// ASCII framing until the host negotiates otherwise
+	pCtrl->framing = testComm_framing_ascii;
+	portMUX_INITIALIZE(&pCtrl->reboot.mux);
+
 	// Allocate the receive buffer
 	if ((pCtrl->rxBuf = malloc(pCtrl->conf.rxBufSz)) == NULL) {
 		return ESP_ERR_NO_MEM;
 	}
 
+	// Message slots: one being received, one being processed, the rest queued
+	if (pCtrl->conf.rxQueueDepth < 1) {
+		pCtrl->conf.rxQueueDepth = 1;
+	}
+	if (pCtrl->conf.msgBufSz <= 0) {
+		pCtrl->conf.msgBufSz = MSG_BUF_SZ_DEFAULT;
+	}
+	int	slotCount = pCtrl->conf.rxQueueDepth + 2;
+
+	pCtrl->rxQueue = xQueueCreate(slotCount, sizeof(rxSlot_t*));
+	pCtrl->rxFreeQueue = xQueueCreate(slotCount, sizeof(rxSlot_t*));
+	pCtrl->statsMutex = xSemaphoreCreateMutex();
+	pCtrl->evt.mutex = xSemaphoreCreateMutex();
+	if (!pCtrl->rxQueue || !pCtrl->rxFreeQueue || !pCtrl->statsMutex || !pCtrl->evt.mutex) {
+		return ESP_ERR_NO_MEM;
+	}
+	for (int i = 0; i < slotCount; i++) {
+		rxSlot_t* slot = calloc(1, sizeof(*slot));
+		if (!slot) {
+			return ESP_ERR_NO_MEM;
+		}
+		// Prefer the configured memory (e.g. PSRAM), fall back to any
+		slot->buf = NULL;
+		if (pCtrl->conf.msgBufCaps) {
+			slot->buf = heap_caps_malloc(pCtrl->conf.msgBufSz + 1, pCtrl->conf.msgBufCaps);
+		}
+		if (!slot->buf && (slot->buf = malloc(pCtrl->conf.msgBufSz + 1)) == NULL) {
+			return ESP_ERR_NO_MEM;
+		}
+		xQueueSend(pCtrl->rxFreeQueue, &slot, 0);
+	}
+
+	// Pool of transmit frames, cycled between txFreeQueue and txQueue
+	pCtrl->txQueue = xQueueCreate(CONFIG_TEST_COMM_TX_FRAME_CNT, sizeof(txFrame_t*));
+	pCtrl->txFreeQueue = xQueueCreate(CONFIG_TEST_COMM_TX_FRAME_CNT, sizeof(txFrame_t*));
+	pCtrl->txFrames = calloc(CONFIG_TEST_COMM_TX_FRAME_CNT, sizeof(txFrame_t));
+	if (!pCtrl->txQueue || !pCtrl->txFreeQueue || !pCtrl->txFrames) {
+		return ESP_ERR_NO_MEM;
+	}
+	for (int i = 0; i < CONFIG_TEST_COMM_TX_FRAME_CNT; i++) {
+		txFrame_t* frame = &pCtrl->txFrames[i];
+		if ((frame->buf = malloc(CONFIG_TEST_COMM_TX_FRAME_SZ)) == NULL) {
+			return ESP_ERR_NO_MEM;
+		}
+		xQueueSend(pCtrl->txFreeQueue, &frame, 0);
+	}
+
 	esp_err_t status;
 	if ((status = watchdogInit()) != ESP_OK) {
 		return status;
@@ -110,16 +235,16 @@ esp_err_t testCommStart(void)
 
 	esp_err_t status;
 
-	if ((status = initUart(&pCtrl->conf)) != ESP_OK) {
+	if ((status = initUart(pCtrl)) != ESP_OK) {
 		return status;
 	}
 
-	// Start the application task
+	// Start the receive task
 	BaseType_t	ret;
 	ret = xTaskCreate(
 		commTask,
 		"test_comm",
-		4000,
+		3000,
 		(void*)pCtrl,
 		pCtrl->conf.taskPriority,
 		NULL
@@ -129,6 +254,34 @@ esp_err_t testCommStart(void)
 		return ESP_FAIL;
 	}
 
+	// Start the transmit task
+	ret = xTaskCreate(
+		txTask,
+		"test_comm_tx",
+		2500,
+		(void*)pCtrl,
+		pCtrl->conf.taskPriority,
+		NULL
+	);
+	if (pdPASS != ret) {
+		ESP_LOGE(TAG, "TX task create failed");
+		return ESP_FAIL;
+	}
+
+	// Start the command task
+	ret = xTaskCreate(
+		cmdTask,
+		"test_comm_cmd",
+		4000,
+		(void*)pCtrl,
+		pCtrl->conf.cmdTaskPriority,
+		NULL
+	);
+	if (pdPASS != ret) {
+		ESP_LOGE(TAG, "Command task create failed");
+		return ESP_FAIL;
+	}
+
 	// Start the watchdog timer
 	watchdogStart();
 
@@ -136,6 +289,28 @@ esp_err_t testCommStart(void)
 	return ESP_OK;
 }
 
+/**
+ * @brief Apply the framing and reboot requests of a command. A baud change
+ * travels with the response frame instead.
+ */
+static void applyAction(appCtrl_t* pCtrl, testComm_action_t* action)
+{
+	// Framing change applies to requests after this one
+	if (action->framing != testComm_framing_none) {
+		pCtrl->framing = action->framing;
+		action->framing = testComm_framing_none;
+	}
+
+	// Maybe schedule reboot. Responses are sent by several tasks, so only a
+	// reboot request is applied: a later response never cancels it
+	if (action->reboot.active) {
+		portENTER_CRITICAL(&pCtrl->reboot.mux);
+		pCtrl->reboot.active = true;
+		pCtrl->reboot.timeMs = action->reboot.timeMs;
+		portEXIT_CRITICAL(&pCtrl->reboot.mux);
+	}
+}
+
 static esp_err_t enterAPI(appCtrl_t** pCtrl)
 {
 	*pCtrl = appCtrl;
@@ -146,7 +321,7 @@ static esp_err_t enterAPI(appCtrl_t** pCtrl)
 	return ESP_OK;
 }
 
-esp_err_t testCommSendResponse(cJSON* jResp, testComm_action_t* action)
+esp_err_t testCommGetStats(testComm_stats_t* stats, bool reset)
 {
 	esp_err_t status;
 	appCtrl_t* pCtrl;
@@ -154,38 +329,330 @@ esp_err_t testCommSendResponse(cJSON* jResp, testComm_action_t* action)
 	if ((status = enterAPI(&pCtrl)) != ESP_OK) {
 		return status;
 	}
+	if (!stats) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	xSemaphoreTake(pCtrl->statsMutex, portMAX_DELAY);
+	*stats = pCtrl->stats;
+	if (reset) {
+		memset(&pCtrl->stats, 0, sizeof(pCtrl->stats));
+	}
+	xSemaphoreGive(pCtrl->statsMutex);
+
+	return ESP_OK;
+}
+
+esp_err_t testCommSendResponse(const testComm_replyTo_t* replyTo, cJSON* jResp, testComm_action_t* action)
+{
+	esp_err_t status;
+	appCtrl_t* pCtrl;
+
+	if ((status = enterAPI(&pCtrl)) != ESP_OK) {
+		return status;
+	}
+
+	// A baud change is made by txTask once the response has gone out
+	sendResponse(pCtrl, replyTo, jResp, action->newBaud);
+	action->newBaud = 0;
 
-	sendResponse(pCtrl, jResp);
+	applyAction(pCtrl, action);
+	return ESP_OK;
+}
 
-	// Maybe schedule reboot
-	pCtrl->reboot.active = action->reboot.active;
-	pCtrl->reboot.timeMs = action->reboot.timeMs;
+esp_err_t testCommRespStreamBegin(testComm_jw_t* jw, const testComm_replyTo_t* replyTo)
+{
+	esp_err_t status;
+	appCtrl_t* pCtrl;
 
-	if (action->newBaud > 0) {
-		uart_port_t port = pCtrl->conf.uart.port;
-		uart_wait_tx_done(port, pdMS_TO_TICKS(1000));
-		uart_set_baudrate(port, action->newBaud);
-		action->newBaud = 0;
+	if ((status = enterAPI(&pCtrl)) != ESP_OK) {
+		return status;
 	}
 
+	char		hdrBuf[MSG_HDR_SZ + 1];
+	const char*	hdr = txHdr(replyTo, "RESP", hdrBuf, sizeof(hdrBuf));
+	txFrame_t*	frame = txFrameGet(pCtrl, replyTo, portMAX_DELAY);
+
+	memset(jw, 0, sizeof(*jw));
+	jw->frame = frame;
+	jw->binary = replyTo && replyTo->binary;
+	jw->buf = frame->buf;
+	jw->bodyOff = txFramePrefix(frame->buf, jw->binary, hdr);
+	jw->crcPos = jw->bodyOff;
+	// Room for the closing brace and the trailer
+	jw->reserve = 1 + MSG_TX_TRAILER_SZ;
+	jw->cap = CONFIG_TEST_COMM_TX_FRAME_SZ - jw->reserve;
+
+	static const char	envelope[] = "{\"result\":";
+	memcpy(&jw->buf[jw->bodyOff], envelope, sizeof(envelope) - 1);
+	jw->pos = jw->bodyOff + sizeof(envelope) - 1;
+
 	return ESP_OK;
 }
 
-esp_err_t testCommSendErrResponse(int errCode, const char* errMesg)
+/**
+ * @brief Send raw bytes after the JSON text of a streamed response
+ *
+ * Only a binary frame carries an attachment; data is copied at
+ * testCommRespStreamEnd() so must stay valid until then. Returns false, with
+ * nothing attached, for ASCII framing and buffered writers.
+ */
+bool testCommJwAttach(testComm_jw_t* jw, const void* data, int len)
+{
+	if (!jw->frame || !jw->binary || len < 0) {
+		return false;
+	}
+	jw->att = data;
+	jw->attLen = len;
+	return true;
+}
+
+esp_err_t testCommRespStreamEnd(testComm_jw_t* jw, testComm_action_t* action)
 {
 	esp_err_t status;
 	appCtrl_t* pCtrl;
 
 	if ((status = enterAPI(&pCtrl)) != ESP_OK) {
+		testCommRespStreamAbort(jw);
 		return status;
 	}
+	if (!jw->frame || jw->error || jw->depth != 0 || !(jw->hasItems & 1)) {
+		// Incomplete result, the caller sends an error instead
+		testCommRespStreamAbort(jw);
+		return ESP_FAIL;
+	}
+
+	txFrame_t*	frame = jw->frame;
+	uint8_t*	buf = jw->buf;
+	int			pos = jw->pos;
+
+	// The closing brace fits the reserved space
+	buf[pos++] = '}';
+	if (jw->binary) {
+		if (jw->attLen > 0) {
+			// The attachment follows the JSON text
+			int	need = pos + jw->attLen + MSG_BIN_CRC_SZ;
+			if (need > jw->cap + jw->reserve) {
+				uint8_t*	newBuf = malloc(need);
+				if (!newBuf) {
+					ESP_LOGE(TAG, "No memory for %d byte attachment", jw->attLen);
+					testCommRespStreamAbort(jw);
+					return ESP_ERR_NO_MEM;
+				}
+				memcpy(newBuf, buf, pos);
+				if (jw->spilled) {
+					free(buf);
+				}
+				jw->spilled = true;
+				jw->buf = buf = newBuf;
+			}
+			memcpy(&buf[pos], jw->att, jw->attLen);
+		}
+		frame->len = txFrameTrailer(buf, true, jw->bodyOff, pos - jw->bodyOff, jw->attLen);
+	} else {
+		uint32_t	crc32 = crc32_le(jw->crc, &buf[jw->crcPos], pos - jw->crcPos);
+		frame->len = txFrameAsciiTrailer(buf, pos, crc32);
+	}
+	if (jw->spilled) {
+		frame->heapBuf = buf;
+	}
+	jw->frame = NULL;
+	jw->buf = NULL;
 
-	sendErrResponse(pCtrl, errCode, errMesg);
+	frame->newBaud = action->newBaud;
+	action->newBaud = 0;
+	xQueueSend(pCtrl->txQueue, &frame, portMAX_DELAY);
+
+	applyAction(pCtrl, action);
 	return ESP_OK;
 }
 
-static esp_err_t initUart(testComm_conf_t* conf)
+void testCommRespStreamAbort(testComm_jw_t* jw)
+{
+	txFrame_t*	frame = jw->frame;
+
+	if (!frame) {
+		return;
+	}
+	if (jw->spilled) {
+		frame->heapBuf = jw->buf;
+	}
+	jw->frame = NULL;
+	jw->buf = NULL;
+	txFrameRelease(appCtrl, frame);
+}
+
+esp_err_t testCommSendErrResponse(const testComm_replyTo_t* replyTo, int errCode, const char* errMesg)
 {
+	esp_err_t status;
+	appCtrl_t* pCtrl;
+
+	if ((status = enterAPI(&pCtrl)) != ESP_OK) {
+		return status;
+	}
+
+	sendErrResponse(pCtrl, replyTo, errCode, errMesg);
+	return ESP_OK;
+}
+
+/**
+ * @brief Release a message kept by the command processor, its slot may receive another
+ */
+void testCommMesgRelease(const testComm_mesg_t* mesg)
+{
+	appCtrl_t*	pCtrl = appCtrl;
+	if (!pCtrl || !mesg) {
+		return;
+	}
+
+	// The message is the first member of its slot
+	rxSlot_t*	slot = (rxSlot_t*)mesg;
+	xQueueSend(pCtrl->rxFreeQueue, &slot, 0);
+}
+
+/**
+ * @brief Find a subscribed topic, returns its index or -1. Call with evt.mutex held.
+ */
+static int evtFind(appCtrl_t* pCtrl, const char* topic)
+{
+	for (int i = 0; i < pCtrl->evt.count; i++) {
+		if (strcmp(topic, pCtrl->evt.topic[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+esp_err_t testCommEventSubscribe(const char* topic)
+{
+	appCtrl_t* pCtrl = appCtrl;
+	if (!pCtrl) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	if (!topic || strlen(topic) == 0 || strlen(topic) > EVT_TOPIC_SZ) {
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	esp_err_t	status = ESP_OK;
+
+	xSemaphoreTake(pCtrl->evt.mutex, portMAX_DELAY);
+	if (evtFind(pCtrl, topic) < 0) {
+		if (pCtrl->evt.count < EVT_TOPIC_MAX) {
+			strcpy(pCtrl->evt.topic[pCtrl->evt.count], topic);
+			pCtrl->evt.count += 1;
+		} else {
+			status = ESP_ERR_NO_MEM;
+		}
+	}
+	xSemaphoreGive(pCtrl->evt.mutex);
+
+	return status;
+}
+
+esp_err_t testCommEventUnsubscribe(const char* topic)
+{
+	appCtrl_t* pCtrl = appCtrl;
+	if (!pCtrl) {
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	xSemaphoreTake(pCtrl->evt.mutex, portMAX_DELAY);
+	if (!topic) {
+		pCtrl->evt.count = 0;
+	} else {
+		int	idx = evtFind(pCtrl, topic);
+		if (idx >= 0) {
+			// Move the last entry into the vacated slot
+			pCtrl->evt.count -= 1;
+			if (idx != pCtrl->evt.count) {
+				strcpy(pCtrl->evt.topic[idx], pCtrl->evt.topic[pCtrl->evt.count]);
+			}
+		}
+	}
+	xSemaphoreGive(pCtrl->evt.mutex);
+
+	return ESP_OK;
+}
+
+esp_err_t testCommEventList(cJSON* jTopics)
+{
+	appCtrl_t* pCtrl = appCtrl;
+	if (!pCtrl) {
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	xSemaphoreTake(pCtrl->evt.mutex, portMAX_DELAY);
+	for (int i = 0; i < pCtrl->evt.count; i++) {
+		cJSON_AddItemToArray(jTopics, cJSON_CreateString(pCtrl->evt.topic[i]));
+	}
+	xSemaphoreGive(pCtrl->evt.mutex);
+
+	return ESP_OK;
+}
+
+bool testCommEventEnabled(const char* topic)
+{
+	appCtrl_t* pCtrl = appCtrl;
+	if (!pCtrl || !pCtrl->isRunning || !topic) {
+		return false;
+	}
+
+	xSemaphoreTake(pCtrl->evt.mutex, portMAX_DELAY);
+	bool enabled = (evtFind(pCtrl, topic) >= 0 || evtFind(pCtrl, "*") >= 0);
+	xSemaphoreGive(pCtrl->evt.mutex);
+
+	return enabled;
+}
+
+esp_err_t testCommSendEvent(const char* topic, cJSON* jData)
+{
+	esp_err_t status;
+	appCtrl_t* pCtrl;
+
+	if ((status = enterAPI(&pCtrl)) != ESP_OK) {
+		cJSON_Delete(jData);
+		return status;
+	}
+
+	// Topics the host has not asked for are dropped quietly
+	if (!testCommEventEnabled(topic)) {
+		cJSON_Delete(jData);
+		return ESP_OK;
+	}
+
+	cJSON*	jEvt = cJSON_CreateObject();
+	if (!jEvt) {
+		cJSON_Delete(jData);
+		return ESP_ERR_NO_MEM;
+	}
+	cJSON_AddStringToObject(jEvt, "topic", topic);
+	cJSON_AddNumberToObject(jEvt, "time_ms", (double)(esp_timer_get_time() / 1000LL));
+	if (jData) {
+		cJSON_AddItemToObject(jEvt, "data", jData);
+	}
+
+	// Events use the negotiated framing and carry no request ID
+	testComm_replyTo_t	replyTo = {
+		.binary = (testComm_framing_binary == pCtrl->framing)
+	};
+
+	bool sent = sendJson(pCtrl, &replyTo, "EVT", jEvt, 0, pdMS_TO_TICKS(EVT_TX_WAIT_MS));
+
+	xSemaphoreTake(pCtrl->statsMutex, portMAX_DELAY);
+	if (sent) {
+		pCtrl->stats.evtSent++;
+	} else {
+		pCtrl->stats.evtDropped++;
+	}
+	xSemaphoreGive(pCtrl->statsMutex);
+
+	return sent ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t initUart(appCtrl_t* pCtrl)
+{
+	testComm_conf_t* conf = &pCtrl->conf;
+
     uart_config_t uart_config = {
         .baud_rate = conf->uart.baud,
         .data_bits = UART_DATA_8_BITS,
@@ -196,53 +663,241 @@ static esp_err_t initUart(testComm_conf_t* conf)
 
 	uart_port_t port = conf->uart.port;
 
-    ESP_ERROR_CHECK(uart_driver_install(port, 1024 * 2, 0, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_driver_install(
+    	port,
+    	CONFIG_TEST_COMM_RX_RING_SZ,
+    	0,
+    	CONFIG_TEST_COMM_EVT_QUEUE_SZ,
+    	&pCtrl->uartQueue,
+    	0
+    ));
     ESP_ERROR_CHECK(uart_param_config(port, &uart_config));
     ESP_ERROR_CHECK(uart_set_pin(port, conf->uart.gpio_txd, conf->uart.gpio_rxd, -1, -1));
 
+    // Raise a pattern event as soon as a frame-ending EOT arrives, rather than
+    // waiting for the FIFO threshold or the RX timeout. Binary frames have no
+    // EOT and complete on the RX timeout.
+    ESP_ERROR_CHECK(uart_enable_pattern_det_baud_intr(port, MSG_EOT, 1, 1, 0, 0));
+    ESP_ERROR_CHECK(uart_pattern_queue_reset(port, CONFIG_TEST_COMM_PATTERN_QUEUE_SZ));
+    ESP_ERROR_CHECK(uart_set_rx_full_threshold(port, CONFIG_TEST_COMM_RX_FIFO_THRESH));
+    ESP_ERROR_CHECK(uart_set_rx_timeout(port, CONFIG_TEST_COMM_RX_TOUT_SYMBOLS));
+
     return ESP_OK;
 }
 
-static void sendMsg(appCtrl_t* pCtrl, const char* hdr, const char* body)
+static void put32le(uint8_t* buf, uint32_t val)
 {
-	static const char soh[1] = {MSG_SOH};
-	static const char stx[1] = {MSG_STX};
-	static const char etx[1] = {MSG_ETX};
-	static const char eot[1] = {MSG_EOT};
+	buf[0] = (uint8_t)(val);
+	buf[1] = (uint8_t)(val >> 8);
+	buf[2] = (uint8_t)(val >> 16);
+	buf[3] = (uint8_t)(val >> 24);
+}
 
-	int	bodyLen = strlen(body);
+static uint32_t get32le(const uint8_t* buf)
+{
+	return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
 
-	// Calc CRC32 of body and form hex string
+/**
+ * @brief Write the frame up to the body, returning the offset of the body
+ *
+ * ASCII:  SOH <hdr> STX <body> ETX <crc> EOT
+ * Binary: SYN <hdr len:1> <hdr> <json len:4> <bin len:4> <json> <bin> <crc32:4>
+ *
+ * Binary lengths and CRC are little-endian, the CRC covers everything after SYN.
+ */
+static int txFramePrefix(uint8_t* buf, bool binary, const char* hdr)
+{
+	int	hdrLen = strlen(hdr);
+	int	pos = 0;
+
+	if (hdrLen > MSG_HDR_SZ) {
+		hdrLen = MSG_HDR_SZ;
+	}
+
+	if (binary) {
+		buf[pos++] = MSG_SYN;
+		buf[pos++] = (uint8_t)hdrLen;
+		memcpy(&buf[pos], hdr, hdrLen);
+		pos += hdrLen;
+		// Lengths are filled in by txFrameTrailer
+		pos += MSG_BIN_LEN_SZ;
+	} else {
+		buf[pos++] = MSG_SOH;
+		memcpy(&buf[pos], hdr, hdrLen);
+		pos += hdrLen;
+		buf[pos++] = MSG_STX;
+	}
+	return pos;
+}
+
+/**
+ * @brief Complete a frame whose body is in place, returning the frame length
+ *
+ * A binary frame body is the JSON text followed by binLen attachment bytes.
+ */
+static int txFrameTrailer(uint8_t* buf, bool binary, int bodyOff, int bodyLen, int binLen)
+{
+	int			pos = bodyOff + bodyLen;
 	uint32_t	crc32;
-	char		crcBuf[10];
-	int			crcLen;
-	crc32 = crc32_le(0, (uint8_t *)body, bodyLen);
-	crcLen = sprintf(crcBuf, "%lx", crc32);
 
-	uart_port_t  port = pCtrl->conf.uart.port;
+	if (binary) {
+		put32le(&buf[bodyOff - MSG_BIN_LEN_SZ], bodyLen);
+		put32le(&buf[bodyOff - MSG_BIN_LEN_SZ + 4], binLen);
+		pos += binLen;
+		crc32 = crc32_le(0, &buf[1], pos - 1);
+		put32le(&buf[pos], crc32);
+		pos += MSG_BIN_CRC_SZ;
+	} else {
+		crc32 = crc32_le(0, &buf[bodyOff], bodyLen);
+		pos = txFrameAsciiTrailer(buf, pos, crc32);
+	}
+	return pos;
+}
+
+/**
+ * @brief Append the ASCII trailer for a body CRC at pos, returning the frame length
+ */
+static int txFrameAsciiTrailer(uint8_t* buf, int pos, uint32_t crc32)
+{
+	buf[pos++] = MSG_ETX;
+	pos += sprintf((char*)&buf[pos], "%lx", crc32);
+	buf[pos++] = MSG_EOT;
+	return pos;
+}
+
+/**
+ * @brief Take a frame from the pool, waiting for txTask if all are in use
+ */
+static txFrame_t* txFrameGet(appCtrl_t* pCtrl, const testComm_replyTo_t* replyTo, TickType_t wait)
+{
+	txFrame_t*	frame;
+
+	if (xQueueReceive(pCtrl->txFreeQueue, &frame, wait) != pdPASS) {
+		return NULL;
+	}
+	frame->heapBuf = NULL;
+	frame->len = 0;
+	frame->rxTimeUs = replyTo ? replyTo->rxTimeUs : 0;
+	frame->latClass = (replyTo && replyTo->latClass < TESTCOMM_LAT_CLASSES) ? replyTo->latClass : 0;
+	frame->newBaud = 0;
+	return frame;
+}
+
+static void txFrameRelease(appCtrl_t* pCtrl, txFrame_t* frame)
+{
+	free(frame->heapBuf);
+	frame->heapBuf = NULL;
+	xQueueSend(pCtrl->txFreeQueue, &frame, 0);
+}
+
+/**
+ * @brief Form the reply header, adding the request ID if any
+ */
+static const char* txHdr(const testComm_replyTo_t* replyTo, const char* hdr, char* hdrBuf, int hdrBufSz)
+{
+	if (replyTo && replyTo->hasId) {
+		snprintf(hdrBuf, hdrBufSz, "%s%c%x", hdr, MSG_ID_SEP, replyTo->id);
+		return hdrBuf;
+	}
+	return hdr;
+}
+
+static void sendMsg(appCtrl_t* pCtrl, const testComm_replyTo_t* replyTo, const char* hdr, const char* body)
+{
+	char		hdrBuf[MSG_HDR_SZ + 1];
+	bool		binary = replyTo && replyTo->binary;
+	int			bodyLen = strlen(body);
+	txFrame_t*	frame = txFrameGet(pCtrl, replyTo, portMAX_DELAY);
+	uint8_t*	buf = frame->buf;
+
+	hdr = txHdr(replyTo, hdr, hdrBuf, sizeof(hdrBuf));
+
+	if (bodyLen + MSG_TX_OVHD > CONFIG_TEST_COMM_TX_FRAME_SZ) {
+		if ((buf = frame->heapBuf = malloc(bodyLen + MSG_TX_OVHD)) == NULL) {
+			ESP_LOGE(TAG, "No memory for %d byte frame", bodyLen);
+			txFrameRelease(pCtrl, frame);
+			return;
+		}
+	}
+
+	int	bodyOff = txFramePrefix(buf, binary, hdr);
+	memcpy(&buf[bodyOff], body, bodyLen);
+	frame->len = txFrameTrailer(buf, binary, bodyOff, bodyLen, 0);
 
-	uart_write_bytes(port, soh, 1);
-	uart_write_bytes(port, hdr, strlen(hdr));
-	uart_write_bytes(port, stx, 1);
-	uart_write_bytes(port, body, bodyLen);
-	uart_write_bytes(port, etx, 1);
-	uart_write_bytes(port, crcBuf, crcLen);
-	uart_write_bytes(port, eot, 1);
+	xQueueSend(pCtrl->txQueue, &frame, portMAX_DELAY);
 }
 
-static void sendResponse(appCtrl_t* pCtrl, cJSON* jResp)
+/**
+ * @brief Serialize a JSON body straight into a transmit frame and queue it
+ *
+ * Bodies that do not fit a pool frame are printed to the heap instead.
+ * Takes ownership of jBody. Returns false if the frame was not sent.
+ */
+static bool sendJson(
+	appCtrl_t*					pCtrl,
+	const testComm_replyTo_t*	replyTo,
+	const char*					hdr,
+	cJSON*						jBody,
+	uint32_t					newBaud,
+	TickType_t					wait
+)
 {
-	// Turn JSON object into a string
-	char* resp = cJSON_PrintUnformatted(jResp);
+	char		hdrBuf[MSG_HDR_SZ + 1];
+	bool		binary = replyTo && replyTo->binary;
+	txFrame_t*	frame = txFrameGet(pCtrl, replyTo, wait);
+	if (!frame) {
+		cJSON_Delete(jBody);
+		return false;
+	}
+
+	hdr = txHdr(replyTo, hdr, hdrBuf, sizeof(hdrBuf));
+
+	int			bodyOff = txFramePrefix(frame->buf, binary, hdr);
+	int			bodyLen;
+	cJSON*		jResp = jBody;
+
+	frame->newBaud = newBaud;
+
+	char*	body = (char*)&frame->buf[bodyOff];
+	int		bodyMax = CONFIG_TEST_COMM_TX_FRAME_SZ - bodyOff - MSG_TX_TRAILER_SZ;
+	if (cJSON_PrintPreallocated(jResp, body, bodyMax, false)) {
+		bodyLen = strlen(body);
+		frame->len = txFrameTrailer(frame->buf, binary, bodyOff, bodyLen, 0);
+	} else {
+		// Too large for a pool frame
+		char* resp = cJSON_PrintUnformatted(jResp);
+		if (resp) {
+			bodyLen = strlen(resp);
+			frame->heapBuf = malloc(bodyLen + MSG_TX_OVHD);
+		}
+		if (!resp || !frame->heapBuf) {
+			ESP_LOGE(TAG, "No memory for %s frame", hdr);
+			cJSON_free(resp);
+			cJSON_Delete(jResp);
+			txFrameRelease(pCtrl, frame);
+			return false;
+		}
+
+		bodyOff = txFramePrefix(frame->heapBuf, binary, hdr);
+		memcpy(&frame->heapBuf[bodyOff], resp, bodyLen);
+		frame->len = txFrameTrailer(frame->heapBuf, binary, bodyOff, bodyLen, 0);
+		cJSON_free(resp);
+	}
+
 	// Release memory used for JSON response object
 	cJSON_Delete(jResp);
-	// Send the response string
-	sendMsg(pCtrl, "RESP", resp);
-	// Release memory used for the string
-	cJSON_free(resp);
+
+	xQueueSend(pCtrl->txQueue, &frame, portMAX_DELAY);
+	return true;
+}
+
+static void sendResponse(appCtrl_t* pCtrl, const testComm_replyTo_t* replyTo, cJSON* jResp, uint32_t newBaud)
+{
+	(void)sendJson(pCtrl, replyTo, "RESP", jResp, newBaud, portMAX_DELAY);
 }
 
-static void sendErrResponse(appCtrl_t* pCtrl, int errCode, const char* errMesg)
+static void sendErrResponse(appCtrl_t* pCtrl, const testComm_replyTo_t* replyTo, int errCode, const char* errMesg)
 {
 	// Build the error object
 	cJSON* jErr = cJSON_CreateObject();
@@ -254,7 +909,7 @@ static void sendErrResponse(appCtrl_t* pCtrl, int errCode, const char* errMesg)
 	cJSON_AddItemToObject(jResp, "error", jErr);
 
 	// Send the response object
-	sendResponse(pCtrl, jResp);
+	sendResponse(pCtrl, replyTo, jResp, 0);
 }
 
 #if 0
@@ -324,36 +979,240 @@ static void procCmd(appCtrl_t* pCtrl)
 }
 #endif
 
+/**
+ * @brief Split an optional request ID from a completed header
+ *
+ * "CMD#1a" leaves "CMD" in the header and sets the reply ID to 0x1a
+ */
+static bool parseHdrId(appCtrl_t* pCtrl)
+{
+	char*	sep = strchr(pCtrl->msg.hdr, MSG_ID_SEP);
+	if (!sep) {
+		return true;
+	}
+	*sep++ = '\0';
+
+	int	len = strlen(sep);
+	if (len < 1 || len > MSG_ID_SZ || strspn(sep, "0123456789abcdefABCDEF") != len) {
+		return false;
+	}
+
+	pCtrl->msg.replyTo.id = (uint16_t)strtoul(sep, NULL, 16);
+	pCtrl->msg.replyTo.hasId = true;
+	return true;
+}
+
+/**
+ * @brief Add to a statistics counter; testCommGetStats() reads and clears them from other tasks
+ */
+static void statsAdd(appCtrl_t* pCtrl, uint32_t* counter, uint32_t n)
+{
+	xSemaphoreTake(pCtrl->statsMutex, portMAX_DELAY);
+	*counter += n;
+	xSemaphoreGive(pCtrl->statsMutex);
+}
+
+/**
+ * @brief Count a receive error and report it to the host
+ */
+static void rxError(appCtrl_t* pCtrl, uint32_t* counter, const char* mesg)
+{
+	statsAdd(pCtrl, counter, 1);
+	sendMsg(pCtrl, &pCtrl->msg.replyTo, "ERR", mesg);
+}
+
+/**
+ * @brief Claim a message slot for the frame whose header has just completed
+ *
+ * Returns false, after reporting it, if every slot is in use
+ */
+static bool rxSlotGet(appCtrl_t* pCtrl)
+{
+	if (!pCtrl->msg.slot && xQueueReceive(pCtrl->rxFreeQueue, &pCtrl->msg.slot, 0) != pdPASS) {
+		pCtrl->msg.slot = NULL;
+		rxError(pCtrl, &pCtrl->stats.rxOvrErr, "Q-FULL: Request queue full");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Hand the received message slot to cmdTask
+ */
+static void queueMsg(appCtrl_t* pCtrl)
+{
+	rxSlot_t*			slot = pCtrl->msg.slot;
+	testComm_mesg_t*	mesg = &slot->mesg;
+
+	mesg->replyTo = pCtrl->msg.replyTo;
+	mesg->body = slot->buf;
+	mesg->bin = NULL;
+	mesg->binLen = 0;
+
+	if (pCtrl->msg.replyTo.binary) {
+		mesg->bodyLen = pCtrl->msg.jsonLen;
+		if (pCtrl->msg.binLen > 0) {
+			// Attachment follows the JSON terminator
+			mesg->bin = (uint8_t *)&slot->buf[pCtrl->msg.jsonLen + 1];
+			mesg->binLen = pCtrl->msg.binLen;
+		}
+	} else {
+		mesg->bodyLen = pCtrl->msg.bodyLen;
+	}
+
+	// The queue holds every slot, so this does not fail
+	xQueueSend(pCtrl->rxQueue, &slot, 0);
+	pCtrl->msg.slot = NULL;
+}
+
 static void procMsg(appCtrl_t *pCtrl)
 {
 	// At this point a properly-framed message has been received
 	// so reset the watchdog now
 	watchdogReset();
 
+	// Command latency is measured from here
+	pCtrl->msg.replyTo.rxTimeUs = esp_timer_get_time();
+	statsAdd(pCtrl, &pCtrl->stats.rxFrames, 1);
+
 	if (strcmp("CMD", pCtrl->msg.hdr) == 0) {
-		pCtrl->conf.cmdProc(pCtrl->msg.body);
+		queueMsg(pCtrl);
 	} else {
-		sendMsg(pCtrl, "ERR", "Header not recognized");
+		rxError(pCtrl, &pCtrl->stats.rxHdrErr, "Header not recognized");
+	}
+}
+
+
+/**
+ * @brief Start receiving a binary frame, if binary framing has been negotiated
+ */
+static bool startBinMsg(appCtrl_t* pCtrl)
+{
+	if (pCtrl->framing != testComm_framing_binary) {
+		return false;
+	}
+
+	pCtrl->msg.replyTo.binary = true;
+	pCtrl->msg.replyTo.hasId = false;
+	pCtrl->msg.replyTo.rxTimeUs = 0;
+	pCtrl->msg.discard = false;
+	pCtrl->msg.len = 0;
+	pCtrl->msg.state = msgState_binHdrLen;
+	return true;
+}
+
+/**
+ * @brief Copy binary frame payload, JSON then attachment, into the message slot
+ *
+ * The JSON is NUL-terminated in place and the attachment follows the terminator.
+ * The CRC is updated as the payload arrives.
+ *
+ * Returns the number of bytes consumed
+ */
+static int procBinBody(appCtrl_t* pCtrl, const char* rxBuf, int rxCount)
+{
+	char*		buf = pCtrl->msg.slot->buf;
+	uint32_t	total = pCtrl->msg.jsonLen + pCtrl->msg.binLen;
+	uint32_t	used = 0;
+
+	while (used < (uint32_t)rxCount && pCtrl->msg.len < total) {
+		uint32_t	pos = pCtrl->msg.len;
+		uint32_t	end = (pos < pCtrl->msg.jsonLen) ? pCtrl->msg.jsonLen : total;
+		uint32_t	n = end - pos;
+		if (n > (uint32_t)rxCount - used) {
+			n = (uint32_t)rxCount - used;
+		}
+
+		// Attachment is stored after the JSON terminator
+		char*	dst = &buf[(pos < pCtrl->msg.jsonLen) ? pos : pos + 1];
+		memcpy(dst, &rxBuf[used], n);
+		pCtrl->msg.crc32 = crc32_le(pCtrl->msg.crc32, (uint8_t *)dst, n);
+
+		pCtrl->msg.len += n;
+		used += n;
 	}
+
+	if (pCtrl->msg.len >= total) {
+		buf[pCtrl->msg.jsonLen] = '\0';
+
+		// Receive the message CRC
+		pCtrl->msg.state = msgState_binCrc;
+		pCtrl->msg.len = 0;
+	}
+
+	return used;
 }
 
+/**
+ * @brief Copy a run of printable ASCII body characters into the message slot
+ *
+ * Control characters are left for the state machine. The CRC is updated
+ * as the body arrives.
+ *
+ * Returns the number of bytes consumed
+ */
+static int procAsciiBody(appCtrl_t* pCtrl, const char* rxBuf, int rxCount)
+{
+	int	n = 0;
+
+	while (n < rxCount && (uint8_t)rxBuf[n] >= 0x20 && (uint8_t)rxBuf[n] <= 0x7E) {
+		n++;
+	}
+	if (0 == n) {
+		return 0;
+	}
+
+	if (pCtrl->msg.len + n > pCtrl->conf.msgBufSz) {
+		// overflow
+		rxError(pCtrl, &pCtrl->stats.rxOvrErr, "MSG-OVR: Message body too large");
+		pCtrl->msg.state = msgState_err;
+		return n;
+	}
+
+	memcpy(&pCtrl->msg.slot->buf[pCtrl->msg.len], rxBuf, n);
+	pCtrl->msg.crc32 = crc32_le(pCtrl->msg.crc32, (const uint8_t *)rxBuf, n);
+	pCtrl->msg.len += n;
+	return n;
+}
 
 static void procData(appCtrl_t* pCtrl, char* rxBuf, int rxCount)
 {
 	static const char* hexDigits = "0123456789abcdef";
 
-	int	i;
-	for (i = 0; i < rxCount; i++) {
+	while (rxCount > 0) {
+		if (msgState_binBody == pCtrl->msg.state) {
+			// Bulk copy of the binary payload
+			int	n = procBinBody(pCtrl, rxBuf, rxCount);
+			rxBuf += n;
+			rxCount -= n;
+			continue;
+		}
+		if (msgState_body == pCtrl->msg.state) {
+			// Bulk copy of printable body text
+			int	n = procAsciiBody(pCtrl, rxBuf, rxCount);
+			if (n > 0) {
+				rxBuf += n;
+				rxCount -= n;
+				continue;
+			}
+		}
+
 		char	c = *rxBuf++;
+		rxCount -= 1;
 
 		switch (pCtrl->msg.state)
 		{
 		case msgState_idle:
-			// Waiting for SOH
+			// Waiting for SOH (or SYN in binary mode)
 			if (MSG_SOH == c) {
 				// Store the header
+				pCtrl->msg.replyTo.binary = false;
+				pCtrl->msg.replyTo.hasId = false;
+				pCtrl->msg.replyTo.rxTimeUs = 0;
 				pCtrl->msg.len = 0;
 				pCtrl->msg.state = msgState_hdr;
+			} else if (MSG_SYN == c) {
+				(void)startBinMsg(pCtrl);
 			}
 			break;
 
@@ -363,7 +1222,15 @@ static void procData(appCtrl_t* pCtrl, char* rxBuf, int rxCount)
 				// End of header, start receiving the message body
 				pCtrl->msg.hdr[pCtrl->msg.len] = '\0';
 				pCtrl->msg.len = 0;
+				pCtrl->msg.crc32 = 0;
 				pCtrl->msg.state = msgState_body;
+
+				if (!parseHdrId(pCtrl)) {
+					rxError(pCtrl, &pCtrl->stats.rxHdrErr, "HDR-ID: Invalid request ID");
+					pCtrl->msg.state = msgState_err;
+				} else if (!rxSlotGet(pCtrl)) {
+					pCtrl->msg.state = msgState_err;
+				}
 			} else if (MSG_SOH == c) {
 				// Restart the header
 				pCtrl->msg.len = 0;
@@ -372,46 +1239,38 @@ static void procData(appCtrl_t* pCtrl, char* rxBuf, int rxCount)
 				pCtrl->msg.state = msgState_idle;
 			} else if (c < 0x20 || c > 0x7E) {
 				// Bad character
-				sendMsg(pCtrl, "ERR", "HDR-CHR: Illegal character in header");
+				rxError(pCtrl, &pCtrl->stats.rxHdrErr, "HDR-CHR: Illegal character in header");
 				pCtrl->msg.state = msgState_err;
 			} else if (pCtrl->msg.len < MSG_HDR_SZ) {
 				pCtrl->msg.hdr[pCtrl->msg.len] = c;
 				pCtrl->msg.len += 1;
 			} else {
 				// Header overflow
-				sendMsg(pCtrl, "ERR", "HDR-OVR: Header too large");
+				rxError(pCtrl, &pCtrl->stats.rxHdrErr, "HDR-OVR: Header too large");
 				pCtrl->msg.state = msgState_err;
 			}
 			break;
 
 		case msgState_body:
+			// Printable characters are taken by procAsciiBody
 			if (MSG_ETX == c) {
-				// Terminate the string
-				pCtrl->msg.body[pCtrl->msg.len] = '\0';
-
-				// Calculate CRC32 of the body
-				pCtrl->msg.crc32 = crc32_le(0, (uint8_t *)pCtrl->msg.body, pCtrl->msg.len);
+				// Terminate the string, the CRC is already calculated
+				pCtrl->msg.slot->buf[pCtrl->msg.len] = '\0';
 
 				// Receive the message CRC
 				pCtrl->msg.state = msgState_crc;
+				pCtrl->msg.bodyLen = pCtrl->msg.len;
 				pCtrl->msg.len = 0;
 			} else if (MSG_STX == c) {
 				// Restart the message
 				pCtrl->msg.len = 0;
+				pCtrl->msg.crc32 = 0;
 			} else if (MSG_EOT == c) {
 				// Early termination of message
 				pCtrl->msg.state = msgState_idle;
-			} else if (c < 0x20 || c > 0x7E) {
-				// Bad character
-				sendMsg(pCtrl, "ERR", "HDR-CHR: Illegal character in body");
-				pCtrl->msg.state = msgState_err;
-			} else if (pCtrl->msg.len < MSG_BODY_SZ) {
-				// Add character to the message buffer
-				pCtrl->msg.body[pCtrl->msg.len] = c;
-				pCtrl->msg.len += 1;
 			} else {
-				// overflow
-				sendMsg(pCtrl, "ERR", "MSG-OVR: Message body too large");
+				// Bad character
+				rxError(pCtrl, &pCtrl->stats.rxHdrErr, "HDR-CHR: Illegal character in body");
 				pCtrl->msg.state = msgState_err;
 			}
 			break;
@@ -429,14 +1288,14 @@ static void procData(appCtrl_t* pCtrl, char* rxBuf, int rxCount)
 				if (msgCrc == pCtrl->msg.crc32) {
 					procMsg(pCtrl);
 				} else {
-					sendMsg(pCtrl, "ERR", "CRC-FAIL: CRC check failed");
+					rxError(pCtrl, &pCtrl->stats.rxCrcErr, "CRC-FAIL: CRC check failed");
 				}
 
 				// Wait for the next message
 				pCtrl->msg.state = msgState_idle;
 			} else if (strchr(hexDigits, c) == NULL) {
 				// Bad character
-				sendMsg(pCtrl, "ERR", "CRC-CHR: Illegal character in CRC");
+				rxError(pCtrl, &pCtrl->stats.rxCrcErr, "CRC-CHR: Illegal character in CRC");
 				pCtrl->msg.state = msgState_err;
 			} else if (pCtrl->msg.len < MSG_CRC_SZ) {
 				// Add character to the message buffer
@@ -444,7 +1303,7 @@ static void procData(appCtrl_t* pCtrl, char* rxBuf, int rxCount)
 				pCtrl->msg.len += 1;
 			} else {
 				// overflow
-				sendMsg(pCtrl, "ERR", "CRC-OVR: CRC too large");
+				rxError(pCtrl, &pCtrl->stats.rxCrcErr, "CRC-OVR: CRC too large");
 				pCtrl->msg.state = msgState_err;
 			}
 			break;
@@ -456,8 +1315,107 @@ static void procData(appCtrl_t* pCtrl, char* rxBuf, int rxCount)
 				pCtrl->msg.state = msgState_idle;
 			} else if (MSG_SOH == c) {
 				// Starting receiving the new header
+				pCtrl->msg.replyTo.binary = false;
+				pCtrl->msg.replyTo.hasId = false;
+				pCtrl->msg.replyTo.rxTimeUs = 0;
 				pCtrl->msg.state = msgState_hdr;
 				pCtrl->msg.len = 0;
+			} else if (MSG_SYN == c) {
+				(void)startBinMsg(pCtrl);
+			}
+			break;
+
+		case msgState_binHdrLen:
+			if (c == 0 || (uint8_t)c > MSG_HDR_SZ) {
+				// Lengths can't be trusted - resynchronize on the next frame marker
+				rxError(pCtrl, &pCtrl->stats.rxHdrErr, "HDR-OVR: Header too large");
+				pCtrl->msg.state = msgState_idle;
+			} else {
+				pCtrl->msg.hdrLen = (uint8_t)c;
+				pCtrl->msg.crc32 = crc32_le(0, &pCtrl->msg.hdrLen, 1);
+				pCtrl->msg.len = 0;
+				pCtrl->msg.state = msgState_binHdr;
+			}
+			break;
+
+		case msgState_binHdr:
+			if (c < 0x20 || c > 0x7E) {
+				rxError(pCtrl, &pCtrl->stats.rxHdrErr, "HDR-CHR: Illegal character in header");
+				pCtrl->msg.state = msgState_idle;
+				break;
+			}
+			pCtrl->msg.hdr[pCtrl->msg.len] = c;
+			pCtrl->msg.len += 1;
+			if (pCtrl->msg.len >= pCtrl->msg.hdrLen) {
+				pCtrl->msg.crc32 = crc32_le(pCtrl->msg.crc32, (uint8_t *)pCtrl->msg.hdr, pCtrl->msg.hdrLen);
+				pCtrl->msg.hdr[pCtrl->msg.len] = '\0';
+				pCtrl->msg.len = 0;
+				pCtrl->msg.state = msgState_binLen;
+
+				if (!parseHdrId(pCtrl)) {
+					rxError(pCtrl, &pCtrl->stats.rxHdrErr, "HDR-ID: Invalid request ID");
+					pCtrl->msg.discard = true;
+				}
+			}
+			break;
+
+		case msgState_binLen:
+			pCtrl->msg.binLenBuf[pCtrl->msg.len] = (uint8_t)c;
+			pCtrl->msg.len += 1;
+			if (pCtrl->msg.len >= MSG_BIN_LEN_SZ) {
+				pCtrl->msg.crc32 = crc32_le(pCtrl->msg.crc32, pCtrl->msg.binLenBuf, MSG_BIN_LEN_SZ);
+				pCtrl->msg.jsonLen = get32le(&pCtrl->msg.binLenBuf[0]);
+				pCtrl->msg.binLen = get32le(&pCtrl->msg.binLenBuf[4]);
+				pCtrl->msg.len = 0;
+
+				uint32_t	bufSz = pCtrl->conf.msgBufSz;
+				if (pCtrl->msg.discard) {
+					// Already rejected
+				} else if (pCtrl->msg.jsonLen > bufSz || pCtrl->msg.binLen > bufSz - pCtrl->msg.jsonLen) {
+					// Too large - discard the rest of the frame
+					rxError(pCtrl, &pCtrl->stats.rxOvrErr, "MSG-OVR: Message body too large");
+					pCtrl->msg.discard = true;
+				} else if (!rxSlotGet(pCtrl)) {
+					pCtrl->msg.discard = true;
+				}
+
+				if (pCtrl->msg.discard) {
+					if (pCtrl->msg.jsonLen > MSG_SKIP_MAX || pCtrl->msg.binLen > MSG_SKIP_MAX) {
+						// Resynchronize on the next frame marker
+						pCtrl->msg.state = msgState_idle;
+					} else {
+						pCtrl->msg.skipLen = pCtrl->msg.jsonLen + pCtrl->msg.binLen + MSG_BIN_CRC_SZ;
+						pCtrl->msg.state = msgState_binSkip;
+					}
+				} else {
+					pCtrl->msg.state = msgState_binBody;
+					// Handles the empty payload case
+					(void)procBinBody(pCtrl, NULL, 0);
+				}
+			}
+			break;
+
+		case msgState_binCrc:
+			pCtrl->msg.crc[pCtrl->msg.len] = c;
+			pCtrl->msg.len += 1;
+			if (pCtrl->msg.len >= MSG_BIN_CRC_SZ) {
+				uint32_t msgCrc = get32le((uint8_t *)pCtrl->msg.crc);
+
+				if (msgCrc == pCtrl->msg.crc32) {
+					procMsg(pCtrl);
+				} else {
+					rxError(pCtrl, &pCtrl->stats.rxCrcErr, "CRC-FAIL: CRC check failed");
+				}
+
+				// Wait for the next message
+				pCtrl->msg.state = msgState_idle;
+			}
+			break;
+
+		case msgState_binSkip:
+			pCtrl->msg.skipLen -= 1;
+			if (0 == pCtrl->msg.skipLen) {
+				pCtrl->msg.state = msgState_idle;
 			}
 			break;
 
@@ -469,6 +1427,35 @@ static void procData(appCtrl_t* pCtrl, char* rxBuf, int rxCount)
 }
 
 
+/**
+ * @brief Read everything buffered by the UART driver and run it through the parser
+ */
+static void rxDrain(appCtrl_t* pCtrl)
+{
+	uart_port_t port = pCtrl->conf.uart.port;
+	size_t		avail;
+
+	while (uart_get_buffered_data_len(port, &avail) == ESP_OK && avail > 0) {
+		int rdLen = (avail < pCtrl->conf.rxBufSz) ? avail : pCtrl->conf.rxBufSz;
+		int rxCount = uart_read_bytes(port, pCtrl->rxBuf, rdLen, 0);
+		if (rxCount <= 0) {
+			break;
+		}
+		statsAdd(pCtrl, &pCtrl->stats.rxBytes, rxCount);
+		procData(pCtrl, pCtrl->rxBuf, rxCount);
+	}
+}
+
+/**
+ * @brief Drop buffered input after an overflow and resynchronize the parser
+ */
+static void rxFlush(appCtrl_t* pCtrl)
+{
+	uart_flush_input(pCtrl->conf.uart.port);
+	xQueueReset(pCtrl->uartQueue);
+	pCtrl->msg.state = msgState_idle;
+}
+
 static void commTask(void* param)
 {
 	appCtrl_t* pCtrl = param;
@@ -477,26 +1464,55 @@ static void commTask(void* param)
 		vTaskDelete(NULL);
 	}
 
-	// Shorthand
-	uart_port_t port = pCtrl->conf.uart.port;
-
     // Setup the task loop
 	pCtrl->msg.state = msgState_idle;
 
     while (true) {
-    	int	rxCount;
-
-    	rxCount = uart_read_bytes(port, pCtrl->rxBuf, pCtrl->conf.rxBufSz, pdMS_TO_TICKS(100));
+    	uart_event_t	event;
+
+    	// The timeout only paces the reboot check, received data is
+    	// signalled by the UART driver
+    	if (xQueueReceive(pCtrl->uartQueue, &event, pdMS_TO_TICKS(100)) == pdPASS) {
+    		switch (event.type)
+    		{
+    			case UART_DATA:
+    			case UART_PATTERN_DET:
+    				// Positions of detected EOTs are dropped from the pattern
+    				// queue by the driver as the data is read
+    				rxDrain(pCtrl);
+    				break;
+
+    			case UART_FIFO_OVF:
+    				statsAdd(pCtrl, &pCtrl->stats.rxFifoOvf, 1);
+    				ESP_LOGW(TAG, "RX FIFO overflow");
+    				rxFlush(pCtrl);
+    				break;
+
+    			case UART_BUFFER_FULL:
+    				statsAdd(pCtrl, &pCtrl->stats.rxBufFull, 1);
+    				ESP_LOGW(TAG, "RX buffer full");
+    				rxFlush(pCtrl);
+    				break;
+
+    			case UART_FRAME_ERR:
+    			case UART_PARITY_ERR:
+    				statsAdd(pCtrl, &pCtrl->stats.rxLineErr, 1);
+    				break;
+
+    			default:
+    				break;
+    		}
+    	}
 
     	pCtrl->curTimeMs = esp_timer_get_time() / 1000LL;
 
-    	if (rxCount > 0) {
-    		//printf("%d bytes received\n", rxCount);
-    		procData(pCtrl, pCtrl->rxBuf, rxCount);
-    	}
+    	portENTER_CRITICAL(&pCtrl->reboot.mux);
+    	bool		reboot = pCtrl->reboot.active;
+    	uint32_t	rebootMs = pCtrl->reboot.timeMs;
+    	portEXIT_CRITICAL(&pCtrl->reboot.mux);
 
-    	if (pCtrl->reboot.active) {
-    		if (pCtrl->curTimeMs >= pCtrl->reboot.timeMs) {
+    	if (reboot) {
+    		if (pCtrl->curTimeMs >= rebootMs) {
 				if (pCtrl->conf.features.wifi) {
 					//wifiDisconnect();	// ToDo --
 				}
@@ -510,3 +1526,72 @@ static void commTask(void* param)
     	}
     }
 }
+
+/**
+ * @brief Write queued frames to the UART, one write per frame
+ *
+ * Handlers return as soon as their response is queued, and reception of the
+ * next command overlaps transmission of this one.
+ */
+static void txTask(void* param)
+{
+	appCtrl_t*	pCtrl = param;
+	uart_port_t	port = pCtrl->conf.uart.port;
+	txFrame_t*	frame;
+
+	while (true) {
+		if (xQueueReceive(pCtrl->txQueue, &frame, portMAX_DELAY) != pdPASS) {
+			continue;
+		}
+
+		uart_write_bytes(port, frame->heapBuf ? frame->heapBuf : frame->buf, frame->len);
+
+		testComm_stats_t*	stats = &pCtrl->stats;
+		xSemaphoreTake(pCtrl->statsMutex, portMAX_DELAY);
+		stats->txFrames++;
+		stats->txBytes += frame->len;
+		if (frame->rxTimeUs > 0) {
+			uint32_t latencyUs = (uint32_t)(esp_timer_get_time() - frame->rxTimeUs);
+
+			stats->cmdCount++;
+			stats->latencyLastUs = latencyUs;
+			stats->latencySumUs += latencyUs;
+			if (latencyUs > stats->latencyMaxUs) {
+				stats->latencyMaxUs = latencyUs;
+			}
+			stats->latency[frame->latClass].count++;
+			stats->latency[frame->latClass].lastUs = latencyUs;
+			stats->latency[frame->latClass].sumUs += latencyUs;
+			if (latencyUs > stats->latency[frame->latClass].maxUs) {
+				stats->latency[frame->latClass].maxUs = latencyUs;
+			}
+		}
+		xSemaphoreGive(pCtrl->statsMutex);
+
+		if (frame->newBaud > 0) {
+			uart_wait_tx_done(port, pdMS_TO_TICKS(1000));
+			uart_set_baudrate(port, frame->newBaud);
+		}
+
+		txFrameRelease(pCtrl, frame);
+	}
+}
+
+static void cmdTask(void* param)
+{
+	appCtrl_t* pCtrl = param;
+	rxSlot_t* slot;
+
+	while (true) {
+		if (xQueueReceive(pCtrl->rxQueue, &slot, portMAX_DELAY) != pdPASS) {
+			continue;
+		}
+
+		// The command processor may keep the message, e.g. to run it on
+		// another task, and releases it when done
+		if (!pCtrl->conf.cmdProc(&slot->mesg)) {
+			// Slot may now receive another message
+			xQueueSend(pCtrl->rxFreeQueue, &slot, 0);
+		}
+	}
+}
@@ -1,30 +1,70 @@
-from test_comm import testerApi
+import base64
+from time import sleep, monotonic
+
+from test_comm import testerApi, cmdBatch
+
+GLITCH_US_DEFAULT = 50000   # Firmware input debounce time when a pin gives none
 
 class boardControl:
     '''
     Communicate with the fixture CPU to set and get IO pin states
     '''
-    def __init__(self, fix_api:testerApi, gpio_map:list[dict]=None) -> None:
+    def __init__(self, fix_api:testerApi, gpio_map:list[dict]=None, gpio_groups:dict[str, list[str]]=None) -> None:
 
         '''
         gpio_map is a list of dictionaries each of the form
           "name": "<name of pin>", "gpio_num": <pin number>, "dir": "<out|in>", "active_hi": <True|False>
+        with optional "glitch_us", the input debounce time.
+
+        gpio_groups names lists of pins or other groups, e.g. {"bank-A": ["relay-1", "relay-2"]}
         '''
         self.fix_api: testerApi = fix_api
         self.gpio_map: list[dict] = gpio_map
+        self.gpio_groups: dict[str, list[str]] = gpio_groups if gpio_groups is not None else dict()
+        self.gpio_desc: dict[str, dict] = {item['name']: item for item in gpio_map} if gpio_map else dict()
+        self.board_map: bool = False    # The board holds the pin map, pins are set by name
+        self.event_seq: int = 0
 
     def initialize(self, dbug:bool=False) -> bool:
-        '''Configure the controller GPIO pins per the GPIO map'''
+        '''
+        Configure the controller GPIO pins per the GPIO map and set outputs inactive
+
+        The map is stored on the board, which configures its pins at every
+        start, so it is only sent when the board's copy differs. Firmware
+        without pin-map support has all pins configured by one gpio-conf-multi.
+        '''
+        want: dict = self._pin_map_params()
+        have: dict|None = self.pin_map_get(dbug=dbug)
+        if have is not None:
+            if have != want and not self.pin_map_set(want['pins'], want['groups'], dbug=dbug):
+                print(f"Failed to store pin map: {self.fix_api.fail_reason()}")
+                return False
+            self.board_map = True
+            outputs: dict[str, bool] = {item['name']: False for item in self.gpio_map if item['dir'] == "out"}
+            return not outputs or self.gpio_set_many(outputs, dbug=dbug)
+
+        pins: list[dict] = list()
         item: dict = dict()
         for item in self.gpio_map:
-            gpio_num: int = item['gpio_num']
             # set initial state inactive
             istate: bool = not item.get('active_hi', False)
-            if not self.gpio_pin_conf(gpio_num, item['dir'], istate, False, False, dbug=dbug):
-                print(f"Failed to configure GPIO {gpio_num}")
-                return False
+            pins.append(self._gpio_conf_params(item['gpio_num'], item['dir'], istate, False, False, item.get('glitch_us')))
+        if not self.gpio_conf_multi(pins, dbug=dbug):
+            print(f"Failed to configure GPIO: {self.fix_api.fail_reason()}")
+            return False
         return True
 
+    def batch(self, stop_on_error:bool=False, dbug:bool=False) -> cmdBatch:
+        '''
+        Return a context manager that sends the commands added to it as one request
+
+            with board.batch() as b:
+                b.add("gpio-set", {"gpio_num": 4, "active": True})
+                b.add("gpio-set", {"gpio_num": 5, "active": False})
+            ok = b.ok
+        '''
+        return self.fix_api.batch(stop_on_error=stop_on_error, dbug=dbug)
+
     def config_set(self, params:dict, dbug:bool=False) -> bool:
         '''
         Set the board configuration
@@ -44,13 +84,74 @@ class boardControl:
         '''Get controller stored parameters'''
         return self.fix_api.command("nvs-get", dbug=dbug)
     
+    def pin_map_get(self, dbug:bool=False) -> dict|None:
+        '''Return the pin map held by the board, {"pins": [...], "groups": {...}}'''
+        return self.fix_api.command("pin-map-get", dbug=dbug)
+
+    def pin_map_set(self, pins:list[dict], groups:dict[str, list[str]]=None, save:bool=True, dbug:bool=False) -> bool:
+        '''
+        Give the board a pin map, configure its pins and store it for later starts
+
+        Parameters
+          pins   : gpio_map style descriptors, see __init__
+          groups : {group name: [pin or group name, ...], ...}
+          save   : store the map in NVS, else it lasts until reset
+
+        An empty pins list removes the map.
+        '''
+        params: dict = {"pins": pins, "groups": groups if groups else dict(), "save": save}
+        return self.fix_api.command_no_resp("pin-map-set", params=params, dbug=dbug)
+
+    def _pin_map_params(self) -> dict:
+        '''Build the pin map of gpio_map and gpio_groups, in the form pin-map-get returns'''
+        pins: list[dict] = list()
+        for item in self.gpio_map:
+            pins.append({
+                "name": item['name'],
+                "gpio_num": item['gpio_num'],
+                "dir": item['dir'],
+                "active_hi": item.get('active_hi', False),
+                "pull_up_en": item.get('pull_up_en', False),
+                "pull_down_en": item.get('pull_down_en', False),
+                "glitch_us": item.get('glitch_us', GLITCH_US_DEFAULT)
+            })
+        return {"pins": pins, "groups": {name: self._group_pins(name) for name in self.gpio_groups}}
+
+    def _group_pins(self, name:str) -> list[str]:
+        '''Return the pins of a group, expanding groups it lists, in gpio_map order'''
+        members: set[str] = set()
+        todo: list[str] = list(self.gpio_groups.get(name, []))
+        while todo:
+            member = todo.pop()
+            if member in self.gpio_groups:
+                todo.extend(self.gpio_groups[member])
+            else:
+                members.add(member)
+        return [item['name'] for item in self.gpio_map if item['name'] in members]
+
     #
     # CPU GPIO primatives
     # Higher-level functions will build on these
     #
 
-    def gpio_pin_conf(self, gpio_num:int, mode:str, istate:bool, pull_up_en:bool, pull_down_en:bool, dbug:bool=False) -> bool:
-        '''Configure a GPIO pin'''
+    def gpio_pin_conf(self, gpio_num:int, mode:str, istate:bool, pull_up_en:bool, pull_down_en:bool, glitch_us:int|None=None, dbug:bool=False) -> bool:
+        '''Configure a GPIO pin. glitch_us is the input debounce time (firmware default 50 ms), 0 for none'''
+        params = self._gpio_conf_params(gpio_num, mode, istate, pull_up_en, pull_down_en, glitch_us)
+        return self.fix_api.command_no_resp("gpio-conf", params=params, dbug=dbug)
+
+    def gpio_conf_multi(self, pins:list[dict], dbug:bool=False) -> bool:
+        '''
+        Configure many GPIO pins in one request
+
+        Each descriptor takes the gpio_pin_conf parameters, with "gpio_num" for one
+        pin or "gpio_nums" for a list of pins sharing them. Nothing is changed
+        unless every descriptor is valid.
+        '''
+        return self.fix_api.command_no_resp("gpio-conf-multi", params={"pins": pins}, dbug=dbug)
+
+    @staticmethod
+    def _gpio_conf_params(gpio_num:int, mode:str, istate:bool, pull_up_en:bool, pull_down_en:bool, glitch_us:int|None=None) -> dict:
+        '''Build the gpio-conf parameters for a pin'''
         params = {
             "gpio_num": gpio_num,
             "mode": mode,
@@ -58,12 +159,21 @@ class boardControl:
             "pull_up_en": pull_up_en,
             "pull_down_en": pull_down_en
         }
-        return self.fix_api.command_no_resp("gpio-conf", params=params, dbug=dbug)
+        if glitch_us is not None:
+            params["glitch_us"] = glitch_us
+        return params
     
     def gpio_pin_set(self, gpio_num:int, active:bool, dbug:bool=False) -> bool:
         '''Set the output start of a GPIO pin'''
         return self.fix_api.command_no_resp("gpio-set", params={"gpio_num": gpio_num, "active": active}, dbug=dbug)
     
+    def gpio_pin_set_mask(self, set_mask:int=0, clear_mask:int=0, dbug:bool=False) -> bool:
+        '''
+        Drive several output pins at once: bit n of set_mask drives GPIO n high,
+        bit n of clear_mask drives it low. The pins change together.
+        '''
+        return self.fix_api.command_no_resp("gpio-set-mask", params={"set": set_mask, "clear": clear_mask}, dbug=dbug)
+
     def gpio_pin_get(self, gpio_num:int, dbug:bool=False) -> bool|None:
         '''Get the high/low state of a GPIO pin'''
         resp = self.fix_api.command("gpio-get", params={"gpio_num": gpio_num}, dbug=dbug)
@@ -78,20 +188,269 @@ class boardControl:
             return None
         return resp
 
+    def gpio_pin_count_conf(self, gpio_num:int, filter_ns:int=0, sim_hz:float|None=None, dbug:bool=False) -> bool:
+        '''
+        Attach a pin to a hardware pulse counter, counting its rising edges from 0
+
+        Parameters
+          filter_ns : ignore pulses shorter than this, up to 12000
+          sim_hz    : rate of a simulated counter (firmware built with GPIO_COUNT_SIM)
+
+        Configuring the pin as "in" or "out" again releases the counter.
+        '''
+        params: dict = {"gpio_num": gpio_num, "mode": "count", "filter_ns": filter_ns}
+        if sim_hz is not None:
+            params["sim_hz"] = sim_hz
+        return self.fix_api.command_no_resp("gpio-conf", params=params, dbug=dbug)
+
+    def gpio_pin_count(self, gpio_num:int, clear:bool=False, dbug:bool=False) -> int|None:
+        '''Return the rising edges counted on a pin since it was configured or cleared, optionally restarting the count'''
+        resp = self.fix_api.command("gpio-count", params={"gpio_num": gpio_num, "clear": clear}, dbug=dbug)
+        if resp is None:
+            return None
+        return resp['count']
+
+    def gpio_pin_freq(self, gpio_num:int, window_ms:int=1000, dbug:bool=False) -> float|None:
+        '''
+        Return the rate of rising edges on a counting pin in Hz, measured by the
+        board over about the last window_ms (100 to 3100)
+        '''
+        resp = self.fix_api.command("gpio-freq", params={"gpio_num": gpio_num, "window_ms": window_ms}, dbug=dbug)
+        if resp is None:
+            return None
+        return resp['freq_hz']
+
+    def gpio_capture(self, gpio_nums:list[int|str], rate_hz:int, samples:int, pre_samples:int=0,
+                     trigger:dict|None=None, timeout_ms:int=1000, dbug:bool=False) -> dict|None:
+        '''
+        Start a logic analyzer capture, sampled by the board at a fixed rate
+
+        Parameters
+          gpio_nums   : 1 to 16 configured pins, by GPIO number or pin map name;
+                        channel n of each sample is gpio_nums[n]
+          rate_hz     : samples per second, up to 500000
+          samples     : samples kept, including pre_samples
+          pre_samples : samples kept from before the trigger
+          trigger     : {"type": "rising"|"falling"|"edge", "gpio_num": <pin>} or
+                        {"type": "pattern", "mask": <pin mask>, "value": <pin mask>},
+                        an edge may add mask and value as a qualifier; None starts at once
+          timeout_ms  : wait for the trigger at most this long; plus the capture
+                        time at most 4 s
+
+        Return
+          {"rate_hz": <actual rate>, "width": <bytes per sample>}, or None on error
+        '''
+        params: dict = {"gpio_nums": gpio_nums, "rate_hz": rate_hz, "samples": samples,
+                        "pre_samples": pre_samples, "timeout_ms": timeout_ms}
+        if trigger is not None:
+            params["trigger"] = trigger
+        return self.fix_api.command("gpio-capture", params=params, dbug=dbug)
+
+    def gpio_capture_status(self, dbug:bool=False) -> dict|None:
+        '''Return the state ("idle", "armed", "triggered", "done", "timeout" or "aborted") of the latest capture'''
+        return self.fix_api.command("gpio-capture-status", dbug=dbug)
+
+    def gpio_capture_abort(self, dbug:bool=False) -> dict|None:
+        '''Stop the running capture, keeping the samples taken'''
+        return self.fix_api.command("gpio-capture-abort", dbug=dbug)
+
+    def gpio_capture_wait(self, timeout:float, dbug:bool=False) -> dict|None:
+        '''Wait for the latest capture to end, return its status or None on timeout'''
+        end: float = monotonic() + timeout
+        while True:
+            status: dict = self.gpio_capture_status(dbug=dbug)
+            if status is None:
+                return None
+            if status['state'] not in ("armed", "triggered"):
+                return status
+            if monotonic() > end:
+                return None
+            sleep(0.05)
+
+    def gpio_capture_read(self, dbug:bool=False) -> dict|None:
+        '''
+        Read the samples of the latest capture, once it has ended
+
+        Return
+          The gpio-capture-status result with "data": <samples, little-endian,
+          "width" bytes each> and "names": <pin names by channel, from the
+          GPIO map>, or None on error
+        '''
+        status: dict = self.gpio_capture_status(dbug=dbug)
+        if status is None:
+            return None
+        if status['state'] in ("armed", "triggered"):
+            print("Capture still running")
+            return None
+
+        # Samples come as the response attachment, or Base64 with ASCII framing
+        data: bytearray = bytearray()
+        while len(data) < status['samples'] * status['width']:
+            resp = self.fix_api.command_bin("gpio-capture-read", params={"offset": len(data) // status['width']}, dbug=dbug)
+            if resp is None:
+                return None
+            result, attachment = resp
+            if result['count'] == 0:
+                break
+            data += attachment if attachment is not None else base64.b64decode(result['data'])
+
+        names: dict[int, str] = {item['gpio_num']: item['name'] for item in self.gpio_map} if self.gpio_map else dict()
+        status['data'] = bytes(data)
+        status['names'] = [names.get(gpio_num, f"gpio{gpio_num}") for gpio_num in status['gpio_nums']]
+        return status
+
+    def gpio_capture_run(self, gpio_nums:list[int|str], rate_hz:int, samples:int, pre_samples:int=0,
+                         trigger:dict|None=None, timeout_ms:int=1000, dbug:bool=False) -> dict|None:
+        '''
+        Capture, wait for the end and read the samples, see gpio_capture() and
+        gpio_capture_read(). Save the result as VCD with capture_vcd.write_vcd()
+        '''
+        if self.gpio_capture(gpio_nums, rate_hz, samples, pre_samples=pre_samples, trigger=trigger,
+                             timeout_ms=timeout_ms, dbug=dbug) is None:
+            return None
+        if self.gpio_capture_wait(timeout=timeout_ms / 1000 + samples / rate_hz + 1, dbug=dbug) is None:
+            return None
+        return self.gpio_capture_read(dbug=dbug)
+
+    def interlock_set(self, rules:list[dict], save:bool=True, dbug:bool=False) -> bool:
+        '''
+        Give the board interlock rules, acted on without the host
+
+        Parameters
+          rules : rule dictionaries, see interlock_trip_rule() and interlock_exclusive_rule()
+          save  : store the rules in NVS, else they last until reset
+
+        Rules are numbered in list order. An empty list removes the rules.
+        Output writes a rule refuses fail with RPC_ERR_INTERLOCK.
+        '''
+        return self.fix_api.command_no_resp("interlock-set", params={"rules": rules, "save": save}, dbug=dbug)
+
+    def interlock_get(self, dbug:bool=False) -> list[dict]|None:
+        '''Return the interlock rules, each with its "trips", "late", "blocked", "worst_us" and "latched"'''
+        result: dict = self.fix_api.command("interlock-get", dbug=dbug)
+        return result['rules'] if result is not None else None
+
+    def interlock_reset(self, rule:int|None=None, clear:bool=False, dbug:bool=False) -> bool:
+        '''Release latched trip rules, or only rule; clear also zeroes their counters'''
+        params: dict = {"clear": clear}
+        if rule is not None:
+            params["rule"] = rule
+        return self.fix_api.command_no_resp("interlock-reset", params=params, dbug=dbug)
+
+    def gpio_pin_events(self, since:int=0, max_events:int=None, dbug:bool=False) -> dict|None:
+        '''
+        Get the input changes recorded after event number since
+
+        Return
+          {"seq": <number of the last event returned>, "lost": <events overwritten>,
+           "more": <True if more events are waiting>,
+           "events": [{"seq", "gpio_num", "active", "time_us"}, ...]}
+        '''
+        params: dict = {"since": since}
+        if max_events is not None:
+            params["max"] = max_events
+        resp = self.fix_api.command("gpio-events", params=params, dbug=dbug)
+        if resp is None:
+            return None
+
+        # Events are [gpio_num, level, us after the previous event]
+        events: list[dict] = list()
+        seq: int = resp['seq'] - len(resp['events'])
+        time_us: int = resp.get('time_us', 0)
+        for gpio_num, level, delta_us in resp['events']:
+            seq += 1
+            time_us += delta_us
+            events.append({"seq": seq, "gpio_num": gpio_num, "active": bool(level), "time_us": time_us})
+        return {"seq": resp['seq'], "lost": resp['lost'], "more": resp['more'], "events": events}
+
+    def gpio_pin_seq(self, steps:list[tuple[int, int, bool]], repeat:int=1, period_us:int|None=None, dbug:bool=False) -> int|None:
+        '''
+        Start a timed sequence of output changes, run by the board
+
+        Parameters
+          steps     : list of (offset_us, mask, active), offsets from the start of each
+                      repeat in time order; bit n of mask is GPIO n
+          repeat    : times to run the steps, 0 runs until gpio_seq_abort()
+          period_us : time between repeats, default the last offset
+
+        Return
+          Sequence id, or None on error
+        '''
+        params: dict = {"steps": [[offset_us, mask, bool(active)] for offset_us, mask, active in steps], "repeat": repeat}
+        if period_us is not None:
+            params["period_us"] = period_us
+        resp = self.fix_api.command("gpio-seq", params=params, dbug=dbug)
+        if resp is None:
+            return None
+        return resp['id']
+
+    def gpio_seq_status(self, dbug:bool=False) -> dict|None:
+        '''Return the state ("idle", "running", "done" or "aborted") and progress of the latest sequence'''
+        return self.fix_api.command("gpio-seq-status", dbug=dbug)
+
+    def gpio_seq_abort(self, dbug:bool=False) -> dict|None:
+        '''Stop the running sequence, outputs keep their levels. Returns its status'''
+        return self.fix_api.command("gpio-seq-abort", dbug=dbug)
+
+    def gpio_seq_wait(self, timeout:float, dbug:bool=False) -> dict|None:
+        '''Wait for the latest sequence to end, return its status or None on timeout'''
+        end: float = monotonic() + timeout
+        while True:
+            status: dict = self.gpio_seq_status(dbug=dbug)
+            if status is None:
+                return None
+            if status['state'] != "running":
+                return status
+            if monotonic() > end:
+                return None
+            sleep(0.05)
+
+    def gpio_pin_wait(self, gpio_num:int|None=None, mask:int=0, active:bool|None=None, edge:str|None=None,
+                      all:bool=False, timeout:float=10.0, dbug:bool=False) -> dict|None:
+        '''
+        Wait on the board for an input condition, answered as soon as it is debounced
+
+        Parameters
+          gpio_num : input to watch, or
+          mask     : inputs to watch, bit n is GPIO n
+          active   : level to wait for (already met returns at once), or
+          edge     : next change to wait for, "rising", "falling" or "any"
+          all      : with a mask and a level, every pin must reach it
+          timeout  : seconds
+
+        Return
+          {"gpio_num", "active", "time_us", "seq"} of the change that met the
+          condition, None on error or timeout (fail_code() -32002)
+        '''
+        params: dict = {"timeout_ms": int(timeout * 1000), "all": all}
+        if gpio_num is not None:
+            params["gpio_num"] = gpio_num
+        else:
+            params["mask"] = mask
+        if edge is not None:
+            params["edge"] = edge
+        else:
+            params["active"] = bool(active)
+        return self.fix_api.command("gpio-wait", params=params, timeout=timeout + 1.0, dbug=dbug)
+
     #
     # Helper functons
     #
 
     def _find_gpio_desc(self, name:str) -> dict|None:
         '''Lookup the descriptor for the named GPIO'''
-        for item in self.gpio_map:
-            if name == item['name']:
-                return item
-        print(f"GPIO descriptor not found for '{name}'")
-        return None
+        desc: dict|None = self.gpio_desc.get(name)
+        if desc is None:
+            print(f"GPIO descriptor not found for '{name}'")
+        return desc
 
     def gpio_set(self, name:str, active:bool, dbug:bool=False) -> bool:
-        '''Helper function to set a channel GPIO pin by name'''
+        '''Helper function to set a channel GPIO pin, or all pins of a group, by name'''
+        if self.board_map:
+            # The board looks the name up and applies the polarity
+            return self.fix_api.command_no_resp("pin-set", params={"name": name, "active": active}, dbug=dbug)
+        if name in self.gpio_groups:
+            return self.gpio_set_many({pin: active for pin in self._group_pins(name)}, dbug=dbug)
         desc: dict = self._find_gpio_desc(name)
         if desc is None:
             return False
@@ -102,8 +461,163 @@ class boardControl:
         set_high: bool = active if desc['active_hi'] else not active
         return self.gpio_pin_set(gpio_num, set_high, dbug=dbug)
 
+    def gpio_set_many(self, states:dict[str, bool], dbug:bool=False) -> bool:
+        '''
+        Set several channel GPIO pins by name in one request, all switching together
+
+        Parameters
+          states : dictionary {name: active, ...}, names of pins or groups
+        '''
+        if self.board_map:
+            return self.fix_api.command_no_resp("pin-set", params={"names": states}, dbug=dbug)
+        expanded: dict[str, bool] = dict()
+        for name, active in states.items():
+            for pin in self._group_pins(name) if name in self.gpio_groups else [name]:
+                expanded[pin] = active
+        set_mask: int = 0
+        clear_mask: int = 0
+        for name, active in expanded.items():
+            desc: dict = self._find_gpio_desc(name)
+            if desc is None:
+                return False
+            if desc['dir'] != "out":
+                print(f"Attempting output on '{name}' which is configured as input")
+                return False
+            set_high: bool = active if desc['active_hi'] else not active
+            if set_high:
+                set_mask |= 1 << desc['gpio_num']
+            else:
+                clear_mask |= 1 << desc['gpio_num']
+        return self.gpio_pin_set_mask(set_mask, clear_mask, dbug=dbug)
+
+    def _output_masks(self, states:dict[str, bool]) -> tuple[int, int]|None:
+        '''Return the (high, low) pin masks that drive named outputs or groups active or inactive'''
+        set_mask: int = 0
+        clear_mask: int = 0
+        for name, active in states.items():
+            for pin in self._group_pins(name) if name in self.gpio_groups else [name]:
+                desc: dict = self._find_gpio_desc(pin)
+                if desc is None:
+                    return None
+                if desc['dir'] != "out":
+                    print(f"'{pin}' is configured as input")
+                    return None
+                if active == desc['active_hi']:
+                    set_mask |= 1 << desc['gpio_num']
+                else:
+                    clear_mask |= 1 << desc['gpio_num']
+        return set_mask, clear_mask
+
+    def interlock_trip_rule(self, name:str, active:bool, outputs:dict[str, bool], raw:bool=False,
+                            latch:bool=False, max_us:int=0) -> dict|None:
+        '''
+        Build a trip rule for interlock_set(): when the named input becomes
+        active (or inactive), drive outputs {name: active, ...} at once
+
+        Parameters
+          raw    : act on the raw edge, ahead of the input's debounce
+          latch  : hold the outputs until interlock_reset()
+          max_us : count trips later than this after the edge, 0 for no limit
+        '''
+        desc: dict = self._find_gpio_desc(name)
+        masks: tuple[int, int]|None = self._output_masks(outputs)
+        if desc is None or masks is None:
+            return None
+        return {"type": "trip", "gpio_num": desc['gpio_num'], "active": active == desc['active_hi'],
+                "set": masks[0], "clear": masks[1], "raw": raw, "latch": latch, "max_us": max_us}
+
+    def interlock_exclusive_rule(self, names:list[str]) -> dict|None:
+        '''Build an exclusive rule for interlock_set(): at most one of the named outputs or groups active'''
+        masks: tuple[int, int]|None = self._output_masks({name: True for name in names})
+        if masks is None:
+            return None
+        return {"type": "exclusive", "mask": masks[0] | masks[1], "high": masks[0]}
+
+    def gpio_events(self, dbug:bool=False) -> list[dict]|None:
+        '''
+        Helper function to get the named input changes since the previous call
+
+        Return
+          List of {"name", "active", "time_us"}, oldest first, or None on error.
+          A {"name": None, "lost": <count>} entry marks changes that were lost.
+        '''
+        ret: list[dict] = list()
+        while True:
+            resp: dict = self.gpio_pin_events(self.event_seq, dbug=dbug)
+            if resp is None:
+                if self.event_seq == 0 or self.fix_api.fail_code() != -32602:
+                    return None
+                # since is ahead of the board: it restarted and numbering started over
+                self.event_seq = 0
+                continue
+            if resp['lost']:
+                ret.append({"name": None, "lost": resp['lost']})
+            for evt in resp['events']:
+                desc: dict = next((item for item in self.gpio_map if item['gpio_num'] == evt['gpio_num']), None)
+                if desc is None or desc['dir'] != "in":
+                    continue
+                active: bool = evt['active'] if desc['active_hi'] else not evt['active']
+                ret.append({"name": desc['name'], "active": active, "time_us": evt['time_us']})
+            self.event_seq = resp['seq']
+            if not resp['more']:
+                return ret
+
+    def gpio_seq(self, steps:list[tuple[int, dict[str, bool]]], repeat:int=1, period_us:int|None=None, dbug:bool=False) -> int|None:
+        '''
+        Helper function to run a timed sequence of named output changes on the board
+
+        Parameters
+          steps : list of (offset_us, {name: active, ...}), see gpio_pin_seq()
+
+        Return
+          Sequence id, or None on error
+        '''
+        pin_steps: list[tuple[int, int, bool]] = list()
+        for offset_us, states in steps:
+            set_mask: int = 0
+            clear_mask: int = 0
+            for name, active in states.items():
+                desc: dict = self._find_gpio_desc(name)
+                if desc is None:
+                    return None
+                if desc['dir'] != "out":
+                    print(f"Attempting output on '{name}' which is configured as input")
+                    return None
+                set_high: bool = active if desc['active_hi'] else not active
+                if set_high:
+                    set_mask |= 1 << desc['gpio_num']
+                else:
+                    clear_mask |= 1 << desc['gpio_num']
+            if set_mask:
+                pin_steps.append((offset_us, set_mask, True))
+            if clear_mask:
+                pin_steps.append((offset_us, clear_mask, False))
+        return self.gpio_pin_seq(pin_steps, repeat=repeat, period_us=period_us, dbug=dbug)
+
+    def gpio_wait(self, name:str, active:bool, timeout:float=10.0, dbug:bool=False) -> int|None:
+        '''
+        Helper function to wait until the named input is active (or inactive)
+
+        Return
+          Board time in microseconds of the change, or None on error or timeout
+        '''
+        desc: dict = self._find_gpio_desc(name)
+        if desc is None:
+            return None
+        if desc['dir'] != "in":
+            print(f"Attempting input on '{name}' which is configured as output")
+            return None
+        is_high: bool = active if desc['active_hi'] else not active
+        resp = self.gpio_pin_wait(gpio_num=desc['gpio_num'], active=is_high, timeout=timeout, dbug=dbug)
+        if resp is None:
+            return None
+        return resp['time_us']
+
     def gpio_get(self, name:str, dbug:bool=False) -> bool|None:
         '''Helper function to read a channel GPIO pin by name'''
+        if self.board_map:
+            resp = self.fix_api.command("pin-get", params={"name": name}, dbug=dbug)
+            return None if resp is None else resp.get(name)
         desc: dict = self._find_gpio_desc(name)
         if desc is None:
             return None
@@ -0,0 +1,99 @@
+'''
+Value Change Dump (VCD) files from the logic analyzer captures returned by
+boardControl.gpio_capture_read(), for viewing in GTKWave, PulseView or
+similar.
+
+A capture saved with save_capture() can be converted from the command line:
+
+    python capture_vcd.py capture.json capture.vcd
+'''
+
+import base64
+import json
+import sys
+
+def capture_samples(capture:dict) -> list[int]:
+    '''Unpack the samples of a capture, channel n of each is bit n'''
+    width: int = capture['width']
+    data: bytes = capture['data']
+    return [int.from_bytes(data[i:i + width], "little") for i in range(0, len(data) - width + 1, width)]
+
+def capture_to_vcd(capture:dict) -> str:
+    '''
+    Format a capture as VCD text
+
+    Each channel is a 1-bit wire named after its pin, plus a "trigger" wire
+    high from the trigger sample on. Time 0 is the first sample; the time
+    unit is 1 ns.
+    '''
+    gpio_nums: list[int] = capture['gpio_nums']
+    names: list[str] = capture.get('names') or [f"gpio{gpio_num}" for gpio_num in gpio_nums]
+    samples: list[int] = capture_samples(capture)
+    rate_hz: int = capture['rate_hz']
+    trigger: int = capture.get('trigger', -1)
+
+    # Identifiers are printable characters from '!'
+    ids: list[str] = [chr(33 + ch) for ch in range(len(gpio_nums))]
+    trig_id: str = chr(33 + len(gpio_nums))
+
+    lines: list[str] = []
+    lines.append(f"$comment {capture.get('state', '?')} capture of {len(samples)} samples at {rate_hz} Hz, "
+                 f"board time {capture.get('time_us', 0)} us, {capture.get('late', 0)} late $end")
+    lines.append("$timescale 1 ns $end")
+    lines.append("$scope module capture $end")
+    for ch, name in enumerate(names):
+        lines.append(f"$var wire 1 {ids[ch]} {name.replace(' ', '_')} $end")
+    lines.append(f"$var wire 1 {trig_id} trigger $end")
+    lines.append("$upscope $end")
+    lines.append("$enddefinitions $end")
+
+    prev: int|None = None
+    for idx, sample in enumerate(samples):
+        changes: list[str] = []
+        for ch in range(len(gpio_nums)):
+            bit: int = (sample >> ch) & 1
+            if prev is None or bit != ((prev >> ch) & 1):
+                changes.append(f"{bit}{ids[ch]}")
+        if prev is None:
+            changes.append(f"{1 if trigger == 0 else 0}{trig_id}")
+        elif idx == trigger:
+            changes.append(f"1{trig_id}")
+        if changes:
+            lines.append(f"#{idx * 1000000000 // rate_hz}")
+            if prev is None:
+                lines.append("$dumpvars")
+                lines.extend(changes)
+                lines.append("$end")
+            else:
+                lines.extend(changes)
+        prev = sample
+
+    # Mark the end of the capture
+    if samples:
+        lines.append(f"#{len(samples) * 1000000000 // rate_hz}")
+    return "\n".join(lines) + "\n"
+
+def write_vcd(path:str, capture:dict) -> None:
+    '''Write a capture to a VCD file'''
+    with open(path, "w") as f:
+        f.write(capture_to_vcd(capture))
+
+def save_capture(path:str, capture:dict) -> None:
+    '''Save a capture as JSON, the samples Base64 encoded'''
+    saved: dict = dict(capture)
+    saved['data'] = base64.b64encode(capture['data']).decode("ascii")
+    with open(path, "w") as f:
+        json.dump(saved, f, indent=1)
+
+def load_capture(path:str) -> dict:
+    '''Load a capture saved with save_capture()'''
+    with open(path) as f:
+        capture: dict = json.load(f)
+    capture['data'] = base64.b64decode(capture['data'])
+    return capture
+
+if __name__ == "__main__":
+    if len(sys.argv) == 3:
+        write_vcd(sys.argv[2], load_capture(sys.argv[1]))
+    else:
+        print("usage: capture_vcd.py capture.json capture.vcd")
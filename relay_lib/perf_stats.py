@@ -0,0 +1,117 @@
+'''
+Readable forms of the perf-stats result returned by testerApi.perf_stats()
+
+Snapshots saved as JSON (json.dump of the perf_stats() result) from two
+firmware versions can be compared with compare_perf_stats(), or from the
+command line:
+
+    python perf_stats.py snapshot.json
+    python perf_stats.py baseline.json current.json
+'''
+
+import json
+import sys
+
+def hist_bucket_label(bucket:int) -> str:
+    '''Return the lower bound of a perf-stats histogram bucket, e.g. "1ms"'''
+    us = 1 << bucket if bucket > 0 else 0
+    if us >= 1000000:
+        return f"{us // 1000000}s"
+    if us >= 1000:
+        return f"{us // 1000}ms"
+    return f"{us}us"
+
+def format_perf_stats(stats:dict, hist:bool=True) -> str:
+    '''
+    Format a perf-stats result as a text table
+
+    Parameters
+      stats : Result of testerApi.perf_stats()
+      hist  : Include each method's latency histogram
+
+    Return
+      Multi-line string, methods sorted by total handler time
+    '''
+    lines: list[str] = []
+    lines.append(f"Firmware {stats.get('version', '?')}, up {stats.get('uptime_ms', 0) / 1000:.1f} s")
+
+    frame: dict = stats.get('frame', {})
+    lines.append("Frames: rx {} ({} bytes), tx {} ({} bytes)".format(
+        frame.get('rx_frames', 0), frame.get('rx_bytes', 0),
+        frame.get('tx_frames', 0), frame.get('tx_bytes', 0)))
+    lines.append("Errors: crc {}, header {}, overflow {}, rx fifo {}, rx buffer {}".format(
+        frame.get('crc_err', 0), frame.get('hdr_err', 0), frame.get('ovr_err', 0),
+        frame.get('rx_fifo_ovf', 0), frame.get('rx_buf_full', 0)))
+
+    methods: dict = stats.get('methods', {})
+    if not methods:
+        lines.append("No methods called")
+        return "\n".join(lines)
+
+    lines.append("")
+    lines.append(f"{'method':<20} {'calls':>8} {'errors':>7} {'min_us':>9} {'avg_us':>9} {'max_us':>9}")
+    order = sorted(methods.items(), key=lambda m: m[1]['calls'] * m[1]['avg_us'], reverse=True)
+    for name, m in order:
+        lines.append(f"{name:<20} {m['calls']:>8} {m['errors']:>7} {m['min_us']:>9} {m['avg_us']:>9} {m['max_us']:>9}")
+        if hist and m['calls'] > 0:
+            peak = max(m['hist'])
+            for bucket, count in enumerate(m['hist']):
+                if count == 0:
+                    continue
+                bar = '#' * max(1, round(40 * count / peak))
+                lines.append(f"    >= {hist_bucket_label(bucket):>6} {count:>8} {bar}")
+    return "\n".join(lines)
+
+def print_perf_stats(stats:dict, hist:bool=True) -> None:
+    '''Print a perf-stats result as a text table'''
+    print(format_perf_stats(stats, hist=hist))
+
+def compare_perf_stats(base:dict, cur:dict, ratio:float=1.2, min_us:int=50) -> list[str]:
+    '''
+    Compare two perf-stats results, e.g. from two firmware versions
+
+    Parameters
+      base  : Baseline perf_stats() result
+      cur   : Current perf_stats() result
+      ratio : Report methods whose average time grew by at least this factor
+      min_us: Ignore changes in average time smaller than this
+
+    Return
+      List of findings, empty if nothing regressed
+    '''
+    ret: list[str] = []
+    base_methods: dict = base.get('methods', {})
+    for name, m in cur.get('methods', {}).items():
+        b = base_methods.get(name)
+        if b is None or b['calls'] == 0 or m['calls'] == 0:
+            continue
+        if m['avg_us'] >= b['avg_us'] * ratio and m['avg_us'] - b['avg_us'] >= min_us:
+            ret.append(f"{name}: avg {b['avg_us']} -> {m['avg_us']} us")
+        b_err = b['errors'] / b['calls']
+        m_err = m['errors'] / m['calls']
+        if m_err > b_err:
+            ret.append(f"{name}: errors {b_err:.1%} -> {m_err:.1%} of calls")
+
+    base_frame: dict = base.get('frame', {})
+    for key in ('crc_err', 'hdr_err', 'ovr_err'):
+        b_rate = base_frame.get(key, 0) / max(1, base_frame.get('rx_frames', 0))
+        m_rate = cur.get('frame', {}).get(key, 0) / max(1, cur.get('frame', {}).get('rx_frames', 0))
+        if m_rate > b_rate:
+            ret.append(f"{key}: {b_rate:.2%} -> {m_rate:.2%} of frames")
+    return ret
+
+if __name__ == "__main__":
+    if len(sys.argv) == 2:
+        with open(sys.argv[1]) as f:
+            print_perf_stats(json.load(f))
+    elif len(sys.argv) == 3:
+        with open(sys.argv[1]) as f:
+            base = json.load(f)
+        with open(sys.argv[2]) as f:
+            cur = json.load(f)
+        print_perf_stats(cur, hist=False)
+        print("")
+        findings = compare_perf_stats(base, cur)
+        print("\n".join(findings) if findings else "No regressions")
+    else:
+        print("usage: perf_stats.py snapshot.json [current.json]")
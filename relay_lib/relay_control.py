@@ -17,7 +17,14 @@ class relayControl(boardControl):
             {"name": "relay-8", "gpio_num": 18, "dir": "out", "active_hi": False}  # Relay 8
         ]
 
-        super().__init__(fix_api, gpio_map=gpio_map)
+        # Groups switched by one pin-set, all pins together
+        gpio_groups: dict[str, list[str]] = {
+            "bank-A": ["relay-1", "relay-2", "relay-3", "relay-4"],
+            "bank-B": ["relay-5", "relay-6", "relay-7", "relay-8"],
+            "all-relays": ["bank-A", "bank-B"]
+        }
+
+        super().__init__(fix_api, gpio_map=gpio_map, gpio_groups=gpio_groups)
         self.initialize(dbug=False)
 
     def set_relay(self, relay_num:int, active:bool, dbug:bool=False) -> bool:
@@ -25,3 +32,42 @@ class relayControl(boardControl):
             return False
         name = f"relay-{relay_num}"
         return self.gpio_set(name, active, dbug=dbug)
+
+    def set_relay_group(self, group:str, active:bool, dbug:bool=False) -> bool:
+        '''Set every relay of a group ("bank-A", "bank-B" or "all-relays") together'''
+        if group not in self.gpio_groups:
+            return False
+        return self.gpio_set(group, active, dbug=dbug)
+
+    def set_relays(self, states:dict[int, bool]|list[bool], dbug:bool=False) -> bool:
+        '''
+        Set several relays in one request, switching them at the same moment
+
+        Parameters
+          states : dictionary {relay_num: active, ...} with relay_num 1..8, or a
+                   list of up to 8 states for relays 1, 2, ...
+        '''
+        if isinstance(states, list):
+            states = {idx + 1: active for idx, active in enumerate(states)}
+        if any(relay_num < 1 or relay_num > 8 for relay_num in states):
+            return False
+        return self.gpio_set_many({f"relay-{num}": active for num, active in states.items()}, dbug=dbug)
+
+    def run_relay_sequence(self, steps:list[tuple[int, dict[int, bool]]], repeat:int=1, period_us:int|None=None, dbug:bool=False) -> int|None:
+        '''
+        Start a timed sequence of relay changes, run by the board for exact timing
+
+        Parameters
+          steps     : list of (offset_us, {relay_num: active, ...}) in time order
+          repeat    : times to run the steps, 0 runs until gpio_seq_abort()
+          period_us : time between repeats, default the last offset
+
+        Return
+          Sequence id, or None on error. Use gpio_seq_wait() for the end.
+        '''
+        named: list[tuple[int, dict[str, bool]]] = list()
+        for offset_us, states in steps:
+            if any(relay_num < 1 or relay_num > 8 for relay_num in states):
+                return None
+            named.append((offset_us, {f"relay-{num}": active for num, active in states.items()}))
+        return self.gpio_seq(named, repeat=repeat, period_us=period_us, dbug=dbug)
@@ -6,9 +6,18 @@ import platform
 import serial
 from time import time, sleep
 import json
-from threading import Lock
+import queue
+import struct
+from threading import Lock, Thread, Event
+from typing import Callable
 from crccheck.crc import Crc32
 
+# Firmware error code: async job not finished, or no job slot free
+RPC_ERR_BUSY = -32001
+
+# Firmware error code: output change refused by an interlock rule
+RPC_ERR_INTERLOCK = -32003
+
 class testerComm:
     '''
     This communicates serially with the tester module. Messages are framed using ASCII
@@ -23,6 +32,8 @@ class testerComm:
     ERR   body is an error response from the module to the script
           it reports a problem with the message framing: buffer overflows,
           invalid character, CRC validation failure, etc
+    EVT   unsolicited event from the module, sent only for topics enabled with
+          evt-subscribe. Body is {"topic": <name>, "time_ms": <uptime>, "data": {...}}
 
     body  For CMD this is a 'thin' variant of JSON RPC, consisting of only "method" and optional
           "params"
@@ -36,16 +47,45 @@ class testerComm:
               {"error": -27, "message":"Not enough memory"}
 
     crc   is the hex representation of the 32-bit checksum of the message body
+
+    After negotiating binary framing (see testerApi.framing_set) messages are sent
+    as length-prefixed binary frames:
+
+    SYN <hdr len> <hdr> <json len> <bin len> <json> <bin> <crc32>
+
+    hdr len  is one byte, json len and bin len are 32-bit little-endian
+    json     is the same JSON body used in ASCII framing
+    bin      is an optional raw attachment, e.g. data for http-write-bin
+    crc32    is the 32-bit little-endian checksum of everything following SYN
+
+    A header may carry a request ID as "CMD#<hex id>" (up to 4 hex digits). The
+    firmware echoes it in the reply header, "RESP#<hex id>" or "ERR#<hex id>", which
+    lets command_pipelined keep several commands in flight.
+
+    EVT frames are passed to callbacks registered with on_event. They are seen
+    while waiting for a response, or at any time once events_start has started
+    the background reader.
     '''
     def __init__(self, comm_dev:str, baud:int=115200, timeout:float=0.5) -> None:
         self._version: str = "1.0.0"
         self._failReason: str = ""
+        self._failCode: int|None = None
 
         self.comm_dev: str = comm_dev
+        self.binary: bool = False
+        self._req_id: int = 0
 
         self.system: str = platform.system()
         self.mutex: Lock = Lock()
 
+        # Event dispatch and the optional background reader
+        self._evt_lock: Lock = Lock()
+        self._evt_callbacks: dict[str, list[Callable]] = dict()
+        self._evt_waiters: list['eventWaiter'] = list()
+        self._replies: queue.Queue = queue.Queue()
+        self._reader: Thread|None = None
+        self._reader_stop: Event = Event()
+
         self.port: serial.Serial = serial.Serial()
         self.port.port = comm_dev
         self.port.baudrate = baud
@@ -53,9 +93,10 @@ class testerComm:
         self.port.dtr = False
         self.port.rts = False
 
-    def _fail(self, mesg:str, dbug:bool=False) -> None:
+    def _fail(self, mesg:str, dbug:bool=False, code:int|None=None) -> None:
         '''Set fail reason string and, if debug is enabled, print it'''
         self._failReason = mesg
+        self._failCode = code
         if dbug:
             print(mesg)
 
@@ -77,7 +118,7 @@ class testerComm:
             except:
                 print(r, end="")
 
-    def _send_mesg(self, hdr:str, body:str, dbug:bool=False) -> bool:
+    def _send_mesg(self, hdr:str, body:str, data:bytes|None=None, dbug:bool=False) -> bool:
         '''Send a message to the unit under test'''
         if self.port is None:
             self._fail(f"'{self.comm_dev}' is not open", dbug=dbug)
@@ -86,14 +127,27 @@ class testerComm:
         hdr = hdr.encode("UTF-8")
         body = body.encode("UTF-8")
 
-        # Compute CRC32 of message body
-        crcInst = Crc32()
-        crcInst.process(body)
-        # convert CRC to hex string, trim off the first two characters (0x)
-        crc = f"{crcInst.final():08x}".encode("UTF-8")
+        if self.binary:
+            if data is None:
+                data = b""
+            # Binary frame: SYN <hdr len> <hdr> <json len> <bin len> <json> <bin> <crc32>
+            payload = bytes([len(hdr)]) + hdr + struct.pack("<II", len(body), len(data)) + body + data
+            crcInst = Crc32()
+            crcInst.process(payload)
+            msg = b"\x16" + payload + struct.pack("<I", crcInst.final())
+        else:
+            if data is not None:
+                self._fail("Binary attachment requires binary framing", dbug=dbug)
+                return False
 
-        # Message frame: SOH <header> STX <body> ETX <crc> EOT
-        msg = b"\x01" + hdr + b"\x02" + body + b"\x03" + crc + b'\x04'
+            # Compute CRC32 of message body
+            crcInst = Crc32()
+            crcInst.process(body)
+            # convert CRC to hex string, trim off the first two characters (0x)
+            crc = f"{crcInst.final():08x}".encode("UTF-8")
+
+            # Message frame: SOH <header> STX <body> ETX <crc> EOT
+            msg = b"\x01" + hdr + b"\x02" + body + b"\x03" + crc + b'\x04'
 
         if dbug:
             print(f"Send: {msg}")
@@ -105,8 +159,56 @@ class testerComm:
             return False
         return True
 
+    def _read_exact(self, count:int, endTime:float) -> bytes|None:
+        '''Read exactly count bytes, or return None if time runs out'''
+        buf = b""
+        while len(buf) < count:
+            if time() >= endTime:
+                return None
+            buf += self.port.read(count - len(buf))
+        return buf
+
+    def _recv_bin_mesg(self, endTime:float, dbug:bool=False) -> tuple|None:
+        '''Receive the remainder of a binary frame, SYN has already been read'''
+        r = self._read_exact(1, endTime)
+        if r is None or r[0] == 0 or r[0] > 10:
+            self._debug("Invalid binary header length", dbug=dbug)
+            return None
+        hdr = self._read_exact(r[0], endTime)
+        lens = self._read_exact(8, endTime)
+        if hdr is None or lens is None:
+            return None
+        jsonLen, binLen = struct.unpack("<II", lens)
+        payload = self._read_exact(jsonLen + binLen, endTime)
+        crc = self._read_exact(4, endTime)
+        if payload is None or crc is None:
+            self._debug("Timed out receiving binary frame", dbug=dbug)
+            return None
+
+        # Compare the CRCs
+        crcInst = Crc32()
+        crcInst.process(r + hdr + lens + payload)
+        calcCrc = crcInst.final()
+        msgCrc = struct.unpack("<I", crc)[0]
+        if msgCrc != calcCrc:
+            self._debug(f"msgCrc: {msgCrc:08x}, calcCrc: {calcCrc:08x}", dbug=dbug)
+            return None
+
+        try:
+            hdr = hdr.decode("UTF-8")
+        except UnicodeDecodeError:
+            self._debug(f"Invalid binary header {hdr}", dbug=dbug)
+            return None
+        body = payload[:jsonLen].decode("UTF-8", errors="replace")
+        data = payload[jsonLen:] if binLen > 0 else None
+        return hdr, body, data
+
     def _recv_mesg(self, timeout:float=5, dbug:bool=False) -> tuple|None:
-        '''Receive a message from the unit under test'''
+        '''
+        Receive a message from the unit under test
+
+        Returns tuple (header, body, attachment), attachment is None except for binary frames
+        '''
         hdr = b""
         body = b""
         crc = b""
@@ -125,9 +227,16 @@ class testerComm:
                     print(r, end="")
 
             if 0 == state:
-                # Waiting for SOH
+                # Waiting for SOH (or SYN if binary framing is active)
                 if b'\x01' == r:
+                    hdr = b""
+                    body = b""
+                    crc = b""
                     state = 1
+                elif self.binary and b'\x16' == r:
+                    msg = self._recv_bin_mesg(endTime, dbug=dbug)
+                    if msg is not None:
+                        return msg
             elif 1 == state:
                 # Reading the header
                 if b'\x01' == r:
@@ -203,7 +312,7 @@ class testerComm:
                     if msgCrc != calcCrc:
                         self._debug(f"msgCrc: {msgCrc:08x}, calcCrc: {calcCrc:08x}", dbug=dbug)
                         return None
-                    return hdr.decode("UTF-8"), body.decode("UTF-8")
+                    return hdr.decode("UTF-8"), body.decode("UTF-8"), None
                 elif r.lower() in b"0123456789abcdef":
                     # Store crc character
                     crc += r.lower()
@@ -224,6 +333,10 @@ class testerComm:
         '''Return reason for most recent failure'''
         return self._failReason
 
+    def fail_code(self) -> int|None:
+        '''Return the firmware error code of the most recent failure, None if it was not a command error'''
+        return self._failCode
+
     def open(self, dbug:bool=False) -> bool:
         '''open the serial port'''
         if self.port.is_open:
@@ -239,6 +352,7 @@ class testerComm:
 
     def close(self) -> None:
         '''close the serial port'''
+        self.events_stop()
         if self.port.is_open:
             self.port.close()
 
@@ -249,10 +363,28 @@ class testerComm:
         self.port.rts = True
         sleep(0.05)
         self.port.rts = False
+        # Firmware restarts in ASCII framing
+        self.binary = False
         return True
 
-    def command(self, cmd:str, params:dict=None, timeout:float=5.0, dbug:bool=False) -> str|None:
-        '''Send a command to unit under test, receive and return the response'''
+    def command(self, cmd:str, params:dict=None, data:bytes|None=None, timeout:float=5.0, dbug:bool=False) -> str|None:
+        '''
+        Send a command to unit under test, receive and return the response
+
+        data is an optional raw attachment, only available with binary framing
+        '''
+        resp = self.command_bin(cmd, params=params, data=data, timeout=timeout, dbug=dbug)
+        if resp is None:
+            return None
+        return resp[0]
+
+    def command_bin(self, cmd:str, params:dict=None, data:bytes|None=None, timeout:float=5.0, dbug:bool=False) -> tuple|None:
+        '''
+        Send a command to unit under test, return (result, attachment) or None on failure
+
+        attachment is the raw data following the response JSON in a binary
+        frame, None if the response has none
+        '''
         if params is None:
             msg = json.dumps({"method": cmd})
         else:
@@ -260,16 +392,24 @@ class testerComm:
 
         # Apply mutex in case multiple threads are operating
         with self.mutex:
-            self.port.reset_input_buffer()
-            self._send_mesg("CMD", msg, dbug=dbug)
-            resp = self._recv_mesg(timeout=timeout, dbug=dbug)
+            self._rx_reset()
+            if not self._send_mesg("CMD", msg, data=data, dbug=dbug):
+                return None
+            resp = self._recv_reply(timeout=timeout, dbug=dbug)
 
         #print(f"recvMesg: {resp}")
         if resp is None:
             return None
 
         # unpack the response tuple
-        hdr, body = resp
+        hdr, body, attachment = resp
+        result = self._decode_resp(hdr, body, dbug=dbug)
+        if result is None:
+            return None
+        return result, attachment
+
+    def _decode_resp(self, hdr:str, body:str, dbug:bool=False) -> str|None:
+        '''Return the result carried by a RESP message, or None on failure'''
         if "RESP" == hdr:
             try:
                 r = json.loads(body)
@@ -281,7 +421,7 @@ class testerComm:
                 return r['result']
             elif 'error' in r:
                 e = r['error']
-                self._fail(f"Command error - code: {e['code']}, mesg: {e['message']}", dbug=dbug)
+                self._fail(f"Command error - code: {e['code']}, mesg: {e['message']}", dbug=dbug, code=e['code'])
                 return None
             else:
                 self._fail(f"Unexpected data: {body}", dbug=dbug)
@@ -293,9 +433,189 @@ class testerComm:
             self._fail(f"Unexpected header: '{hdr}'", dbug=dbug)
             return None
 
-    def command_no_resp(self, cmd:str, params:dict=None, timeout=2.0, dbug:bool=False) -> bool:
+    def _next_req_id(self) -> int:
+        '''Return the next request ID, wrapping at 16 bits'''
+        self._req_id = (self._req_id + 1) & 0xffff
+        return self._req_id
+
+    @staticmethod
+    def _split_hdr(hdr:str) -> tuple:
+        '''Split "RESP#1a" into ("RESP", 0x1a), a header without ID gives ("RESP", None)'''
+        kind, sep, rid = hdr.partition('#')
+        if not sep:
+            return kind, None
+        try:
+            return kind, int(rid, 16)
+        except ValueError:
+            return kind, None
+
+    def command_pipelined(self, cmds:list[tuple], window:int=4, timeout:float=5.0, dbug:bool=False) -> list:
+        '''
+        Send several commands, keeping up to window of them in flight
+
+        cmds is a list of (method, params) tuples, params may be None. Replies are
+        matched by request ID so they may arrive in any order. Returns a list of
+        results in the same order as cmds, None for any command that failed.
+
+        The firmware queues requests per scheduling class, so window should not
+        exceed the queue depth of the class the commands belong to: 4 for io
+        (GPIO/relay), 2 for config and net as main.c configures them. Requests
+        over the limit fail with RPC_ERR_BUSY; comm_stats() reports them as
+        "rejected" by class.
+        '''
+        results: list = [None] * len(cmds)
+        pending: dict[int, int] = dict()
+        next_cmd: int = 0
+
+        with self.mutex:
+            self._rx_reset()
+            while next_cmd < len(cmds) or pending:
+                # Top up the window
+                while next_cmd < len(cmds) and len(pending) < window:
+                    method, params = cmds[next_cmd]
+                    if params is None:
+                        msg = json.dumps({"method": method})
+                    else:
+                        msg = json.dumps({"method": method, "params": params})
+                    rid = self._next_req_id()
+                    if not self._send_mesg(f"CMD#{rid:x}", msg, dbug=dbug):
+                        return results
+                    pending[rid] = next_cmd
+                    next_cmd += 1
+
+                resp = self._recv_reply(timeout=timeout, dbug=dbug)
+                if resp is None:
+                    self._fail(f"Timed out with {len(pending)} command(s) outstanding", dbug=dbug)
+                    break
+
+                hdr, body, _ = resp
+                kind, rid = self._split_hdr(hdr)
+                if rid not in pending:
+                    self._debug(f"Unmatched reply '{hdr}': {body}", dbug=dbug)
+                    continue
+                results[pending.pop(rid)] = self._decode_resp(kind, body, dbug=dbug)
+
+        return results
+
+    def _rx_reset(self) -> None:
+        '''Discard stale input before sending a command'''
+        if self._reader is None:
+            self.port.reset_input_buffer()
+            return
+        # The reader owns the port, drop replies nobody waited for
+        while True:
+            try:
+                self._replies.get_nowait()
+            except queue.Empty:
+                return
+
+    def _recv_reply(self, timeout:float=5.0, dbug:bool=False) -> tuple|None:
+        '''
+        Receive the next RESP or ERR message, dispatching any EVT messages that
+        arrive first. Returns tuple (header, body, attachment) or None on timeout.
+        '''
+        if self._reader is not None:
+            try:
+                return self._replies.get(timeout=timeout)
+            except queue.Empty:
+                self._debug("Timed out waiting for response", dbug=dbug)
+                return None
+
+        endTime = time() + timeout
+        while True:
+            remaining = endTime - time()
+            if remaining <= 0:
+                self._debug("Timed out waiting for response", dbug=dbug)
+                return None
+            resp = self._recv_mesg(timeout=remaining, dbug=dbug)
+            if resp is None:
+                return None
+            if self._split_hdr(resp[0])[0] == "EVT":
+                self._dispatch_event(resp[1], dbug=dbug)
+                continue
+            return resp
+
+    def _dispatch_event(self, body:str, dbug:bool=False) -> None:
+        '''Pass an EVT message to the registered callbacks and waiters'''
+        try:
+            evt = json.loads(body)
+            topic = evt['topic']
+        except (ValueError, KeyError, TypeError):
+            self._debug(f"Malformed event: {body}", dbug=dbug)
+            return
+        data = evt.get('data')
+        self._debug(f"EVT {topic}: {data}", dbug=dbug)
+
+        with self._evt_lock:
+            callbacks = self._evt_callbacks.get(topic, []) + self._evt_callbacks.get("*", [])
+            waiters = list(self._evt_waiters)
+        for cb in callbacks:
+            try:
+                cb(topic, data)
+            except Exception as e:
+                self._debug(f"Event callback failed: {e}", dbug=dbug)
+        for w in waiters:
+            w._offer(topic, data)
+
+    def on_event(self, topic:str, callback:Callable[[str, dict|None], None]) -> None:
+        '''Call callback(topic, data) for each event on topic, "*" for every topic'''
+        with self._evt_lock:
+            self._evt_callbacks.setdefault(topic, []).append(callback)
+
+    def remove_event(self, topic:str, callback:Callable) -> None:
+        '''Remove a callback added with on_event'''
+        with self._evt_lock:
+            if callback in self._evt_callbacks.get(topic, []):
+                self._evt_callbacks[topic].remove(callback)
+
+    def event_waiter(self, topic:str, match:Callable[[dict|None], bool]|None=None) -> 'eventWaiter':
+        '''
+        Return an eventWaiter for the next event on topic that satisfies match(data)
+
+        Create the waiter before issuing the command that leads to the event, so an
+        event arriving with or just after the response is not missed.
+        '''
+        return eventWaiter(self, topic, match)
+
+    def events_start(self) -> None:
+        '''
+        Start a background reader so events are dispatched as they arrive rather
+        than only while a command is waiting for its response
+        '''
+        if self._reader is not None:
+            return
+        self._reader_stop.clear()
+        self._replies = queue.Queue()
+        self._reader = Thread(target=self._reader_loop, name=f"testerComm-{self.comm_dev}", daemon=True)
+        self._reader.start()
+
+    def events_stop(self) -> None:
+        '''Stop the background reader'''
+        if self._reader is None:
+            return
+        self._reader_stop.set()
+        self._reader.join()
+        self._reader = None
+
+    def _reader_loop(self) -> None:
+        '''Background reader: dispatch EVT messages, queue everything else for _recv_reply'''
+        while not self._reader_stop.is_set():
+            try:
+                msg = self._recv_mesg(timeout=0.2)
+            except Exception:
+                # Port closed or reopened, e.g. by set_local_baud
+                sleep(0.05)
+                continue
+            if msg is None:
+                continue
+            if self._split_hdr(msg[0])[0] == "EVT":
+                self._dispatch_event(msg[1])
+            else:
+                self._replies.put(msg)
+
+    def command_no_resp(self, cmd:str, params:dict=None, data:bytes|None=None, timeout=2.0, dbug:bool=False) -> bool:
         '''Send command and return success/fail status with no data'''
-        result = self.command(cmd, params, timeout=timeout, dbug=dbug)
+        result = self.command(cmd, params, data=data, timeout=timeout, dbug=dbug)
         if result is None:
             return False
         # print(result)
@@ -332,7 +652,11 @@ class testerApi(testerComm):
 
     def reboot(self) -> bool:
         '''Signal the uut to reboot'''
-        return self.command_no_resp("reboot")
+        if not self.command_no_resp("reboot"):
+            return False
+        # Firmware restarts in ASCII framing
+        self.binary = False
+        return True
 
     def chip_info(self, dbug:bool=False) -> dict|None:
         '''Return information about the uut CPU'''
@@ -354,3 +678,262 @@ class testerApi(testerComm):
         sleep(0.25)
         self.set_local_baud(baud)
         return True
+
+    def framing_set(self, mode:str, dbug:bool=False) -> bool:
+        '''
+        Select "ascii" or "binary" message framing
+
+        Binary framing carries raw attachments without Base64 encoding. The
+        firmware switches after responding, so the reply arrives in the old framing.
+        '''
+        if mode not in ("ascii", "binary"):
+            self._fail(f"Invalid framing mode '{mode}'", dbug=dbug)
+            return False
+        if not self.command_no_resp("set-framing", params={'mode': mode}, dbug=dbug):
+            return False
+        self.binary = (mode == "binary")
+        return True
+
+    def comm_stats(self, reset:bool=False, dbug:bool=False) -> dict|None:
+        '''
+        Return the uut serial link statistics
+
+        Overflow and line error counts, plus command latency in microseconds
+        measured from request frame completion to the response being written.
+        'classes' breaks latency down by scheduling class ("io", "config",
+        "net"), with the requests queued and refused for each. With reset the
+        counters are cleared after reading.
+        '''
+        return self.command("comm-stats", params={'reset': reset}, dbug=dbug)
+
+    def mem_stats(self, reset:bool=False, dbug:bool=False) -> dict|None:
+        '''
+        Return the uut memory statistics
+
+        JSON arena size, and for each class worker's arena ('arenas') its
+        high-water mark and heap fallback count, plus free heap figures. With
+        reset the arena counters are cleared.
+        '''
+        return self.command("mem-stats", params={'reset': reset}, dbug=dbug)
+
+    def perf_stats(self, all:bool=False, dbug:bool=False) -> dict|None:
+        '''
+        Return the uut per-method handler timing and frame counters
+
+        For each method called since the last reset: calls, errors, min/avg/max
+        handler time in microseconds and a log2 histogram ('hist', bucket n
+        counting times of 2^n to 2^(n+1)-1 us). With all, methods never called
+        are included too. See perf_stats.format_perf_stats() for a readable form.
+        '''
+        return self.command("perf-stats", params={'all': all}, dbug=dbug)
+
+    def perf_reset(self, dbug:bool=False) -> bool:
+        '''Clear the uut method timing and frame counters, comm-stats included'''
+        return self.command("perf-reset", dbug=dbug) is not None
+
+    def evt_subscribe(self, topics:list[str], dbug:bool=False) -> list[str]|None:
+        '''
+        Enable EVT messages for the listed topics ("gpio", "gpio-seq", "wifi",
+        "http", or "*" for all). Returns the list of subscribed topics.
+        '''
+        return self.command("evt-subscribe", params={'topics': topics}, dbug=dbug)
+
+    def evt_unsubscribe(self, topics:list[str]|None=None, dbug:bool=False) -> list[str]|None:
+        '''Disable EVT messages for the listed topics, or all topics if None'''
+        params = None if topics is None else {'topics': topics}
+        return self.command("evt-unsubscribe", params=params, dbug=dbug)
+
+    def job_status(self, job_id:int|None=None, dbug:bool=False) -> dict|list|None:
+        '''
+        Return the state of an async job: queued, running, done, failed or
+        cancelled. Without job_id return a list of all jobs.
+        '''
+        params = None if job_id is None else {'job_id': job_id}
+        return self.command("job-status", params=params, dbug=dbug)
+
+    def job_result(self, job_id:int, dbug:bool=False):
+        '''
+        Return the result of a finished job, which is then discarded by the
+        firmware. Returns None if the job failed or is not finished; fail_code()
+        is RPC_ERR_BUSY in the latter case.
+        '''
+        return self.command("job-result", params={'job_id': job_id}, dbug=dbug)
+
+    def job_cancel(self, job_id:int, dbug:bool=False) -> dict|None:
+        '''Cancel a job. A running job completes but its result is discarded.'''
+        return self.command("job-cancel", params={'job_id': job_id}, dbug=dbug)
+
+    def job_wait(self, job_id:int, timeout:float=30, poll:float=0.1, dbug:bool=False):
+        '''
+        Wait for a job to finish and return its result, None on failure or timeout
+
+        The serial link is free between polls, so other threads may keep
+        sending commands (e.g. relay changes) while the job runs.
+        '''
+        endTime = time() + timeout
+        while True:
+            ret = self.job_result(job_id, dbug=dbug)
+            if ret is not None or self.fail_code() != RPC_ERR_BUSY:
+                return ret
+            if time() >= endTime:
+                self.job_cancel(job_id, dbug=dbug)
+                self._fail(f"Timed out waiting for job {job_id}", dbug=dbug)
+                return None
+            sleep(poll)
+
+    def command_job(self, cmd:str, params:dict|None=None, data:bytes|None=None, timeout:float=30, dbug:bool=False):
+        '''
+        Send a command the firmware runs as an async job, wait for and return its result
+
+        Firmware that runs the command synchronously returns the result directly.
+        '''
+        ret = self.command(cmd, params=params, data=data, timeout=timeout, dbug=dbug)
+        if isinstance(ret, dict) and list(ret.keys()) == ['job_id']:
+            return self.job_wait(ret['job_id'], timeout=timeout, dbug=dbug)
+        return ret
+
+    def batch(self, stop_on_error:bool=False, timeout:float=5.0, dbug:bool=False) -> 'cmdBatch':
+        '''Return a cmdBatch context manager for sending several commands in one request'''
+        return cmdBatch(self, stop_on_error=stop_on_error, timeout=timeout, dbug=dbug)
+
+
+class eventWaiter:
+    '''
+    Wait for an event, see testerComm.event_waiter
+
+        with api.event_waiter("wifi", lambda d: d['event'] == "got_ip") as w:
+            api.command_no_resp("wifi-connect", ...)
+            data = w.wait(10)
+    '''
+    def __init__(self, comm:testerComm, topic:str, match:Callable[[dict|None], bool]|None=None) -> None:
+        self.comm: testerComm = comm
+        self.topic: str = topic
+        self.match: Callable|None = match
+        self._events: queue.Queue = queue.Queue()
+        with comm._evt_lock:
+            comm._evt_waiters.append(self)
+
+    def __enter__(self) -> 'eventWaiter':
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb) -> bool:
+        self.close()
+        return False
+
+    def _offer(self, topic:str, data:dict|None) -> None:
+        if topic != self.topic:
+            return
+        try:
+            if self.match is not None and not self.match(data):
+                return
+        except (KeyError, TypeError):
+            return
+        self._events.put(data)
+
+    def wait(self, timeout:float, dbug:bool=False) -> dict|None:
+        '''Return the data of the matching event, or None on timeout'''
+        endTime = time() + timeout
+        while True:
+            try:
+                return self._events.get_nowait()
+            except queue.Empty:
+                pass
+            remaining = endTime - time()
+            if remaining <= 0:
+                return None
+            if self.comm._reader is not None:
+                try:
+                    return self._events.get(timeout=remaining)
+                except queue.Empty:
+                    return None
+            # No background reader, read the port here
+            with self.comm.mutex:
+                msg = self.comm._recv_mesg(timeout=min(remaining, 0.5), dbug=dbug)
+            if msg is None:
+                continue
+            if self.comm._split_hdr(msg[0])[0] == "EVT":
+                self.comm._dispatch_event(msg[1], dbug=dbug)
+            else:
+                self.comm._debug(f"Unexpected reply '{msg[0]}': {msg[1]}", dbug=dbug)
+
+    def close(self) -> None:
+        '''Stop collecting events'''
+        with self.comm._evt_lock:
+            if self in self.comm._evt_waiters:
+                self.comm._evt_waiters.remove(self)
+
+
+class cmdBatch:
+    '''
+    Collect commands and send them to the uut as a single "batch" request
+
+        with api.batch() as b:
+            b.add("gpio-conf", {...})
+            b.add("gpio-conf", {...})
+        if not b.ok:
+            print(b.errors)
+
+    The batch is sent when the with block exits without an exception. After
+    that, results holds one entry per command run: the command result, or
+    None if that command failed. errors maps command index to the error
+    message. With stop_on_error the firmware stops at the first failure.
+    Async commands (http-get, wifi-scan, ...) give {"job_id": n} as their
+    result; other Wi-Fi and HTTP commands cannot be batched.
+    '''
+    def __init__(self, api:testerComm, stop_on_error:bool=False, timeout:float=5.0, dbug:bool=False) -> None:
+        self.api: testerComm = api
+        self.stop_on_error: bool = stop_on_error
+        self.timeout: float = timeout
+        self.dbug: bool = dbug
+        self.cmds: list[dict] = list()
+        self.results: list = list()
+        self.errors: dict[int, str] = dict()
+        self.ok: bool = False
+
+    def __enter__(self) -> 'cmdBatch':
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb) -> bool:
+        if exc_type is None:
+            self.send()
+        return False
+
+    def add(self, cmd:str, params:dict|None=None) -> int:
+        '''Add a command to the batch, returning its index in the results'''
+        item = {"method": cmd}
+        if params is not None:
+            item["params"] = params
+        self.cmds.append(item)
+        return len(self.cmds) - 1
+
+    def send(self) -> bool:
+        '''Send the collected commands, return True if every command succeeded'''
+        self.results = list()
+        self.errors = dict()
+        self.ok = False
+        if not self.cmds:
+            self.ok = True
+            return True
+
+        params = {"cmds": self.cmds, "stop_on_error": self.stop_on_error}
+        resp = self.api.command("batch", params=params, timeout=self.timeout, dbug=self.dbug)
+        if resp is None:
+            return False
+
+        for idx, item in enumerate(resp):
+            if 'error' in item:
+                e = item['error']
+                self.errors[idx] = f"code: {e['code']}, mesg: {e['message']}"
+                self.results.append(None)
+            else:
+                self.results.append(item.get('result'))
+
+        if self.errors:
+            idx = min(self.errors)
+            self.api._fail(f"Batch command {idx} ({self.cmds[idx]['method']}) error - {self.errors[idx]}", dbug=self.dbug)
+            return False
+        if len(self.results) != len(self.cmds):
+            self.api._fail(f"Batch returned {len(self.results)} of {len(self.cmds)} results", dbug=self.dbug)
+            return False
+        self.ok = True
+        return True
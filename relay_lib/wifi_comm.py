@@ -18,7 +18,7 @@ class wifiComm:
 
     def wifi_scan(self, timeout:float=10) -> list|None:
         '''Return list of Wi-Fi access points visible to the uut'''
-        return self.api.command("wifi-scan", timeout=timeout)
+        return self.api.command_job("wifi-scan", timeout=timeout)
 
     def wifi_status(self, dbug:bool=False) -> dict|None:
         '''Return status of Wi-Fi connection between uut and access point'''
@@ -30,6 +30,27 @@ class wifiComm:
         if passwd is not None:
             params["pass"] = passwd
 
+        # Wait for the got_ip event where the firmware supports it, otherwise poll
+        topics = self.api.evt_subscribe(["wifi"], dbug=dbug)
+        if topics is None:
+            return self._wifi_connect_poll(params, timeout, dbug=dbug)
+
+        try:
+            with self.api.event_waiter("wifi", lambda d: d['event'] == "got_ip") as w:
+                if not self.api.command_no_resp("wifi-connect", params=params, dbug=dbug):
+                    return False
+                st = w.wait(timeout, dbug=dbug)
+        finally:
+            self.api.evt_unsubscribe(["wifi"], dbug=dbug)
+
+        if st is None:
+            return False
+        if dbug:
+            print(f"Connected as {st['ip_addr']}")
+        return True
+
+    def _wifi_connect_poll(self, params:dict, timeout:float, dbug:bool=False) -> bool:
+        '''Connect, polling wifi-status (firmware without EVT support)'''
         if not self.api.command_no_resp("wifi-connect", params=params, dbug=dbug):
             return False
 
@@ -53,16 +74,22 @@ class wifiComm:
         '''Close active connection between uut and access point'''
         return self.api.command_no_resp("wifi-disconnect")
 
-    def http_post(self, url:str, data:str=None, dbug=False) -> dict|None:
+    # HTTP requests run as firmware jobs, the serial link stays free for
+    # other commands (e.g. from another thread) while they are in progress
+
+    def http_post(self, url:str, data:str=None, timeout:float=20, dbug=False) -> dict|None:
         params = {'url': url} if data is None else {'url': url, 'data': data}
-        return self.api.command("http-post", params=params, dbug=dbug)
+        return self.api.command_job("http-post", params=params, timeout=timeout, dbug=dbug)
 
-    def http_post_bin(self, url:str, data:bytes) -> dict|None:
+    def http_post_bin(self, url:str, data:bytes, timeout:float=20) -> dict|None:
+        if self.api.binary:
+            # Send data as a raw attachment
+            return self.api.command_job("http-post-bin", params={'url': url}, data=data, timeout=timeout)
         params = {'url': url, 'data': b64encode(data).decode('utf-8')}
-        return self.api.command("http-post-bin", params=params)
+        return self.api.command_job("http-post-bin", params=params, timeout=timeout)
 
-    def http_get(self, url:str) -> dict|None:
-        return self.api.command("http-get", params={'url':url})
+    def http_get(self, url:str, timeout:float=20) -> dict|None:
+        return self.api.command_job("http-get", params={'url':url}, timeout=timeout)
 
     def http_stream_open(self, url:str, method:str, wrLen:int, hdrs:list[dict]|None=None, dbug:bool=False) -> bool:
         '''
@@ -79,10 +106,13 @@ class wifiComm:
         return self.api.command_no_resp("http-close", dbug=dbug)
 
     def http_stream_write_bin(self, data:bytes, dbug=False) -> bool:
+        if self.api.binary:
+            # Send data as a raw attachment
+            return self.api.command_no_resp("http-write-bin", data=data, dbug=dbug)
         b64_bytes = b64encode(data)
         b64_str = b64_bytes.decode('UTF-8')
         return self.api.command_no_resp("http-write-bin", params={'data':b64_str}, dbug=dbug)
 
-    def http_stream_finish(self, dbug=False) -> dict:
-        return self.api.command("http-write-fin", dbug=dbug)
+    def http_stream_finish(self, timeout:float=20, dbug=False) -> dict:
+        return self.api.command_job("http-write-fin", timeout=timeout, dbug=dbug)
 
@@ -91,15 +91,22 @@ def main() -> int:
     board_params = relay_ctrl.params_get()
     print(f"{board_params = }")
 
-    # Test each relay
+    # Test each relay: on for 400 ms, then off for 400 ms, timed by the board
+    steps: list[tuple[int, dict[int, bool]]] = list()
     for relay_num in range(1, 9):
-        sleep(0.4)
-        print(f"Turn on relay {relay_num}")
-        relay_ctrl.set_relay(relay_num, True)
+        start_us: int = (relay_num - 1) * 800000 + 400000
+        steps.append((start_us, {relay_num: True}))
+        steps.append((start_us + 400000, {relay_num: False}))
 
-        sleep(0.4)
-        print(f"Turn off relay {relay_num}")
-        relay_ctrl.set_relay(relay_num, False)
+    print("Pulse relays 1 to 8")
+    if relay_ctrl.run_relay_sequence(steps) is None:
+        print(f"Failed to start relay sequence: {relay_board.fail_reason()}")
+        return 1
+    status = relay_ctrl.gpio_seq_wait(timeout=10.0)
+    if status is None or status['state'] != "done":
+        print(f"Relay sequence did not complete: {status}")
+        return 1
+    print(f"Relay sequence done, worst step timing error {status['late_max_us']} us")
 
     return 0
 